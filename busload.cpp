@@ -0,0 +1,202 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/can/netlink.h>
+
+#include "busload.h"
+
+using namespace cannelloni;
+
+/* Window lengths in slots */
+static const uint64_t windowSlots[BUSLOAD_WINDOWS] = {10, 100, BUSLOAD_SLOTS};
+
+BusLoad::BusLoad()
+  : m_bitrate(0)
+  , m_dataBitrate(0)
+  , m_slot(0)
+{
+  memset(m_slots, 0, sizeof(m_slots));
+  memset(m_sums, 0, sizeof(m_sums));
+}
+
+void BusLoad::setBitrates(uint32_t bitrate, uint32_t dataBitrate) {
+  m_bitrate = bitrate;
+  /* Without BRS or without a known data bitrate, everything is nominal */
+  m_dataBitrate = dataBitrate ? dataBitrate : bitrate;
+}
+
+uint32_t BusLoad::getBitrate() {
+  return m_bitrate;
+}
+
+uint32_t BusLoad::getDataBitrate() {
+  return m_dataBitrate;
+}
+
+bool BusLoad::isEnabled() {
+  return m_bitrate != 0;
+}
+
+uint64_t BusLoad::frameTime(const struct canfd_frame *frame) {
+  uint32_t dataBits = (frame->can_id & CAN_RTR_FLAG) ? 0 : 8 * canfd_len(frame);
+  bool eff = frame->can_id & CAN_EFF_FLAG;
+  uint64_t nominalBits, fastBits;
+
+  if (frame->len & CANFD_FRAME) {
+    /* SOF, ID, (SRR, IDE, ID ext), RRS, IDE/FDF, res, BRS */
+    uint32_t arbitration = eff ? 36 : 17;
+    /* ESI, DLC and data are subject to dynamic stuffing */
+    uint32_t control = 1 + 4 + dataBits;
+    /* Stuff count, CRC with fixed stuff bits and CRC delimiter */
+    uint32_t crc = (canfd_len(frame) > 16) ? 4 + 21 + 7 + 1 : 4 + 17 + 6 + 1;
+    uint32_t stuff = (arbitration + control - 1) / 4;
+    /* ACK slot, ACK delimiter, EOF and IFS */
+    uint32_t trailer = 2 + 7 + 3;
+    if (frame->flags & CANFD_BRS) {
+      uint32_t arbitrationStuff = (arbitration - 1) / 4;
+      nominalBits = arbitration + arbitrationStuff + trailer;
+      fastBits = control + crc + stuff - arbitrationStuff;
+    } else {
+      nominalBits = arbitration + control + crc + stuff + trailer;
+      fastBits = 0;
+    }
+  } else {
+    /* SOF, ID, RTR/SRR, IDE, (ID ext, RTR), r0/r1, DLC, data and CRC */
+    uint32_t stuffed = (eff ? 54 : 34) + dataBits;
+    /* CRC delimiter, ACK slot, ACK delimiter, EOF and IFS */
+    nominalBits = stuffed + (stuffed - 1) / 4 + 13;
+    fastBits = 0;
+  }
+  uint64_t ns = nominalBits * 1000000000ULL / m_bitrate;
+  if (fastBits)
+    ns += fastBits * 1000000000ULL / m_dataBitrate;
+  return ns;
+}
+
+void BusLoad::advance(uint64_t slot) {
+  if (slot <= m_slot)
+    return;
+  if (m_slot == 0 || slot - m_slot >= BUSLOAD_SLOTS) {
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(m_sums, 0, sizeof(m_sums));
+    m_slot = slot;
+    return;
+  }
+  while (m_slot < slot) {
+    m_slot++;
+    /* Drop the slot that falls out of each window */
+    for (int w = 0; w < BUSLOAD_WINDOWS; w++)
+      m_sums[w] -= m_slots[(m_slot - windowSlots[w]) % BUSLOAD_SLOTS];
+    m_slots[m_slot % BUSLOAD_SLOTS] = 0;
+  }
+}
+
+void BusLoad::addFrame(const struct canfd_frame *frame, uint64_t now) {
+  if (!isEnabled())
+    return;
+  advance(now / BUSLOAD_SLOT_US);
+  uint64_t ns = frameTime(frame);
+  m_slots[m_slot % BUSLOAD_SLOTS] += ns;
+  for (int w = 0; w < BUSLOAD_WINDOWS; w++)
+    m_sums[w] += ns;
+}
+
+uint32_t BusLoad::getLoad(BusLoadWindow window, uint64_t now) {
+  if (!isEnabled())
+    return 0;
+  advance(now / BUSLOAD_SLOT_US);
+  uint64_t windowNs = windowSlots[window] * BUSLOAD_SLOT_US * 1000;
+  return m_sums[window] * 10000 / windowNs;
+}
+
+bool BusLoad::readBitrates(const std::string &interfaceName,
+                           uint32_t &bitrate, uint32_t &dataBitrate) {
+  struct {
+    struct nlmsghdr header;
+    struct ifinfomsg info;
+  } request;
+  char buffer[8192];
+  bool found = false;
+
+  unsigned int index = if_nametoindex(interfaceName.c_str());
+  if (index == 0)
+    return false;
+
+  int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (fd < 0)
+    return false;
+
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  request.header.nlmsg_type = RTM_GETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST;
+  request.header.nlmsg_seq = 1;
+  request.info.ifi_family = AF_UNSPEC;
+  request.info.ifi_index = index;
+
+  if (send(fd, &request, request.header.nlmsg_len, 0) < 0) {
+    close(fd);
+    return false;
+  }
+  ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+  close(fd);
+  if (len < 0)
+    return false;
+
+  bitrate = 0;
+  dataBitrate = 0;
+  for (struct nlmsghdr *nh = (struct nlmsghdr*) buffer; NLMSG_OK(nh, len);
+       nh = NLMSG_NEXT(nh, len)) {
+    if (nh->nlmsg_type != RTM_NEWLINK)
+      continue;
+    struct ifinfomsg *info = (struct ifinfomsg*) NLMSG_DATA(nh);
+    int attrLen = IFLA_PAYLOAD(nh);
+    for (struct rtattr *attr = IFLA_RTA(info); RTA_OK(attr, attrLen);
+         attr = RTA_NEXT(attr, attrLen)) {
+      if (attr->rta_type != IFLA_LINKINFO)
+        continue;
+      int linkLen = RTA_PAYLOAD(attr);
+      for (struct rtattr *link = (struct rtattr*) RTA_DATA(attr); RTA_OK(link, linkLen);
+           link = RTA_NEXT(link, linkLen)) {
+        if (link->rta_type != IFLA_INFO_DATA)
+          continue;
+        int dataLen = RTA_PAYLOAD(link);
+        for (struct rtattr *data = (struct rtattr*) RTA_DATA(link); RTA_OK(data, dataLen);
+             data = RTA_NEXT(data, dataLen)) {
+          struct can_bittiming *bt = (struct can_bittiming*) RTA_DATA(data);
+          if (data->rta_type == IFLA_CAN_BITTIMING) {
+            bitrate = bt->bitrate;
+            found = true;
+          } else if (data->rta_type == IFLA_CAN_DATA_BITTIMING) {
+            dataBitrate = bt->bitrate;
+          }
+        }
+      }
+    }
+  }
+  return found && bitrate != 0;
+}
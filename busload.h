@@ -0,0 +1,86 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Length of one slot of the sliding windows */
+#define BUSLOAD_SLOT_US 10000
+/* The longest window covers 10 s */
+#define BUSLOAD_SLOTS 1000
+
+enum BusLoadWindow {BUSLOAD_100MS, BUSLOAD_1S, BUSLOAD_10S, BUSLOAD_WINDOWS};
+
+/*
+ * Estimates the load of a CAN bus from the frames that have been
+ * seen on it.
+ *
+ * Every frame is converted into the time it occupies the bus,
+ * assuming worst-case bit stuffing. For CAN FD frames with BRS set,
+ * the arbitration and the data phase are accounted separately with
+ * the nominal and the data bitrate.
+ */
+class BusLoad {
+  public:
+    BusLoad();
+
+    void setBitrates(uint32_t bitrate, uint32_t dataBitrate);
+    uint32_t getBitrate();
+    uint32_t getDataBitrate();
+
+    /* Returns false if no bitrate is known and no load can be computed */
+    bool isEnabled();
+
+    /* Accounts a frame that has been seen at now (us, CLOCK_MONOTONIC) */
+    void addFrame(const struct canfd_frame *frame, uint64_t now);
+
+    /* Returns the load in 1/100 percent over window */
+    uint32_t getLoad(BusLoadWindow window, uint64_t now);
+
+    /* Time in ns the frame occupies the bus */
+    uint64_t frameTime(const struct canfd_frame *frame);
+
+    /*
+     * Reads the nominal and data bitrate of interfaceName through netlink.
+     * Returns false if the interface has no bittiming (e.g. vcan)
+     */
+    static bool readBitrates(const std::string &interfaceName,
+                             uint32_t &bitrate, uint32_t &dataBitrate);
+
+  private:
+    void advance(uint64_t slot);
+
+  private:
+    uint32_t m_bitrate;
+    uint32_t m_dataBitrate;
+    /* Absolute number of the current slot */
+    uint64_t m_slot;
+    /* Bus time in ns per slot */
+    uint64_t m_slots[BUSLOAD_SLOTS];
+    uint64_t m_sums[BUSLOAD_WINDOWS];
+};
+
+}
@@ -0,0 +1,455 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fstream>
+
+#include "canlog.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+/* A token of a line, not terminated */
+struct Token {
+  const char *p;
+  size_t n;
+
+  bool operator==(const char *s) const {
+    return strlen(s) == n && strncmp(p, s, n) == 0;
+  }
+};
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static bool parseNumber(const char *p, size_t n, unsigned base, uint32_t &value) {
+  if (n == 0)
+    return false;
+  value = 0;
+  for (size_t i = 0; i < n; i++) {
+    int digit = hexValue(p[i]);
+    if (digit < 0 || digit >= (int) base)
+      return false;
+    value = value * base + digit;
+  }
+  return true;
+}
+
+/* Parses "seconds.fraction" into ns without losing precision */
+static bool parseTime(const char *p, size_t n, uint64_t &ns) {
+  uint64_t seconds = 0, fraction = 0, scale = 1000000000ULL;
+  size_t i = 0;
+  for (; i < n && p[i] >= '0' && p[i] <= '9'; i++)
+    seconds = seconds * 10 + (p[i] - '0');
+  if (i == 0)
+    return false;
+  if (i < n && p[i] == '.') {
+    for (i++; i < n && p[i] >= '0' && p[i] <= '9'; i++) {
+      if (scale > 1) {
+        scale /= 10;
+        fraction += (p[i] - '0') * scale;
+      }
+    }
+  }
+  ns = seconds * 1000000000ULL + fraction;
+  return i == n;
+}
+
+static void tokenize(const char *begin, const char *end, std::vector<Token> &tokens) {
+  tokens.clear();
+  const char *p = begin;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+      p++;
+    if (p > start)
+      tokens.push_back(Token{start, (size_t) (p - start)});
+  }
+}
+
+/* Parses the ID#DATA notation of candump and cansend */
+static bool parseCandumpFrame(const Token &token, struct canfd_frame *frame) {
+  const char *p = token.p, *end = token.p + token.n;
+  const char *hash = (const char*) memchr(p, '#', token.n);
+  uint32_t id;
+
+  memset(frame, 0, sizeof(*frame));
+  if (hash == NULL || !parseNumber(p, hash - p, 16, id))
+    return false;
+  if (hash - p == 3) {
+    frame->can_id = id;
+  } else if (hash - p == 8) {
+    frame->can_id = id;
+    if (!(id & CAN_ERR_FLAG))
+      frame->can_id |= CAN_EFF_FLAG;
+  } else {
+    return false;
+  }
+  p = hash + 1;
+
+  uint8_t maxLen = CAN_MAX_DLEN;
+  if (p < end && *p == '#') {
+    /* CAN FD, one nibble of flags follows */
+    if (p + 1 >= end || hexValue(p[1]) < 0)
+      return false;
+    frame->flags = hexValue(p[1]);
+    frame->len = CANFD_FRAME;
+    maxLen = CANFD_MAX_DLEN;
+    p += 2;
+  } else if (p < end && (*p == 'R' || *p == 'r')) {
+    frame->can_id |= CAN_RTR_FLAG;
+    if (p + 1 < end && p[1] >= '0' && p[1] <= '8')
+      frame->len = p[1] - '0';
+    return true;
+  }
+
+  uint8_t len = 0;
+  while (p < end) {
+    if (*p == '.') {
+      p++;
+      continue;
+    }
+    if (p + 1 >= end || len >= maxLen)
+      return false;
+    int high = hexValue(p[0]), low = hexValue(p[1]);
+    if (high < 0 || low < 0)
+      return false;
+    frame->data[len++] = (high << 4) | low;
+    p += 2;
+  }
+  /* CAN FD only knows 12, 16, 20, 24, 32, 48 and 64 above 8 bytes */
+  if ((frame->len & CANFD_FRAME) && len > 8 &&
+      !(len % 4 == 0 && (len <= 24 || len % 16 == 0)))
+    return false;
+  frame->len |= len;
+  return true;
+}
+
+CANLog::CANLog()
+  : m_map(NULL)
+  , m_mapSize(0)
+  , m_skipped(0)
+  , m_firstTime(0)
+  , m_haveFirstTime(false)
+  , m_records(NULL)
+  , m_data(NULL)
+  , m_count(0)
+{ }
+
+CANLog::~CANLog() {
+  unmap();
+}
+
+void CANLog::unmap() {
+  if (m_map)
+    munmap(m_map, m_mapSize);
+  m_map = NULL;
+  m_mapSize = 0;
+}
+
+bool CANLog::load(const std::string &path, const std::string &channel) {
+  unmap();
+  m_recordVector.clear();
+  m_dataVector.clear();
+  m_skipped = 0;
+  m_haveFirstTime = false;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    lerror << "Could not open " << path << std::endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    lerror << "Could not read " << path << std::endl;
+    close(fd);
+    return false;
+  }
+  m_mapSize = st.st_size;
+  m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m_map == MAP_FAILED) {
+    m_map = NULL;
+    lerror << "Could not map " << path << std::endl;
+    return false;
+  }
+  madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+
+  const char *begin = static_cast<const char*>(m_map);
+  const char *end = begin + m_mapSize;
+  const CANLogHeader *header = static_cast<const CANLogHeader*>(m_map);
+
+  if (m_mapSize >= sizeof(CANLogHeader) && header->magic == CANLOG_MAGIC) {
+    if (header->version != CANLOG_VERSION ||
+        m_mapSize < sizeof(CANLogHeader) + header->count * sizeof(CANLogRecord) + header->dataSize) {
+      lerror << path << " is not a valid compact log" << std::endl;
+      return false;
+    }
+    /* Use the mapping as it is */
+    m_count = header->count;
+    m_records = reinterpret_cast<const CANLogRecord*>(header + 1);
+    m_data = reinterpret_cast<const uint8_t*>(m_records + m_count);
+    return true;
+  }
+
+  /* Skip leading whitespace to tell candump from ASC */
+  const char *p = begin;
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    p++;
+  if (p < end && *p == '(')
+    parseCandump(begin, end, channel);
+  else
+    parseASC(begin, end, channel);
+
+  /* The text is not needed anymore */
+  unmap();
+  m_count = m_recordVector.size();
+  m_records = m_recordVector.data();
+  m_data = m_dataVector.data();
+  return true;
+}
+
+bool CANLog::save(const std::string &path) {
+  CANLogHeader header;
+  header.magic = CANLOG_MAGIC;
+  header.version = CANLOG_VERSION;
+  header.count = m_count;
+  header.dataSize = 0;
+  for (uint64_t i = 0; i < m_count; i++)
+    header.dataSize += payloadLength(m_records[i]);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(m_records), m_count * sizeof(CANLogRecord));
+  file.write(reinterpret_cast<const char*>(m_data), header.dataSize);
+  if (!file) {
+    lerror << "Could not write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+uint64_t CANLog::getCount() {
+  return m_count;
+}
+
+const CANLogRecord* CANLog::getRecords() {
+  return m_records;
+}
+
+const uint8_t* CANLog::getData() {
+  return m_data;
+}
+
+uint64_t CANLog::getSkipped() {
+  return m_skipped;
+}
+
+uint8_t CANLog::payloadLength(const CANLogRecord &record) {
+  if (record.id & CAN_RTR_FLAG)
+    return 0;
+  return record.len & ~CANFD_FRAME;
+}
+
+void CANLog::toFrame(const CANLogRecord &record, const uint8_t *data,
+                     struct canfd_frame *frame) {
+  frame->can_id = record.id;
+  frame->len = record.len;
+  frame->flags = record.flags;
+  frame->__res0 = 0;
+  frame->__res1 = 0;
+  memcpy(frame->data, data, payloadLength(record));
+}
+
+void CANLog::addFrame(uint64_t time, const struct canfd_frame *frame) {
+  if (!m_haveFirstTime) {
+    m_firstTime = time;
+    m_haveFirstTime = true;
+  }
+  CANLogRecord record;
+  /* Logs are not guaranteed to be monotonic, never go backwards */
+  record.time = time > m_firstTime ? time - m_firstTime : 0;
+  if (!m_recordVector.empty() && record.time < m_recordVector.back().time)
+    record.time = m_recordVector.back().time;
+  record.id = frame->can_id;
+  record.len = frame->len;
+  record.flags = frame->flags;
+  record.reserved = 0;
+  m_recordVector.push_back(record);
+  uint8_t len = payloadLength(record);
+  m_dataVector.insert(m_dataVector.end(), frame->data, frame->data + len);
+}
+
+void CANLog::parseCandump(const char *begin, const char *end, const std::string &channel) {
+  std::vector<Token> tokens;
+  struct canfd_frame frame;
+
+  while (begin < end) {
+    const char *lineEnd = (const char*) memchr(begin, '\n', end - begin);
+    if (lineEnd == NULL)
+      lineEnd = end;
+    tokenize(begin, lineEnd, tokens);
+    begin = lineEnd + 1;
+    if (tokens.empty())
+      continue;
+
+    uint64_t time;
+    if (tokens.size() < 3 || tokens[0].n < 3 || tokens[0].p[0] != '(' ||
+        tokens[0].p[tokens[0].n - 1] != ')' ||
+        !parseTime(tokens[0].p + 1, tokens[0].n - 2, time) ||
+        !parseCandumpFrame(tokens[2], &frame)) {
+      m_skipped++;
+      continue;
+    }
+    if (!channel.empty() && !(tokens[1] == channel.c_str()))
+      continue;
+    addFrame(time, &frame);
+  }
+}
+
+void CANLog::parseASC(const char *begin, const char *end, const std::string &channel) {
+  std::vector<Token> tokens;
+  struct canfd_frame frame;
+  unsigned base = 16;
+
+  while (begin < end) {
+    const char *lineEnd = (const char*) memchr(begin, '\n', end - begin);
+    if (lineEnd == NULL)
+      lineEnd = end;
+    tokenize(begin, lineEnd, tokens);
+    begin = lineEnd + 1;
+    if (tokens.size() < 2)
+      continue;
+
+    if (tokens[0] == "base") {
+      base = (tokens[1] == "dec") ? 10 : 16;
+      continue;
+    }
+    uint64_t time;
+    if (!parseTime(tokens[0].p, tokens[0].n, time))
+      continue;
+
+    bool fd = tokens[1] == "CANFD";
+    uint32_t value;
+    /* Everything else (events, statistics, error frames) is not a frame */
+    if (!fd && (!parseNumber(tokens[1].p, tokens[1].n, 10, value) ||
+                tokens.size() < 4 || tokens[2] == "ErrorFrame" ||
+                !(tokens[3] == "Rx" || tokens[3] == "Tx")))
+      continue;
+
+    const Token &channelToken = tokens[fd ? 2 : 1];
+    if (!channel.empty() && !(channelToken == channel.c_str()))
+      continue;
+
+    /* Time CANFD Channel Dir ID [Name] BRS ESI DLC Length Data
+     * Time Channel ID Dir d|r [DLC] Data */
+    size_t idIndex = fd ? 4 : 2;
+    if (tokens.size() <= idIndex + 1) {
+      m_skipped++;
+      continue;
+    }
+    memset(&frame, 0, sizeof(frame));
+    Token id = tokens[idIndex];
+    bool eff = id.n > 1 && (id.p[id.n - 1] == 'x' || id.p[id.n - 1] == 'X');
+    if (eff)
+      id.n--;
+    if (!parseNumber(id.p, id.n, base, value)) {
+      m_skipped++;
+      continue;
+    }
+    frame.can_id = eff ? (value | CAN_EFF_FLAG) : value;
+
+    size_t dataIndex;
+    uint32_t len;
+    if (fd) {
+      /* The symbolic name is optional */
+      size_t k = idIndex + 1;
+      uint32_t brs, esi, dlc;
+      if (tokens.size() > k + 3 && !(tokens[k] == "0" || tokens[k] == "1"))
+        k++;
+      if (tokens.size() < k + 4 ||
+          !parseNumber(tokens[k].p, tokens[k].n, 10, brs) ||
+          !parseNumber(tokens[k + 1].p, tokens[k + 1].n, 10, esi) ||
+          !parseNumber(tokens[k + 2].p, tokens[k + 2].n, 16, dlc) ||
+          !parseNumber(tokens[k + 3].p, tokens[k + 3].n, 10, len) ||
+          len > CANFD_MAX_DLEN) {
+        m_skipped++;
+        continue;
+      }
+      frame.flags = (brs ? CANFD_BRS : 0) | (esi ? CANFD_ESI : 0);
+      frame.len = CANFD_FRAME | len;
+      dataIndex = k + 4;
+    } else {
+      const Token &type = tokens[idIndex + 2 < tokens.size() ? idIndex + 2 : 0];
+      if (idIndex + 2 >= tokens.size() || !(type == "d" || type == "r")) {
+        m_skipped++;
+        continue;
+      }
+      if (type == "r") {
+        frame.can_id |= CAN_RTR_FLAG;
+        if (idIndex + 3 < tokens.size() &&
+            parseNumber(tokens[idIndex + 3].p, tokens[idIndex + 3].n, 16, len) &&
+            len <= CAN_MAX_DLEN)
+          frame.len = len;
+        addFrame(time, &frame);
+        continue;
+      }
+      if (idIndex + 3 >= tokens.size() ||
+          !parseNumber(tokens[idIndex + 3].p, tokens[idIndex + 3].n, 16, len) ||
+          len > CAN_MAX_DLEN) {
+        m_skipped++;
+        continue;
+      }
+      frame.len = len;
+      dataIndex = idIndex + 4;
+    }
+
+    if (tokens.size() < dataIndex + len) {
+      m_skipped++;
+      continue;
+    }
+    bool valid = true;
+    for (uint32_t i = 0; i < len && valid; i++) {
+      valid = parseNumber(tokens[dataIndex + i].p, tokens[dataIndex + i].n, base, value) &&
+              value <= 0xff;
+      frame.data[i] = value;
+    }
+    if (!valid) {
+      m_skipped++;
+      continue;
+    }
+    addFrame(time, &frame);
+  }
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * CANLog reads recorded CAN traffic. It understands
+ *
+ *  - candump -l:  (1436509053.850870) can0 123#DEADBEEF
+ *  - Vector ASC:  1.234567 1 123 Rx d 4 DE AD BE EF
+ *  - its own compact binary form
+ *
+ * The log file is memory-mapped and parsed once into the compact form,
+ * which can be written to disk with save() and is mapped directly when
+ * loaded again. It consists of a CANLogHeader, count CANLogRecords and
+ * the payload of all frames back to back, in host byte order.
+ */
+
+#define CANLOG_MAGIC 0x524c4e43 /* "CNLR" */
+#define CANLOG_VERSION 1
+
+struct CANLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+  uint64_t dataSize;
+};
+
+struct CANLogRecord {
+  /* ns since the first frame of the log */
+  uint64_t time;
+  /* can_id including the EFF/RTR/ERR flags */
+  uint32_t id;
+  /* Payload length, CANFD_FRAME is set for CAN FD frames */
+  uint8_t len;
+  /* CAN FD flags */
+  uint8_t flags;
+  uint16_t reserved;
+};
+
+class CANLog {
+  public:
+    CANLog();
+    ~CANLog();
+
+    /*
+     * Loads a log, only frames of channel are kept if it is not empty.
+     * channel is the interface name for candump and the channel number
+     * for ASC logs. Lines that cannot be parsed are skipped and counted.
+     */
+    bool load(const std::string &path, const std::string &channel = "");
+    /* Writes the compact binary form */
+    bool save(const std::string &path);
+
+    uint64_t getCount();
+    const CANLogRecord* getRecords();
+    /* The payload of record i starts at the sum of the lengths before it */
+    const uint8_t* getData();
+    /* Number of lines that were skipped */
+    uint64_t getSkipped();
+
+    /* Fills frame from record, data points to the payload of record */
+    static void toFrame(const CANLogRecord &record, const uint8_t *data,
+                        struct canfd_frame *frame);
+    static uint8_t payloadLength(const CANLogRecord &record);
+
+  private:
+    void unmap();
+    void parseCandump(const char *begin, const char *end, const std::string &channel);
+    void parseASC(const char *begin, const char *end, const std::string &channel);
+    void addFrame(uint64_t time, const struct canfd_frame *frame);
+
+  private:
+    void *m_map;
+    size_t m_mapSize;
+    uint64_t m_skipped;
+    /* Time of the first frame in ns */
+    uint64_t m_firstTime;
+    bool m_haveFirstTime;
+    /* Either point into the vectors or into m_map */
+    const CANLogRecord *m_records;
+    const uint8_t *m_data;
+    uint64_t m_count;
+    std::vector<CANLogRecord> m_recordVector;
+    std::vector<uint8_t> m_dataVector;
+};
+
+}
@@ -0,0 +1,906 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "udpthread.h"
+#include "canthread.h"
+#include "eventloop.h"
+#include "framebuffer.h"
+#include "logging.h"
+#include "make_unique.h"
+#include "iobackend.h"
+#include "simio.h"
+#include "sockets.h"
+#include "statictunnel.h"
+
+using namespace cannelloni;
+
+/* Design Notes:
+ *
+ * cannelloni-bench starts two complete tunnel endpoints A and B in this
+ * process. Their UDPThreads talk over the loopback interface.
+ *
+ * Frames are generated at a fixed rate on the CAN side of A and
+ * collected on the CAN side of B. With two (v)can interfaces, real
+ * CANThreads are used and the generator and the sink use their own raw
+ * sockets. Otherwise MemoryCANThread replaces the CANThreads and hands
+ * frames directly to the UDPThreads.
+ *
+ * With -N, everything runs on SimIO: the CANThreads use two simulated
+ * buses and the UDPThreads a simulated link with configurable delay,
+ * jitter, loss and reordering. No privileges are needed.
+ *
+ * With -C, the CAN sides only carry CAN 2.0 frames, so the tunnels run
+ * the classic variant of the codec, see FrameMode in cannelloni.h.
+ *
+ * With -F, the endpoints are StaticTunnels (statictunnel.h) instead of
+ * pairs of threads. They need real or simulated CAN buses.
+ *
+ * With -Q, the CANThread of B writes frames in the order of their
+ * priority (see TxQueue). This only makes a difference once the bus of
+ * B is the bottleneck, e.g. a simulated one with a low bitrate (-b). The
+ * latency of the 10% of frames with the highest priority is reported
+ * separately to show the effect.
+ *
+ * With -W, the CANThread of B measures the time from write() until its
+ * frames have been sent (see TxCompletion), per priority class.
+ *
+ * With -Y, both CANThreads offload cyclic frames (see CyclicDetector).
+ * The cyclic mix sends 64 IDs round robin, so each ID has a period of
+ * 64 / rate. Its frames are too short to carry a send time.
+ *
+ * With -X, the CANThreads of A and B are peered directly (cannelloni
+ * -X) and the UDPThreads are not started. This is the baseline of the
+ * CAN sides without any encoding or network.
+ *
+ * Every frame with at least 8 data bytes carries its send time, which
+ * gives the latency distribution. The results of each run are printed
+ * as one JSON object per line.
+ */
+
+#define BENCH_SLEEP_THRESHOLD_NS 100000
+
+struct BenchConfig {
+  std::string mix;
+  uint64_t rate;
+  uint32_t duration;
+  uint32_t timeout;
+  bool sort;
+  /* Serve each endpoint from one EventLoop */
+  bool eventLoop;
+  /* CAN sides without CAN FD */
+  bool classic;
+  /* Use StaticTunnel endpoints */
+  bool staticTunnel;
+  /* CANThread of B uses a TxQueue */
+  bool priorityTx;
+  uint32_t txLimit;
+  /* CANThread of B measures write-to-wire times */
+  bool txCompletion;
+  /* Both CANThreads offload cyclic frames */
+  bool cyclic;
+  /* CANThreads of A and B bridged without the network */
+  bool bridge;
+  uint16_t port;
+  std::string canA;
+  std::string canB;
+  /* Only used with SimIO */
+  bool simulate;
+  SimLink link;
+  uint32_t bitrate;
+  uint32_t dataBitrate;
+};
+
+struct BenchResult {
+  uint64_t sent;
+  uint64_t received;
+  uint64_t packets;
+  double seconds;
+  double cpuSeconds;
+  std::vector<uint32_t> latencies;
+  /* arbitrationKey() of each of latencies */
+  std::vector<uint32_t> keys;
+  /* Write-to-wire times of B, see -W */
+  StatsHistogram wire[CANNELLONI_STATS_PRIORITY_CLASSES];
+  uint64_t echoesLost;
+};
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpuTime() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+       + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Produces the frames of a traffic mix
+ */
+class FrameMix {
+  public:
+    FrameMix(const std::string &name)
+      : m_name(name)
+      , m_random(42)
+      , m_count(0)
+    { }
+
+    bool isValid() {
+      return m_name == "classic" || m_name == "classic-mixed" ||
+             m_name == "fd" || m_name == "fd-mixed" || m_name == "mixed" ||
+             m_name == "cyclic";
+    }
+
+    bool needsFD() {
+      return m_name == "fd" || m_name == "fd-mixed" || m_name == "mixed";
+    }
+
+    void next(struct canfd_frame *frame) {
+      static const uint8_t fdLengths[] = {8, 12, 16, 20, 24, 32, 48, 64};
+      memset(frame, 0, sizeof(*frame));
+      std::string mix = m_name;
+      if (mix == "mixed")
+        mix = (m_random() & 1) ? "classic-mixed" : "fd-mixed";
+
+      if (mix == "classic") {
+        frame->can_id = 0x100 + (m_random() & 0xff);
+        frame->len = 8;
+      } else if (mix == "cyclic") {
+        /* The payload of an ID changes every 100 rounds */
+        uint64_t round = m_count / 64;
+        frame->can_id = 0x100 + m_count++ % 64;
+        frame->len = 6;
+        for (uint8_t i = 0; i < 6; i++)
+          frame->data[i] = frame->can_id + round / 100 + i;
+        return;
+      } else if (mix == "classic-mixed") {
+        if (m_random() % 10 == 0)
+          frame->can_id = (m_random() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+        else
+          frame->can_id = m_random() & CAN_SFF_MASK;
+        frame->len = m_random() % 9;
+      } else if (mix == "fd") {
+        frame->can_id = 0x100 + (m_random() & 0xff);
+        frame->len = 64 | CANFD_FRAME;
+        frame->flags = CANFD_BRS;
+      } else {
+        frame->can_id = m_random() & CAN_SFF_MASK;
+        frame->len = fdLengths[m_random() % 8] | CANFD_FRAME;
+        frame->flags = CANFD_BRS;
+      }
+      for (uint8_t i = 0; i < canfd_len(frame); i++)
+        frame->data[i] = m_random();
+    }
+
+  private:
+    std::string m_name;
+    std::minstd_rand m_random;
+    uint64_t m_count;
+};
+
+static void stamp(struct canfd_frame *frame) {
+  if (canfd_len(frame) >= sizeof(uint64_t)) {
+    uint64_t now = nowNs();
+    memcpy(frame->data, &now, sizeof(now));
+  }
+}
+
+static void collect(const struct canfd_frame *frame, BenchResult &result) {
+  if (canfd_len(frame) >= sizeof(uint64_t) && !(frame->can_id & CAN_RTR_FLAG)) {
+    uint64_t sent;
+    memcpy(&sent, frame->data, sizeof(sent));
+    result.latencies.push_back((nowNs() - sent) / 1000);
+    result.keys.push_back(arbitrationKey(frame));
+  }
+}
+
+/*
+ * Paces a generator to a fixed frame rate, a rate of 0 is unlimited
+ */
+class Pacer {
+  public:
+    Pacer(uint64_t rate)
+      : m_rate(rate)
+      , m_start(nowNs())
+      , m_count(0)
+    { }
+
+    void wait() {
+      if (m_rate == 0)
+        return;
+      uint64_t target = m_start + m_count++ * 1000000000ULL / m_rate;
+      uint64_t now = nowNs();
+      if (target > now + BENCH_SLEEP_THRESHOLD_NS) {
+        struct timespec ts;
+        ts.tv_sec = target / 1000000000ULL;
+        ts.tv_nsec = target % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      }
+    }
+
+  private:
+    uint64_t m_rate;
+    uint64_t m_start;
+    uint64_t m_count;
+};
+
+/*
+ * Stand-in for a CANThread without any CAN interface.
+ * run() generates frames, transmitFrame() collects them.
+ */
+class MemoryCANThread : public ConnectionThread {
+  public:
+    MemoryCANThread(const BenchConfig &config, BenchResult &result, bool generate)
+      : m_config(config)
+      , m_result(result)
+      , m_generate(generate)
+      , m_received(0)
+    {
+      if (config.classic)
+        setFrameMode(FRAME_MODE_CLASSIC);
+    }
+
+    virtual void run() {
+      if (!m_generate)
+        return;
+      FrameMix mix(m_config.mix);
+      Pacer pacer(m_config.rate);
+      uint64_t end = nowNs() + m_config.duration * 1000000000ULL;
+      while (m_started && nowNs() < end) {
+        pacer.wait();
+        canfd_frame *frame = m_peerThread->getFrameBuffer()->requestFrame(false);
+        if (frame == NULL) {
+          /* The tunnel does not keep up, give it some time */
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          continue;
+        }
+        mix.next(frame);
+        stamp(frame);
+        m_peerThread->transmitFrame(frame);
+        m_result.sent++;
+      }
+    }
+
+    virtual void transmitFrame(canfd_frame *frame) {
+      collect(frame, m_result);
+      m_frameBuffer->insertFramePool(frame);
+      m_received++;
+    }
+
+    uint64_t getReceived() {
+      return m_received;
+    }
+
+  private:
+    const BenchConfig &m_config;
+    BenchResult &m_result;
+    bool m_generate;
+    std::atomic<uint64_t> m_received;
+};
+
+static int openCANSocket(const std::string &name, bool fd) {
+  CANSocketOptions options;
+  options.fd = fd ? CANFD_REQUIRED : CANFD_OFF;
+  FrameMode mode;
+  int ifindex;
+  return cannelloni::openCANSocket(name, options, mode, ifindex);
+}
+
+static void makeAddr(struct sockaddr_in &addr, uint16_t port) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+}
+
+/*
+ * Sends the frames of the mix on txSocket in this thread and collects
+ * them on rxSocket in a second one, until every frame arrived or the
+ * tunnel had enough time to deliver them
+ */
+static void runCANTraffic(const BenchConfig &config, int txSocket, int rxSocket, BenchResult &result) {
+  FrameMix mix(config.mix);
+  double cpuStart = cpuTime();
+  uint64_t start = nowNs();
+  std::atomic<bool> receiving(true);
+  /* Counted by the sink thread, read while draining */
+  std::atomic<uint64_t> sinkReceived(0);
+
+  std::thread sink([&]() {
+    struct canfd_frame frame;
+    while (receiving) {
+      fd_set readfds;
+      struct timeval timeout = {0, 10000};
+      FD_ZERO(&readfds);
+      FD_SET(rxSocket, &readfds);
+      if (select(rxSocket + 1, &readfds, NULL, NULL, &timeout) <= 0)
+        continue;
+      ssize_t len = io()->recvfrom(rxSocket, &frame, sizeof(frame), 0, NULL, NULL);
+      if (len == CAN_MTU || len == CANFD_MTU) {
+        collect(&frame, result);
+        sinkReceived++;
+      }
+    }
+  });
+  Pacer pacer(config.rate);
+  uint64_t end = start + config.duration * 1000000000ULL;
+  struct canfd_frame frame;
+  while (nowNs() < end) {
+    pacer.wait();
+    mix.next(&frame);
+    bool fd = frame.len & CANFD_FRAME;
+    frame.len &= ~CANFD_FRAME;
+    stamp(&frame);
+    while (io()->sendto(txSocket, &frame, fd ? CANFD_MTU : CAN_MTU, 0, NULL, 0) < 0) {
+      /* The tx queue of the interface is full */
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      if (nowNs() >= end)
+        break;
+    }
+    result.sent++;
+  }
+  result.seconds = (nowNs() - start) / 1e9;
+
+  /* Wait until every frame arrived or the tunnel had enough time */
+  uint64_t drainEnd = nowNs() + 2ULL * config.timeout * 1000 + 500000000ULL;
+  while (nowNs() < drainEnd && sinkReceived < result.sent)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  result.cpuSeconds = cpuTime() - cpuStart;
+
+  receiving = false;
+  sink.join();
+  result.received = sinkReceived;
+}
+
+static bool runBench(const BenchConfig &config, bool useCAN, BenchResult &result) {
+  struct debugOptions_t debugOptions = { 0, 0, 0, 0 };
+  struct sockaddr_in addrA, addrB;
+  makeAddr(addrA, config.port);
+  makeAddr(addrB, config.port + 1);
+
+  result.sent = 0;
+  result.received = 0;
+  result.latencies.clear();
+  result.keys.clear();
+  memset(result.wire, 0, sizeof(result.wire));
+  result.echoesLost = 0;
+
+  UDPThread netA(debugOptions, addrB, addrA, config.sort, true);
+  UDPThread netB(debugOptions, addrA, addrB, config.sort, true);
+  FrameBuffer netBufferA(1000, 16000), netBufferB(1000, 16000);
+  FrameBuffer canBufferA(1000, 16000), canBufferB(1000, 16000);
+  /* MemoryCANThread only looks at the first 8 data bytes as well */
+  for (FrameBuffer *buffer : {&netBufferA, &netBufferB, &canBufferA, &canBufferB})
+    buffer->setClassicSlots(true);
+  std::unique_ptr<ConnectionThread> canA, canB;
+  int txSocket = -1, rxSocket = -1;
+  FrameMix mix(config.mix);
+
+  if (useCAN) {
+    txSocket = openCANSocket(config.canA, mix.needsFD());
+    rxSocket = openCANSocket(config.canB, mix.needsFD());
+    if (txSocket < 0 || rxSocket < 0) {
+      lerror << "Could not open " << config.canA << " and " << config.canB << std::endl;
+      return false;
+    }
+    auto threadA = std::make_unique<CANThread>(debugOptions, config.canA);
+    if (config.cyclic)
+      threadA->setCyclicOffload();
+    canA = std::move(threadA);
+    auto threadB = std::make_unique<CANThread>(debugOptions, config.canB);
+    if (config.priorityTx)
+      threadB->setPriorityTx(config.txLimit);
+    if (config.txCompletion)
+      threadB->setTxCompletion();
+    if (config.cyclic)
+      threadB->setCyclicOffload();
+    canB = std::move(threadB);
+  } else {
+    canA = std::make_unique<MemoryCANThread>(config, result, true);
+    canB = std::make_unique<MemoryCANThread>(config, result, false);
+  }
+
+  netA.setPeerThread(canA.get());
+  netA.setFrameBuffer(&netBufferA);
+  netA.setTimeout(config.timeout);
+  netB.setPeerThread(canB.get());
+  netB.setFrameBuffer(&netBufferB);
+  netB.setTimeout(config.timeout);
+  canA->setPeerThread(config.bridge ? canB.get() : &netA);
+  canA->setFrameBuffer(&canBufferA);
+  canB->setPeerThread(config.bridge ? canA.get() : &netB);
+  canB->setFrameBuffer(&canBufferB);
+
+  EventLoop loopA, loopB;
+  bool started;
+  if (config.eventLoop) {
+    netBufferA.setLocking(false);
+    netBufferB.setLocking(false);
+    canBufferA.setLocking(false);
+    canBufferB.setLocking(false);
+    if (config.bridge)
+      started = canA->attach(&loopA) >= 0 && canB->attach(&loopA) >= 0;
+    else
+      started = netA.attach(&loopA) >= 0 && canA->attach(&loopA) >= 0 &&
+                netB.attach(&loopB) >= 0 && canB->attach(&loopB) >= 0;
+    if (started) {
+      loopA.start();
+      if (!config.bridge)
+        loopB.start();
+    }
+  } else if (config.bridge) {
+    started = canB->start() >= 0 && canA->start() >= 0;
+  } else {
+    started = netA.start() >= 0 && netB.start() >= 0 && canA->start() >= 0 && canB->start() >= 0;
+  }
+  if (!started) {
+    lerror << "Could not start the tunnel endpoints" << std::endl;
+    return false;
+  }
+
+  if (useCAN) {
+    runCANTraffic(config, txSocket, rxSocket, result);
+  } else {
+    double cpuStart = cpuTime();
+    uint64_t start = nowNs();
+    canA->join();
+    result.seconds = (nowNs() - start) / 1e9;
+    /* Wait until every frame arrived or the tunnel had enough time */
+    MemoryCANThread *sink = static_cast<MemoryCANThread*>(canB.get());
+    uint64_t drainEnd = nowNs() + 2ULL * config.timeout * 1000 + 500000000ULL;
+    while (nowNs() < drainEnd && sink->getReceived() < result.sent)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    result.cpuSeconds = cpuTime() - cpuStart;
+  }
+
+  if (config.eventLoop) {
+    loopA.stop();
+    loopA.join();
+    if (!config.bridge) {
+      loopB.stop();
+      loopB.join();
+    }
+  } else {
+    canA->stop();
+    canB->stop();
+    canA->join();
+    canB->join();
+    if (!config.bridge) {
+      netA.stop();
+      netB.stop();
+      netA.join();
+      netB.join();
+    }
+  }
+  if (!useCAN)
+    result.received = static_cast<MemoryCANThread*>(canB.get())->getReceived();
+
+  NetStats stats;
+  netA.getStatistics()->net.read(stats);
+  result.packets = stats.txPackets;
+  CANStats canStats;
+  canB->getStatistics()->can.read(canStats);
+  memcpy(result.wire, canStats.txCompletion, sizeof(result.wire));
+  result.echoesLost = canStats.txEchoesLost;
+
+  netBufferA.clearPool();
+  netBufferB.clearPool();
+  canBufferA.clearPool();
+  canBufferB.clearPool();
+  if (txSocket >= 0)
+    io()->close(txSocket);
+  if (rxSocket >= 0)
+    io()->close(rxSocket);
+  return true;
+}
+
+/*
+ * Runs the bench against two StaticTunnels, composed for the frame mode
+ * of the interfaces
+ */
+template <class Mode>
+static bool runStaticBench(const BenchConfig &config, BenchResult &result) {
+  struct debugOptions_t debugOptions = { 0, 0, 0, 0 };
+  struct sockaddr_in addrA, addrB;
+  makeAddr(addrA, config.port);
+  makeAddr(addrB, config.port + 1);
+
+  result.sent = 0;
+  result.received = 0;
+  result.latencies.clear();
+  result.keys.clear();
+  memset(result.wire, 0, sizeof(result.wire));
+  result.echoesLost = 0;
+
+  FrameMix mix(config.mix);
+  int txSocket = openCANSocket(config.canA, mix.needsFD());
+  int rxSocket = openCANSocket(config.canB, mix.needsFD());
+  if (txSocket < 0 || rxSocket < 0) {
+    lerror << "Could not open " << config.canA << " and " << config.canB << std::endl;
+    return false;
+  }
+  UDPStaticTunnel<Mode> tunnelA(debugOptions, config.canA, UDPTransport(addrB, addrA, true));
+  UDPStaticTunnel<Mode> tunnelB(debugOptions, config.canB, UDPTransport(addrA, addrB, true));
+  tunnelA.batching().setTimeout(config.timeout);
+  tunnelB.batching().setTimeout(config.timeout);
+  bool started = tunnelA.start() >= 0;
+  if (started && tunnelB.start() < 0) {
+    tunnelA.stop();
+    tunnelA.join();
+    started = false;
+  }
+  if (started) {
+    runCANTraffic(config, txSocket, rxSocket, result);
+    tunnelA.stop();
+    tunnelB.stop();
+    tunnelA.join();
+    tunnelB.join();
+
+    NetStats stats;
+    tunnelA.getStatistics()->net.read(stats);
+    result.packets = stats.txPackets;
+  } else {
+    lerror << "Could not start the tunnel endpoints" << std::endl;
+  }
+  io()->close(txSocket);
+  io()->close(rxSocket);
+  return started;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t i = std::min(sorted.size() - 1, (size_t) (p * sorted.size()));
+  return sorted[i];
+}
+
+static void printResult(const BenchConfig &config, bool useCAN, BenchResult &result) {
+  std::vector<uint32_t> &lat = result.latencies;
+  /* The 10% of frames with the highest priority, before lat is sorted */
+  std::vector<uint32_t> prio;
+  if (!result.keys.empty()) {
+    std::vector<uint32_t> keys(result.keys);
+    size_t n = std::max<size_t>(1, keys.size() / 10);
+    std::nth_element(keys.begin(), keys.begin() + n - 1, keys.end());
+    uint32_t threshold = keys[n - 1];
+    for (size_t i = 0; i < lat.size(); i++) {
+      if (result.keys[i] <= threshold)
+        prio.push_back(lat[i]);
+    }
+    std::sort(prio.begin(), prio.end());
+  }
+  std::sort(lat.begin(), lat.end());
+  double framesPerSecond = result.seconds > 0 ? result.received / result.seconds : 0;
+  double cpuPerFrame = result.received ? result.cpuSeconds * 1e6 / result.received : 0;
+
+  std::cout << "{\"backend\":\"" << (config.simulate ? "sim" : useCAN ? "can" : "memory") << "\""
+            << ",\"mix\":\"" << config.mix << "\""
+            << ",\"rate\":" << config.rate
+            << ",\"timeout_us\":" << config.timeout
+            << ",\"sort\":" << (config.sort ? "true" : "false")
+            << ",\"event_loop\":" << (config.eventLoop ? "true" : "false")
+            << ",\"static\":" << (config.staticTunnel ? "true" : "false")
+            << ",\"priority_tx\":" << (config.priorityTx ? "true" : "false")
+            << ",\"cyclic\":" << (config.cyclic ? "true" : "false")
+            << ",\"bridge\":" << (config.bridge ? "true" : "false")
+            << ",\"frame_mode\":\"" << (config.classic ? "classic" : "fd") << "\""
+            << ",\"duration_s\":" << result.seconds
+            << ",\"sent\":" << result.sent
+            << ",\"received\":" << result.received
+            << ",\"lost\":" << (result.sent > result.received ? result.sent - result.received : 0)
+            << ",\"packets\":" << result.packets
+            << ",\"frames_per_s\":" << framesPerSecond
+            << ",\"cpu_us_per_frame\":" << cpuPerFrame
+            << ",\"latency_us\":{\"p50\":" << percentile(lat, 0.5)
+            << ",\"p90\":" << percentile(lat, 0.9)
+            << ",\"p99\":" << percentile(lat, 0.99)
+            << ",\"max\":" << (lat.empty() ? 0 : lat.back())
+            << "},\"latency_prio_us\":{\"p50\":" << percentile(prio, 0.5)
+            << ",\"p99\":" << percentile(prio, 0.99)
+            << ",\"max\":" << (prio.empty() ? 0 : prio.back())
+            << "}";
+  if (config.txCompletion) {
+    for (const char *p : {"p50", "p99"}) {
+      std::cout << ",\"wire_" << p << "_us\":[";
+      for (int i = 0; i < CANNELLONI_STATS_PRIORITY_CLASSES; i++)
+        std::cout << (i ? "," : "") << result.wire[i].percentile(p[1] == '5' ? 0.5 : 0.99);
+      std::cout << "]";
+    }
+    std::cout << ",\"echoes_lost\":" << result.echoesLost;
+  }
+  std::cout << "}" << std::endl;
+}
+
+void printUsage() {
+  std::cout << "Usage: cannelloni-bench OPTIONS" << std::endl;
+  std::cout << "Available options:" << std::endl;
+  std::cout << "\t -f RATE[,RATE...] \t frames per second, 0 is unlimited, default: 10000" << std::endl;
+  std::cout << "\t -x MIX[,MIX...] \t frame mix, default: classic" << std::endl;
+  std::cout << "\t\t\t classic       : CAN 2.0, 8 bytes" << std::endl;
+  std::cout << "\t\t\t classic-mixed : CAN 2.0, 0-8 bytes, 10% extended IDs" << std::endl;
+  std::cout << "\t\t\t fd            : CAN FD, 64 bytes" << std::endl;
+  std::cout << "\t\t\t fd-mixed      : CAN FD, 8-64 bytes" << std::endl;
+  std::cout << "\t\t\t mixed         : classic-mixed and fd-mixed" << std::endl;
+  std::cout << "\t\t\t cyclic        : CAN 2.0, 6 bytes, 64 IDs round robin, no latencies" << std::endl;
+  std::cout << "\t -D SECONDS \t\t duration of each run, default: 5" << std::endl;
+  std::cout << "\t -t timeout \t\t buffer timeout (us), default: 100000" << std::endl;
+  std::cout << "\t -s           \t\t enable frame sorting" << std::endl;
+  std::cout << "\t -e           \t\t serve each endpoint from one event loop thread, needs -I or -N" << std::endl;
+  std::cout << "\t -C           \t\t CAN 2.0 only CAN sides, runs the classic codec, not with -I" << std::endl;
+  std::cout << "\t -F           \t\t use tunnels composed at compile time (cannelloni -F), needs -I or -N" << std::endl;
+  std::cout << "\t -Q LIMIT \t\t CAN side of B writes by priority with about LIMIT frames in the kernel," << std::endl;
+  std::cout << "\t\t\t needs -I or -N, not -F" << std::endl;
+  std::cout << "\t -W           \t\t CAN side of B measures write-to-wire times by priority class," << std::endl;
+  std::cout << "\t\t\t needs -I or -N, not -F" << std::endl;
+  std::cout << "\t -Y           \t\t offload cyclic frames to CAN_BCM, needs -I or -N, not -F, -s or -Q" << std::endl;
+  std::cout << "\t -X           \t\t bridge the CAN sides directly, without the network," << std::endl;
+  std::cout << "\t\t\t needs -I or -N, not -F, -s or -Y" << std::endl;
+  std::cout << "\t -l PORT \t\t first of two local UDP ports, default: 23000" << std::endl;
+  std::cout << "\t -I CAN_A,CAN_B \t use two (v)can interfaces instead of the in-memory CAN stand-in" << std::endl;
+  std::cout << "\t -N DELAY,JITTER,LOSS,REORDER \t simulate the CAN buses and the network," << std::endl;
+  std::cout << "\t\t\t delay and jitter in us, loss and reorder in percent" << std::endl;
+  std::cout << "\t -b BITRATE[:DBITRATE] \t bitrates of the simulated buses, default: unlimited" << std::endl;
+  std::cout << "\t -h      \t\t display this help text" << std::endl;
+}
+
+static std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> items;
+  std::istringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    items.push_back(item);
+  return items;
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  BenchConfig config;
+  std::vector<std::string> rates = {"10000"};
+  std::vector<std::string> mixes = {"classic"};
+  config.duration = 5;
+  config.timeout = 100000;
+  config.sort = false;
+  config.eventLoop = false;
+  config.classic = false;
+  config.staticTunnel = false;
+  config.priorityTx = false;
+  config.txLimit = 0;
+  config.txCompletion = false;
+  config.cyclic = false;
+  config.bridge = false;
+  config.port = 23000;
+  config.simulate = false;
+  memset(&config.link, 0, sizeof(config.link));
+  config.bitrate = 0;
+  config.dataBitrate = 0;
+
+  while ((opt = getopt(argc, argv, "f:x:D:t:seCFQ:WYXl:I:N:b:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        rates = split(optarg);
+        break;
+      case 'x':
+        mixes = split(optarg);
+        break;
+      case 'D':
+        config.duration = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        config.timeout = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        config.sort = true;
+        break;
+      case 'e':
+        config.eventLoop = true;
+        break;
+      case 'C':
+        config.classic = true;
+        break;
+      case 'F':
+        config.staticTunnel = true;
+        break;
+      case 'Q':
+        config.priorityTx = true;
+        config.txLimit = strtoul(optarg, NULL, 10);
+        break;
+      case 'W':
+        config.txCompletion = true;
+        break;
+      case 'Y':
+        config.cyclic = true;
+        break;
+      case 'X':
+        config.bridge = true;
+        break;
+      case 'l':
+        config.port = strtoul(optarg, NULL, 10);
+        break;
+      case 'I':
+      {
+        std::vector<std::string> interfaces = split(optarg);
+        if (interfaces.size() != 2) {
+          std::cout << "Usage Error: " << std::endl
+                    << "-I needs two interfaces" << std::endl << std::endl;
+          printUsage();
+          return -1;
+        }
+        config.canA = interfaces[0];
+        config.canB = interfaces[1];
+        break;
+      }
+      case 'N':
+      {
+        std::vector<std::string> params = split(optarg);
+        if (params.size() != 4) {
+          std::cout << "Usage Error: " << std::endl
+                    << "-N needs delay, jitter, loss and reorder" << std::endl << std::endl;
+          printUsage();
+          return -1;
+        }
+        config.simulate = true;
+        config.link.delay = strtoull(params[0].c_str(), NULL, 10);
+        config.link.jitter = strtoull(params[1].c_str(), NULL, 10);
+        config.link.loss = strtod(params[2].c_str(), NULL) / 100;
+        config.link.reorder = strtod(params[3].c_str(), NULL) / 100;
+        /* Reordered packets overtake at least one later packet */
+        config.link.reorderDelay = config.link.jitter + 1000;
+        break;
+      }
+      case 'b':
+      {
+        char *end;
+        config.bitrate = strtoul(optarg, &end, 10);
+        if (*end == ':')
+          config.dataBitrate = strtoul(end + 1, NULL, 10);
+        break;
+      }
+      case 'h':
+        printUsage();
+        return 0;
+      default:
+        printUsage();
+        return -1;
+    }
+  }
+  if (config.timeout == 0) {
+    std::cout << "Usage Error: " << std::endl
+              << "Only non-zero timeouts are allowed" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  if (config.classic && !config.canA.empty() && !config.simulate) {
+    std::cout << "Usage Error: " << std::endl
+              << "With -I, the interfaces decide whether CAN FD is used" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  bool useCAN = false;
+  std::unique_ptr<SimIO> sim;
+  if (config.simulate) {
+    if (config.canA.empty()) {
+      config.canA = "sim0";
+      config.canB = "sim1";
+    }
+    sim = std::make_unique<SimIO>();
+    sim->addBus(config.canA, config.bitrate, config.dataBitrate, !config.classic);
+    sim->addBus(config.canB, config.bitrate, config.dataBitrate, !config.classic);
+    sim->setLink(config.link);
+    setIO(sim.get());
+    useCAN = true;
+  } else if (!config.canA.empty()) {
+    int a = openCANSocket(config.canA, false);
+    int b = openCANSocket(config.canB, false);
+    useCAN = a >= 0 && b >= 0;
+    if (a >= 0)
+      io()->close(a);
+    if (b >= 0)
+      io()->close(b);
+    if (!useCAN)
+      lwarn << "CAN interfaces not available, using the in-memory CAN stand-in" << std::endl;
+  }
+  if (config.eventLoop && !useCAN) {
+    std::cout << "Usage Error: " << std::endl
+              << "The event loop needs CAN interfaces (-I) or simulated buses (-N)" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  if (config.staticTunnel && (!useCAN || config.eventLoop || config.sort)) {
+    std::cout << "Usage Error: " << std::endl
+              << "-F needs CAN interfaces (-I) or simulated buses (-N), not -e or -s" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  if ((config.priorityTx || config.txCompletion) && (!useCAN || config.staticTunnel)) {
+    std::cout << "Usage Error: " << std::endl
+              << "-Q and -W need CAN interfaces (-I) or simulated buses (-N), not -F" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (config.cyclic && (!useCAN || config.staticTunnel || config.sort || config.priorityTx)) {
+    std::cout << "Usage Error: " << std::endl
+              << "-Y needs CAN interfaces (-I) or simulated buses (-N), not -F, -s or -Q" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (config.bridge && (!useCAN || config.staticTunnel || config.sort || config.cyclic)) {
+    std::cout << "Usage Error: " << std::endl
+              << "-X needs CAN interfaces (-I) or simulated buses (-N), not -F, -s or -Y" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  FrameMode staticMode = config.staticTunnel ? staticFrameMode(config.canA) : FRAME_MODE_FD;
+
+  for (const std::string &mix : mixes) {
+    if (!FrameMix(mix).isValid()) {
+      lerror << "Unknown frame mix " << mix << std::endl;
+      return -1;
+    }
+    if (config.classic && FrameMix(mix).needsFD()) {
+      lerror << "Frame mix " << mix << " needs CAN FD, it cannot be used with -C" << std::endl;
+      return -1;
+    }
+    for (const std::string &rate : rates) {
+      BenchResult result;
+      config.mix = mix;
+      config.rate = strtoull(rate.c_str(), NULL, 10);
+      bool ok;
+      if (!config.staticTunnel)
+        ok = runBench(config, useCAN, result);
+      else if (staticMode == FRAME_MODE_FD)
+        ok = runStaticBench<FDFrames>(config, result);
+      else
+        ok = runStaticBench<ClassicFrames>(config, result);
+      if (!ok)
+        return -1;
+      printResult(config, useCAN, result);
+    }
+  }
+  setIO(NULL);
+  return 0;
+}
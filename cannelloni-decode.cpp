@@ -0,0 +1,744 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cannelloni.h"
+#include "parser.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+/* Design Notes:
+ *
+ * cannelloni-decode memory-maps a pcap or pcapng capture and works in
+ * three steps:
+ *
+ *  1. A single pass over the record headers builds an index of all
+ *     packets. This only follows the length fields and is cheap.
+ *  2. The index is cut into chunks that worker threads decode
+ *     independently: link layer, IPv4/IPv6, UDP, port filter and
+ *     finally parseFrames(). Every chunk is formatted into its own
+ *     text buffer.
+ *  3. The main thread writes the buffers in capture order as soon as
+ *     they are ready. A final pass over the sequence numbers of every
+ *     UDP flow reports gaps and late packets.
+ *
+ * Sequence numbers only have 8 bit, so more than 127 consecutive lost
+ * packets look like late ones. IP fragments are not reassembled.
+ */
+
+/* Packets per chunk */
+#define DECODE_CHUNK 16384
+/* Chunks a worker may be ahead of the writer, per worker */
+#define DECODE_AHEAD 4
+/* No cannelloni packet in this slot of the sequence table */
+#define DECODE_NO_SEQ 0xffff
+
+/* Link types */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+enum OutputFormat {FORMAT_CANDUMP, FORMAT_CSV, FORMAT_NONE};
+
+struct Packet {
+  const uint8_t *data;
+  uint32_t len;
+  uint32_t linkType;
+  /* ns since the epoch */
+  uint64_t time;
+};
+
+/* No padding, compared with memcmp */
+struct Flow {
+  uint16_t family;
+  uint16_t srcPort;
+  uint16_t dstPort;
+  uint8_t src[16];
+  uint8_t dst[16];
+
+  bool operator<(const Flow &other) const {
+    return memcmp(this, &other, sizeof(Flow)) < 0;
+  }
+};
+
+struct DecodeCounters {
+  uint64_t packets;
+  uint64_t frames;
+  uint64_t malformed;
+  uint64_t fragments;
+};
+
+struct Chunk {
+  std::string output;
+  DecodeCounters counters;
+  std::map<Flow, uint32_t> flows;
+  bool ready;
+};
+
+struct Options {
+  std::set<uint16_t> ports;
+  OutputFormat format;
+  std::string interfaceName;
+};
+
+static uint16_t get16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t swap32(uint32_t v, bool swap) {
+  return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t swap16(uint16_t v, bool swap) {
+  return swap ? __builtin_bswap16(v) : v;
+}
+
+/*
+ * Index of pcap and pcapng files
+ */
+static bool indexPcap(const uint8_t *begin, const uint8_t *end, std::vector<Packet> &packets) {
+  uint32_t magic;
+  memcpy(&magic, begin, sizeof(magic));
+  bool swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+  bool nano = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+  if (end - begin < 24)
+    return false;
+  uint32_t linkType;
+  memcpy(&linkType, begin + 20, sizeof(linkType));
+  linkType = swap32(linkType, swap) & 0x0fffffff;
+
+  const uint8_t *p = begin + 24;
+  while (end - p >= 16) {
+    uint32_t header[4];
+    memcpy(header, p, sizeof(header));
+    uint32_t seconds = swap32(header[0], swap);
+    uint32_t fraction = swap32(header[1], swap);
+    uint32_t capLen = swap32(header[2], swap);
+    p += 16;
+    if ((uint64_t) (end - p) < capLen) {
+      lwarn << "Capture is truncated" << std::endl;
+      break;
+    }
+    Packet packet;
+    packet.data = p;
+    packet.len = capLen;
+    packet.linkType = linkType;
+    packet.time = seconds * 1000000000ULL + (nano ? fraction : fraction * 1000ULL);
+    packets.push_back(packet);
+    p += capLen;
+  }
+  return true;
+}
+
+static bool indexPcapng(const uint8_t *begin, const uint8_t *end, std::vector<Packet> &packets) {
+  struct Interface {
+    uint32_t linkType;
+    /* Units per second of the timestamps */
+    uint64_t resolution;
+  };
+  std::vector<Interface> interfaces;
+  bool swap = false;
+  const uint8_t *p = begin;
+
+  while (end - p >= 12) {
+    uint32_t type, length;
+    memcpy(&type, p, sizeof(type));
+    if (type == 0x0a0d0d0a) {
+      /* Section header block, determines the byte order of the section */
+      uint32_t byteOrder;
+      memcpy(&byteOrder, p + 8, sizeof(byteOrder));
+      swap = byteOrder == 0x4d3c2b1a;
+      interfaces.clear();
+    }
+    memcpy(&length, p + 4, sizeof(length));
+    type = swap32(type, swap);
+    length = swap32(length, swap);
+    if (length < 12 || length % 4 || (uint64_t) (end - p) < length) {
+      lwarn << "Capture is truncated" << std::endl;
+      break;
+    }
+    const uint8_t *body = p + 8;
+    const uint8_t *blockEnd = p + length - 4;
+
+    if (type == 1 && blockEnd - body >= 8) {
+      /* Interface description block */
+      Interface interface;
+      uint16_t linkType;
+      memcpy(&linkType, body, sizeof(linkType));
+      interface.linkType = swap16(linkType, swap);
+      interface.resolution = 1000000;
+      /* Options, only if_tsresol is of interest */
+      const uint8_t *option = body + 8;
+      while (blockEnd - option >= 4) {
+        uint16_t code, optionLength;
+        memcpy(&code, option, sizeof(code));
+        memcpy(&optionLength, option + 2, sizeof(optionLength));
+        code = swap16(code, swap);
+        optionLength = swap16(optionLength, swap);
+        if (code == 0)
+          break;
+        if (code == 9 && optionLength >= 1) {
+          uint8_t value = option[4];
+          interface.resolution = 1;
+          for (int i = 0; i < (value & 0x7f); i++)
+            interface.resolution *= (value & 0x80) ? 2 : 10;
+        }
+        option += 4 + ((optionLength + 3) & ~3);
+      }
+      interfaces.push_back(interface);
+    } else if (type == 6 && blockEnd - body >= 20) {
+      /* Enhanced packet block */
+      uint32_t fields[5];
+      memcpy(fields, body, sizeof(fields));
+      uint32_t interfaceId = swap32(fields[0], swap);
+      uint64_t timestamp = ((uint64_t) swap32(fields[1], swap) << 32) | swap32(fields[2], swap);
+      uint32_t capLen = swap32(fields[3], swap);
+      if (interfaceId < interfaces.size() && capLen <= (uint64_t) (blockEnd - body - 20)) {
+        const Interface &interface = interfaces[interfaceId];
+        Packet packet;
+        packet.data = body + 20;
+        packet.len = capLen;
+        packet.linkType = interface.linkType;
+        packet.time = timestamp / interface.resolution * 1000000000ULL +
+                      timestamp % interface.resolution * 1000000000ULL / interface.resolution;
+        packets.push_back(packet);
+      }
+    } else if (type == 3 && blockEnd - body >= 4 && !interfaces.empty()) {
+      /* Simple packet block, no timestamp */
+      uint32_t originalLength;
+      memcpy(&originalLength, body, sizeof(originalLength));
+      Packet packet;
+      packet.data = body + 4;
+      packet.len = std::min<uint64_t>(swap32(originalLength, swap), blockEnd - body - 4);
+      packet.linkType = interfaces[0].linkType;
+      packet.time = 0;
+      packets.push_back(packet);
+    }
+    p += length;
+  }
+  return true;
+}
+
+/*
+ * Finds the UDP payload of a packet, returns false for anything else
+ */
+static bool findUDP(const Packet &packet, Flow &flow, const uint8_t *&payload,
+                    uint16_t &payloadLen, DecodeCounters &counters) {
+  const uint8_t *p = packet.data, *end = packet.data + packet.len;
+  uint16_t etherType = 0;
+
+  switch (packet.linkType) {
+    case LINKTYPE_ETHERNET:
+      if (end - p < 14)
+        return false;
+      etherType = get16(p + 12);
+      p += 14;
+      /* VLAN tags */
+      while ((etherType == 0x8100 || etherType == 0x88a8) && end - p >= 4) {
+        etherType = get16(p + 2);
+        p += 4;
+      }
+      break;
+    case LINKTYPE_LINUX_SLL:
+      if (end - p < 16)
+        return false;
+      etherType = get16(p + 14);
+      p += 16;
+      break;
+    case LINKTYPE_LINUX_SLL2:
+      if (end - p < 20)
+        return false;
+      etherType = get16(p);
+      p += 20;
+      break;
+    case LINKTYPE_NULL:
+    {
+      if (end - p < 4)
+        return false;
+      uint32_t family;
+      memcpy(&family, p, sizeof(family));
+      /* Host byte order of the capturing machine */
+      if (family == 2 || family == 0x02000000)
+        etherType = 0x0800;
+      else
+        etherType = 0x86dd;
+      p += 4;
+      break;
+    }
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+      if (end - p < 1)
+        return false;
+      etherType = ((p[0] >> 4) == 4) ? 0x0800 : 0x86dd;
+      break;
+    default:
+      return false;
+  }
+
+  memset(&flow, 0, sizeof(flow));
+  if (etherType == 0x0800) {
+    if (end - p < 20 || (p[0] >> 4) != 4)
+      return false;
+    uint8_t headerLen = (p[0] & 0x0f) * 4;
+    if (p[9] != IPPROTO_UDP || end - p < headerLen + 8)
+      return false;
+    /* More fragments or a fragment offset */
+    if (get16(p + 6) & 0x3fff) {
+      counters.fragments++;
+      return false;
+    }
+    flow.family = 4;
+    memcpy(flow.src, p + 12, 4);
+    memcpy(flow.dst, p + 16, 4);
+    p += headerLen;
+  } else if (etherType == 0x86dd) {
+    if (end - p < 48 || (p[0] >> 4) != 6)
+      return false;
+    if (p[6] == 44) {
+      counters.fragments++;
+      return false;
+    }
+    if (p[6] != IPPROTO_UDP)
+      return false;
+    flow.family = 6;
+    memcpy(flow.src, p + 8, 16);
+    memcpy(flow.dst, p + 24, 16);
+    p += 40;
+  } else {
+    return false;
+  }
+
+  flow.srcPort = get16(p);
+  flow.dstPort = get16(p + 2);
+  uint16_t udpLen = get16(p + 4);
+  if (udpLen < 8)
+    return false;
+  payload = p + 8;
+  payloadLen = std::min<ptrdiff_t>(udpLen - 8, end - payload);
+  return true;
+}
+
+static std::string flowToString(const Flow &flow) {
+  char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+  int family = flow.family == 4 ? AF_INET : AF_INET6;
+  inet_ntop(family, flow.src, src, sizeof(src));
+  inet_ntop(family, flow.dst, dst, sizeof(dst));
+  std::ostringstream ss;
+  ss << src << ":" << flow.srcPort << "->" << dst << ":" << flow.dstPort;
+  return ss.str();
+}
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static void appendHex(std::string &out, uint32_t value, int digits) {
+  for (int i = digits - 1; i >= 0; i--)
+    out += hexDigits[(value >> (4 * i)) & 0xf];
+}
+
+static void appendTime(std::string &out, uint64_t time) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%010llu.%06llu",
+           (unsigned long long) (time / 1000000000ULL),
+           (unsigned long long) (time % 1000000000ULL / 1000));
+  out += buffer;
+}
+
+/* prefix is "(TIME) INTERFACE " */
+static void formatCandump(std::string &out, const std::string &prefix,
+                          const struct canfd_frame *frame) {
+  out += prefix;
+  if (frame->can_id & CAN_EFF_FLAG)
+    appendHex(out, frame->can_id & CAN_EFF_MASK, 8);
+  else if (frame->can_id & CAN_ERR_FLAG)
+    appendHex(out, frame->can_id & (CAN_ERR_MASK | CAN_ERR_FLAG), 8);
+  else
+    appendHex(out, frame->can_id & CAN_SFF_MASK, 3);
+  out += '#';
+  if (frame->len & CANFD_FRAME) {
+    out += '#';
+    appendHex(out, frame->flags, 1);
+  } else if (frame->can_id & CAN_RTR_FLAG) {
+    out += 'R';
+    if (canfd_len(frame))
+      out += (char) ('0' + std::min<uint8_t>(canfd_len(frame), 8));
+    out += '\n';
+    return;
+  }
+  for (uint8_t i = 0; i < canfd_len(frame); i++)
+    appendHex(out, frame->data[i], 2);
+  out += '\n';
+}
+
+/* prefix is "TIME,FLOW,SEQ," */
+static void formatCSV(std::string &out, const std::string &prefix,
+                      const struct canfd_frame *frame) {
+  char buffer[64];
+  out += prefix;
+  bool eff = frame->can_id & CAN_EFF_FLAG;
+  appendHex(out, frame->can_id & (eff ? CAN_EFF_MASK : CAN_SFF_MASK), eff ? 8 : 3);
+  snprintf(buffer, sizeof(buffer), ",%d,%d,%d,%d,%d,%d,%u,",
+           eff, !!(frame->can_id & CAN_RTR_FLAG), !!(frame->can_id & CAN_ERR_FLAG),
+           !!(frame->len & CANFD_FRAME), !!(frame->flags & CANFD_BRS),
+           !!(frame->flags & CANFD_ESI), canfd_len(frame));
+  out += buffer;
+  if (!(frame->can_id & CAN_RTR_FLAG)) {
+    for (uint8_t i = 0; i < canfd_len(frame); i++)
+      appendHex(out, frame->data[i], 2);
+  }
+  out += '\n';
+}
+
+static void decodeChunk(const std::vector<Packet> &packets, size_t first, size_t last,
+                        const Options &options, Chunk &chunk, uint16_t *sequence,
+                        uint32_t *flowIds) {
+  struct canfd_frame frame;
+  std::vector<std::string> flowNames;
+  std::string prefix;
+  Flow flow;
+  const uint8_t *payload;
+  uint16_t payloadLen;
+
+  memset(&chunk.counters, 0, sizeof(chunk.counters));
+  for (size_t i = first; i < last; i++) {
+    const Packet &packet = packets[i];
+    sequence[i] = DECODE_NO_SEQ;
+    if (!findUDP(packet, flow, payload, payloadLen, chunk.counters) ||
+        !(options.ports.count(flow.srcPort) || options.ports.count(flow.dstPort)) ||
+        payloadLen < CANNELLONI_DATA_PACKET_BASE_SIZE) {
+      continue;
+    }
+    auto it = chunk.flows.find(flow);
+    if (it == chunk.flows.end()) {
+      it = chunk.flows.insert(std::make_pair(flow, (uint32_t) chunk.flows.size())).first;
+      flowNames.push_back(flowToString(flow));
+    }
+
+    /* Everything in front of the ID is the same for all frames of a packet */
+    uint8_t seq = payload[2];
+    prefix.clear();
+    if (options.format == FORMAT_CANDUMP) {
+      prefix += '(';
+      appendTime(prefix, packet.time);
+      prefix += ") ";
+      prefix += options.interfaceName;
+      prefix += ' ';
+    } else if (options.format == FORMAT_CSV) {
+      char buffer[8];
+      appendTime(prefix, packet.time);
+      prefix += ',';
+      prefix += flowNames[it->second];
+      snprintf(buffer, sizeof(buffer), ",%u,", seq);
+      prefix += buffer;
+    }
+    auto allocator = [&frame]() { return &frame; };
+    auto receiver = [&](canfd_frame *f, bool success) {
+      if (!success)
+        return;
+      chunk.counters.frames++;
+      if (options.format == FORMAT_CANDUMP)
+        formatCandump(chunk.output, prefix, f);
+      else if (options.format == FORMAT_CSV)
+        formatCSV(chunk.output, prefix, f);
+    };
+    try {
+      memset(&frame, 0, sizeof(frame));
+      parseFrames(payloadLen, payload, allocator, receiver);
+    } catch (std::runtime_error &error) {
+      chunk.counters.malformed++;
+      continue;
+    }
+    chunk.counters.packets++;
+    sequence[i] = seq;
+    /* Local flow ids, made global once all chunks are done */
+    flowIds[i] = it->second;
+  }
+}
+
+void printUsage() {
+  std::cout << "Usage: cannelloni-decode OPTIONS CAPTURE" << std::endl;
+  std::cout << "CAPTURE is a pcap or pcapng file" << std::endl;
+  std::cout << "Available options:" << std::endl;
+  std::cout << "\t -p PORT[,PORT...] \t UDP ports of cannelloni, default: 20000" << std::endl;
+  std::cout << "\t -f FORMAT \t\t output format, default: candump" << std::endl;
+  std::cout << "\t\t\t candump : candump -l log" << std::endl;
+  std::cout << "\t\t\t csv     : CSV with flow and sequence number" << std::endl;
+  std::cout << "\t\t\t none    : only statistics and sequence gaps" << std::endl;
+  std::cout << "\t -i NAME \t\t interface name in candump logs, default: can0" << std::endl;
+  std::cout << "\t -o FILE \t\t output file, default: stdout" << std::endl;
+  std::cout << "\t -j THREADS \t\t worker threads, default: number of cores" << std::endl;
+  std::cout << "\t -h      \t\t display this help text" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  Options options;
+  std::string outputFile;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+  options.format = FORMAT_CANDUMP;
+  options.interfaceName = "can0";
+  while ((opt = getopt(argc, argv, "p:f:i:o:j:h")) != -1) {
+    switch (opt) {
+      case 'p':
+      {
+        std::istringstream ss(optarg);
+        std::string port;
+        while (std::getline(ss, port, ','))
+          options.ports.insert(strtoul(port.c_str(), NULL, 10));
+        break;
+      }
+      case 'f':
+        if (strcmp(optarg, "candump") == 0) {
+          options.format = FORMAT_CANDUMP;
+        } else if (strcmp(optarg, "csv") == 0) {
+          options.format = FORMAT_CSV;
+        } else if (strcmp(optarg, "none") == 0) {
+          options.format = FORMAT_NONE;
+        } else {
+          std::cout << "Usage Error: " << std::endl
+                    << "Unknown format " << optarg << std::endl << std::endl;
+          printUsage();
+          return -1;
+        }
+        break;
+      case 'i':
+        options.interfaceName = std::string(optarg);
+        break;
+      case 'o':
+        outputFile = std::string(optarg);
+        break;
+      case 'j':
+        threads = std::max(1UL, strtoul(optarg, NULL, 10));
+        break;
+      case 'h':
+        printUsage();
+        return 0;
+      default:
+        printUsage();
+        return -1;
+    }
+  }
+  if (optind >= argc) {
+    std::cout << "Usage Error: " << std::endl
+              << "No capture given" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (options.ports.empty())
+    options.ports.insert(20000);
+
+  struct timespec startTime, endTime;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+  int fd = open(argv[optind], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 4) {
+    lerror << "Could not read " << argv[optind] << std::endl;
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    lerror << "Could not map " << argv[optind] << std::endl;
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_WILLNEED);
+  const uint8_t *begin = static_cast<const uint8_t*>(map);
+  const uint8_t *end = begin + st.st_size;
+
+  std::vector<Packet> packets;
+  uint32_t magic;
+  memcpy(&magic, begin, sizeof(magic));
+  bool indexed;
+  if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1) {
+    indexed = indexPcap(begin, end, packets);
+  } else if (magic == 0x0a0d0d0a) {
+    indexed = indexPcapng(begin, end, packets);
+  } else {
+    lerror << argv[optind] << " is neither a pcap nor a pcapng file" << std::endl;
+    return -1;
+  }
+  if (!indexed) {
+    lerror << "Could not index " << argv[optind] << std::endl;
+    return -1;
+  }
+
+  FILE *out = stdout;
+  if (!outputFile.empty()) {
+    out = fopen(outputFile.c_str(), "w");
+    if (out == NULL) {
+      lerror << "Could not open " << outputFile << std::endl;
+      return -1;
+    }
+  }
+  if (options.format == FORMAT_CSV)
+    fputs("time,flow,seq,id,eff,rtr,err,fd,brs,esi,len,data\n", out);
+
+  /* Decode the chunks in parallel, write them in order */
+  size_t chunkCount = (packets.size() + DECODE_CHUNK - 1) / DECODE_CHUNK;
+  std::vector<Chunk> chunks(chunkCount);
+  std::vector<uint16_t> sequence(packets.size());
+  std::vector<uint32_t> flowIds(packets.size());
+  std::atomic<size_t> nextChunk(0);
+  size_t written = 0;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  auto worker = [&]() {
+    size_t c;
+    while ((c = nextChunk++) < chunkCount) {
+      {
+        /* Do not run too far ahead of the writer */
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return c < written + DECODE_AHEAD * threads; });
+      }
+      size_t first = c * DECODE_CHUNK;
+      size_t last = std::min(first + DECODE_CHUNK, packets.size());
+      decodeChunk(packets, first, last, options, chunks[c], &sequence[0], &flowIds[0]);
+      std::lock_guard<std::mutex> lock(mutex);
+      chunks[c].ready = true;
+      condition.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back(worker);
+
+  DecodeCounters total;
+  memset(&total, 0, sizeof(total));
+  std::map<Flow, uint32_t> flows;
+  for (size_t c = 0; c < chunkCount; c++) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&]() { return chunks[c].ready; });
+    }
+    Chunk &chunk = chunks[c];
+    fwrite(chunk.output.data(), 1, chunk.output.size(), out);
+    std::string().swap(chunk.output);
+    total.packets += chunk.counters.packets;
+    total.frames += chunk.counters.frames;
+    total.malformed += chunk.counters.malformed;
+    total.fragments += chunk.counters.fragments;
+
+    /* Map the flow ids of the chunk to global ones */
+    std::vector<uint32_t> globalIds(chunk.flows.size());
+    for (auto &flow : chunk.flows) {
+      auto it = flows.insert(std::make_pair(flow.first, (uint32_t) flows.size())).first;
+      globalIds[flow.second] = it->second;
+    }
+    size_t first = c * DECODE_CHUNK;
+    size_t last = std::min(first + DECODE_CHUNK, packets.size());
+    for (size_t i = first; i < last; i++) {
+      if (sequence[i] != DECODE_NO_SEQ)
+        flowIds[i] = globalIds[flowIds[i]];
+    }
+    std::map<Flow, uint32_t>().swap(chunk.flows);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    written = c + 1;
+    condition.notify_all();
+  }
+  for (std::thread &thread : workers)
+    thread.join();
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+
+  /* Sequence gaps per flow */
+  struct FlowState {
+    bool seen;
+    uint8_t last;
+    uint64_t packets;
+    uint64_t missing;
+    uint64_t late;
+  };
+  std::vector<FlowState> states(flows.size());
+  memset(states.data(), 0, states.size() * sizeof(FlowState));
+  for (size_t i = 0; i < packets.size(); i++) {
+    if (sequence[i] == DECODE_NO_SEQ)
+      continue;
+    FlowState &state = states[flowIds[i]];
+    uint8_t seq = sequence[i];
+    state.packets++;
+    if (state.seen) {
+      uint8_t distance = seq - (uint8_t) (state.last + 1);
+      if (distance < 128) {
+        state.missing += distance;
+        state.last = seq;
+      } else {
+        /* Behind the newest packet, reordered or duplicated */
+        state.late++;
+      }
+    } else {
+      state.seen = true;
+      state.last = seq;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+  double seconds = (endTime.tv_sec - startTime.tv_sec) +
+                   (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+
+  std::cerr << "Decoded " << total.packets << " cannelloni packets with " << total.frames
+            << " frames out of " << packets.size() << " packets in " << seconds << " s ("
+            << (uint64_t) (st.st_size / seconds / 1e6) << " MB/s, " << threads
+            << " threads)" << std::endl;
+  if (total.malformed || total.fragments)
+    std::cerr << "Malformed packets: " << total.malformed
+              << ", IP fragments skipped: " << total.fragments << std::endl;
+  for (auto &flow : flows) {
+    const FlowState &state = states[flow.second];
+    std::cerr << flowToString(flow.first) << ": " << state.packets << " packets, "
+              << state.missing << " missing, " << state.late << " late" << std::endl;
+  }
+  munmap(map, st.st_size);
+  return 0;
+}
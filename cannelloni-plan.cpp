@@ -0,0 +1,428 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cannelloni.h"
+#include "canlog.h"
+#include "csvmapparser.h"
+#include "flushpolicy.h"
+#include "framebuffer.h"
+#include "iobackend.h"
+#include "parser.h"
+#include "stats.h"
+#include "udpthread.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+/* Design Notes:
+ *
+ * cannelloni-plan predicts the network traffic and the buffering
+ * latency of a tunnel for a recorded bus log. The frames of the log are
+ * queued in a real FrameBuffer, the FlushPolicy of UDPThread decides
+ * when a packet is sent and buildPacket() fills it, exactly like in a
+ * running cannelloni. Only the transmit timer is replaced by a virtual
+ * clock that jumps from event to event, so hours of traffic are planned
+ * in seconds and the result does not depend on the load of the machine.
+ *
+ * The latency is the time a frame spends in the buffer until its packet
+ * is sent. The network itself is not modelled, add its latency on top.
+ */
+
+/* IPv4 and UDP header */
+#define PLAN_IP_UDP_OVERHEAD 28
+/* Ethernet header, FCS, preamble and inter-frame gap */
+#define PLAN_ETHERNET_OVERHEAD 38
+#define PLAN_ETHERNET_MIN_PAYLOAD 46
+
+struct PlanConfig {
+  uint32_t timeout;
+  bool sort;
+  uint32_t payloadSize;
+  /* Path of the timeout table, empty for none */
+  std::string table;
+  std::map<uint32_t,uint32_t> timeoutTable;
+};
+
+struct PlanBucket {
+  uint64_t packets;
+  uint64_t frames;
+  uint64_t wireBytes;
+};
+
+struct PlanResult {
+  uint64_t frames;
+  /* Overwritten in a full FrameBuffer */
+  uint64_t dropped;
+  uint64_t packets;
+  uint64_t payloadBytes;
+  uint64_t wireBytes;
+  uint64_t flushes[FLUSH_TRIGGERS];
+  std::vector<uint32_t> latencies;
+  std::vector<PlanBucket> series;
+};
+
+/*
+ * Provides the virtual time to FrameBuffer
+ */
+class VirtualClock : public PosixIO {
+  public:
+    VirtualClock() : m_now(0) {}
+
+    void set(uint64_t now) { m_now = now; }
+
+    virtual uint64_t monotonicTime() { return m_now; }
+    virtual uint64_t realtimeTime() { return m_now; }
+
+  private:
+    uint64_t m_now;
+};
+
+static void runPlan(CANLog &log, const PlanConfig &config, uint64_t bucketWidth,
+                    VirtualClock &clock, PlanResult &result) {
+  /* Same limits as cannelloni */
+  FrameBuffer buffer(1000, 16000);
+  FlushPolicy policy;
+  policy.setTimeout(config.timeout);
+  policy.setTimeoutTable(config.timeoutTable);
+  policy.setPayloadSize(config.payloadSize);
+
+  std::vector<uint8_t> packet(config.payloadSize);
+  std::unordered_map<canfd_frame*, uint64_t> queuedAt;
+  const CANLogRecord *records = log.getRecords();
+  const uint8_t *data = log.getData();
+
+  bool timerEnabled = false;
+  uint64_t expiry = 0;
+  uint32_t triggers = 0;
+  uint8_t sequenceNumber = 0;
+
+  result.frames = 0;
+  result.dropped = 0;
+  result.packets = 0;
+  result.payloadBytes = 0;
+  result.wireBytes = 0;
+  memset(result.flushes, 0, sizeof(result.flushes));
+  result.latencies.clear();
+  result.latencies.reserve(log.getCount());
+  result.series.clear();
+
+  /* Mirrors UDPThread::prepareBuffer */
+  auto expire = [&](uint64_t now) {
+    clock.set(now);
+    if (buffer.getFrameBufferSize() == 0) {
+      timerEnabled = false;
+      triggers = 0;
+      return;
+    }
+    buffer.swapBuffers();
+    if (config.sort)
+      buffer.sortIntermediateBuffer();
+    std::list<canfd_frame*> *frames = buffer.getIntermediateBuffer();
+    bool overflow = false;
+    auto overflowHandler = [&](std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator it) {
+      buffer.returnIntermediateBuffer(it);
+      overflow = true;
+    };
+    uint8_t *end = buildPacket(config.payloadSize, packet.data(), *frames,
+                               sequenceNumber++, overflowHandler);
+    uint64_t len = end - packet.data();
+    uint64_t wireBytes = std::max<uint64_t>(len + PLAN_IP_UDP_OVERHEAD, PLAN_ETHERNET_MIN_PAYLOAD) +
+                         PLAN_ETHERNET_OVERHEAD;
+
+    /* Only the frames that made it into the packet are left */
+    for (canfd_frame *frame : *frames) {
+      auto it = queuedAt.find(frame);
+      result.latencies.push_back(now - it->second);
+      queuedAt.erase(it);
+    }
+    FlushTrigger trigger = FlushPolicy::mostUrgent(triggers);
+    result.flushes[trigger]++;
+    result.packets++;
+    result.payloadBytes += len;
+    result.wireBytes += wireBytes;
+
+    size_t index = now / bucketWidth;
+    if (index >= result.series.size())
+      result.series.resize(index + 1, PlanBucket());
+    result.series[index].packets++;
+    result.series[index].frames += frames->size();
+    result.series[index].wireBytes += wireBytes;
+
+    triggers = policy.packetBuilt(overflow);
+    expiry = now + config.timeout;
+    buffer.unlockIntermediateBuffer();
+    buffer.mergeIntermediateBuffer();
+  };
+
+  /* Mirrors UDPThread::transmitFrame */
+  for (uint64_t i = 0; i < log.getCount(); i++) {
+    const CANLogRecord &record = records[i];
+    uint64_t now = record.time / 1000;
+    while (timerEnabled && expiry <= now)
+      expire(expiry);
+
+    clock.set(now);
+    canfd_frame *frame = buffer.requestFrame(true);
+    if (queuedAt.count(frame))
+      result.dropped++;
+    CANLog::toFrame(record, data, frame);
+    data += CANLog::payloadLength(record);
+    buffer.insertFrame(frame);
+    queuedAt[frame] = now;
+    result.frames++;
+
+    if (!timerEnabled) {
+      timerEnabled = true;
+      expiry = now + config.timeout;
+    }
+    uint64_t timeout;
+    switch (policy.frameQueued(frame, buffer.getFrameBufferSize(), timeout)) {
+      case FLUSH_FULL:
+        triggers |= 1 << FLUSH_FULL;
+        expiry = now;
+        break;
+      case FLUSH_ID_TIMEOUT:
+        if (now + timeout < expiry) {
+          triggers |= 1 << FLUSH_ID_TIMEOUT;
+          expiry = now + timeout;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  while (timerEnabled)
+    expire(expiry);
+}
+
+static void printResult(const PlanConfig &config, uint64_t bucketWidth, PlanResult &result) {
+  std::vector<uint32_t> &lat = result.latencies;
+  std::sort(lat.begin(), lat.end());
+  auto percentile = [&lat](double p) -> uint32_t {
+    if (lat.empty())
+      return 0;
+    size_t i = std::min(lat.size() - 1, (size_t) (p * lat.size()));
+    return lat[i];
+  };
+  double seconds = result.series.size() * bucketWidth / 1e6;
+  uint64_t peakPackets = 0, peakBytes = 0;
+  for (const PlanBucket &bucket : result.series) {
+    peakPackets = std::max(peakPackets, bucket.packets);
+    peakBytes = std::max(peakBytes, bucket.wireBytes);
+  }
+  double bucketSeconds = bucketWidth / 1e6;
+
+  std::cout << "{\"timeout_us\":" << config.timeout
+            << ",\"sort\":" << (config.sort ? "true" : "false")
+            << ",\"payload\":" << config.payloadSize
+            << ",\"table\":\"" << config.table << "\""
+            << ",\"duration_s\":" << seconds
+            << ",\"frames\":" << result.frames
+            << ",\"dropped\":" << result.dropped
+            << ",\"packets\":" << result.packets
+            << ",\"frames_per_packet\":" << (result.packets ? (double) result.frames / result.packets : 0)
+            << ",\"packets_per_s\":{\"mean\":" << (seconds > 0 ? result.packets / seconds : 0)
+            << ",\"peak\":" << peakPackets / bucketSeconds << "}"
+            << ",\"bandwidth_bps\":{\"mean\":" << (seconds > 0 ? result.wireBytes * 8 / seconds : 0)
+            << ",\"peak\":" << peakBytes * 8 / bucketSeconds << "}"
+            << ",\"flushes\":{\"timer\":" << result.flushes[FLUSH_TIMER]
+            << ",\"full\":" << result.flushes[FLUSH_FULL]
+            << ",\"id_timeout\":" << result.flushes[FLUSH_ID_TIMEOUT]
+            << ",\"overflow\":" << result.flushes[FLUSH_OVERFLOW] << "}"
+            << ",\"latency_us\":{\"p50\":" << percentile(0.5)
+            << ",\"p90\":" << percentile(0.9)
+            << ",\"p99\":" << percentile(0.99)
+            << ",\"max\":" << (lat.empty() ? 0 : lat.back())
+            << "}}" << std::endl;
+}
+
+static void writeSeries(std::ostream &out, const PlanConfig &config, uint64_t bucketWidth,
+                        const PlanResult &result) {
+  double bucketSeconds = bucketWidth / 1e6;
+  for (size_t i = 0; i < result.series.size(); i++) {
+    const PlanBucket &bucket = result.series[i];
+    out << config.timeout << "," << config.sort << "," << config.payloadSize << ","
+        << config.table << "," << i * bucketSeconds << "," << bucket.packets / bucketSeconds
+        << "," << bucket.frames / bucketSeconds << "," << bucket.wireBytes * 8 / bucketSeconds
+        << "\n";
+  }
+}
+
+static bool loadTimeoutTable(const std::string &path, std::map<uint32_t,uint32_t> &table) {
+  CSVMapParser<uint32_t,uint32_t> mapParser;
+  if (!mapParser.open(path)) {
+    lerror << "Unable to open " << path << "." << std::endl;
+    return false;
+  }
+  if (!mapParser.parse()) {
+    lerror << "Error while parsing " << path << "." << std::endl;
+    return false;
+  }
+  mapParser.close();
+  table = mapParser.read();
+  return true;
+}
+
+void printUsage() {
+  std::cout << "Usage: cannelloni-plan OPTIONS LOGFILE" << std::endl;
+  std::cout << "LOGFILE is a candump -l log, an ASC log or a compact log of cannelloni-replay" << std::endl;
+  std::cout << "Lists of values are swept, every combination is planned" << std::endl;
+  std::cout << "Available options:" << std::endl;
+  std::cout << "\t -t TIMEOUT[,TIMEOUT...] \t buffer timeout (us), default: 100000" << std::endl;
+  std::cout << "\t -T FILE[,FILE...] \t timeout tables, - for none, default: none" << std::endl;
+  std::cout << "\t -s off|on[,...] \t frame sorting, default: off" << std::endl;
+  std::cout << "\t -P SIZE[,SIZE...] \t packet payload size, default: " << UDP_PAYLOAD_SIZE << std::endl;
+  std::cout << "\t -c CHANNEL \t\t only plan frames of CHANNEL (interface or ASC channel)" << std::endl;
+  std::cout << "\t -w MS \t\t\t interval of the time series, default: 1000" << std::endl;
+  std::cout << "\t -o FILE \t\t write the time series as CSV to FILE" << std::endl;
+  std::cout << "\t -h      \t\t display this help text" << std::endl;
+}
+
+static std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> items;
+  std::istringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    items.push_back(item);
+  return items;
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  std::vector<std::string> timeouts = {"100000"};
+  std::vector<std::string> tables = {"-"};
+  std::vector<std::string> sortModes = {"off"};
+  std::vector<std::string> payloadSizes = {std::to_string(UDP_PAYLOAD_SIZE)};
+  std::string channel, seriesPath;
+  uint64_t bucketWidth = 1000000;
+
+  while ((opt = getopt(argc, argv, "t:T:s:P:c:w:o:h")) != -1) {
+    switch (opt) {
+      case 't':
+        timeouts = split(optarg);
+        break;
+      case 'T':
+        tables = split(optarg);
+        break;
+      case 's':
+        sortModes = split(optarg);
+        break;
+      case 'P':
+        payloadSizes = split(optarg);
+        break;
+      case 'c':
+        channel = std::string(optarg);
+        break;
+      case 'w':
+        bucketWidth = std::max(1UL, strtoul(optarg, NULL, 10)) * 1000;
+        break;
+      case 'o':
+        seriesPath = std::string(optarg);
+        break;
+      case 'h':
+        printUsage();
+        return 0;
+      default:
+        printUsage();
+        return -1;
+    }
+  }
+  if (optind >= argc) {
+    std::cout << "Usage Error: " << std::endl
+              << "No log given" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  /* Build all combinations */
+  std::vector<PlanConfig> configs;
+  for (const std::string &timeout : timeouts) {
+    for (const std::string &table : tables) {
+      for (const std::string &sort : sortModes) {
+        for (const std::string &payloadSize : payloadSizes) {
+          PlanConfig config;
+          config.timeout = strtoul(timeout.c_str(), NULL, 10);
+          config.sort = sort == "on";
+          config.payloadSize = strtoul(payloadSize.c_str(), NULL, 10);
+          if (table != "-") {
+            config.table = table;
+            if (!loadTimeoutTable(table, config.timeoutTable))
+              return -1;
+          }
+          if (config.timeout == 0 || (sort != "on" && sort != "off") ||
+              config.payloadSize < CANNELLONI_DATA_PACKET_BASE_SIZE + CANNELLONI_FRAME_BASE_SIZE + CANFD_MAX_DLEN + 1 ||
+              config.payloadSize > UINT16_MAX) {
+            std::cout << "Usage Error: " << std::endl
+                      << "Invalid timeout, sort mode or payload size" << std::endl << std::endl;
+            printUsage();
+            return -1;
+          }
+          configs.push_back(config);
+        }
+      }
+    }
+  }
+
+  CANLog log;
+  if (!log.load(argv[optind], channel))
+    return -1;
+  if (log.getSkipped())
+    lwarn << "Skipped " << log.getSkipped() << " lines that could not be parsed" << std::endl;
+  if (log.getCount() == 0) {
+    lerror << "No frames to plan" << std::endl;
+    return -1;
+  }
+
+  std::ofstream series;
+  if (!seriesPath.empty()) {
+    series.open(seriesPath.c_str());
+    if (!series.is_open()) {
+      lerror << "Could not open " << seriesPath << std::endl;
+      return -1;
+    }
+    series << "timeout_us,sort,payload,table,time_s,packets_per_s,frames_per_s,bandwidth_bps\n";
+  }
+
+  VirtualClock clock;
+  setIO(&clock);
+  PlanResult result;
+  for (const PlanConfig &config : configs) {
+    runPlan(log, config, bucketWidth, clock, result);
+    printResult(config, bucketWidth, result);
+    if (series.is_open())
+      writeSeries(series, config, bucketWidth, result);
+  }
+  setIO(NULL);
+  return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+#include "canlog.h"
+#include "parser.h"
+#include "udpthread.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+/* Design Notes:
+ *
+ * cannelloni-replay loads a log with CANLog and writes it either onto a
+ * CAN interface or, encoded as cannelloni packets, to the UDP port of a
+ * tunnel endpoint.
+ *
+ * Frames are sent in batches with sendmmsg(): every batch contains all
+ * frames that are due, so a late replay catches up without one syscall
+ * per frame. To hold the timing, the replay sleeps until shortly before
+ * the next frame is due and spins for the rest of the time.
+ */
+
+/* Busy wait for the last part of every wait */
+#define REPLAY_SPIN_NS 100000
+/* Default number of frames per batch */
+#define REPLAY_BATCH 64
+
+static const size_t packetSize = UDP_PAYLOAD_SIZE;
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void waitUntil(uint64_t due) {
+  uint64_t now = nowNs();
+  if (due > now + REPLAY_SPIN_NS) {
+    struct timespec ts;
+    ts.tv_sec = (due - REPLAY_SPIN_NS) / 1000000000ULL;
+    ts.tv_nsec = (due - REPLAY_SPIN_NS) % 1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+  while (nowNs() < due)
+    ;
+}
+
+/*
+ * Destination of a replay
+ */
+class ReplaySink {
+  public:
+    virtual ~ReplaySink() {}
+    virtual bool open() = 0;
+    /* Sends all count frames, returns false on a fatal error */
+    virtual bool send(struct canfd_frame *frames, size_t count) = 0;
+    /* Messages handed to the kernel (frames or UDP packets) */
+    uint64_t getMessages() { return m_messages; }
+    /* Frames that could not be sent */
+    uint64_t getDropped() { return m_dropped; }
+
+  protected:
+    ReplaySink() : m_socket(-1), m_messages(0), m_dropped(0) {}
+
+    /* Sends all messages, waits while the socket is out of buffers */
+    bool sendAll(struct mmsghdr *messages, size_t count) {
+      size_t sent = 0;
+      while (sent < count) {
+        int ret = sendmmsg(m_socket, messages + sent, count - sent, 0);
+        if (ret < 0) {
+          if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR) {
+            struct timespec ts = {0, 50000};
+            nanosleep(&ts, NULL);
+            continue;
+          }
+          lerror << "sendmmsg error: " << strerror(errno) << std::endl;
+          return false;
+        }
+        sent += ret;
+      }
+      m_messages += count;
+      return true;
+    }
+
+  protected:
+    int m_socket;
+    uint64_t m_messages;
+    uint64_t m_dropped;
+};
+
+class CANSink : public ReplaySink {
+  public:
+    CANSink(const std::string &name, size_t batch)
+      : m_name(name)
+      , m_canfd(false)
+      , m_iov(batch)
+      , m_messages(batch)
+    { }
+
+    ~CANSink() {
+      if (m_socket >= 0)
+        close(m_socket);
+    }
+
+    virtual bool open() {
+      struct ifreq ifr;
+      struct sockaddr_can addr;
+      int enable = 1;
+
+      m_socket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+      if (m_socket < 0) {
+        lerror << "socket Error" << std::endl;
+        return false;
+      }
+      memset(&ifr, 0, sizeof(ifr));
+      strncpy(ifr.ifr_name, m_name.c_str(), IFNAMSIZ - 1);
+      if (ioctl(m_socket, SIOCGIFINDEX, &ifr) < 0) {
+        lerror << "Could get index of interface >" << m_name << "<" << std::endl;
+        return false;
+      }
+      memset(&addr, 0, sizeof(addr));
+      addr.can_family = AF_CAN;
+      addr.can_ifindex = ifr.ifr_ifindex;
+      if (ioctl(m_socket, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu == CANFD_MTU &&
+          setsockopt(m_socket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) == 0)
+        m_canfd = true;
+      /* We only write */
+      setsockopt(m_socket, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+      if (bind(m_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        lerror << "Could not bind to interface" << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    virtual bool send(struct canfd_frame *frames, size_t count) {
+      size_t n = 0;
+      for (size_t i = 0; i < count; i++) {
+        bool fd = frames[i].len & CANFD_FRAME;
+        if (fd && !m_canfd) {
+          m_dropped++;
+          continue;
+        }
+        frames[i].len &= ~CANFD_FRAME;
+        m_iov[n].iov_base = &frames[i];
+        m_iov[n].iov_len = fd ? CANFD_MTU : CAN_MTU;
+        memset(&m_messages[n], 0, sizeof(struct mmsghdr));
+        m_messages[n].msg_hdr.msg_iov = &m_iov[n];
+        m_messages[n].msg_hdr.msg_iovlen = 1;
+        n++;
+      }
+      return sendAll(m_messages.data(), n);
+    }
+
+  private:
+    std::string m_name;
+    bool m_canfd;
+    std::vector<struct iovec> m_iov;
+    std::vector<struct mmsghdr> m_messages;
+};
+
+class UDPSink : public ReplaySink {
+  public:
+    UDPSink(const struct sockaddr_in &remoteAddr, const struct sockaddr_in &localAddr,
+            size_t batch)
+      : m_remoteAddr(remoteAddr)
+      , m_localAddr(localAddr)
+      , m_sequenceNumber(0)
+      , m_packets(batch * packetSize)
+      , m_iov(batch)
+      , m_messages(batch)
+    { }
+
+    ~UDPSink() {
+      if (m_socket >= 0)
+        close(m_socket);
+    }
+
+    virtual bool open() {
+      m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+      if (m_socket < 0) {
+        lerror << "socket Error" << std::endl;
+        return false;
+      }
+      if (bind(m_socket, (struct sockaddr *) &m_localAddr, sizeof(m_localAddr)) < 0) {
+        lerror << "Could not bind to address" << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    virtual bool send(struct canfd_frame *frames, size_t count) {
+      std::list<canfd_frame*> pending;
+      for (size_t i = 0; i < count; i++)
+        pending.push_back(&frames[i]);
+
+      size_t n = 0;
+      while (!pending.empty()) {
+        /* Every batch holds at least one frame per packet */
+        if (n == m_messages.size()) {
+          if (!sendAll(m_messages.data(), n))
+            return false;
+          n = 0;
+        }
+        uint8_t *packet = &m_packets[n * packetSize];
+        std::list<canfd_frame*> overflow;
+        auto overflowHandler = [&overflow](std::list<canfd_frame*> &frames,
+                                           std::list<canfd_frame*>::iterator it)
+        {
+          overflow.splice(overflow.begin(), frames, it, frames.end());
+        };
+        uint8_t *end = buildPacket(packetSize, packet, pending,
+                                   m_sequenceNumber++, overflowHandler);
+        pending.swap(overflow);
+
+        m_iov[n].iov_base = packet;
+        m_iov[n].iov_len = end - packet;
+        memset(&m_messages[n], 0, sizeof(struct mmsghdr));
+        m_messages[n].msg_hdr.msg_name = &m_remoteAddr;
+        m_messages[n].msg_hdr.msg_namelen = sizeof(m_remoteAddr);
+        m_messages[n].msg_hdr.msg_iov = &m_iov[n];
+        m_messages[n].msg_hdr.msg_iovlen = 1;
+        n++;
+      }
+      return sendAll(m_messages.data(), n);
+    }
+
+  private:
+    struct sockaddr_in m_remoteAddr;
+    struct sockaddr_in m_localAddr;
+    uint8_t m_sequenceNumber;
+    std::vector<uint8_t> m_packets;
+    std::vector<struct iovec> m_iov;
+    std::vector<struct mmsghdr> m_messages;
+};
+
+void printUsage() {
+  std::cout << "Usage: cannelloni-replay OPTIONS LOGFILE" << std::endl;
+  std::cout << "LOGFILE is a candump -l log, an ASC log or a compact log written with -w" << std::endl;
+  std::cout << "Available options:" << std::endl;
+  std::cout << "\t -I INTERFACE \t\t replay onto a CAN interface" << std::endl;
+  std::cout << "\t -R IP \t\t\t replay into the tunnel endpoint at IP" << std::endl;
+  std::cout << "\t -r PORT \t\t UDP port of the tunnel endpoint, default: 20000" << std::endl;
+  std::cout << "\t -l PORT \t\t local UDP port, default: any" << std::endl;
+  std::cout << "\t -c CHANNEL \t\t only replay frames of CHANNEL (interface or ASC channel)" << std::endl;
+  std::cout << "\t -s SPEED \t\t speed factor, 0 is as fast as possible, default: 1" << std::endl;
+  std::cout << "\t -n LOOPS \t\t number of times the log is replayed, default: 1" << std::endl;
+  std::cout << "\t -B FRAMES \t\t maximum frames per batch, default: " << REPLAY_BATCH << std::endl;
+  std::cout << "\t -w FILE \t\t write the compact form of LOGFILE to FILE and exit" << std::endl;
+  std::cout << "\t -h      \t\t display this help text" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  std::string canInterface, channel, compactPath;
+  std::string remoteIP;
+  uint16_t remotePort = 20000, localPort = 0;
+  double speed = 1.0;
+  uint32_t loops = 1;
+  size_t batch = REPLAY_BATCH;
+
+  while ((opt = getopt(argc, argv, "I:R:r:l:c:s:n:B:w:h")) != -1) {
+    switch (opt) {
+      case 'I':
+        canInterface = std::string(optarg);
+        break;
+      case 'R':
+        remoteIP = std::string(optarg);
+        break;
+      case 'r':
+        remotePort = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        localPort = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        channel = std::string(optarg);
+        break;
+      case 's':
+        speed = strtod(optarg, NULL);
+        break;
+      case 'n':
+        loops = strtoul(optarg, NULL, 10);
+        break;
+      case 'B':
+        batch = std::max(1UL, strtoul(optarg, NULL, 10));
+        break;
+      case 'w':
+        compactPath = std::string(optarg);
+        break;
+      case 'h':
+        printUsage();
+        return 0;
+      default:
+        printUsage();
+        return -1;
+    }
+  }
+  if (optind >= argc) {
+    std::cout << "Usage Error: " << std::endl
+              << "No log file given" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  CANLog log;
+  uint64_t loadStart = nowNs();
+  if (!log.load(argv[optind], channel))
+    return -1;
+  linfo << "Loaded " << log.getCount() << " frames in "
+        << (nowNs() - loadStart) / 1000000 << " ms, skipped "
+        << log.getSkipped() << " lines" << std::endl;
+  if (!compactPath.empty())
+    return log.save(compactPath) ? 0 : -1;
+  if (log.getCount() == 0) {
+    lerror << "The log contains no frames" << std::endl;
+    return -1;
+  }
+
+  std::unique_ptr<ReplaySink> sink;
+  if (!canInterface.empty() && remoteIP.empty()) {
+    sink.reset(new CANSink(canInterface, batch));
+  } else if (canInterface.empty() && !remoteIP.empty()) {
+    struct sockaddr_in remoteAddr, localAddr;
+    memset(&remoteAddr, 0, sizeof(remoteAddr));
+    remoteAddr.sin_family = AF_INET;
+    remoteAddr.sin_port = htons(remotePort);
+    if (inet_pton(AF_INET, remoteIP.c_str(), &remoteAddr.sin_addr) != 1) {
+      std::cout << "Usage Error: " << std::endl
+                << "Invalid remote IP " << remoteIP << std::endl << std::endl;
+      printUsage();
+      return -1;
+    }
+    memset(&localAddr, 0, sizeof(localAddr));
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_port = htons(localPort);
+    sink.reset(new UDPSink(remoteAddr, localAddr, batch));
+  } else {
+    std::cout << "Usage Error: " << std::endl
+              << "Either -I or -R is needed" << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (!sink->open())
+    return -1;
+
+  const CANLogRecord *records = log.getRecords();
+  const uint8_t *data = log.getData();
+  uint64_t count = log.getCount();
+  std::vector<struct canfd_frame> frames(batch);
+  std::vector<uint32_t> lateness;
+  if (speed > 0)
+    lateness.reserve(std::min<uint64_t>(count * loops, 100000000ULL));
+
+  uint64_t start = nowNs();
+  for (uint32_t loop = 0; loop < loops; loop++) {
+    uint64_t base = nowNs();
+    const uint8_t *payload = data;
+    uint64_t i = 0;
+    while (i < count) {
+      uint64_t now = 0;
+      if (speed > 0) {
+        waitUntil(base + records[i].time / speed);
+        now = nowNs();
+      }
+      size_t n = 0;
+      while (i < count && n < batch) {
+        if (speed > 0) {
+          uint64_t due = base + records[i].time / speed;
+          if (due > now)
+            break;
+          if (lateness.size() < lateness.capacity())
+            lateness.push_back((now - due) / 1000);
+        }
+        CANLog::toFrame(records[i], payload, &frames[n++]);
+        payload += CANLog::payloadLength(records[i]);
+        i++;
+      }
+      if (!sink->send(frames.data(), n))
+        return -1;
+    }
+  }
+  double seconds = (nowNs() - start) / 1e9;
+  uint64_t total = count * loops;
+
+  std::cout << "Replayed " << total << " frames as " << sink->getMessages()
+            << (remoteIP.empty() ? " frames" : " packets") << " in " << seconds << " s"
+            << std::endl;
+  std::cout << "Achieved rate: " << (uint64_t) (total / seconds) << " frames/s";
+  if (records[count - 1].time > 0)
+    std::cout << ", logged rate: " << (uint64_t) (count / (records[count - 1].time / 1e9))
+              << " frames/s";
+  std::cout << std::endl;
+  if (sink->getDropped())
+    std::cout << "Dropped " << sink->getDropped()
+              << " CAN FD frames, the interface only supports CAN 2.0" << std::endl;
+  if (!lateness.empty()) {
+    std::sort(lateness.begin(), lateness.end());
+    std::cout << "Timing error (us): p50 " << lateness[lateness.size() / 2]
+              << " p99 " << lateness[lateness.size() * 99 / 100]
+              << " max " << lateness.back() << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "stats.h"
+
+using namespace cannelloni;
+
+/* Consistent copy of one tunnel slot */
+struct TunnelSample {
+  CANStats can;
+  NetStats net;
+};
+
+void printUsage() {
+  std::cout << "Usage: cannelloni-top OPTIONS" << std::endl;
+  std::cout << "Available options:" << std::endl;
+  std::cout << "\t -m NAME \t\t name of the statistics region, default: cannelloni" << std::endl;
+  std::cout << "\t -i INTERVAL \t\t refresh interval (ms), default: 1000" << std::endl;
+  std::cout << "\t -n COUNT \t\t exit after COUNT refreshes, default: run forever" << std::endl;
+  std::cout << "\t -h      \t\t display this help text" << std::endl;
+}
+
+static std::string poolUsage(const PoolStats &pool) {
+  std::ostringstream ss;
+  ss << (pool.allocated - pool.free) << "/" << pool.maxAlloc;
+  return ss.str();
+}
+
+static std::string busLoad(const CANStats &can) {
+  if (can.bitrate == 0)
+    return "-";
+  std::ostringstream ss;
+  if (can.busLoadAlarm)
+    ss << "!";
+  ss << std::fixed << std::setprecision(1) << can.busLoad[1] / 100.0;
+  return ss.str();
+}
+
+template <class H>
+static std::string percentiles(const H &current, const H &last, bool p99 = true) {
+  H delta = current;
+  delta.count = current.count - last.count;
+  delta.sum = current.sum - last.sum;
+  for (uint32_t i = 0; i < CANNELLONI_STATS_HIST_BUCKETS; i++)
+    delta.bucket[i] = current.bucket[i] - last.bucket[i];
+  if (delta.count == 0)
+    return "-";
+  std::ostringstream ss;
+  ss << delta.percentile(0.5) << "/" << delta.percentile(0.9);
+  if (p99)
+    ss << "/" << delta.percentile(0.99);
+  return ss.str();
+}
+
+static void printSample(const StatsRegion *region, TunnelSample *current,
+                        TunnelSample *last, double seconds) {
+  uint32_t count = region->tunnelCount.load(std::memory_order_acquire);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t uptime = (now.tv_sec * 1000000ULL + now.tv_nsec / 1000 - region->startTime) / 1000000;
+
+  std::cout << "cannelloni-top - pid " << region->pid << " - up "
+            << uptime << " s - " << count << " tunnel(s)" << std::endl << std::endl;
+  std::cout << std::left << std::setw(16) << "TUNNEL" << std::right
+            << std::setw(10) << "CAN RX/s"
+            << std::setw(10) << "CAN TX/s"
+            << std::setw(8) << "LOAD%"
+            << std::setw(10) << "PKT RX/s"
+            << std::setw(10) << "PKT TX/s"
+            << std::setw(11) << "TX kbit/s"
+            << std::setw(14) << "POOL CAN"
+            << std::setw(14) << "POOL NET"
+            << std::setw(7) << "FILL%"
+            << std::setw(20) << "LAT p50/90/99 us" << std::endl;
+
+  for (uint32_t i = 0; i < count; i++) {
+    const TunnelStats &tunnel = region->tunnels[i];
+    TunnelSample &c = current[i];
+    TunnelSample &l = last[i];
+    tunnel.can.read(c.can);
+    tunnel.net.read(c.net);
+
+    uint64_t txPackets = c.net.txPackets - l.net.txPackets;
+    uint64_t txBytes = c.net.txBytes - l.net.txBytes;
+    double fill = 0;
+    if (txPackets && c.net.payloadSize)
+      fill = 100.0 * txBytes / (txPackets * c.net.payloadSize);
+
+    std::cout << std::left << std::setw(16)
+              << std::string(tunnel.name, strnlen(tunnel.name, CANNELLONI_STATS_NAME_LEN))
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << (c.can.rxFrames - l.can.rxFrames) / seconds
+              << std::setw(10) << (c.can.txFrames - l.can.txFrames) / seconds
+              << std::setw(8) << busLoad(c.can)
+              << std::setw(10) << (c.net.rxPackets - l.net.rxPackets) / seconds
+              << std::setw(10) << txPackets / seconds
+              << std::setprecision(1)
+              << std::setw(11) << txBytes * 8 / seconds / 1000
+              << std::setw(14) << poolUsage(c.can.pool)
+              << std::setw(14) << poolUsage(c.net.pool)
+              << std::setw(7) << fill
+              << std::setw(20) << percentiles(c.net.bufferLatency, l.net.bufferLatency)
+              << std::endl;
+  }
+
+  std::cout << std::endl << std::left << std::setw(16) << "TUNNEL" << std::right
+            << std::setw(16) << "FRAMES/PKT 50/90"
+            << std::setw(16) << "BYTES/PKT 50/90"
+            << std::setw(8) << "TIMER%"
+            << std::setw(8) << "FULL%"
+            << std::setw(8) << "ID-TO%"
+            << std::setw(8) << "OVFL%"
+            << std::setw(10) << "POOL KiB"
+            << std::setw(10) << "ERR/s"
+            << std::setw(10) << "ERR SUP%"
+            << std::setw(10) << "RERR/s"
+            << std::setw(12) << "CYC IDS/JOB"
+            << std::setw(10) << "CYC SUP/s"
+            << std::setw(10) << "RULE RW/s"
+            << std::setw(10) << "RULE DR/s" << std::endl;
+  for (uint32_t i = 0; i < count; i++) {
+    const TunnelStats &tunnel = region->tunnels[i];
+    TunnelSample &c = current[i];
+    TunnelSample &l = last[i];
+    uint64_t flushes[FLUSH_TRIGGERS];
+    uint64_t total = 0;
+    for (int t = 0; t < FLUSH_TRIGGERS; t++) {
+      flushes[t] = c.net.flushes[t] - l.net.flushes[t];
+      total += flushes[t];
+    }
+
+    std::cout << std::left << std::setw(16)
+              << std::string(tunnel.name, strnlen(tunnel.name, CANNELLONI_STATS_NAME_LEN))
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(16) << percentiles(c.net.framesPerPacket, l.net.framesPerPacket, false)
+              << std::setw(16) << percentiles(c.net.bytesPerPacket, l.net.bytesPerPacket, false);
+    for (int t = 0; t < FLUSH_TRIGGERS; t++)
+      std::cout << std::setw(8) << (total ? 100.0 * flushes[t] / total : 0.0);
+    std::cout << std::setw(10) << (c.can.pool.memoryBytes + c.net.pool.memoryBytes) / 1024;
+    uint64_t errors = c.can.errorFrames - l.can.errorFrames;
+    uint64_t suppressed = c.can.errorFramesSuppressed - l.can.errorFramesSuppressed;
+    std::cout << std::setw(10) << errors / seconds
+              << std::setw(10) << (errors ? 100.0 * suppressed / errors : 0.0)
+              << std::setw(10) << (c.can.remoteErrorFrames + c.can.remoteErrorSummaries -
+                                   l.can.remoteErrorFrames - l.can.remoteErrorSummaries) / seconds;
+    std::ostringstream cyclic;
+    cyclic << c.can.cyclicOffloaded << "/" << c.can.cyclicJobs;
+    std::cout << std::setw(12) << cyclic.str()
+              << std::setw(10) << (c.can.cyclicSuppressed - l.can.cyclicSuppressed) / seconds
+              << std::setw(10) << (c.can.ruleRewrites - l.can.ruleRewrites) / seconds
+              << std::setw(10) << (c.can.ruleDrops - l.can.ruleDrops) / seconds;
+    std::cout << std::endl;
+  }
+
+  std::cout << std::endl << std::left << std::setw(16) << "TUNNEL" << std::right
+            << std::setw(10) << "PROBES/s"
+            << std::setw(8) << "LOSS%"
+            << std::setw(20) << "RTT p50/90/99 us"
+            << std::setw(20) << "FWD p50/90/99 us"
+            << std::setw(20) << "BWD p50/90/99 us" << std::endl;
+  for (uint32_t i = 0; i < count; i++) {
+    const TunnelStats &tunnel = region->tunnels[i];
+    TunnelSample &c = current[i];
+    TunnelSample &l = last[i];
+    uint64_t sent = c.can.probesSent - l.can.probesSent;
+    uint64_t answered = c.can.probesAnswered - l.can.probesAnswered;
+    double loss = 0;
+    if (sent && answered < sent)
+      loss = 100.0 * (sent - answered) / sent;
+
+    std::cout << std::left << std::setw(16)
+              << std::string(tunnel.name, strnlen(tunnel.name, CANNELLONI_STATS_NAME_LEN))
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << sent / seconds
+              << std::setw(8) << loss
+              << std::setw(20) << percentiles(c.can.probeRoundTrip, l.can.probeRoundTrip)
+              << std::setw(20) << percentiles(c.can.probeForward, l.can.probeForward)
+              << std::setw(20) << percentiles(c.can.probeBackward, l.can.probeBackward)
+              << std::endl;
+  }
+
+  std::cout << std::endl << std::left << std::setw(16) << "TUNNEL" << std::right;
+  for (int p = 0; p < CANNELLONI_STATS_PRIORITY_CLASSES; p++) {
+    std::ostringstream header;
+    header << "WIRE" << p << " p50/90/99 us";
+    std::cout << std::setw(22) << header.str();
+  }
+  std::cout << std::setw(10) << "LOST/s" << std::endl;
+  for (uint32_t i = 0; i < count; i++) {
+    const TunnelStats &tunnel = region->tunnels[i];
+    TunnelSample &c = current[i];
+    TunnelSample &l = last[i];
+
+    std::cout << std::left << std::setw(16)
+              << std::string(tunnel.name, strnlen(tunnel.name, CANNELLONI_STATS_NAME_LEN))
+              << std::right << std::fixed << std::setprecision(1);
+    for (int p = 0; p < CANNELLONI_STATS_PRIORITY_CLASSES; p++)
+      std::cout << std::setw(22) << percentiles(c.can.txCompletion[p], l.can.txCompletion[p]);
+    std::cout << std::setw(10) << (c.can.txEchoesLost - l.can.txEchoesLost) / seconds
+              << std::endl;
+    l = c;
+  }
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  std::string name = "cannelloni";
+  uint32_t interval = 1000;
+  uint32_t iterations = 0;
+
+  while ((opt = getopt(argc, argv, "m:i:n:h")) != -1) {
+    switch (opt) {
+      case 'm':
+        name = std::string(optarg);
+        break;
+      case 'i':
+        interval = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        iterations = strtoul(optarg, NULL, 10);
+        break;
+      case 'h':
+        printUsage();
+        return 0;
+      default:
+        printUsage();
+        return -1;
+    }
+  }
+  if (interval == 0) {
+    std::cout << "Usage Error: " << std::endl
+              << "Only non-zero intervals are allowed" << std::endl
+                                                       << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  const StatsRegion *region = Statistics::attach(name);
+  if (region == NULL) {
+    std::cerr << "Could not attach to statistics region " << name
+              << ". Is cannelloni running with -m " << name << "?" << std::endl;
+    return -1;
+  }
+  if (region->magic != CANNELLONI_STATS_MAGIC ||
+      region->version != CANNELLONI_STATS_VERSION) {
+    std::cerr << "Statistics region " << name << " has an incompatible version ("
+              << region->version << ", expected " << CANNELLONI_STATS_VERSION
+              << ")" << std::endl;
+    Statistics::detach(region);
+    return -1;
+  }
+
+  bool clearScreen = isatty(STDOUT_FILENO);
+  TunnelSample current[CANNELLONI_STATS_MAX_TUNNELS];
+  TunnelSample last[CANNELLONI_STATS_MAX_TUNNELS];
+  /* The first refresh shows the rates since the start of cannelloni */
+  memset(last, 0, sizeof(last));
+  uint64_t lastTime = monotonicTime();
+  uint64_t startTime = region->startTime;
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t realNow = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    if (realNow > startTime)
+      lastTime -= realNow - startTime;
+  }
+
+  for (uint32_t i = 0; iterations == 0 || i < iterations; i++) {
+    if (i > 0)
+      usleep(interval * 1000);
+    uint64_t now = monotonicTime();
+    double seconds = (now - lastTime) / 1000000.0;
+    if (seconds <= 0)
+      seconds = 1;
+    lastTime = now;
+    if (clearScreen)
+      std::cout << "\033[H\033[2J";
+    printSample(region, current, last, seconds);
+    std::cout << std::flush;
+  }
+
+  Statistics::detach(region);
+  return 0;
+}
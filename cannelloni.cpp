@@ -40,7 +40,14 @@
 #endif
 
 #include "canthread.h"
+#include "generator.h"
+#include "shmthread.h"
+#include "hubthread.h"
+#include "statictunnel.h"
+#include "eventloop.h"
+#include "realtime.h"
 #include "framebuffer.h"
+#include "stats.h"
 #include "logging.h"
 #include "csvmapparser.h"
 #include "make_unique.h"
@@ -66,6 +73,31 @@ void printUsage() {
   std::cout << "\t -t timeout \t\t buffer timeout for can messages (us), default: 100000" << std::endl;
   std::cout << "\t -T table.csv \t\t path to csv with individual timeouts" << std::endl;
   std::cout << "\t -s           \t\t enable frame sorting" << std::endl;
+  std::cout << "\t -m NAME \t\t publish statistics in shared memory /dev/shm/NAME" << std::endl;
+  std::cout << "\t -b BITRATE[:DBITRATE] \t bitrate(s) for the bus load, default: read from netlink" << std::endl;
+  std::cout << "\t -a PERCENT \t\t bus load alarm threshold, 0 disables it, default: 80" << std::endl;
+  std::cout << "\t -p ID[:RATE] \t\t reserve ID for latency probes, send RATE probes/s" << std::endl;
+  std::cout << "\t -E WINDOW \t\t tunnel error frames, collapse those within WINDOW us, 0 passes all" << std::endl;
+  std::cout << "\t -Q LIMIT \t\t write frames to the CAN bus in the order of their priority," << std::endl;
+  std::cout << "\t\t\t with at most about LIMIT frames in the kernel, 0 for no limit" << std::endl;
+  std::cout << "\t -W           \t\t measure the time from write() until frames are sent on the CAN bus" << std::endl;
+  std::cout << "\t -Y           \t\t let the kernel of the remote send cyclic frames (CAN_BCM)," << std::endl;
+  std::cout << "\t\t\t needed on both ends, no -s or -Q" << std::endl;
+  std::cout << "\t -g RULES \t\t rewrite or drop the frames read from the CAN bus by the RULES in a file" << std::endl;
+  std::cout << "\t -G PROFILE[:SCALE] \t generate traffic from PROFILE instead of using a CAN interface," << std::endl;
+  std::cout << "\t\t\t all rates are multiplied with SCALE" << std::endl;
+  std::cout << "\t -X INTERFACE \t\t bridge to a second can interface instead of a remote," << std::endl;
+  std::cout << "\t\t\t no -E, -Y, probes, sorting or SCTP" << std::endl;
+  std::cout << "\t -H TABLE \t\t act as a hub for the sites in TABLE and route frames between them," << std::endl;
+  std::cout << "\t\t\t see README.md, no -E, -Y, probes, sorting, SCTP, -F or -X" << std::endl;
+  std::cout << "\t -B NAME \t\t serve local clients through the shared memory bus /dev/shm/NAME" << std::endl;
+  std::cout << "\t\t\t instead of using a CAN interface, see cannelloni_client.h" << std::endl;
+  std::cout << "\t -e           \t\t serve CAN and UDP from a single event loop thread" << std::endl;
+  std::cout << "\t -F           \t\t serve CAN and UDP from a single thread with the tunnel composed at" << std::endl;
+  std::cout << "\t\t\t compile time, no SCTP, sorting, probes, error frames or bus load estimation" << std::endl;
+  std::cout << "\t -A THREAD=CPUS[:POLICY[:PRIO]] pin THREAD (can, net or loop) to CPUS, e.g. 0,2-3," << std::endl;
+  std::cout << "\t\t\t and set its POLICY (other, fifo, rr) and priority" << std::endl;
+  std::cout << "\t -M           \t\t lock all memory and prefault the thread stacks" << std::endl;
   std::cout << "\t -d [cubt]\t\t enable debug, can be any of these: " << std::endl;
   std::cout << "\t\t\t c : enable debugging of can frames" << std::endl;
 #ifdef SCTP_SUPPORT
@@ -77,7 +109,42 @@ void printUsage() {
   std::cout << "\t\t\t t : enable debugging of internal timers" << std::endl;
   std::cout << "\t -h      \t\t display this help text" << std::endl;
   std::cout << "Mandatory options:" << std::endl;
-  std::cout << "\t -R IP   \t\t remote IP" << std::endl;
+  std::cout << "\t -R IP   \t\t remote IP, unless bridging with -X or acting as a hub with -H" << std::endl;
+}
+
+/* Blocks until SIGTERM or SIGINT arrives on signalFD */
+static void waitForSignal(int signalFD) {
+  struct signalfd_siginfo signalFdInfo;
+  while (1) {
+    ssize_t receivedBytes = read(signalFD, &signalFdInfo, sizeof(struct signalfd_siginfo));
+    if (receivedBytes != sizeof(struct signalfd_siginfo)) {
+      lerror << "signalfd read error" << std::endl;
+      break;
+    }
+    /* Currently we only receive SIGTERM and SIGINT but we check nonetheless */
+    if (signalFdInfo.ssi_signo == SIGTERM || signalFdInfo.ssi_signo == SIGINT) {
+      linfo << "Received signal " << signalFdInfo.ssi_signo << ": Exiting" << std::endl;
+      break;
+    }
+  }
+}
+
+/* Composes the tunnel of -F for the frame mode of the CAN interface */
+template <class Mode>
+static std::unique_ptr<Thread> createStaticTunnel(const struct debugOptions_t &debugOptions,
+                                                  const std::string &canInterface,
+                                                  const UDPTransport &transport,
+                                                  uint32_t timeout,
+                                                  const std::map<uint32_t, uint32_t> &timeoutTable,
+                                                  const std::string &rulesFile,
+                                                  TunnelStats *stats) {
+  auto tunnel = std::make_unique<UDPStaticTunnel<Mode>>(debugOptions, canInterface, transport);
+  tunnel->batching().setTimeout(timeout);
+  tunnel->batching().setTimeoutTable(timeoutTable);
+  tunnel->setStatistics(stats);
+  if (!rulesFile.empty() && !tunnel->loadRules(rulesFile))
+    return std::unique_ptr<Thread>();
+  return std::unique_ptr<Thread>(tunnel.release());
 }
 
 int main(int argc, char** argv) {
@@ -85,6 +152,11 @@ int main(int argc, char** argv) {
   bool remoteIPSupplied = false;
   bool sortUDP = false;
   bool useSCTP = false;
+  bool useEventLoop = false;
+  bool useStaticTunnel = false;
+  bool lockMemoryPages = false;
+  /* Key is the thread (can, net or loop) */
+  std::map<std::string, SchedulingOptions> scheduling;
 #ifdef SCTP_SUPPORT
   SCTPThreadRole sctpRole = CLIENT;
 #endif
@@ -95,15 +167,34 @@ int main(int argc, char** argv) {
   std::string canInterface = "vcan0";
   uint32_t bufferTimeout = 100000;
   std::string timeoutTableFile;
+  std::string statsName;
+  uint32_t bitrate = 0;
+  uint32_t dataBitrate = 0;
+  uint32_t busLoadThreshold = 80;
+  bool probe = false;
+  canid_t probeId = 0;
+  uint32_t probeRate = 0;
+  bool errorFrames = false;
+  uint64_t errorWindow = 0;
+  bool priorityTx = false;
+  uint32_t txLimit = 0;
+  bool txCompletion = false;
+  bool cyclicOffload = false;
+  std::string profileFile;
+  double profileScale = 1.0;
+  std::string busName;
+  std::string bridgeInterface;
+  std::string hubTableFile;
+  std::string rulesFile;
   /* Key is CAN ID, Value is timeout in us */
   std::map<uint32_t, uint32_t> timeoutTable;
 
   struct debugOptions_t debugOptions = { /* can */ 0, /* udp */ 0, /* buffer */ 0, /* timer */ 0 };
 
 #ifdef SCTP_SUPPORT
-  const std::string argument_options = "S:l:L:r:R:I:t:T:d:hs";
+  const std::string argument_options = "S:l:L:r:R:I:t:T:d:hsm:b:a:p:E:Q:WYG:eFA:MB:X:H:g:";
 #else
-  const std::string argument_options = "Sl:L:r:R:I:t:T:d:hs";
+  const std::string argument_options = "Sl:L:r:R:I:t:T:d:hsm:b:a:p:E:Q:WYG:eFA:MB:X:H:g:";
 #endif
 
   while ((opt = getopt(argc, argv, argument_options.c_str())) != -1) {
@@ -174,13 +265,99 @@ int main(int argc, char** argv) {
       case 's':
         sortUDP = true;
         break;
+      case 'm':
+        statsName = std::string(optarg);
+        break;
+      case 'b':
+      {
+        char *end;
+        bitrate = strtoul(optarg, &end, 10);
+        if (*end == ':')
+          dataBitrate = strtoul(end+1, NULL, 10);
+        break;
+      }
+      case 'a':
+        busLoadThreshold = strtoul(optarg, NULL, 10);
+        break;
+      case 'p':
+      {
+        char *end;
+        probe = true;
+        probeId = strtoul(optarg, &end, 0);
+        if (probeId > CAN_SFF_MASK)
+          probeId = (probeId & CAN_EFF_MASK) | CAN_EFF_FLAG;
+        if (*end == ':')
+          probeRate = strtoul(end+1, NULL, 10);
+        break;
+      }
+      case 'E':
+        errorFrames = true;
+        errorWindow = strtoull(optarg, NULL, 10);
+        break;
+      case 'Q':
+        priorityTx = true;
+        txLimit = strtoul(optarg, NULL, 10);
+        break;
+      case 'W':
+        txCompletion = true;
+        break;
+      case 'Y':
+        cyclicOffload = true;
+        break;
+      case 'G':
+      {
+        profileFile = std::string(optarg);
+        size_t pos = profileFile.rfind(':');
+        if (pos != std::string::npos) {
+          profileScale = strtod(profileFile.c_str() + pos + 1, NULL);
+          profileFile.erase(pos);
+        }
+        break;
+      }
+      case 'B':
+        busName = std::string(optarg);
+        break;
+      case 'X':
+        bridgeInterface = std::string(optarg);
+        break;
+      case 'H':
+        hubTableFile = std::string(optarg);
+        break;
+      case 'g':
+        rulesFile = std::string(optarg);
+        break;
+      case 'e':
+        useEventLoop = true;
+        break;
+      case 'F':
+        useStaticTunnel = true;
+        break;
+      case 'A':
+      {
+        std::string spec(optarg);
+        size_t pos = spec.find('=');
+        std::string thread = spec.substr(0, pos);
+        SchedulingOptions options;
+        if (pos == std::string::npos || (thread != "can" && thread != "net" && thread != "loop") ||
+            !parseSchedulingOptions(spec.substr(pos + 1), options)) {
+          std::cout << "Usage Error: " << std::endl
+                    << "Invalid scheduling options " << optarg << std::endl << std::endl;
+          printUsage();
+          return -1;
+        }
+        scheduling[thread] = options;
+        break;
+      }
+      case 'M':
+        lockMemoryPages = true;
+        break;
       default:
         printUsage();
         return -1;
     }
   }
 #ifdef SCTP_SUPPORT
-  if (!remoteIPSupplied && !(useSCTP && sctpRole == SERVER)) {
+  if (!remoteIPSupplied && !(useSCTP && sctpRole == SERVER) && bridgeInterface.empty() && hubTableFile.empty()) {
 
     std::cout << "Usage Error: " << std::endl
               << "Remote IP not supplied" << std::endl
@@ -189,7 +366,7 @@ int main(int argc, char** argv) {
     return -1;
   }
 #else
-  if (!remoteIPSupplied) {
+  if (!remoteIPSupplied && bridgeInterface.empty() && hubTableFile.empty()) {
     std::cout << "Usage Error: " << std::endl
               << "Remote IP not supplied" << std::endl
                                           << std::endl;
@@ -204,6 +381,69 @@ int main(int argc, char** argv) {
     printUsage();
     return -1;
   }
+  if (!busName.empty() && !profileFile.empty()) {
+    std::cout << "Usage Error: " << std::endl
+              << "-B and -G both replace the CAN interface" << std::endl
+                                                            << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (useEventLoop && (useSCTP || !profileFile.empty() || !busName.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "The event loop only supports UDP and CAN interfaces" << std::endl
+                                                                       << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  if (errorFrames && (!profileFile.empty() || !busName.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "-E needs a CAN interface" << std::endl
+                                            << std::endl;
+    printUsage();
+    return -1;
+  }
+  if ((probe || priorityTx || txCompletion || cyclicOffload || !rulesFile.empty()) &&
+      (!profileFile.empty() || !busName.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "Probes, -Q, -W, -Y and -g need a CAN interface" << std::endl
+                                                                  << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (cyclicOffload && (sortUDP || priorityTx)) {
+    std::cout << "Usage Error: " << std::endl
+              << "-Y needs the frames in order, it cannot be used with -s or -Q" << std::endl
+                                                                                 << std::endl;
+    printUsage();
+    return -1;
+  }
+  if (useStaticTunnel && (useSCTP || useEventLoop || sortUDP || probe || errorFrames || priorityTx ||
+                          txCompletion || cyclicOffload || !profileFile.empty() || !busName.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "-F only supports UDP and CAN interfaces, without sorting, probes, -E, -Q, -W and -Y"
+              << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  if (!bridgeInterface.empty() && (useSCTP || useStaticTunnel || sortUDP || probe || errorFrames ||
+                                   cyclicOffload || !profileFile.empty() || !busName.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "-X bridges two CAN interfaces, without SCTP, -F, sorting, probes, -E and -Y"
+              << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
+
+  if (!hubTableFile.empty() && (useSCTP || useStaticTunnel || sortUDP || probe || errorFrames ||
+                                 cyclicOffload || !bridgeInterface.empty())) {
+    std::cout << "Usage Error: " << std::endl
+              << "-H only supports UDP, without -F, -X, sorting, probes, -E and -Y"
+              << std::endl << std::endl;
+    printUsage();
+    return -1;
+  }
 
   if (!timeoutTableFile.empty()) {
     CSVMapParser<uint32_t,uint32_t> mapParser;
@@ -243,7 +483,6 @@ int main(int argc, char** argv) {
   /* We use the signalfd() system call to create a
    * file descriptor to receive signals */
   sigset_t signalMask;
-  struct signalfd_siginfo signalFdInfo;
   int signalFD;
 
   /* Prepare the signalMask */
@@ -273,42 +512,165 @@ int main(int argc, char** argv) {
   localAddr.sin_port = htons(localPort);
   inet_pton(AF_INET, localIP, &localAddr.sin_addr);
 
-  std::unique_ptr<UDPThread> netThread;
-  if (useSCTP) {
+  std::vector<HubSite> hubSites;
+  RouteTable hubRoutes;
+  if (!hubTableFile.empty() && !loadHubTable(hubTableFile, remotePort, hubSites, hubRoutes))
+    return -1;
+
+  if (lockMemoryPages && !lockMemory())
+    return -1;
+
+  /* Without a name, the statistics are only kept in private memory */
+  Statistics statistics;
+  if (!statistics.open(statsName)) {
+    lerror << "Could not create statistics region." << std::endl;
+    return -1;
+  }
+  std::string tunnelName = canInterface;
+  if (!profileFile.empty())
+    tunnelName = "generator";
+  else if (!busName.empty())
+    tunnelName = "bus:" + busName;
+  TunnelStats *tunnelStats = statistics.addTunnel(tunnelName);
+  /* The second interface of a bridge publishes its CAN side on its own */
+  TunnelStats *bridgeStats = tunnelStats;
+  if (!bridgeInterface.empty())
+    bridgeStats = statistics.addTunnel(bridgeInterface);
+
+  if (useStaticTunnel) {
+    UDPTransport transport(remoteAddr, localAddr, true);
+    std::unique_ptr<Thread> tunnel;
+    if (staticFrameMode(canInterface) == FRAME_MODE_FD)
+      tunnel = createStaticTunnel<FDFrames>(debugOptions, canInterface, transport,
+                                            bufferTimeout, timeoutTable, rulesFile, tunnelStats);
+    else
+      tunnel = createStaticTunnel<ClassicFrames>(debugOptions, canInterface, transport,
+                                                 bufferTimeout, timeoutTable, rulesFile, tunnelStats);
+    if (!tunnel)
+      return -1;
+    tunnel->setScheduling("StaticTunnel", scheduling["loop"]);
+    if (tunnel->start() < 0)
+      return -1;
+    waitForSignal(signalFD);
+    tunnel->stop();
+    tunnel->join();
+    close(signalFD);
+    return 0;
+  }
+
+  auto createCANThread = [&](const std::string &interface) {
+    auto thread = std::make_unique<CANThread>(debugOptions, interface);
+    thread->setBitrates(bitrate, dataBitrate);
+    thread->setBusLoadThreshold(busLoadThreshold);
+    if (probe)
+      thread->setProbe(probeId, probeRate);
+    if (errorFrames)
+      thread->setErrorFrames(errorWindow);
+    if (priorityTx)
+      thread->setPriorityTx(txLimit);
+    if (txCompletion)
+      thread->setTxCompletion();
+    if (cyclicOffload)
+      thread->setCyclicOffload();
+    if (!rulesFile.empty() && !thread->loadRules(rulesFile))
+      thread.reset();
+    return thread;
+  };
+
+  /* With -X, the "network" side is the CANThread of the second interface
+   * and both CANThreads hand their frames directly to each other */
+  std::unique_ptr<ConnectionThread> netThread;
+  std::string netThreadName = "UDPThread";
+  SchedulingOptions netScheduling = scheduling["net"];
+  if (!bridgeInterface.empty()) {
+    netThread = createCANThread(bridgeInterface);
+    if (!netThread)
+      return -1;
+    netThreadName = "CANThread";
+    netScheduling = scheduling["can"];
+  } else if (!hubTableFile.empty()) {
+    auto hubThread = std::make_unique<HubThread>(debugOptions, localAddr, hubSites, hubRoutes);
+    hubThread->setTimeout(bufferTimeout);
+    hubThread->setTimeoutTable(timeoutTable);
+    /* Sites beyond the slots of the statistics region are only counted in the total */
+    for (size_t i = 0; i < hubSites.size(); i++)
+      hubThread->setSiteStatistics(i, statistics.addTunnel(hubSites[i].name));
+    netThread = std::move(hubThread);
+    netThreadName = "HubThread";
+  } else {
+    std::unique_ptr<UDPThread> udpThread;
+    if (useSCTP) {
 #ifdef SCTP_SUPPORT
-    netThread = std::make_unique<SCTPThread>(debugOptions, remoteAddr, localAddr, sortUDP, remoteIPSupplied, sctpRole);
+      udpThread = std::make_unique<SCTPThread>(debugOptions, remoteAddr, localAddr, sortUDP, remoteIPSupplied, sctpRole);
 #endif
+    } else {
+      udpThread = std::make_unique<UDPThread>(debugOptions, remoteAddr, localAddr, sortUDP, true);
+    }
+    udpThread->setTimeoutTable(timeoutTable);
+    udpThread->setTimeout(bufferTimeout);
+    netThread = std::move(udpThread);
+  }
+  std::unique_ptr<ConnectionThread> canThread;
+  /* CANThread and the network threads only look at the bytes of a frame
+   * that go on the wire, so both buffers can use classic slots */
+  bool classicSlots = false;
+  if (!busName.empty()) {
+    canThread = std::make_unique<ShmThread>(debugOptions, busName);
+  } else if (profileFile.empty()) {
+    canThread = createCANThread(canInterface);
+    if (!canThread)
+      return -1;
+    classicSlots = true;
   } else {
-    netThread = std::make_unique<UDPThread>(debugOptions, remoteAddr, localAddr, sortUDP, true);
+    auto thread = std::make_unique<GeneratorThread>(debugOptions);
+    if (!thread->loadProfile(profileFile, profileScale))
+      return -1;
+    thread->setBitrates(bitrate, dataBitrate);
+    canThread = std::move(thread);
   }
-  auto canThread = std::make_unique<CANThread>(debugOptions, canInterface);
   auto netFrameBuffer = std::make_unique<FrameBuffer>(1000,16000);
   auto canFrameBuffer = std::make_unique<FrameBuffer>(1000,16000);
+  netFrameBuffer->setClassicSlots(classicSlots);
+  canFrameBuffer->setClassicSlots(classicSlots);
   netThread->setPeerThread(canThread.get());
   netThread->setFrameBuffer(netFrameBuffer.get());
-  netThread->setTimeoutTable(timeoutTable);
   canThread->setPeerThread(netThread.get());
   canThread->setFrameBuffer(canFrameBuffer.get());
-  netThread->setTimeout(bufferTimeout);
-  netThread->start();
-  canThread->start();
-  while (1) {
-    ssize_t receivedBytes = read(signalFD, &signalFdInfo, sizeof(struct signalfd_siginfo));
-    if (receivedBytes != sizeof(struct signalfd_siginfo)) {
-      lerror << "signalfd read error" << std::endl;
-      break;
-    }
-    /* Currently we only receive SIGTERM and SIGINT but we check nonetheless */
-    if (signalFdInfo.ssi_signo == SIGTERM || signalFdInfo.ssi_signo == SIGINT) {
-      linfo << "Received signal " << signalFdInfo.ssi_signo << ": Exiting" << std::endl;
-      break;
+  netThread->setStatistics(bridgeStats);
+  canThread->setStatistics(tunnelStats);
+  EventLoop eventLoop;
+  if (useEventLoop) {
+    /* Both sides run on the thread of eventLoop, the sockets get its CPU hint */
+    eventLoop.setScheduling("EventLoop", scheduling["loop"]);
+    netThread->setScheduling(netThreadName, scheduling["loop"]);
+    canThread->setScheduling("CANThread", scheduling["loop"]);
+    netFrameBuffer->setLocking(false);
+    canFrameBuffer->setLocking(false);
+    if (netThread->attach(&eventLoop) < 0 || canThread->attach(&eventLoop) < 0)
+      return -1;
+    eventLoop.start();
+  } else {
+    netThread->setScheduling(netThreadName, netScheduling);
+    canThread->setScheduling("CANThread", scheduling["can"]);
+    if (netThread->start() < 0)
+      return -1;
+    if (canThread->start() < 0) {
+      netThread->stop();
+      netThread->join();
+      return -1;
     }
   }
+  waitForSignal(signalFD);
 
-  netThread->stop();
-  netThread->join();
-  canThread->stop();
-  canThread->join();
+  if (useEventLoop) {
+    eventLoop.stop();
+    eventLoop.join();
+  } else {
+    netThread->stop();
+    netThread->join();
+    canThread->stop();
+    canThread->join();
+  }
 
   /* Clear/free pools once all threads are joined */
   netFrameBuffer->clearPool();
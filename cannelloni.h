@@ -35,6 +35,30 @@ namespace cannelloni {
 
 enum op_codes {DATA, ACK, NACK};
 
+/*
+ * Set in the error class bits of an error frame that summarizes the
+ * error frames cannelloni has collapsed, see doc/udp_format.md
+ */
+#define CANNELLONI_ERR_SUMMARY   0x10000000U
+
+/*
+ * Set together with CAN_ERR_FLAG in can_id of a cyclic offload record,
+ * see doc/udp_format.md
+ */
+#define CANNELLONI_CYCLIC_RECORD 0x08000000U
+
+/*
+ * Set together with CANNELLONI_CYCLIC_RECORD in the answer of a receiver
+ * that runs the job of a cyclic frame, see doc/udp_format.md
+ */
+#define CANNELLONI_CYCLIC_ACK    0x04000000U
+
+/*
+ * The remaining bits of can_id of a cyclic setup record, the time in us
+ * at which the sender received the frame, see doc/udp_format.md
+ */
+#define CANNELLONI_CYCLIC_TIME   0x03FFFFFFU
+
 struct __attribute__((__packed__)) CannelloniDataPacket {
   /* Version */
   uint8_t version;
@@ -75,4 +99,41 @@ inline uint8_t canfd_len(const struct canfd_frame *f) {
   return f->len & ~(CANFD_FRAME);
 }
 
+/* Data bytes of a frame in a packet, RTR frames have none */
+inline uint8_t canfd_wire_len(const struct canfd_frame *f) {
+  return (f->can_id & CAN_RTR_FLAG) ? 0 : canfd_len(f);
+}
+
+/* An error summary or cyclic record, only a remote cannelloni understands it */
+inline bool canfd_is_record(const struct canfd_frame *f) {
+  return (f->can_id & CAN_ERR_FLAG) &&
+         (f->can_id & (CANNELLONI_ERR_SUMMARY | CANNELLONI_CYCLIC_RECORD));
+}
+
+/* Bytes a frame takes in a packet, including the flags of CAN FD frames */
+inline uint16_t canfd_wire_size(const struct canfd_frame *f) {
+  return CANNELLONI_FRAME_BASE_SIZE + (f->len >> 7) + canfd_wire_len(f);
+}
+
+/*
+ * Frame modes the hot paths are specialized for. A connection whose
+ * interface only carries CAN 2.0 frames runs in FRAME_MODE_CLASSIC:
+ * every frame fits into CAN_MTU and the codec never deals with flags.
+ * FRAME_MODE_FD handles any mix. The traits are used as template
+ * arguments, see parseFrames() and buildPacket().
+ */
+enum FrameMode {FRAME_MODE_FD, FRAME_MODE_CLASSIC};
+
+struct FDFrames {
+  static const FrameMode mode = FRAME_MODE_FD;
+  static const bool fd = true;
+  static const uint8_t maxLen = CANFD_MAX_DLEN;
+};
+
+struct ClassicFrames {
+  static const FrameMode mode = FRAME_MODE_CLASSIC;
+  static const bool fd = false;
+  static const uint8_t maxLen = CAN_MAX_DLEN;
+};
+
 }
@@ -0,0 +1,79 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <linux/can.h>
+
+/*
+ * Client of the shared memory bus of a running cannelloni (-S NAME),
+ * see shmbus.h for the Design Notes. A client handle must only be used
+ * by one thread at a time.
+ *
+ * As on the wire, a CAN FD frame is marked by CANNELLONI_CANFD_FRAME in
+ * len, a classic frame has it cleared.
+ */
+
+#ifndef CANNELLONI_CANFD_FRAME
+#define CANNELLONI_CANFD_FRAME 0x80
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cannelloni_client cannelloni_client;
+
+/* Connects to the bus NAME, returns NULL if it does not exist or is full */
+cannelloni_client* cannelloni_client_open(const char *name);
+void cannelloni_client_close(cannelloni_client *client);
+
+/*
+ * Receive only frames with (can_id & mask) == (id & mask) for any of
+ * the subscriptions, like CAN_RAW_FILTER. Without a subscription, all
+ * frames are received. Returns -1 if the table is full.
+ */
+int cannelloni_client_subscribe(cannelloni_client *client, canid_t id, canid_t mask);
+/* Removes all subscriptions */
+void cannelloni_client_unsubscribe_all(cannelloni_client *client);
+
+/*
+ * Sends frame to the remote and to all other clients, returns -1 if the
+ * frame is invalid, the ring is full or cannelloni has shut down
+ */
+int cannelloni_client_send(cannelloni_client *client, const struct canfd_frame *frame);
+
+/* Takes a frame from the ring, returns 1 on success, 0 if it is empty */
+int cannelloni_client_receive(cannelloni_client *client, struct canfd_frame *frame);
+
+/*
+ * Sleeps until a frame can be received, at most timeout_ms or forever
+ * if it is negative. Returns 1 if a frame is available, 0 on timeout
+ * and -1 if cannelloni has shut down.
+ */
+int cannelloni_client_wait(cannelloni_client *client, int timeout_ms);
+
+/* Frames cannelloni dropped because the ring of this client was full */
+uint64_t cannelloni_client_dropped(cannelloni_client *client);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,108 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <linux/can.h>
+
+/*
+ * C interface of libcannelloni, see tunnel.h for the C++ interface
+ * and the Design Notes.
+ *
+ * Frames are exchanged as struct canfd_frame. As on the wire, a CAN FD
+ * frame is marked by CANNELLONI_CANFD_FRAME in len, a classic frame has
+ * it cleared.
+ */
+
+#define CANNELLONI_TUNNEL_API_VERSION 1
+#define CANNELLONI_CANFD_FRAME 0x80
+
+/* libcannelloni is built with hidden visibility, this interface is all it exports */
+#define CANNELLONI_TUNNEL_EXPORT __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cannelloni_tunnel cannelloni_tunnel;
+
+struct cannelloni_tunnel_config {
+  /* IPv4 address and port to listen on, default 0.0.0.0:20000 */
+  const char *local_address;
+  uint16_t local_port;
+  /* IPv4 address and port of the remote, default 127.0.0.1:20000 */
+  const char *remote_address;
+  uint16_t remote_port;
+  /* Buffer timeout in us, default 100000 */
+  uint32_t timeout;
+  /* Sort frames by ID before sending, default 0 */
+  int sort;
+  /* Drop packets from other hosts than the remote, default 1 */
+  int check_peer;
+};
+
+/* Called in the network thread for every received frame */
+typedef void (*cannelloni_receive_fn)(const struct canfd_frame *frame, void *user);
+
+/* Fills config with the defaults */
+CANNELLONI_TUNNEL_EXPORT void cannelloni_tunnel_config_init(struct cannelloni_tunnel_config *config);
+
+/* The strings in config are copied, returns NULL on error */
+CANNELLONI_TUNNEL_EXPORT cannelloni_tunnel* cannelloni_tunnel_create(
+    const struct cannelloni_tunnel_config *config);
+CANNELLONI_TUNNEL_EXPORT void cannelloni_tunnel_destroy(cannelloni_tunnel *tunnel);
+
+/*
+ * Delivers received frames to fn instead of the receive queue,
+ * must be called before cannelloni_tunnel_start
+ */
+CANNELLONI_TUNNEL_EXPORT void cannelloni_tunnel_set_receive_handler(cannelloni_tunnel *tunnel,
+                                                                    cannelloni_receive_fn fn,
+                                                                    void *user);
+
+/* Opens the socket and starts the network thread, returns -1 on error */
+CANNELLONI_TUNNEL_EXPORT int cannelloni_tunnel_start(cannelloni_tunnel *tunnel);
+CANNELLONI_TUNNEL_EXPORT void cannelloni_tunnel_stop(cannelloni_tunnel *tunnel);
+
+/*
+ * Queues frame for the remote, must not be called from more than one
+ * thread at a time. Returns -1 if the frame is invalid, the tunnel is
+ * not running or its buffer is full.
+ */
+CANNELLONI_TUNNEL_EXPORT int cannelloni_tunnel_send(cannelloni_tunnel *tunnel,
+                                                    const struct canfd_frame *frame);
+
+/* Takes a frame from the receive queue, returns 1 on success, 0 if empty */
+CANNELLONI_TUNNEL_EXPORT int cannelloni_tunnel_receive(cannelloni_tunnel *tunnel,
+                                                       struct canfd_frame *frame);
+
+/*
+ * Becomes readable when the receive queue was empty and a frame has
+ * arrived, call cannelloni_tunnel_receive until it returns 0 afterwards
+ */
+CANNELLONI_TUNNEL_EXPORT int cannelloni_tunnel_receive_fd(cannelloni_tunnel *tunnel);
+
+/* Frames dropped because the receive queue was full */
+CANNELLONI_TUNNEL_EXPORT uint64_t cannelloni_tunnel_receive_dropped(cannelloni_tunnel *tunnel);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,6 +20,8 @@
 
 #include <string.h>
 
+#include <algorithm>
+
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -35,6 +37,9 @@
 #include "canthread.h"
 #include "cannelloni.h"
 #include "logging.h"
+#include "iobackend.h"
+#include "sockets.h"
+#include "eventloop.h"
 
 using namespace cannelloni;
 
@@ -45,186 +50,636 @@ CANThread::CANThread(const struct debugOptions_t &debugOptions,
   , m_canInterfaceName(canInterfaceName)
   , m_rxCount(0)
   , m_txCount(0)
+  , m_rxErrorCount(0)
+  , m_txErrorCount(0)
+  , m_probesSent(0)
+  , m_probesAnswered(0)
+  , m_probesReplied(0)
   , m_canfd(false)
+  , m_bitrate(0)
+  , m_dataBitrate(0)
+  , m_busLoadThreshold(0)
+  , m_busLoadAlarm(false)
+  , m_busLoadAlarmCount(0)
+  , m_errorFrames(false)
+  , m_remoteErrorCount(0)
+  , m_remoteSummaryCount(0)
+  , m_remoteCyclicCount(0)
+  , m_priorityTx(false)
+  , m_txLimit(0)
+  , m_txFlags(0)
+  , m_txCompletion(false)
+  , m_cyclic(false)
+  , m_useRules(false)
 {
   memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
+  memset(m_completionTimes, 0, sizeof(m_completionTimes));
 }
 
 CANThread::~CANThread() {}
 
 int CANThread::start() {
-  struct timeval timeout;
-  struct ifreq canInterface;
-  uint32_t canfd_on = 1;
-  /* Setup our socket */
-  m_canSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-  if (m_canSocket < 0) {
-    lerror << "socket Error" << std::endl;
+  if (setup() < 0)
     return -1;
-  }
-  /* Determine the index of m_canInterfaceName */
-  strcpy(canInterface.ifr_name, m_canInterfaceName.c_str());
-  if (ioctl(m_canSocket, SIOCGIFINDEX, &canInterface) < 0) {
-    lerror << "Could get index of interface >" << m_canInterfaceName << "<" << std::endl;
+  return Thread::start();
+}
+
+int CANThread::attach(EventLoop *loop) {
+  if (setup() < 0)
     return -1;
-  }
-  struct sockaddr_can localAddr;
-  memset(&localAddr, 0, sizeof(localAddr));
-  localAddr.can_ifindex = canInterface.ifr_ifindex;
-  localAddr.can_family = AF_CAN;
-  /* Check MTU of interface */
-  if (ioctl(m_canSocket, SIOCGIFMTU, &canInterface) < 0) {
-    lerror << "Could get MTU of interface >" << m_canInterfaceName << "<" <<  std::endl;
-  }
-  /* Check whether CAN_FD is possible */
-  if (canInterface.ifr_mtu == CANFD_MTU) {
-    /* Try to switch into CAN_FD mode */
-    if (setsockopt(m_canSocket, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on))) {
-      lerror << "Could not enable CAN_FD." << std::endl;
-    } else {
-      m_canfd = true;
-    }
+  m_loop = loop;
+  prepareTimers();
+  if (loop->add(m_canSocket, [this]() { if (!handleSocket()) m_loop->stop(); }) < 0 ||
+      loop->add(m_timer.getFd(), [this]() { handleTimer(); }) < 0 ||
+      loop->add(m_probeTimer.getFd(), [this]() { handleProbeTimer(); }) < 0 ||
+      loop->add(m_errorTimer.getFd(), [this]() { handleErrorTimer(); }) < 0 ||
+      loop->add(m_cyclicTimer.getFd(), [this]() { handleCyclicTimer(); }) < 0 ||
+      loop->add(m_statsTimer.getFd(), [this]() { handleStatsTimer(); }) < 0)
+    return -1;
+  loop->addExitHandler([this]() { teardown(); });
+  linfo << "CANThread attached to the event loop" << std::endl;
+  return 0;
+}
 
-  } else {
-    lerror << "CAN_FD is not supported on >" << m_canInterfaceName << "<" << std::endl;
+int CANThread::setup() {
+  CANSocketOptions options;
+  options.errorFrames = m_errorFrames;
+  options.recvOwnMsgs = m_txCompletion;
+  if (m_txLimit) {
+    /* SIOCOUTQ is not implemented for CAN_RAW, the send buffer is what
+     * bounds the frames of a socket in the kernel. The kernel doubles the
+     * value and does not go below a few frames. */
+    options.sendBuffer = m_txLimit * CAN_TX_FRAME_TRUESIZE / 2;
+    /* A full send buffer must not block the thread */
+    m_txFlags = MSG_DONTWAIT;
   }
-
-  if (bind(m_canSocket, (struct sockaddr *)&localAddr, sizeof(localAddr)) < 0) {
-    lerror << "Could not bind to interface" << std::endl;
+  FrameMode mode;
+  int ifindex;
+  m_canSocket = openCANSocket(m_canInterfaceName, options, mode, ifindex);
+  if (m_canSocket < 0)
+    return -1;
+  m_canfd = mode == FRAME_MODE_FD;
+  m_txCompletion = options.recvOwnMsgs;
+  setFrameMode(mode);
+  setIncomingCPU(m_canSocket);
+  if (m_cyclic && !m_cyclicJobs.open(ifindex))
     return -1;
-  }
-
-  return Thread::start();
-}
 
-void CANThread::stop() {
-  Thread::stop();
-  fireTimer();
+  /* Bitrates supplied by the user take precedence over netlink */
+  uint32_t bitrate = m_bitrate, dataBitrate = m_dataBitrate;
+  if (bitrate == 0 && !io()->readBitrates(m_canInterfaceName, bitrate, dataBitrate)) {
+    linfo << "Bitrate of >" << m_canInterfaceName << "< is unknown, "
+          << "bus load estimation is disabled." << std::endl;
+  }
+  m_busLoad.setBitrates(bitrate, dataBitrate);
+  return 0;
 }
 
 void CANThread::run() {
   fd_set readfds;
-  ssize_t receivedBytes;
-  struct itimerspec ts;
 
   linfo << "CANThread up and running" << std::endl;
-
-  m_timer.adjust(CAN_TIMEOUT, CAN_TIMEOUT);
-
+  prepareTimers();
   while (m_started) {
     /* Prepare readfds */
     FD_ZERO(&readfds);
     FD_SET(m_canSocket, &readfds);
     FD_SET(m_timer.getFd(), &readfds);
+    FD_SET(m_probeTimer.getFd(), &readfds);
+    FD_SET(m_errorTimer.getFd(), &readfds);
+    FD_SET(m_cyclicTimer.getFd(), &readfds);
+    FD_SET(m_statsTimer.getFd(), &readfds);
+    FD_SET(getStopFd(), &readfds);
 
-    int ret = select(std::max(m_canSocket,m_timer.getFd())+1, &readfds, NULL, NULL, NULL);
+    int ret = select(std::max({m_canSocket, m_timer.getFd(), m_probeTimer.getFd(),
+                               m_errorTimer.getFd(), m_cyclicTimer.getFd(), m_statsTimer.getFd(),
+                               getStopFd()})+1,
+                     &readfds, NULL, NULL, NULL);
     if (ret < 0) {
       lerror << "select error" << std::endl;
       break;
     }
-    if (FD_ISSET(m_timer.getFd(), &readfds)) {
-      if (m_timer.read() > 0) {
-        /* We transmit our buffer */
-        if (m_frameBuffer->getFrameBufferSize())
-          transmitBuffer();
-      }
-    }
+    if (FD_ISSET(getStopFd(), &readfds))
+      break;
+    if (FD_ISSET(m_probeTimer.getFd(), &readfds))
+      handleProbeTimer();
+    if (FD_ISSET(m_errorTimer.getFd(), &readfds))
+      handleErrorTimer();
+    if (FD_ISSET(m_cyclicTimer.getFd(), &readfds))
+      handleCyclicTimer();
+    if (FD_ISSET(m_statsTimer.getFd(), &readfds))
+      handleStatsTimer();
+    if (FD_ISSET(m_timer.getFd(), &readfds))
+      handleTimer();
     if (FD_ISSET(m_canSocket, &readfds)) {
-      /* Request frame from frameBuffer */
-      struct canfd_frame *frame = m_peerThread->getFrameBuffer()->requestFrame(true, m_debugOptions.buffer);
+      if (!handleSocket())
+        break;
+    }
+  }
+  teardown();
+}
+
+void CANThread::prepareTimers() {
+  m_timer.adjust(CAN_TIMEOUT, CAN_TIMEOUT);
+  if (m_probe.getRate()) {
+    uint64_t interval = 1000000 / m_probe.getRate();
+    m_probeTimer.adjust(interval, interval);
+  } else {
+    m_probeTimer.disable();
+  }
+  m_errorTimer.disable();
+  if (m_cyclic)
+    m_cyclicTimer.adjust(CYCLIC_CHECK_INTERVAL, CYCLIC_CHECK_INTERVAL);
+  else
+    m_cyclicTimer.disable();
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
+}
+
+void CANThread::handleTimer() {
+  if (m_timer.read() > 0) {
+    /* We transmit our buffer */
+    if (m_frameBuffer->getFrameBufferSize() || !m_txQueue.empty())
+      transmitBuffer();
+  }
+}
+
+void CANThread::handleProbeTimer() {
+  if (m_probeTimer.read() > 0)
+    sendProbe();
+}
+
+void CANThread::handleErrorTimer() {
+  if (m_errorTimer.read() == 0)
+    return;
+  m_errorTimer.disable();
+  struct canfd_frame summary, last;
+  uint32_t collapsed = m_errors.close(&summary, &last);
+  if (collapsed > 1)
+    forwardCopy(&summary);
+  if (collapsed > 0)
+    forwardCopy(&last);
+  if (m_debugOptions.can && collapsed > 1)
+    linfo << "Collapsed " << collapsed - 1 << " error frames" << std::endl;
+}
+
+void CANThread::handleCyclicTimer() {
+  if (m_cyclicTimer.read() == 0)
+    return;
+  uint64_t now = monotonicTime();
+  std::vector<canid_t> stopped;
+  m_cyclicDetector.expire(now, stopped);
+  for (canid_t id : stopped) {
+    sendCyclicRecord(id, 0, now);
+    if (m_debugOptions.can)
+      linfo << "Cyclic frame " << std::hex << id << std::dec << " has stopped" << std::endl;
+  }
+  m_cyclicJobs.expire(now);
+  std::vector<canfd_frame> acks;
+  m_cyclicJobs.start(now, acks);
+  /* The remote stops tunneling the frames only after this */
+  for (const canfd_frame &ack : acks)
+    forwardCopy(&ack);
+}
+
+void CANThread::handleStatsTimer() {
+  if (m_statsTimer.read() > 0)
+    publishStats();
+}
+
+bool CANThread::handleCyclic(const canfd_frame *frame) {
+  /* Sent by a job of the remote, see CyclicJobs */
+  if (m_cyclicJobs.isRemote(frame->can_id))
+    return false;
+  uint32_t period = 0;
+  uint64_t now = monotonicTime();
+  switch (m_cyclicDetector.add(frame, now, period)) {
+    case CYCLIC_SUPPRESS:
+      return false;
+    case CYCLIC_SETUP:
+      sendCyclicRecord(frame->can_id, period, now);
+      break;
+    case CYCLIC_DELETE:
+      sendCyclicRecord(frame->can_id, 0, now);
+      break;
+    case CYCLIC_FORWARD:
+      break;
+  }
+  return true;
+}
+
+bool CANThread::handleRemoteCyclic(const canfd_frame *frame) {
+  if (isCyclicAck(frame)) {
+    m_cyclicDetector.acknowledge(frame, monotonicTime());
+    return true;
+  }
+  canid_t id;
+  uint32_t period;
+  CyclicJobResult result = m_cyclicJobs.handle(frame, monotonicTime(), id, period);
+  if (result == CYCLIC_ACKNOWLEDGE) {
+    struct canfd_frame ack;
+    buildCyclicAck(&ack, id, period);
+    forwardCopy(&ack);
+  }
+  return result != CYCLIC_WRITE;
+}
+
+void CANThread::sendCyclicRecord(canid_t id, uint32_t period, uint64_t time) {
+  struct canfd_frame record;
+  buildCyclicRecord(&record, id, period, time);
+  forwardCopy(&record);
+}
+
+bool CANThread::handleErrorFrame(canfd_frame *frame) {
+  bool opened;
+  bool pass = m_errors.add(frame, monotonicTime(), opened);
+  if (opened)
+    m_errorTimer.adjust(m_errors.getWindow(), m_errors.getWindow());
+  return pass;
+}
+
+void CANThread::forwardCopy(const canfd_frame *frame) {
+  canfd_frame *copy = m_peerThread->getFrameBuffer()->requestFrame(FRAME_CLASS_CLASSIC, false,
+                                                                   m_debugOptions.buffer);
+  if (copy == NULL) {
+    m_rxErrorCount++;
+    return;
+  }
+  memcpy(copy, frame, CAN_MTU);
+  m_peerThread->transmitFrame(copy);
+}
+
+bool CANThread::handleSocket() {
+  FrameBuffer *buffer = m_peerThread->getFrameBuffer();
+  struct canfd_frame *frame;
+  ssize_t receivedBytes;
+  bool echo = false;
+  if (m_canfd || m_txCompletion) {
+    /* The size class is only known after the read, an echo never needs a slot */
+    struct canfd_frame tmp;
+    receivedBytes = readFrame(&tmp, sizeof(tmp), echo);
+    frame = NULL;
+    if (echo && (receivedBytes == CAN_MTU || receivedBytes == CANFD_MTU)) {
+      handleEcho(&tmp);
+      return true;
+    }
+    if (receivedBytes == CAN_MTU || receivedBytes == CANFD_MTU) {
+      frame = buffer->requestFrame(receivedBytes == CANFD_MTU ? FRAME_CLASS_FD : FRAME_CLASS_CLASSIC,
+                                   true, m_debugOptions.buffer);
       if (frame == NULL) {
-        continue;
+        m_rxErrorCount++;
+        return true;
+      }
+      memcpy(frame, &tmp, receivedBytes);
+    }
+  } else {
+    /* Request frame from frameBuffer */
+    frame = buffer->requestFrame(FRAME_CLASS_CLASSIC, true, m_debugOptions.buffer);
+    if (frame == NULL)
+      return true;
+    receivedBytes = io()->recvfrom(m_canSocket, frame, CAN_MTU, 0, NULL, NULL);
+  }
+  if (receivedBytes < 0) {
+    if (frame)
+      buffer->insertFramePool(frame);
+    if (errno == EWOULDBLOCK || errno == EAGAIN) {
+      /* Timeout occured */
+      return true;
+    }
+    lerror << "CAN read error" << std::endl;
+    m_rxErrorCount++;
+    return false;
+  } else if (receivedBytes == CAN_MTU || receivedBytes == CANFD_MTU) {
+    m_rxCount++;
+    /* If it is a CAN FD frame, encode this in len */
+    if (receivedBytes == CANFD_MTU) {
+      frame->len |= CANFD_FRAME;
+      /* A bridged CAN 2.0 interface could not write it */
+      if (m_peerThread->getFrameMode() == FRAME_MODE_CLASSIC) {
+        buffer->insertFramePool(frame);
+        return true;
       }
-      receivedBytes = recv(m_canSocket, frame, sizeof(struct canfd_frame), 0);
-      if (receivedBytes < 0) {
-        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-          /* Timeout occured */
-          m_peerThread->getFrameBuffer()->insertFramePool(frame);
-          continue;
-        } else {
-          m_peerThread->getFrameBuffer()->insertFramePool(frame);
-          lerror << "CAN read error" << std::endl;
-          return;
-        }
-      } else if (receivedBytes == CAN_MTU || receivedBytes == CANFD_MTU) {
-        m_rxCount++;
-        /* If it is a CAN FD frame, encode this in len */
-        if (receivedBytes == CANFD_MTU) {
-          frame->len |= CANFD_FRAME;
-        } else {
-          frame->len &= ~(CANFD_FRAME);
-        }
-        if (m_peerThread != NULL) {
-          m_peerThread->transmitFrame(frame);
-        }
-        if (m_debugOptions.can) {
-          printCANInfo(frame);
-        }
-      } else {
-        lwarn << "Incomplete/Invalid CAN frame" << std::endl;
+    } else {
+      frame->len &= ~(CANFD_FRAME);
+    }
+    /* Error frames are reported by the controller, they never were on the bus */
+    if (__builtin_expect(frame->can_id & CAN_ERR_FLAG, 0)) {
+      if (!handleErrorFrame(frame)) {
+        buffer->insertFramePool(frame);
+        return true;
+      }
+    } else {
+      m_busLoad.addFrame(frame, monotonicTime());
+      if (m_useRules && !m_rules.apply(frame)) {
+        buffer->insertFramePool(frame);
+        return true;
+      }
+      if (m_cyclic && !handleCyclic(frame)) {
+        buffer->insertFramePool(frame);
+        return true;
       }
     }
+    if (m_peerThread != NULL) {
+      m_peerThread->transmitFrame(frame);
+    }
+    if (m_debugOptions.can) {
+      printCANInfo(frame);
+    }
+  } else {
+    lwarn << "Incomplete/Invalid CAN frame" << std::endl;
+    if (frame)
+      buffer->insertFramePool(frame);
+    m_rxErrorCount++;
   }
+  return true;
+}
+
+ssize_t CANThread::readFrame(canfd_frame *frame, size_t len, bool &echo) {
+  if (!m_txCompletion)
+    return io()->recvfrom(m_canSocket, frame, len, 0, NULL, NULL);
+  struct iovec iov;
+  struct msghdr msg;
+  iov.iov_base = frame;
+  iov.iov_len = len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  ssize_t receivedBytes = io()->recvmsg(m_canSocket, &msg, 0);
+  echo = msg.msg_flags & MSG_CONFIRM;
+  return receivedBytes;
+}
+
+void CANThread::handleEcho(const canfd_frame *frame) {
+  uint64_t latency;
+  if (!m_completion.confirm(frame, monotonicTime(), latency))
+    return;
+  m_completionTimes[TxCompletion::priorityClass(frame)].add(latency);
+}
+
+void CANThread::teardown() {
   if (m_debugOptions.buffer) {
     m_frameBuffer->debug();
   }
   linfo << "Shutting down. CAN Transmission Summary: TX: " << m_txCount << " RX: " << m_rxCount << std::endl;
-  shutdown(m_canSocket, SHUT_RDWR);
-  close(m_canSocket);
+  std::vector<canfd_frame*> queued;
+  m_txQueue.clear(queued);
+  for (canfd_frame *frame : queued)
+    m_frameBuffer->insertFramePool(frame);
+  m_cyclicJobs.close();
+  publishStats();
+  io()->shutdown(m_canSocket, SHUT_RDWR);
+  io()->close(m_canSocket);
 }
 
 void CANThread::transmitFrame(canfd_frame* frame) {
   m_frameBuffer->insertFrame(frame);
-  fireTimer();
+  /* In the event loop, we are already on the right thread */
+  if (m_loop)
+    transmitBuffer();
+  else
+    fireTimer();
 }
 
 void CANThread::transmitBuffer() {
-  ssize_t transmittedBytes = 0;
+  if (m_canfd)
+    transmitBuffer<FDFrames>();
+  else
+    transmitBuffer<ClassicFrames>();
+}
+
+template <class Mode>
+void CANThread::transmitBuffer() {
+  if (m_priorityTx) {
+    transmitQueue<Mode>();
+    return;
+  }
   /* Loop here until buffer is empty or we cannot write anymore */
   while(1) {
     canfd_frame *frame = m_frameBuffer->requestBufferFront();
     if (frame == NULL)
       break;
-    /* Check whether we are operating on a CAN FD socket */
-    if (m_canfd) {
-      if (frame->len & CANFD_FRAME) {
-        /* Clear the CANFD_FRAME bit in len */
-        frame->len &= ~(CANFD_FRAME);
-        transmittedBytes = write(m_canSocket, frame, CANFD_MTU);
-      } else {
-        frame->len &= ~(CANFD_FRAME);
-        transmittedBytes = write(m_canSocket, frame, CAN_MTU);
-      }
-    } else {
-      /* First check the length of the frame */
-      if (frame->len & CANFD_FRAME) {
-        /* Something is wrong with the setup */
-        lwarn << "Received a CAN FD for a socket that only supports (CAN 2.0)." << std::endl;
-        frame->len &= ~(CANFD_FRAME);
-        m_frameBuffer->insertFramePool(frame);
-        continue;
-      } else {
-        /* No CAN FD socket, use legacy MTU */
-        transmittedBytes = write(m_canSocket, frame, CAN_MTU);
-      }
-    }
-    if (transmittedBytes == CANFD_MTU || transmittedBytes == CAN_MTU) {
-      /* Put frame back into pool */
-      m_frameBuffer->insertFramePool(frame);
-      m_txCount++;
-    } else {
+    if (!writeFrame<Mode>(frame)) {
       /* Put frame back into buffer */
       m_frameBuffer->returnFrame(frame);
-      /* Revisit this function after 25 us */
-      m_timer.adjust(CAN_TIMEOUT, 25);
-      if (m_debugOptions.can)
-        linfo << "CAN write failed." << std::endl;
+      retryTransmit();
+      break;
+    }
+  }
+}
+
+template <class Mode>
+void CANThread::transmitQueue() {
+  /* Everything that has arrived competes for the next write */
+  while (canfd_frame *frame = m_frameBuffer->requestBufferFront())
+    m_txQueue.push(frame);
+  while (canfd_frame *frame = m_txQueue.top()) {
+    if (!writeFrame<Mode>(frame)) {
+      /* frame stays at the top, unless a higher priority one arrives */
+      retryTransmit();
       break;
     }
+    m_txQueue.pop();
+  }
+}
+
+template <class Mode>
+bool CANThread::writeFrame(canfd_frame *frame) {
+  ssize_t transmittedBytes = 0;
+  if (__builtin_expect(frame->can_id & CAN_ERR_FLAG, 0)) {
+    /* A controller would send it as a data frame with the error class as ID */
+    if (!m_cyclic || !isCyclicRecord(frame))
+      countRemoteErrorFrame(frame);
+    else
+      handleRemoteCyclic(frame);
+    m_frameBuffer->insertFramePool(frame);
+    return true;
+  }
+  if (Mode::fd && (frame->len & CANFD_FRAME)) {
+    /* Clear the CANFD_FRAME bit in len, but keep it for accounting
+     * and for a retry if the write fails */
+    frame->len &= ~(CANFD_FRAME);
+    transmittedBytes = io()->sendto(m_canSocket, frame, CANFD_MTU, m_txFlags, NULL, 0);
+    frame->len |= CANFD_FRAME;
+  } else if (m_cyclic && handleRemoteCyclic(frame)) {
+    /* The payload of a job */
+    m_frameBuffer->insertFramePool(frame);
+    return true;
+  } else if (!Mode::fd && __builtin_expect(frame->len & CANFD_FRAME, 0)) {
+    /* Only possible for frames that arrived before the socket was set up */
+    lwarn << "Received a CAN FD for a socket that only supports (CAN 2.0)." << std::endl;
+    m_frameBuffer->insertFramePool(frame);
+    return true;
+  } else {
+    transmittedBytes = io()->sendto(m_canSocket, frame, CAN_MTU, m_txFlags, NULL, 0);
+  }
+  if (transmittedBytes == CAN_MTU || (Mode::fd && transmittedBytes == CANFD_MTU)) {
+    uint64_t now = monotonicTime();
+    m_busLoad.addFrame(frame, now);
+    if (m_txCompletion)
+      m_completion.sent(frame, now);
+    if (m_probe.isProbe(frame))
+      handleProbe(frame);
+    /* Put frame back into pool */
+    m_frameBuffer->insertFramePool(frame);
+    m_txCount++;
+    return true;
   }
+  return false;
+}
+
+void CANThread::countRemoteErrorFrame(const canfd_frame *frame) {
+  if (isCyclicRecord(frame)) {
+    /* The remote keeps tunneling the frames, they are never acknowledged */
+    if (m_remoteCyclicCount++ == 0)
+      lwarn << "The remote offloads cyclic frames, but -Y is not enabled here." << std::endl;
+  } else if (frame->can_id & CANNELLONI_ERR_SUMMARY) {
+    m_remoteSummaryCount++;
+  } else {
+    m_remoteErrorCount++;
+  }
+  if (m_debugOptions.can)
+    linfo << "Dropped an error frame from the network." << std::endl;
+}
+
+void CANThread::retryTransmit() {
+  /* Revisit transmitBuffer after CAN_RETRY_TIMEOUT us */
+  m_timer.adjust(CAN_TIMEOUT, CAN_RETRY_TIMEOUT);
+  m_txErrorCount++;
+  if (m_debugOptions.can)
+    linfo << "CAN write failed." << std::endl;
 }
 
 void CANThread::fireTimer() {
   /* Instant expiry (so 1us) */
   m_timer.adjust(CAN_TIMEOUT, 1);
 }
+
+void CANThread::setBitrates(uint32_t bitrate, uint32_t dataBitrate) {
+  m_bitrate = bitrate;
+  m_dataBitrate = dataBitrate;
+}
+
+void CANThread::setBusLoadThreshold(uint32_t percent) {
+  m_busLoadThreshold = percent * 100;
+}
+
+void CANThread::setErrorFrames(uint64_t window) {
+  m_errorFrames = true;
+  m_errors.setWindow(window);
+}
+
+void CANThread::setPriorityTx(uint32_t limit) {
+  m_priorityTx = true;
+  m_txLimit = limit;
+}
+
+void CANThread::setTxCompletion() {
+  m_txCompletion = true;
+}
+
+void CANThread::setCyclicOffload() {
+  m_cyclic = true;
+}
+
+bool CANThread::loadRules(const std::string &path) {
+  m_useRules = m_rules.load(path);
+  return m_useRules;
+}
+
+void CANThread::setProbe(canid_t id, uint32_t rate) {
+  m_probe.setId(id);
+  m_probe.setRate(rate);
+}
+
+void CANThread::sendProbe() {
+  canfd_frame *frame = m_peerThread->getFrameBuffer()->requestFrame(false, m_debugOptions.buffer);
+  if (frame == NULL)
+    return;
+  m_probe.buildRequest(frame);
+  m_peerThread->transmitFrame(frame);
+  m_probesSent++;
+}
+
+void CANThread::handleProbe(const canfd_frame *frame) {
+  if (m_probe.isRequest(frame)) {
+    /* The request just hit our bus, answer it */
+    canfd_frame *reply = m_peerThread->getFrameBuffer()->requestFrame(false, m_debugOptions.buffer);
+    if (reply == NULL)
+      return;
+    m_probe.buildReply(frame, reply);
+    m_peerThread->transmitFrame(reply);
+    m_probesReplied++;
+  } else {
+    uint64_t roundTrip;
+    int64_t forward, backward;
+    if (!m_probe.handleReply(frame, roundTrip, forward, backward))
+      return;
+    m_probesAnswered++;
+    CANStats &stats = m_stats->can.beginWrite();
+    stats.probeRoundTrip.add(roundTrip);
+    /* Skip one-way times if the clocks are obviously not synchronized */
+    if (forward >= 0)
+      stats.probeForward.add(forward);
+    if (backward >= 0)
+      stats.probeBackward.add(backward);
+    m_stats->can.endWrite();
+    if (m_debugOptions.timer) {
+      linfo << "Probe round trip " << roundTrip << " us, one-way "
+            << forward << "/" << backward << " us" << std::endl;
+    }
+  }
+}
+
+void CANThread::publishStats() {
+  uint64_t now = monotonicTime();
+  uint32_t load = m_busLoad.getLoad(BUSLOAD_1S, now);
+  if (m_busLoadThreshold && m_busLoad.isEnabled()) {
+    if (!m_busLoadAlarm && load >= m_busLoadThreshold) {
+      m_busLoadAlarm = true;
+      m_busLoadAlarmCount++;
+      lwarn << "Bus load of >" << m_canInterfaceName << "< is "
+            << load / 100 << "%, above " << m_busLoadThreshold / 100 << "%" << std::endl;
+    } else if (m_busLoadAlarm && load < m_busLoadThreshold * 9 / 10) {
+      /* Some hysteresis to prevent a flood of alarms */
+      m_busLoadAlarm = false;
+      linfo << "Bus load of >" << m_canInterfaceName << "< is back to "
+            << load / 100 << "%" << std::endl;
+    }
+  }
+
+  CANStats &stats = m_stats->can.beginWrite();
+  stats.rxFrames = m_rxCount;
+  stats.txFrames = m_txCount;
+  stats.rxErrors = m_rxErrorCount;
+  stats.txErrors = m_txErrorCount;
+  m_frameBuffer->getPoolStats(stats.pool);
+  /* Frames in m_txQueue still wait for the socket */
+  stats.pool.buffered += m_txQueue.size();
+  stats.pool.bufferedBytes += m_txQueue.getBytes();
+  stats.bitrate = m_busLoad.getBitrate();
+  stats.dataBitrate = m_busLoad.getDataBitrate();
+  stats.busLoad[BUSLOAD_100MS] = m_busLoad.getLoad(BUSLOAD_100MS, now);
+  stats.busLoad[BUSLOAD_1S] = load;
+  stats.busLoad[BUSLOAD_10S] = m_busLoad.getLoad(BUSLOAD_10S, now);
+  stats.busLoadThreshold = m_busLoadThreshold;
+  stats.busLoadAlarm = m_busLoadAlarm;
+  stats.busLoadAlarms = m_busLoadAlarmCount;
+  stats.probesSent = m_probesSent;
+  stats.probesAnswered = m_probesAnswered;
+  stats.probesReplied = m_probesReplied;
+  stats.errorFrames = m_errors.getFrameCount();
+  stats.errorFramesSuppressed = m_errors.getSuppressedCount();
+  stats.remoteErrorFrames = m_remoteErrorCount;
+  stats.remoteErrorSummaries = m_remoteSummaryCount;
+  stats.remoteCyclicRecords = m_remoteCyclicCount;
+  if (m_txCompletion) {
+    memcpy(stats.txCompletion, m_completionTimes, sizeof(m_completionTimes));
+    stats.txEchoesUnmatched = m_completion.getUnmatchedCount();
+    stats.txEchoesLost = m_completion.getLostCount();
+  }
+  stats.cyclicOffloaded = m_cyclicDetector.getOffloadedCount();
+  stats.cyclicSuppressed = m_cyclicDetector.getSuppressedCount();
+  stats.cyclicJobs = m_cyclicJobs.getJobCount();
+  stats.ruleRewrites = m_rules.getRewrittenCount();
+  stats.ruleDrops = m_rules.getDroppedCount();
+  m_stats->can.endWrite();
+}
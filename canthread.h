@@ -25,10 +25,21 @@
 
 #include "connection.h"
 #include "timer.h"
+#include "busload.h"
+#include "probe.h"
+#include "errorframes.h"
+#include "txqueue.h"
+#include "txcompletion.h"
+#include "cyclic.h"
+#include "rules.h"
 
 namespace cannelloni {
 
 #define CAN_TIMEOUT 2000000 /* 2 sec in us */
+/* Retry of a failed write in us */
+#define CAN_RETRY_TIMEOUT 25
+/* Send buffer a frame occupies in the kernel until it has been sent, roughly */
+#define CAN_TX_FRAME_TRUESIZE 1024
 
 class CANThread : public ConnectionThread {
   public:
@@ -36,14 +47,71 @@ class CANThread : public ConnectionThread {
               const std::string &canInterfaceName);
     virtual ~CANThread();
     virtual int start();
-    virtual void stop();
     virtual void run();
+    virtual int attach(EventLoop *loop);
 
     virtual void transmitFrame(canfd_frame *frame);
 
+    /* Bitrates used for the bus load if netlink does not report them */
+    void setBitrates(uint32_t bitrate, uint32_t dataBitrate);
+    /* Bus load in percent that raises an alarm, 0 disables it */
+    void setBusLoadThreshold(uint32_t percent);
+    /* Reserves id for latency probes and sends rate requests per second */
+    void setProbe(canid_t id, uint32_t rate);
+    /* Receives error frames and collapses those within window us, 0 passes all */
+    void setErrorFrames(uint64_t window);
+    /* Writes frames in the order of the arbitration (see TxQueue) with at
+     * most about limit frames in the kernel, 0 leaves that to the kernel */
+    void setPriorityTx(uint32_t limit);
+    /* Measures the time from write() until each frame has been sent,
+     * see TxCompletion */
+    void setTxCompletion();
+    /* Offloads cyclic frames to the kernel of the remote, see CyclicDetector */
+    void setCyclicOffload();
+    /* Applies the rules in path to the frames read from the bus, see FrameRules */
+    bool loadRules(const std::string &path);
+
   private:
+    /* Opens and binds the socket */
+    int setup();
+    void prepareTimers();
+    void handleTimer();
+    void handleProbeTimer();
+    void handleErrorTimer();
+    void handleCyclicTimer();
+    void handleStatsTimer();
+    /* Returns false if frame must not be tunneled */
+    bool handleCyclic(const canfd_frame *frame);
+    /* Returns true if frame from the network is a record or the payload of a job */
+    bool handleRemoteCyclic(const canfd_frame *frame);
+    /* Tunnels a setup record for the frame received at time, a period of 0 deletes */
+    void sendCyclicRecord(canid_t id, uint32_t period, uint64_t time);
+    /* Returns false if frame has been collapsed */
+    bool handleErrorFrame(canfd_frame *frame);
+    /* Counts an error frame, summary or cyclic record from the network */
+    void countRemoteErrorFrame(const canfd_frame *frame);
+    /* Returns false on a fatal read error */
+    bool handleSocket();
+    /* recvfrom() on m_canSocket, echo is set for own frames (MSG_CONFIRM) */
+    ssize_t readFrame(canfd_frame *frame, size_t len, bool &echo);
+    void handleEcho(const canfd_frame *frame);
+    void teardown();
+    /* Dispatches to the variant for the frame mode of the socket */
+    void transmitBuffer();
+    template <class Mode>
     void transmitBuffer();
+    template <class Mode>
+    void transmitQueue();
+    /* Returns false if the write failed and frame has to be retried */
+    template <class Mode>
+    bool writeFrame(canfd_frame *frame);
+    void retryTransmit();
     void fireTimer();
+    void sendProbe();
+    /* Passes a copy of frame to the network */
+    void forwardCopy(const canfd_frame *frame);
+    void handleProbe(const canfd_frame *frame);
+    void publishStats();
 
   private:
     struct debugOptions_t m_debugOptions;
@@ -53,9 +121,54 @@ class CANThread : public ConnectionThread {
 
     std::string m_canInterfaceName;
 
+    BusLoad m_busLoad;
+    uint32_t m_bitrate;
+    uint32_t m_dataBitrate;
+    /* in 1/100 percent */
+    uint32_t m_busLoadThreshold;
+    bool m_busLoadAlarm;
+    uint64_t m_busLoadAlarmCount;
+
+    LatencyProbe m_probe;
+    Timer m_probeTimer;
+
+    bool m_errorFrames;
+    ErrorAggregator m_errors;
+    Timer m_errorTimer;
+    /* Error frames, summaries and cyclic records without -Y from the
+     * network, see writeFrame() */
+    uint64_t m_remoteErrorCount;
+    uint64_t m_remoteSummaryCount;
+    uint64_t m_remoteCyclicCount;
+
+    bool m_priorityTx;
+    uint32_t m_txLimit;
+    int m_txFlags;
+    TxQueue m_txQueue;
+
+    bool m_txCompletion;
+    TxCompletion m_completion;
+    StatsHistogram m_completionTimes[CANNELLONI_STATS_PRIORITY_CLASSES];
+
+    bool m_cyclic;
+    CyclicDetector m_cyclicDetector;
+    CyclicJobs m_cyclicJobs;
+    Timer m_cyclicTimer;
+
+    /* Publishes the counters every CANNELLONI_STATS_INTERVAL us */
+    Timer m_statsTimer;
+
+    bool m_useRules;
+    FrameRules m_rules;
+
     /* Performance Counters */
     uint64_t m_rxCount;
     uint64_t m_txCount;
+    uint64_t m_rxErrorCount;
+    uint64_t m_txErrorCount;
+    uint64_t m_probesSent;
+    uint64_t m_probesAnswered;
+    uint64_t m_probesReplied;
 };
 
 }
@@ -0,0 +1,153 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * PacketCodec holds the encoding of a single frame and of the packet
+ * header, see doc/udp_format.md. Everything is inline, so callers that
+ * know the frame mode at compile time get the codec folded into their
+ * loops. parseFrames() and buildPacket() in parser.cpp are built on it,
+ * as is StaticTunnel (statictunnel.h), which uses it as its codec
+ * policy.
+ *
+ * Mode is FDFrames or ClassicFrames. The classic codec never reads or
+ * writes flags and skips CAN FD frames of a packet, see decode().
+ */
+
+enum DecodeResult {
+  /* frame has been filled */
+  DECODE_OK,
+  /* A frame that does not fit the mode was stepped over */
+  DECODE_SKIP,
+  /* The packet is incomplete or the frame header is corrupt */
+  DECODE_ERROR
+};
+
+enum PacketResult {
+  PACKET_OK,
+  PACKET_INCOMPLETE,
+  PACKET_WRONG_VERSION,
+  PACKET_WRONG_OP_CODE
+};
+
+template <class Mode>
+struct PacketCodec {
+  typedef Mode Frames;
+
+  /* Checks the header of a data packet and returns the number of frames in count */
+  static inline PacketResult readHeader(const uint8_t *packet, uint16_t len, uint16_t &count) {
+    const struct CannelloniDataPacket *data =
+        reinterpret_cast<const struct CannelloniDataPacket*>(packet);
+    if (len < CANNELLONI_DATA_PACKET_BASE_SIZE)
+      return PACKET_INCOMPLETE;
+    if (data->version != CANNELLONI_FRAME_VERSION)
+      return PACKET_WRONG_VERSION;
+    if (data->op_code != DATA)
+      return PACKET_WRONG_OP_CODE;
+    count = ntohs(data->count);
+    return PACKET_OK;
+  }
+
+  static inline void writeHeader(uint8_t *packet, uint8_t seqNo, uint16_t count) {
+    struct CannelloniDataPacket *data = reinterpret_cast<struct CannelloniDataPacket*>(packet);
+    data->version = CANNELLONI_FRAME_VERSION;
+    data->op_code = DATA;
+    data->seq_no = seqNo;
+    data->count = htons(count);
+  }
+
+  /* Whether the encoded frame at data needs a complete canfd_frame to be
+   * decoded into, needs CANNELLONI_FRAME_BASE_SIZE bytes */
+  static inline bool needsFDSlot(const uint8_t *data) {
+    return data[sizeof(canid_t)] > CAN_MAX_DLEN;
+  }
+
+  /* Bytes frame takes in a packet */
+  static inline uint16_t size(const struct canfd_frame *frame) {
+    return canfd_wire_size(frame);
+  }
+
+  /* Writes frame to data, returns the end of the encoded frame */
+  static inline uint8_t* encode(uint8_t *data, const struct canfd_frame *frame) {
+    canid_t id = htonl(frame->can_id);
+    memcpy(data, &id, sizeof(canid_t));
+    data += sizeof(canid_t);
+    *data++ = frame->len;
+    if (Mode::fd && (frame->len & CANFD_FRAME))
+      *data++ = frame->flags;
+    /* RTR Frames have no data section although they have a dlc */
+    uint8_t dataLen = canfd_wire_len(frame);
+    memcpy(data, frame->data, dataLen);
+    return data + dataLen;
+  }
+
+  /*
+   * Reads the frame at data, which must not go beyond end, and moves
+   * data behind it. The classic codec steps over frames that are too
+   * long for CAN 2.0 and returns DECODE_SKIP. Like earlier versions, the
+   * FD codec takes frames without the CANFD_FRAME bit up to
+   * CANFD_MAX_DLEN bytes; frames that would not fit into a canfd_frame
+   * are corrupt for both codecs. Nothing behind data[CAN_MAX_DLEN] of frame is written
+   * unless needsFDSlot() holds. On DECODE_ERROR, the packet can not be
+   * read any further.
+   */
+  static inline DecodeResult decode(const uint8_t *&data, const uint8_t *end,
+                                    struct canfd_frame *frame) {
+    if (end - data < CANNELLONI_FRAME_BASE_SIZE)
+      return DECODE_ERROR;
+    canid_t id;
+    memcpy(&id, data, sizeof(canid_t));
+    frame->can_id = ntohl(id);
+    data += sizeof(canid_t);
+    frame->len = *data++;
+    bool valid = canfd_len(frame) <= CANFD_MAX_DLEN;
+    bool skip = false;
+    if (Mode::fd) {
+      if (frame->len & CANFD_FRAME) {
+        if (data >= end)
+          return DECODE_ERROR;
+        frame->flags = *data++;
+      }
+    } else if (frame->len > CAN_MAX_DLEN) {
+      /* Not a CAN 2.0 frame, step over it */
+      data += frame->len >> 7;
+      skip = true;
+    }
+    uint8_t dataLen = canfd_wire_len(frame);
+    if (!valid || data + dataLen > end)
+      return DECODE_ERROR;
+    if (!skip)
+      memcpy(frame->data, data, dataLen);
+    data += dataLen;
+    return skip ? DECODE_SKIP : DECODE_OK;
+  }
+};
+
+}
@@ -18,7 +18,12 @@
  *
  */
 
+#include <sys/socket.h>
+
 #include "connection.h"
+#include "iobackend.h"
+#include "logging.h"
+#include "sockets.h"
 
 using namespace cannelloni;
 
@@ -26,8 +31,11 @@ ConnectionThread::ConnectionThread()
   : Thread()
   , m_frameBuffer(0)
   , m_peerThread(0)
+  , m_loop(0)
+  , m_frameMode(FRAME_MODE_FD)
+  , m_privateStats(new TunnelStats())
 {
-
+  m_stats = m_privateStats.get();
 }
 
 ConnectionThread::~ConnectionThread() {}
@@ -47,3 +55,28 @@ void ConnectionThread::setPeerThread(ConnectionThread *thread) {
 ConnectionThread* ConnectionThread::getPeerThread() {
   return m_peerThread;
 }
+
+void ConnectionThread::setStatistics(TunnelStats *stats) {
+  m_stats = stats ? stats : m_privateStats.get();
+}
+
+TunnelStats* ConnectionThread::getStatistics() {
+  return m_stats;
+}
+
+void ConnectionThread::setIncomingCPU(int fd) {
+  cannelloni::setIncomingCPU(fd, getScheduling());
+}
+
+FrameMode ConnectionThread::getFrameMode() {
+  return m_frameMode.load(std::memory_order_relaxed);
+}
+
+void ConnectionThread::setFrameMode(FrameMode mode) {
+  m_frameMode.store(mode, std::memory_order_relaxed);
+}
+
+int ConnectionThread::attach(EventLoop *) {
+  lerror << "This connection does not support the event loop" << std::endl;
+  return -1;
+}
@@ -23,11 +23,17 @@
 #include <linux/can/raw.h>
 #include <stdint.h>
 
+#include <atomic>
+
+#include "cannelloni.h"
 #include "thread.h"
 #include "framebuffer.h"
+#include "stats.h"
 
 namespace cannelloni {
 
+class EventLoop;
+
 struct debugOptions_t {
   uint8_t can    : 1;
   uint8_t udp    : 1;
@@ -47,9 +53,40 @@ class ConnectionThread : public Thread {
     void setPeerThread(ConnectionThread *thread);
     ConnectionThread* getPeerThread();
 
+    /* Sets the slot in the statistics region this thread publishes to */
+    void setStatistics(TunnelStats *stats);
+    TunnelStats* getStatistics();
+
+    /*
+     * Sets the connection up to be served by loop instead of its own
+     * thread, start() must not be called then. Returns -1 if this is
+     * not supported.
+     */
+    virtual int attach(EventLoop *loop);
+
+    /*
+     * FRAME_MODE_CLASSIC once the connection knows that it only carries
+     * CAN 2.0 frames. Its peer then encodes and decodes with the classic
+     * codec. May change once while the connection starts up.
+     */
+    FrameMode getFrameMode();
+
+  protected:
+    /* Sets SO_INCOMING_CPU of fd to the first CPU of the thread, see realtime.h */
+    void setIncomingCPU(int fd);
+    void setFrameMode(FrameMode mode);
+
   protected:
     FrameBuffer *m_frameBuffer;
     ConnectionThread *m_peerThread;
+    TunnelStats *m_stats;
+    /* Set while the connection is served by an EventLoop */
+    EventLoop *m_loop;
+    std::atomic<FrameMode> m_frameMode;
+
+  private:
+    /* Used as long as no slot has been assigned */
+    std::unique_ptr<TunnelStats> m_privateStats;
 };
 
 }
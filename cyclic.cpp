@@ -0,0 +1,375 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <linux/can/bcm.h>
+
+#include "cyclic.h"
+#include "iobackend.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+void cannelloni::buildCyclicRecord(struct canfd_frame *record, canid_t id, uint32_t period,
+                                   uint64_t time) {
+  memset(record, 0, CAN_MTU);
+  record->can_id = CAN_ERR_FLAG | CANNELLONI_CYCLIC_RECORD | (time & CANNELLONI_CYCLIC_TIME);
+  record->len = CAN_MAX_DLEN;
+  id = htonl(id);
+  period = htonl(period);
+  memcpy(record->data, &id, sizeof(id));
+  memcpy(record->data + 4, &period, sizeof(period));
+}
+
+void cannelloni::buildCyclicAck(struct canfd_frame *record, canid_t id, uint32_t period) {
+  buildCyclicRecord(record, id, period, 0);
+  record->can_id |= CANNELLONI_CYCLIC_ACK;
+}
+
+void cannelloni::readCyclicRecord(const struct canfd_frame *record, canid_t &id, uint32_t &period) {
+  memcpy(&id, record->data, sizeof(id));
+  memcpy(&period, record->data + 4, sizeof(period));
+  id = ntohl(id);
+  period = ntohl(period);
+}
+
+CyclicDetector::CyclicDetector()
+  : m_offloaded(0)
+  , m_suppressed(0)
+{
+}
+
+CyclicAction CyclicDetector::add(const struct canfd_frame *frame, uint64_t now, uint32_t &period) {
+  if ((frame->len & CANFD_FRAME) || (frame->can_id & CAN_ERR_FLAG))
+    return CYCLIC_FORWARD;
+  uint8_t len = canfd_len(frame);
+  auto it = m_entries.find(frame->can_id);
+  if (it == m_entries.end()) {
+    if (m_entries.size() >= CYCLIC_MAX_IDS)
+      return CYCLIC_FORWARD;
+    Entry &entry = m_entries[frame->can_id];
+    memset(&entry, 0, sizeof(entry));
+    entry.last = now;
+    entry.len = len;
+    memcpy(entry.data, frame->data, len);
+    return CYCLIC_FORWARD;
+  }
+
+  Entry &entry = it->second;
+  uint64_t interval = now - entry.last;
+  entry.last = now;
+  bool changed = entry.len != len || memcmp(entry.data, frame->data, len) != 0;
+  if (changed) {
+    entry.len = len;
+    memcpy(entry.data, frame->data, len);
+  }
+  uint64_t tol = tolerance(entry.period);
+  bool regular = entry.period && interval + tol >= entry.period && interval <= entry.period + tol;
+  if (!regular) {
+    /* Start over with this interval */
+    entry.period = interval;
+    entry.stable = 0;
+    if (!entry.offloaded)
+      return CYCLIC_FORWARD;
+    entry.offloaded = false;
+    m_offloaded--;
+    return CYCLIC_DELETE;
+  }
+  /* Average over the last 8 intervals or so */
+  entry.period = (entry.period * 7 + interval) / 8;
+
+  if (!entry.offloaded) {
+    if (++entry.stable < CYCLIC_STABLE || entry.period < CYCLIC_MIN_PERIOD ||
+        entry.period > CYCLIC_MAX_PERIOD)
+      return CYCLIC_FORWARD;
+    entry.offloaded = true;
+    m_offloaded++;
+    entry.announced = entry.period;
+    entry.refreshed = now;
+    entry.acknowledged = 0;
+    period = entry.announced;
+    return CYCLIC_SETUP;
+  }
+  /* The receiving side keeps its period, announce it again if we drift away */
+  uint64_t drift = entry.period > entry.announced ? entry.period - entry.announced
+                                                  : entry.announced - entry.period;
+  if (drift > entry.announced / 32 || now - entry.refreshed >= CYCLIC_REFRESH) {
+    if (drift > entry.announced / 32) {
+      entry.announced = entry.period;
+      entry.acknowledged = 0;
+    }
+    entry.refreshed = now;
+    period = entry.announced;
+    return CYCLIC_SETUP;
+  }
+  /* Only the remote that runs the job can send the frame */
+  if (changed || entry.acknowledged == 0 || now - entry.acknowledged > CYCLIC_EXPIRY)
+    return CYCLIC_FORWARD;
+  m_suppressed++;
+  return CYCLIC_SUPPRESS;
+}
+
+void CyclicDetector::acknowledge(const struct canfd_frame *record, uint64_t now) {
+  canid_t id;
+  uint32_t period;
+  readCyclicRecord(record, id, period);
+  auto it = m_entries.find(id);
+  /* An acknowledgement of an earlier period does not count */
+  if (it != m_entries.end() && it->second.offloaded && it->second.announced == period)
+    it->second.acknowledged = now;
+}
+
+void CyclicDetector::expire(uint64_t now, std::vector<canid_t> &stopped) {
+  if (m_offloaded == 0)
+    return;
+  for (auto &it : m_entries) {
+    Entry &entry = it.second;
+    if (!entry.offloaded || now - entry.last <= 2 * entry.period + tolerance(entry.period))
+      continue;
+    entry.offloaded = false;
+    entry.stable = 0;
+    entry.period = 0;
+    m_offloaded--;
+    stopped.push_back(it.first);
+  }
+}
+
+uint32_t CyclicDetector::getOffloadedCount() {
+  return m_offloaded;
+}
+
+uint64_t CyclicDetector::getSuppressedCount() {
+  return m_suppressed;
+}
+
+uint64_t CyclicDetector::tolerance(uint64_t period) {
+  return period / 8 + CYCLIC_JITTER;
+}
+
+CyclicJobs::CyclicJobs()
+  : m_socket(-1)
+  , m_installed(0)
+  , m_offset(0)
+  , m_nextOffset(0)
+  , m_window(0)
+{
+}
+
+CyclicJobs::~CyclicJobs() {
+  close();
+}
+
+bool CyclicJobs::open(int ifindex) {
+  m_socket = io()->socket(PF_CAN, SOCK_DGRAM, CAN_BCM);
+  if (m_socket < 0) {
+    lerror << "Could not create CAN_BCM socket" << std::endl;
+    return false;
+  }
+  struct sockaddr_can addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifindex;
+  if (io()->connect(m_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    lerror << "Could not connect CAN_BCM socket" << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+void CyclicJobs::close() {
+  if (m_socket < 0)
+    return;
+  /* Closing the socket deletes all jobs */
+  io()->close(m_socket);
+  m_socket = -1;
+  m_jobs.clear();
+  m_installed = 0;
+  m_starting.clear();
+  m_window = 0;
+}
+
+CyclicJobResult CyclicJobs::handle(const struct canfd_frame *frame, uint64_t now, canid_t &id,
+                                   uint32_t &period) {
+  if (isCyclicRecord(frame)) {
+    readCyclicRecord(frame, id, period);
+    auto it = m_jobs.find(id);
+    if (period == 0) {
+      if (it != m_jobs.end()) {
+        remove(id, it->second);
+        m_jobs.erase(it);
+      }
+      return CYCLIC_HANDLED;
+    }
+    uint32_t sent = frame->can_id & CANNELLONI_CYCLIC_TIME;
+    synchronize(sent, now);
+    if (it == m_jobs.end()) {
+      if (m_jobs.size() >= CYCLIC_MAX_IDS || period < CYCLIC_MIN_PERIOD || period > CYCLIC_MAX_PERIOD)
+        return CYCLIC_HANDLED;
+      Job &job = m_jobs[id];
+      memset(&job, 0, sizeof(job));
+      job.period = period;
+      job.sent = sent;
+      job.refreshed = now;
+      return CYCLIC_HANDLED;
+    }
+    Job &job = it->second;
+    job.sent = sent;
+    job.refreshed = now;
+    if (job.period != period) {
+      job.period = period;
+      /* Otherwise the next frame starts the job */
+      if (job.installed)
+        schedule(id, job);
+    }
+    return job.installed && !job.pending ? CYCLIC_ACKNOWLEDGE : CYCLIC_HANDLED;
+  }
+
+  if (m_jobs.empty() || (frame->len & CANFD_FRAME))
+    return CYCLIC_WRITE;
+  auto it = m_jobs.find(frame->can_id);
+  if (it == m_jobs.end())
+    return CYCLIC_WRITE;
+  Job &job = it->second;
+  job.len = canfd_len(frame);
+  memcpy(job.data, frame->data, job.len);
+  if (!job.installed) {
+    schedule(it->first, job);
+    return CYCLIC_WRITE;
+  }
+  return setup(it->first, job, 0) ? CYCLIC_HANDLED : CYCLIC_WRITE;
+}
+
+bool CyclicJobs::isRemote(canid_t id) {
+  if (m_installed == 0)
+    return false;
+  auto it = m_jobs.find(id);
+  return it != m_jobs.end() && it->second.installed;
+}
+
+void CyclicJobs::expire(uint64_t now) {
+  for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+    if (now - it->second.refreshed > CYCLIC_EXPIRY) {
+      remove(it->first, it->second);
+      it = m_jobs.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void CyclicJobs::start(uint64_t now, std::vector<struct canfd_frame> &acks) {
+  for (canid_t id : m_starting) {
+    auto it = m_jobs.find(id);
+    /* Deleted in the meantime */
+    if (it == m_jobs.end() || !it->second.pending)
+      continue;
+    Job &job = it->second;
+    job.pending = false;
+    /* Time since the frame would have arrived with the least delay */
+    uint64_t elapsed = (now - m_offset - job.sent) & CANNELLONI_CYCLIC_TIME;
+    if (!setup(id, job, job.period - elapsed % job.period))
+      continue;
+    if (!job.installed)
+      m_installed++;
+    job.installed = true;
+    acks.emplace_back();
+    buildCyclicAck(&acks.back(), id, job.period);
+  }
+  m_starting.clear();
+}
+
+uint32_t CyclicJobs::getJobCount() {
+  return m_installed;
+}
+
+void CyclicJobs::synchronize(uint32_t sent, uint64_t now) {
+  uint32_t offset = (now - sent) & CANNELLONI_CYCLIC_TIME;
+  /* Whether offset is less than the other one, the times wrap around */
+  auto less = [offset](uint32_t other) {
+    return ((offset - other) & CANNELLONI_CYCLIC_TIME) > CANNELLONI_CYCLIC_TIME / 2;
+  };
+  if (m_window == 0) {
+    m_offset = offset;
+    m_nextOffset = offset;
+    m_window = now;
+    return;
+  }
+  /* The clocks drift apart, so old differences must be forgotten */
+  if (now - m_window >= CYCLIC_SYNC_WINDOW) {
+    m_offset = m_nextOffset;
+    m_nextOffset = offset;
+    m_window = now;
+  }
+  if (less(m_offset))
+    m_offset = offset;
+  if (less(m_nextOffset))
+    m_nextOffset = offset;
+}
+
+void CyclicJobs::schedule(canid_t id, Job &job) {
+  if (job.pending)
+    return;
+  job.pending = true;
+  m_starting.push_back(id);
+}
+
+bool CyclicJobs::setup(canid_t id, Job &job, uint64_t delay) {
+  /* bcm_msg_head ends in a flexible array of frames */
+  alignas(struct bcm_msg_head) uint8_t msg[sizeof(struct bcm_msg_head) + sizeof(struct can_frame)];
+  struct bcm_msg_head *head = reinterpret_cast<struct bcm_msg_head*>(msg);
+  struct can_frame *cyclic = reinterpret_cast<struct can_frame*>(msg + sizeof(*head));
+  memset(msg, 0, sizeof(msg));
+  head->opcode = TX_SETUP;
+  /* Otherwise only the payload changes and the timer keeps running */
+  if (delay) {
+    /* The first frame after delay, then one every period */
+    head->flags = SETTIMER | STARTTIMER;
+    head->count = 1;
+    head->ival1.tv_sec = delay / 1000000;
+    head->ival1.tv_usec = delay % 1000000;
+    head->ival2.tv_sec = job.period / 1000000;
+    head->ival2.tv_usec = job.period % 1000000;
+  }
+  head->can_id = id;
+  head->nframes = 1;
+  cyclic->can_id = id;
+  cyclic->can_dlc = job.len;
+  memcpy(cyclic->data, job.data, job.len);
+  if (io()->sendto(m_socket, msg, sizeof(msg), 0, NULL, 0) != sizeof(msg)) {
+    lwarn << "CAN_BCM TX_SETUP failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void CyclicJobs::remove(canid_t id, const Job &job) {
+  if (!job.installed)
+    return;
+  struct bcm_msg_head head;
+  memset(&head, 0, sizeof(head));
+  head.opcode = TX_DELETE;
+  head.can_id = id;
+  if (io()->sendto(m_socket, &head, sizeof(head), 0, NULL, 0) != sizeof(head))
+    lwarn << "CAN_BCM TX_DELETE failed" << std::endl;
+  m_installed--;
+}
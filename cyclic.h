@@ -0,0 +1,240 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * Most frames on a CAN bus are sent with a fixed period and a payload
+ * that rarely changes. With cyclic offload (-Y on both ends), only what
+ * is needed to reproduce such a frame is tunneled and the kernel of the
+ * receiving side sends it (CAN_BCM), so neither the network nor the
+ * CANThread have to handle every single frame.
+ *
+ * CyclicDetector looks at the frames received from the bus. An ID
+ * becomes cyclic once CYCLIC_STABLE consecutive intervals are within
+ * the tolerance of its period. A setup record with the period is
+ * tunneled, followed by the frame. The frames are still tunneled until
+ * the remote acknowledges that its job runs, from then on a frame is
+ * only tunneled if its payload has changed. The setup record and the
+ * frame are repeated every CYCLIC_REFRESH us, which repairs lost
+ * packets. If an interval leaves the tolerance or the frame stops, a
+ * delete record is tunneled and the ID is handled as usual again.
+ *
+ * Without the acknowledgement, the frames would be lost whenever the
+ * remote does not send them itself, e.g. without -Y or behind a hub,
+ * which both drop the records.
+ * The remote acknowledges every setup record of a running job, so if
+ * it stops doing so, the frames are tunneled again after CYCLIC_EXPIRY
+ * us at the latest, the same time after which its job would expire.
+ *
+ * CyclicJobs handles the frames from the network. A setup record and
+ * the next frame of its ID install a TX_SETUP job on a CAN_BCM socket,
+ * later frames of the ID update the payload of the job. Installing a
+ * job and every later setup record for it are acknowledged. A job that has
+ * not been refreshed for CYCLIC_EXPIRY us is deleted, so a lost delete
+ * record does not leave a frame on the bus forever. The frames of a job
+ * are looped back to the CAN_RAW socket like any other local frame,
+ * isRemote() tells them apart.
+ *
+ * The jobs must keep the phases the frames have on the source bus. The
+ * setup records of many IDs arrive in the same packet, jobs that all
+ * start on arrival would send their frames in one burst every period,
+ * which overflows the TX queue of the interface. The kernel drops such
+ * frames silently, unlike a write to the CAN_RAW socket it is not
+ * retried. So a setup record carries the time the sender received the
+ * frame, and the least difference to the local time of arrival that
+ * was seen within CYCLIC_SYNC_WINDOW us maps it to the local clock. The
+ * frame that installs a job is written as usual, start() then installs
+ * the job with a first interval (ival1, count 1) that ends at the next
+ * period of the source. That is done from the timer, after all records
+ * of the packet have refined the mapping.
+ *
+ * Only CAN 2.0 frames are offloaded. A payload update appears on the
+ * bus up to one period later than without offload. The records are
+ * described in doc/udp_format.md.
+ */
+
+/* Intervals within the tolerance before an ID is offloaded */
+#define CYCLIC_STABLE 8
+/* Periods in us that are offloaded */
+#define CYCLIC_MIN_PERIOD 1000
+#define CYCLIC_MAX_PERIOD 5000000
+/* Tolerance in us on top of 1/8 of the period */
+#define CYCLIC_JITTER 500
+/* Time in us after which setup record and frame are tunneled again */
+#define CYCLIC_REFRESH 1000000
+/* Time in us after which a job without a refresh is deleted */
+#define CYCLIC_EXPIRY (3 * CYCLIC_REFRESH)
+/* Interval in us of the checks for stopped frames and expired jobs */
+#define CYCLIC_CHECK_INTERVAL 10000
+/* Time in us after which the mapping of the sender's clock starts over */
+#define CYCLIC_SYNC_WINDOW (10 * CYCLIC_REFRESH)
+/* IDs that are tracked at most */
+#define CYCLIC_MAX_IDS 4096
+
+enum CyclicAction {
+  /* Tunnel the frame */
+  CYCLIC_FORWARD,
+  /* The receiving side sends the frame */
+  CYCLIC_SUPPRESS,
+  /* Tunnel a setup record, then the frame */
+  CYCLIC_SETUP,
+  /* Tunnel a delete record, then the frame */
+  CYCLIC_DELETE
+};
+
+enum CyclicJobResult {
+  /* Write the frame to the bus */
+  CYCLIC_WRITE,
+  /* A record or the payload of a job */
+  CYCLIC_HANDLED,
+  /* Like CYCLIC_HANDLED, and the job runs, acknowledge it to the remote */
+  CYCLIC_ACKNOWLEDGE
+};
+
+/*
+ * Fills record with a setup record for id, a period of 0 deletes it,
+ * time (us) is when the frame was received from the bus
+ */
+void buildCyclicRecord(struct canfd_frame *record, canid_t id, uint32_t period,
+                       uint64_t time);
+/* Fills record with the acknowledgement of a job for id that runs with period */
+void buildCyclicAck(struct canfd_frame *record, canid_t id, uint32_t period);
+void readCyclicRecord(const struct canfd_frame *record, canid_t &id, uint32_t &period);
+static inline bool isCyclicRecord(const struct canfd_frame *frame) {
+  return (frame->can_id & (CAN_ERR_FLAG | CANNELLONI_CYCLIC_RECORD)) ==
+         (CAN_ERR_FLAG | CANNELLONI_CYCLIC_RECORD);
+}
+static inline bool isCyclicAck(const struct canfd_frame *frame) {
+  return isCyclicRecord(frame) && (frame->can_id & CANNELLONI_CYCLIC_ACK);
+}
+
+class CyclicDetector {
+  public:
+    CyclicDetector();
+
+    /* Called for every frame received at now (us), period is set for CYCLIC_SETUP */
+    CyclicAction add(const struct canfd_frame *frame, uint64_t now, uint32_t &period);
+
+    /* Called for every acknowledgement from the network at now (us) */
+    void acknowledge(const struct canfd_frame *record, uint64_t now);
+
+    /* Ends the offload of IDs that have stopped, each needs a delete record */
+    void expire(uint64_t now, std::vector<canid_t> &stopped);
+
+    /* IDs that are currently offloaded and frames that were not tunneled */
+    uint32_t getOffloadedCount();
+    uint64_t getSuppressedCount();
+
+  private:
+    struct Entry {
+      /* Time of the last frame and the average interval in us */
+      uint64_t last;
+      uint64_t period;
+      /* Period of the last setup record and the time it was sent */
+      uint64_t announced;
+      uint64_t refreshed;
+      /* Time of the last acknowledgement of the announced period, 0 for none */
+      uint64_t acknowledged;
+      uint32_t stable;
+      bool offloaded;
+      uint8_t len;
+      uint8_t data[CAN_MAX_DLEN];
+    };
+
+    static uint64_t tolerance(uint64_t period);
+
+  private:
+    std::unordered_map<canid_t, Entry> m_entries;
+    uint32_t m_offloaded;
+    uint64_t m_suppressed;
+};
+
+class CyclicJobs {
+  public:
+    CyclicJobs();
+    ~CyclicJobs();
+
+    /* Opens the CAN_BCM socket for the interface ifindex */
+    bool open(int ifindex);
+    void close();
+
+    /*
+     * Called for every frame and setup record from the network at now (us),
+     * id and period are set for CYCLIC_ACKNOWLEDGE
+     */
+    CyclicJobResult handle(const struct canfd_frame *frame, uint64_t now, canid_t &id,
+                           uint32_t &period);
+
+    /* Whether frames of id received from the bus have been sent by a job */
+    bool isRemote(canid_t id);
+
+    /* Deletes the jobs that have not been refreshed */
+    void expire(uint64_t now);
+
+    /* Starts the jobs installed by frames since the last call, each needs the ack */
+    void start(uint64_t now, std::vector<struct canfd_frame> &acks);
+
+    uint32_t getJobCount();
+
+  private:
+    struct Job {
+      uint32_t period;
+      uint64_t refreshed;
+      /* Time of the frame in the last setup record, on the clock of the sender */
+      uint32_t sent;
+      bool installed;
+      /* Waits for start(), also after the period of a running job has changed */
+      bool pending;
+      uint8_t len;
+      uint8_t data[CAN_MAX_DLEN];
+    };
+
+    /* Maps the clock of the sender with the time of a setup record */
+    void synchronize(uint32_t sent, uint64_t now);
+    void schedule(canid_t id, Job &job);
+    /* TX_SETUP with the payload of job, a delay (us) also (re)starts the timer */
+    bool setup(canid_t id, Job &job, uint64_t delay);
+    void remove(canid_t id, const Job &job);
+
+  private:
+    int m_socket;
+    std::unordered_map<canid_t, Job> m_jobs;
+    uint32_t m_installed;
+    std::vector<canid_t> m_starting;
+    /* Least difference (us) between the local time and the time of the
+     * sender since the previous window started, and in the current one */
+    uint32_t m_offset;
+    uint32_t m_nextOffset;
+    /* Start of the current window, 0 before the first setup record */
+    uint64_t m_window;
+};
+
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+
+#include <linux/can/error.h>
+
+#include "errorframes.h"
+
+using namespace cannelloni;
+
+ErrorAggregator::ErrorAggregator()
+  : m_window(0)
+  , m_open(false)
+  , m_openTime(0)
+  , m_lastTime(0)
+  , m_collapsed(0)
+  , m_classes(0)
+  , m_frameCount(0)
+  , m_suppressedCount(0)
+{
+  memset(&m_last, 0, sizeof(m_last));
+}
+
+void ErrorAggregator::setWindow(uint64_t window) {
+  m_window = window;
+}
+
+uint64_t ErrorAggregator::getWindow() {
+  return m_window;
+}
+
+bool ErrorAggregator::isOpen() {
+  return m_open;
+}
+
+bool ErrorAggregator::add(const struct canfd_frame *frame, uint64_t now, bool &opened) {
+  m_frameCount++;
+  opened = false;
+  if (m_window == 0)
+    return true;
+  if (!m_open) {
+    m_open = true;
+    m_openTime = now;
+    m_collapsed = 0;
+    m_classes = 0;
+    opened = true;
+    return true;
+  }
+  /* The previous last one is now in between */
+  if (m_collapsed)
+    m_classes |= m_last.can_id & CAN_ERR_MASK;
+  memcpy(&m_last, frame, CAN_MTU);
+  m_lastTime = now;
+  m_collapsed++;
+  return false;
+}
+
+uint32_t ErrorAggregator::close(struct canfd_frame *summary, struct canfd_frame *last) {
+  uint32_t collapsed = m_collapsed;
+  m_open = false;
+  m_collapsed = 0;
+  if (collapsed == 0)
+    return 0;
+  memcpy(last, &m_last, CAN_MTU);
+  if (collapsed > 1) {
+    uint32_t count = collapsed - 1;
+    uint64_t span = m_lastTime - m_openTime;
+    uint32_t spanUs = span > UINT32_MAX ? UINT32_MAX : span;
+    memset(summary, 0, CAN_MTU);
+    summary->can_id = CAN_ERR_FLAG | CANNELLONI_ERR_SUMMARY | (m_classes & ~CANNELLONI_ERR_SUMMARY);
+    summary->len = CAN_ERR_DLC;
+    summary->data[0] = count >> 24;
+    summary->data[1] = count >> 16;
+    summary->data[2] = count >> 8;
+    summary->data[3] = count;
+    summary->data[4] = spanUs >> 24;
+    summary->data[5] = spanUs >> 16;
+    summary->data[6] = spanUs >> 8;
+    summary->data[7] = spanUs;
+    m_suppressedCount += count;
+  }
+  return collapsed;
+}
+
+uint64_t ErrorAggregator::getFrameCount() {
+  return m_frameCount;
+}
+
+uint64_t ErrorAggregator::getSuppressedCount() {
+  return m_suppressedCount;
+}
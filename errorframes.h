@@ -0,0 +1,87 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * A controller reports bus faults with error frames (CAN_ERR_FLAG),
+ * often thousands per second while the fault lasts. ErrorAggregator
+ * collapses them before they reach the network.
+ *
+ * The first error frame opens a window of a fixed length and is passed
+ * on unchanged. Error frames within the window are only counted. When
+ * the window closes, the last of them is passed on unchanged as well,
+ * preceded by a summary record for the frames in between. The next
+ * error frame opens a new window. A burst of any length thus costs at
+ * most three frames per window on the link.
+ *
+ * The summary record is an error frame with CANNELLONI_ERR_SUMMARY set
+ * in can_id, see doc/udp_format.md.
+ */
+
+class ErrorAggregator {
+  public:
+    ErrorAggregator();
+
+    /* Window in us, 0 passes every error frame */
+    void setWindow(uint64_t window);
+    uint64_t getWindow();
+    bool isOpen();
+
+    /*
+     * Called for every error frame received at now (us). Returns true if
+     * frame has to be passed on. opened is set if frame opened a window,
+     * which has to be closed with close() after getWindow() us.
+     */
+    bool add(const struct canfd_frame *frame, uint64_t now, bool &opened);
+
+    /*
+     * Closes the window and returns the number of frames that were
+     * collapsed. If there was at least one, last holds the last of them.
+     * If there were more, summary holds the record for all others.
+     */
+    uint32_t close(struct canfd_frame *summary, struct canfd_frame *last);
+
+    /* Error frames seen and those not passed on */
+    uint64_t getFrameCount();
+    uint64_t getSuppressedCount();
+
+  private:
+    uint64_t m_window;
+    bool m_open;
+    uint64_t m_openTime;
+    uint64_t m_lastTime;
+    uint32_t m_collapsed;
+    /* Error classes of all collapsed frames but the last */
+    canid_t m_classes;
+    struct canfd_frame m_last;
+
+    uint64_t m_frameCount;
+    uint64_t m_suppressedCount;
+};
+
+}
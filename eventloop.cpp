@@ -0,0 +1,83 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include "eventloop.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+/* Maximum number of events handled per epoll_wait */
+#define EVENTLOOP_MAX_EVENTS 16
+
+EventLoop::EventLoop()
+  : Thread()
+{
+  m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epollFd < 0)
+    lerror << "epoll_create1 error" << std::endl;
+  /* stop() clears m_started, the handler only has to consume the wakeup */
+  add(getStopFd(), [this]() { clearStop(); });
+}
+
+EventLoop::~EventLoop() {
+  if (m_epollFd >= 0)
+    close(m_epollFd);
+}
+
+int EventLoop::add(int fd, std::function<void()> handler) {
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u32 = m_handlers.size();
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    lerror << "Could not add fd " << fd << " to the event loop" << std::endl;
+    return -1;
+  }
+  m_handlers.push_back(handler);
+  return 0;
+}
+
+void EventLoop::addExitHandler(std::function<void()> handler) {
+  m_exitHandlers.push_back(handler);
+}
+
+void EventLoop::run() {
+  struct epoll_event events[EVENTLOOP_MAX_EVENTS];
+
+  linfo << "EventLoop up and running" << std::endl;
+  while (m_started) {
+    int ret = epoll_wait(m_epollFd, events, EVENTLOOP_MAX_EVENTS, -1);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      lerror << "epoll_wait error" << std::endl;
+      break;
+    }
+    for (int i = 0; i < ret && m_started; i++)
+      m_handlers[events[i].data.u32]();
+  }
+  for (std::function<void()> &handler : m_exitHandlers)
+    handler();
+}
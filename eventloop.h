@@ -0,0 +1,66 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "thread.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * By default, the CAN side and the network side of a tunnel run in two
+ * threads that hand frames over through locked FrameBuffers and wake
+ * each other up with their timers. On a single core this handoff costs
+ * more than the actual work.
+ *
+ * EventLoop serves both sides from one thread instead. CANThread and
+ * UDPThread register their sockets and timers with attach() and are
+ * then driven by a single epoll loop. A frame that is received on one
+ * side is passed to the other side by a direct call: a full packet is
+ * sent right away and frames from the network are written to the bus
+ * right away, without any locks or wakeups. Only the buffer timeout
+ * still uses the timerfd of UDPThread.
+ *
+ * The FrameBuffers of both sides have to be switched to setLocking(false).
+ */
+
+class EventLoop : public Thread {
+  public:
+    EventLoop();
+    virtual ~EventLoop();
+
+    /* Calls handler whenever fd is readable, returns -1 on error */
+    int add(int fd, std::function<void()> handler);
+    /* Called once when the loop has stopped */
+    void addExitHandler(std::function<void()> handler);
+
+    virtual void run();
+
+  private:
+    int m_epollFd;
+    std::vector<std::function<void()>> m_handlers;
+    std::vector<std::function<void()>> m_exitHandlers;
+};
+
+}
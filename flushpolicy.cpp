@@ -0,0 +1,71 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "flushpolicy.h"
+#include "udpthread.h"
+
+using namespace cannelloni;
+
+FlushPolicy::FlushPolicy()
+  : m_timeout(100)
+  , m_payloadSize(UDP_PAYLOAD_SIZE)
+{
+}
+
+void FlushPolicy::setTimeout(uint32_t timeout) {
+  m_timeout = timeout;
+}
+
+uint32_t FlushPolicy::getTimeout() const {
+  return m_timeout;
+}
+
+void FlushPolicy::setTimeoutTable(const std::map<uint32_t,uint32_t> &timeoutTable) {
+  m_timeoutTable = timeoutTable;
+}
+
+std::map<uint32_t,uint32_t>& FlushPolicy::getTimeoutTable() {
+  return m_timeoutTable;
+}
+
+void FlushPolicy::setPayloadSize(uint32_t payloadSize) {
+  m_payloadSize = payloadSize;
+}
+
+uint32_t FlushPolicy::getPayloadSize() const {
+  return m_payloadSize;
+}
+
+FlushTrigger FlushPolicy::lookupTimeout(const canfd_frame *frame, uint64_t &expiry) const {
+  uint32_t can_id;
+  if (frame->can_id & CAN_EFF_FLAG)
+    can_id = frame->can_id & CAN_EFF_MASK;
+  else
+    can_id = frame->can_id & CAN_SFF_MASK;
+  std::map<uint32_t,uint32_t>::const_iterator it = m_timeoutTable.find(can_id);
+  if (it != m_timeoutTable.end()) {
+    uint32_t timeout = it->second;
+    if (timeout < m_timeout) {
+      expiry = timeout;
+      return FLUSH_ID_TIMEOUT;
+    }
+  }
+  return FLUSH_TIMER;
+}
@@ -0,0 +1,113 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <map>
+
+#include "cannelloni.h"
+#include "stats.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * FlushPolicy decides when the frames queued for the network have to
+ * be sent. The transmit timer of UDPThread and SCTPThread expires every
+ * timeout us. A frame with an entry in the timeout table pulls the
+ * next expiry forward and a buffer that can not take another frame is
+ * sent right away.
+ *
+ * The policy does not own the timer, it only tells the caller what to
+ * do with it. This way cannelloni-plan can run the very same decisions
+ * against a virtual clock. Frames that do not fit into a packet are not
+ * sent right away, they wait for the next expiry or a full buffer and
+ * the packet that carries them counts as FLUSH_OVERFLOW.
+ */
+
+class FlushPolicy {
+  public:
+    FlushPolicy();
+
+    void setTimeout(uint32_t timeout);
+    uint32_t getTimeout() const;
+
+    void setTimeoutTable(const std::map<uint32_t,uint32_t> &timeoutTable);
+    std::map<uint32_t,uint32_t>& getTimeoutTable();
+
+    void setPayloadSize(uint32_t payloadSize);
+    uint32_t getPayloadSize() const;
+
+    /*
+     * Called after frame has been queued, bufferSize is the number of
+     * bytes in the buffer.
+     *
+     * Returns FLUSH_FULL if the buffer has to be sent now,
+     * FLUSH_ID_TIMEOUT if the timer has to expire in expiry us unless
+     * it expires earlier anyway and FLUSH_TIMER if the timer can keep
+     * running.
+     */
+    inline FlushTrigger frameQueued(const canfd_frame *frame, size_t bufferSize,
+                                    uint64_t &expiry) const {
+      /*
+       * We want that at least this frame and next frame fits into
+       * the packet. The minimum size is CANNELLONI_FRAME_BASE_SIZE,
+       * which is just the ID * plus the DLC
+       */
+      if (bufferSize + CANNELLONI_DATA_PACKET_BASE_SIZE +
+          CANNELLONI_FRAME_BASE_SIZE >= m_payloadSize)
+        return FLUSH_FULL;
+      if (m_timeoutTable.empty())
+        return FLUSH_TIMER;
+      return lookupTimeout(frame, expiry);
+    }
+
+    /*
+     * Called after a packet has been built, overflow is set if frames
+     * did not fit into it. Returns the triggers to record for the next
+     * packet, the timer keeps running.
+     */
+    inline uint32_t packetBuilt(bool overflow) const {
+      return overflow ? 1u << FLUSH_OVERFLOW : 0;
+    }
+
+    /* The most urgent of the recorded triggers, a packet counts for it */
+    static inline FlushTrigger mostUrgent(uint32_t triggers) {
+      for (int t = FLUSH_TRIGGERS - 1; t > FLUSH_TIMER; t--) {
+        if (triggers & (1 << t))
+          return static_cast<FlushTrigger>(t);
+      }
+      return FLUSH_TIMER;
+    }
+
+  private:
+    /* Checks whether we have custom timeout for frame */
+    FlushTrigger lookupTimeout(const canfd_frame *frame, uint64_t &expiry) const;
+
+  private:
+    uint32_t m_timeout;
+    std::map<uint32_t,uint32_t> m_timeoutTable;
+    uint32_t m_payloadSize;
+};
+
+}
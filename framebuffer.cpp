@@ -18,19 +18,32 @@
  *
  */
 
+#include <algorithm>
 #include <cstring>
+#include <new>
+
 #include "framebuffer.h"
 #include "logging.h"
 
 using namespace cannelloni;
 
+/* Bytes of a slot of each class */
+static const size_t slotSize[FRAME_CLASSES] = {CAN_MTU, sizeof(canfd_frame)};
+
+static_assert(CAN_MTU % alignof(canfd_frame) == 0, "classic slots must keep the alignment of canfd_frame");
+
 FrameBuffer::FrameBuffer(size_t size, size_t max) :
+  m_classicSlots(false),
+  m_totalAllocCount(0),
+  m_allocCount(),
+  m_initialSize(size),
   m_bufferSize(0),
   m_intermediateBufferSize(0),
-  m_maxAllocCount(max),
-  m_totalAllocCount(0)
+  m_bufferTime(0),
+  m_intermediateBufferTime(0),
+  m_maxAllocCount(max)
 {
-  resizePool(size, false);
+  resizePool(FRAME_CLASS_FD, size, false);
 }
 
 FrameBuffer::~FrameBuffer() {
@@ -38,34 +51,75 @@ FrameBuffer::~FrameBuffer() {
   clearPool();
 }
 
+void FrameBuffer::setLocking(bool locking) {
+  m_bufferMutex.setEnabled(locking);
+  m_intermediateBufferMutex.setEnabled(locking);
+  m_poolMutex.setEnabled(locking);
+}
+
+void FrameBuffer::setClassicSlots(bool enabled) {
+  std::lock_guard<OptionalMutex> lock(m_poolMutex);
+
+  m_classicSlots = enabled;
+  if (!enabled || m_allocCount[FRAME_CLASS_CLASSIC] > 0)
+    return;
+  /* Most frames will fit into classic slots, FD slots are allocated
+   * once they are needed */
+  if (m_framePool.size() == m_allocCount[FRAME_CLASS_FD]) {
+    m_framePool.clear();
+    auto it = std::remove_if(m_slabs.begin(), m_slabs.end(), [](const Slab &slab) {
+      if (slab.frameClass != FRAME_CLASS_FD)
+        return false;
+      ::operator delete(slab.begin);
+      return true;
+    });
+    m_slabs.erase(it, m_slabs.end());
+    m_totalAllocCount -= m_allocCount[FRAME_CLASS_FD];
+    m_allocCount[FRAME_CLASS_FD] = 0;
+  }
+  resizePool(FRAME_CLASS_CLASSIC, m_initialSize, false);
+}
+
 canfd_frame* FrameBuffer::requestFrame(bool overwriteLast, bool debug) {
-  std::lock_guard<std::recursive_mutex> lock(m_poolMutex);
-  if (m_framePool.empty()) {
+  return requestFrame(FRAME_CLASS_FD, overwriteLast, debug);
+}
+
+canfd_frame* FrameBuffer::requestFrame(FrameClass frameClass, bool overwriteLast, bool debug) {
+  std::lock_guard<OptionalMutex> lock(m_poolMutex);
+  if (!m_classicSlots)
+    frameClass = FRAME_CLASS_FD;
+  std::list<canfd_frame*> &pool = (frameClass == FRAME_CLASS_FD) ? m_framePool : m_classicPool;
+  if (pool.empty()) {
     bool resizePoolResult;
+    /* Grow a class by its current size, but at least by the initial size */
+    size_t grow = std::max<size_t>(m_allocCount[frameClass], std::max<size_t>(m_initialSize, 1));
     if (m_maxAllocCount > 0) {
       if (m_maxAllocCount <= m_totalAllocCount) {
         if (debug)
           lerror << "Maximum of allocated frames reached." << std::endl;
         resizePoolResult = false;
       } else {
-        resizePoolResult = resizePool(std::min(m_maxAllocCount-m_totalAllocCount,m_totalAllocCount), debug);
+        resizePoolResult = resizePool(frameClass, std::min<size_t>(m_maxAllocCount-m_totalAllocCount, grow), debug);
       }
     } else {
       /* If m_maxAllocCount is 0, we just grow the pool */
-      resizePoolResult = resizePool(m_totalAllocCount, debug);
+      resizePoolResult = resizePool(frameClass, grow, debug);
     }
     if (!resizePoolResult && !overwriteLast) {
       if (debug)
         lerror << "Allocation failed. Not enough memory available." << std::endl;
       /* Test whether a partial alloc was possible */
-      if (m_framePool.empty()) {
+      if (pool.empty()) {
         /* We have no frames available and return NULL */
         if (debug)
           lerror << "Frame Pool is depleted!!!." << std::endl;
         return NULL;
       }
     } else if(!resizePoolResult && overwriteLast) {
-      std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+      std::lock_guard<OptionalMutex> lock(m_bufferMutex);
+      /* A classic slot cannot take a CAN FD frame */
+      if (frameClass == FRAME_CLASS_FD && !m_buffer.empty() && isClassicSlot(m_buffer.back()))
+        return NULL;
       /*
        * We did reach the limit but we are returning the last frame in the
        * buffer. (ringbuffer behaviour)
@@ -73,72 +127,92 @@ canfd_frame* FrameBuffer::requestFrame(bool overwriteLast, bool debug) {
       return requestBufferBack();
     }
   }
-  /* If we reach this point, m_framePool is not depleted */
-  canfd_frame *ret = m_framePool.front();
+  /* If we reach this point, the pool is not depleted */
+  canfd_frame *ret = pool.front();
   /*
    * In a benchmark, splicing between three lists showed no
    * performance improvement over front() and pop_front(),
    * it even was 33% slower
    */
-  m_framePool.pop_front();
+  pool.pop_front();
   return ret;
 }
 
 void FrameBuffer::insertFramePool(canfd_frame *frame) {
-  std::lock_guard<std::recursive_mutex> lock(m_poolMutex);
+  std::lock_guard<OptionalMutex> lock(m_poolMutex);
+
+  releaseFrame(frame);
+}
+
+bool FrameBuffer::isClassicSlot(const canfd_frame *frame) {
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(frame);
+  for (const Slab &slab : m_slabs) {
+    if (slab.frameClass == FRAME_CLASS_CLASSIC && p >= slab.begin && p < slab.end)
+      return true;
+  }
+  return false;
+}
 
-  m_framePool.push_back(frame);
+void FrameBuffer::releaseFrame(canfd_frame *frame) {
+  if (m_allocCount[FRAME_CLASS_CLASSIC] > 0 && isClassicSlot(frame))
+    m_classicPool.push_back(frame);
+  else
+    m_framePool.push_back(frame);
+}
+
+void FrameBuffer::releaseFrames(std::list<canfd_frame*> &list) {
+  /* Without classic slots, everything belongs into m_framePool */
+  if (m_allocCount[FRAME_CLASS_CLASSIC] == 0) {
+    m_framePool.splice(m_framePool.end(), list);
+    return;
+  }
+  while (!list.empty()) {
+    auto it = list.begin();
+    std::list<canfd_frame*> &pool = isClassicSlot(*it) ? m_classicPool : m_framePool;
+    pool.splice(pool.end(), list, it);
+  }
 }
 
 void FrameBuffer::insertFrame(canfd_frame *frame) {
-  std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_bufferMutex);
 
+  if (m_buffer.empty())
+    m_bufferTime = monotonicTime();
   m_buffer.push_back(frame);
-  m_bufferSize += CANNELLONI_FRAME_BASE_SIZE + canfd_len(frame);
-
-  /* We need one more byte for CAN_FD Frames */
-  if (frame->len & CANFD_FRAME)
-    m_bufferSize++;
+  m_bufferSize += canfd_wire_size(frame);
 }
 
 void FrameBuffer::returnFrame(canfd_frame *frame) {
-  std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_bufferMutex);
 
+  if (m_buffer.empty())
+    m_bufferTime = monotonicTime();
   m_buffer.push_front(frame);
-  m_bufferSize += CANNELLONI_FRAME_BASE_SIZE + canfd_len(frame);
-  /* We need one more byte for CAN_FD Frames */
-  if (frame->len & CANFD_FRAME)
-    m_bufferSize++;
+  m_bufferSize += canfd_wire_size(frame);
 }
 
 canfd_frame* FrameBuffer::requestBufferFront() {
-  std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_bufferMutex);
   if (m_buffer.empty()) {
     return NULL;
   }
   else {
     canfd_frame *ret = m_buffer.front();
     m_buffer.pop_front();
-    m_bufferSize -= (CANNELLONI_FRAME_BASE_SIZE + canfd_len(ret));
-    /* We need one more byte for CAN_FD Frames */
-    if (ret->len & CANFD_FRAME)
-      m_bufferSize--;
+    m_bufferSize -= canfd_wire_size(ret);
     return ret;
   }
 }
 
 canfd_frame* FrameBuffer::requestBufferBack() {
-  std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_bufferMutex);
   if (m_buffer.empty()) {
     return NULL;
   }
   else {
     canfd_frame *ret = m_buffer.back();
     m_buffer.pop_back();
-    m_bufferSize -= (CANNELLONI_FRAME_BASE_SIZE + canfd_len(ret));
-    /* We need one more byte for CAN_FD Frames */
-    if (ret->len & CANFD_FRAME)
-      m_bufferSize--;
+    m_bufferSize -= canfd_wire_size(ret);
     return ret;
   }
 }
@@ -146,32 +220,33 @@ canfd_frame* FrameBuffer::requestBufferBack() {
 
 
 void FrameBuffer::swapBuffers() {
-  std::unique_lock<std::recursive_mutex> lock1(m_bufferMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock2(m_intermediateBufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock1(m_bufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_intermediateBufferMutex, std::defer_lock);
   std::lock(lock1, lock2);
 
   std::swap(m_bufferSize, m_intermediateBufferSize);
+  std::swap(m_bufferTime, m_intermediateBufferTime);
   m_buffer.swap(m_intermediateBuffer);
 }
 
 void FrameBuffer::sortIntermediateBuffer() {
-  std::lock_guard<std::recursive_mutex> lock(m_intermediateBufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_intermediateBufferMutex);
 
   m_intermediateBuffer.sort(canfd_frame_comp());
 }
 
 void FrameBuffer::mergeIntermediateBuffer() {
-  std::unique_lock<std::recursive_mutex> lock1(m_poolMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock2(m_intermediateBufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock1(m_poolMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_intermediateBufferMutex, std::defer_lock);
   std::lock(lock1, lock2);
 
-  m_framePool.splice(m_framePool.end(), m_intermediateBuffer);
+  releaseFrames(m_intermediateBuffer);
   m_intermediateBufferSize = 0;
 }
 
 void FrameBuffer::returnIntermediateBuffer(std::list<canfd_frame*>::iterator start) {
-  std::unique_lock<std::recursive_mutex> lock1(m_intermediateBufferMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock2(m_bufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock1(m_intermediateBufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_bufferMutex, std::defer_lock);
   std::lock(lock1,lock2);
 
   /* Don't splice since we need to keep track of the size */
@@ -181,6 +256,9 @@ void FrameBuffer::returnIntermediateBuffer(std::list<canfd_frame*>::iterator sta
     it = m_intermediateBuffer.erase(it);
     returnFrame(frame);
   }
+  /* The returned frames are older than everything else in m_buffer */
+  if (!m_buffer.empty())
+    m_bufferTime = std::min(m_bufferTime, m_intermediateBufferTime);
 }
 
 std::list<canfd_frame*>* FrameBuffer::getIntermediateBuffer() {
@@ -201,50 +279,79 @@ void FrameBuffer::debug() {
 }
 
 void FrameBuffer::reset() {
-  std::unique_lock<std::recursive_mutex> lock1(m_poolMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock2(m_bufferMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock3(m_intermediateBufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock1(m_poolMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_bufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock3(m_intermediateBufferMutex, std::defer_lock);
   std::lock(lock1, lock2, lock3);
 
-  /* Splice everything back into the pool */
-  m_framePool.splice(m_framePool.end(), m_intermediateBuffer);
-  m_framePool.splice(m_framePool.end(), m_buffer);
+  /* Splice everything back into the pools */
+  releaseFrames(m_intermediateBuffer);
+  releaseFrames(m_buffer);
 
   m_intermediateBufferSize = 0;
   m_bufferSize = 0;
 }
 
 void FrameBuffer::clearPool() {
-  std::unique_lock<std::recursive_mutex> lock1(m_poolMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock2(m_bufferMutex, std::defer_lock);
-  std::unique_lock<std::recursive_mutex> lock3(m_intermediateBufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock1(m_poolMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_bufferMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock3(m_intermediateBufferMutex, std::defer_lock);
   std::lock(lock1, lock2, lock3);
 
-  for (canfd_frame *f : m_framePool) {
-    delete f;
-  }
-  for (canfd_frame *f : m_intermediateBuffer) {
-    delete f;
-  }
-  for (canfd_frame *f : m_buffer) {
-    delete f;
-  }
+  /* The slabs own the memory of all frames */
   m_framePool.clear();
+  m_classicPool.clear();
+  m_intermediateBuffer.clear();
+  m_buffer.clear();
+  for (const Slab &slab : m_slabs)
+    ::operator delete(slab.begin);
+  m_slabs.clear();
   m_totalAllocCount = 0;
+  m_allocCount[FRAME_CLASS_CLASSIC] = 0;
+  m_allocCount[FRAME_CLASS_FD] = 0;
+  m_bufferSize = 0;
+  m_intermediateBufferSize = 0;
 }
 
 size_t FrameBuffer::getFrameBufferSize() {
-  std::lock_guard<std::recursive_mutex> lock(m_bufferMutex);
+  std::lock_guard<OptionalMutex> lock(m_bufferMutex);
   return m_bufferSize;
 }
 
-bool FrameBuffer::resizePool(std::size_t size, bool debug) {
-  std::lock_guard<std::recursive_mutex> lock(m_poolMutex);
+uint64_t FrameBuffer::getIntermediateBufferTime() {
+  std::lock_guard<OptionalMutex> lock(m_intermediateBufferMutex);
+  return m_intermediateBufferTime;
+}
+
+void FrameBuffer::getPoolStats(PoolStats &stats) {
+  std::unique_lock<OptionalMutex> lock1(m_poolMutex, std::defer_lock);
+  std::unique_lock<OptionalMutex> lock2(m_bufferMutex, std::defer_lock);
+  std::lock(lock1, lock2);
+
+  stats.allocated = m_totalAllocCount;
+  stats.classicAllocated = m_allocCount[FRAME_CLASS_CLASSIC];
+  stats.free = m_framePool.size() + m_classicPool.size();
+  stats.memoryBytes = m_allocCount[FRAME_CLASS_CLASSIC] * slotSize[FRAME_CLASS_CLASSIC]
+                      + m_allocCount[FRAME_CLASS_FD] * slotSize[FRAME_CLASS_FD];
+  stats.buffered = m_buffer.size();
+  stats.bufferedBytes = m_bufferSize;
+  stats.maxAlloc = m_maxAllocCount;
+}
+
+bool FrameBuffer::resizePool(FrameClass frameClass, std::size_t size, bool debug) {
+  std::lock_guard<OptionalMutex> lock(m_poolMutex);
+  if (size == 0)
+    return true;
+  uint8_t *mem = static_cast<uint8_t*>(::operator new(size * slotSize[frameClass], std::nothrow));
+  if (mem == NULL)
+    return false;
+  memset(mem, 0, size * slotSize[frameClass]);
+  m_slabs.push_back({frameClass, mem, mem + size * slotSize[frameClass]});
+  std::list<canfd_frame*> &pool = (frameClass == FRAME_CLASS_FD) ? m_framePool : m_classicPool;
   for (size_t i=0; i<size; i++) {
-      auto f = new canfd_frame;
-      memset(f, 0, sizeof(*f));
-      m_framePool.push_back(f);
+      pool.push_back(reinterpret_cast<canfd_frame*>(mem + i * slotSize[frameClass]));
   }
+  m_allocCount[frameClass] += size;
   m_totalAllocCount += size;
   if (debug)
     linfo << "New Poolsize:" << m_totalAllocCount << std::endl;
@@ -22,7 +22,9 @@
 
 #include <list>
 #include <mutex>
+#include <vector>
 #include "cannelloni.h"
+#include "stats.h"
 
 namespace cannelloni {
 
@@ -49,12 +51,59 @@ namespace cannelloni {
  *
  * The goal is to have FrameBuffer 100% thread-safe to support further
  * use-cases of cannelloni.
+ *
+ * The pool has two size classes. An FD slot holds a complete canfd_frame,
+ * a classic slot only the CAN_MTU bytes of a CAN 2.0 frame. Both are
+ * handed out as canfd_frame, the user of a classic slot must not touch
+ * anything behind data[CAN_MAX_DLEN]. Slots are carved out of slabs,
+ * which also tell the class of a slot that comes back. Each class grows
+ * on demand, both share the limit of m_maxAllocCount.
+ *
+ * Classic slots are only handed out after setClassicSlots(), which is
+ * meant for buffers whose consumer only reads the bytes of a frame that
+ * go on the wire (CANThread, UDPThread). Otherwise every request gets an
+ * FD slot.
  */
 
+/* Size classes of the slots in the pool */
+enum FrameClass {
+  /* CAN_MTU bytes, up to data[CAN_MAX_DLEN] */
+  FRAME_CLASS_CLASSIC,
+  /* A complete canfd_frame */
+  FRAME_CLASS_FD,
+  FRAME_CLASSES
+};
+
+/*
+ * A recursive mutex that can be switched off when only one
+ * thread uses the FrameBuffer, see EventLoop
+ */
+class OptionalMutex {
+  public:
+    OptionalMutex() : m_enabled(true) {}
+
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+
+    void lock() { if (m_enabled) m_mutex.lock(); }
+    void unlock() { if (m_enabled) m_mutex.unlock(); }
+    bool try_lock() { return m_enabled ? m_mutex.try_lock() : true; }
+
+  private:
+    std::recursive_mutex m_mutex;
+    bool m_enabled;
+};
+
 class FrameBuffer {
   public:
     FrameBuffer(size_t size, size_t max);
     ~FrameBuffer();
+
+    /* Disables all locks if producer and consumer share one thread,
+     * must be called before the buffer is used */
+    void setLocking(bool locking);
+    /* Allows classic slots (see Design Notes), must be called before
+     * the buffer is used */
+    void setClassicSlots(bool enabled);
     /* Locks m_poolMutex and takes a free frame from m_framePool,
      * will grow the buffer if no frame is available
      *
@@ -64,6 +113,10 @@ class FrameBuffer {
      */
     canfd_frame* requestFrame(bool overwriteLast, bool debug = false);
 
+    /* Same as above for a slot of frameClass, an FD slot may be returned
+     * instead of a classic one */
+    canfd_frame* requestFrame(FrameClass frameClass, bool overwriteLast, bool debug = false);
+
     /* If a read fails we need to give the frame back */
     void insertFramePool(canfd_frame *frame);
 
@@ -113,22 +166,53 @@ class FrameBuffer {
 
     size_t getFrameBufferSize();
 
+    /* Returns the time (us, CLOCK_MONOTONIC) at which the oldest frame
+     * of m_intermediateBuffer has been inserted */
+    uint64_t getIntermediateBufferTime();
+
+    /* Fills in the current pool and buffer gauges */
+    void getPoolStats(PoolStats &stats);
+
   private:
-    bool resizePool(std::size_t size, bool debug = false);
+    bool resizePool(FrameClass frameClass, std::size_t size, bool debug = false);
+    bool isClassicSlot(const canfd_frame *frame);
+    /* Puts frame into the pool of its class, m_poolMutex must be held */
+    void releaseFrame(canfd_frame *frame);
+    /* Moves all frames of list into the pools, m_poolMutex must be held */
+    void releaseFrames(std::list<canfd_frame*> &list);
 
   private:
+    /* Memory of the slots of one class */
+    struct Slab {
+      FrameClass frameClass;
+      uint8_t *begin;
+      uint8_t *end;
+    };
+
+    /* Free FD slots */
     std::list<canfd_frame*> m_framePool;
+    /* Free classic slots */
+    std::list<canfd_frame*> m_classicPool;
     std::list<canfd_frame*> m_buffer;
     std::list<canfd_frame*> m_intermediateBuffer;
 
+    std::vector<Slab> m_slabs;
+    bool m_classicSlots;
+    /* Slots of both classes and of each class */
     uint64_t m_totalAllocCount;
+    uint64_t m_allocCount[FRAME_CLASSES];
+    /* Slots allocated by the constructor, the minimal growth of a class */
+    size_t m_initialSize;
     /* When filling/swapping the buffers we currently need a mutex */
-    std::recursive_mutex m_bufferMutex;
-    std::recursive_mutex m_intermediateBufferMutex;
-    std::recursive_mutex m_poolMutex;
+    OptionalMutex m_bufferMutex;
+    OptionalMutex m_intermediateBufferMutex;
+    OptionalMutex m_poolMutex;
     /* Track current frame buffer size */
     size_t m_bufferSize;
     size_t m_intermediateBufferSize;
+    /* Insertion time of the oldest frame in each buffer */
+    uint64_t m_bufferTime;
+    uint64_t m_intermediateBufferTime;
     /*
      * This is the maximum of frames that will be
      * allocated. This guarantees that cannelloni stays
@@ -0,0 +1,274 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/select.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "generator.h"
+#include "cannelloni.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+static std::string trim(const std::string &s) {
+  size_t first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos)
+    return "";
+  return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+static bool parseUnsigned(const std::string &s, uint64_t &value) {
+  char *end;
+  if (s.empty())
+    return false;
+  value = strtoull(s.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+static bool validFDLength(uint64_t len) {
+  return len <= 8 || (len % 4 == 0 && (len <= 24 || len % 16 == 0));
+}
+
+GeneratorThread::GeneratorThread(const struct debugOptions_t &debugOptions)
+  : ConnectionThread()
+  , m_random(1)
+  , m_rxCount(0)
+  , m_txCount(0)
+  , m_maxLag(0)
+{
+  memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
+}
+
+GeneratorThread::~GeneratorThread() {}
+
+bool GeneratorThread::loadProfile(const std::string &path, double scale) {
+  std::ifstream file(path.c_str());
+  std::string line;
+  uint32_t lineNumber = 0;
+
+  if (!file.is_open()) {
+    lerror << "Unable to open " << path << "." << std::endl;
+    return false;
+  }
+  if (scale <= 0) {
+    lerror << "Invalid profile scale " << scale << "." << std::endl;
+    return false;
+  }
+  m_sources.clear();
+  while (getline(file, line)) {
+    lineNumber++;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    GeneratorSource source;
+    if (!parseSource(line, scale, source)) {
+      lerror << "Error in " << path << ":" << lineNumber << ": " << line << std::endl;
+      return false;
+    }
+    m_sources.push_back(source);
+  }
+  if (m_sources.empty()) {
+    lerror << path << " contains no sources." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool GeneratorThread::parseSource(const std::string &line, double scale,
+                                  GeneratorSource &source) {
+  std::vector<std::string> fields;
+  std::istringstream ss(line);
+  std::string field;
+  while (getline(ss, field, ','))
+    fields.push_back(trim(field));
+
+  uint64_t id, interval, count = 1, gap = 0;
+  size_t lengthField;
+  if (fields.size() >= 4 && fields[0] == "cyclic") {
+    lengthField = 3;
+  } else if (fields.size() >= 6 && fields[0] == "burst") {
+    if (!parseUnsigned(fields[3], count) || !parseUnsigned(fields[4], gap) || count == 0)
+      return false;
+    lengthField = 5;
+  } else {
+    return false;
+  }
+  if (!parseUnsigned(fields[1], id) || id > CAN_EFF_MASK ||
+      !parseUnsigned(fields[2], interval) || interval == 0)
+    return false;
+  /* A burst has to fit into its interval */
+  if ((count - 1) * gap >= interval)
+    return false;
+
+  source.id = (id > CAN_SFF_MASK) ? (id | CAN_EFF_FLAG) : id;
+  source.fd = false;
+  source.brs = false;
+  if (fields.size() > lengthField + 1) {
+    const std::string &flags = fields[lengthField + 1];
+    if (flags == "fd") {
+      source.fd = true;
+    } else if (flags == "brs") {
+      source.fd = true;
+      source.brs = true;
+    } else {
+      return false;
+    }
+  }
+  source.interval = std::max<uint64_t>(1, interval / scale);
+  source.burstCount = count;
+  source.burstGap = gap / scale;
+
+  std::istringstream lengths(fields[lengthField]);
+  std::string entry;
+  source.totalWeight = 0;
+  while (getline(lengths, entry, '|')) {
+    GeneratorLength length;
+    uint64_t len, weight = 1;
+    size_t at = entry.find('@');
+    if (!parseUnsigned(trim(entry.substr(0, at)), len))
+      return false;
+    if (at != std::string::npos && !parseUnsigned(trim(entry.substr(at + 1)), weight))
+      return false;
+    if (source.fd ? (len > CANFD_MAX_DLEN || !validFDLength(len)) : len > CAN_MAX_DLEN)
+      return false;
+    length.len = len;
+    length.weight = weight;
+    source.totalWeight += weight;
+    source.lengths.push_back(length);
+  }
+  if (source.totalWeight == 0)
+    return false;
+  source.next = 0;
+  source.burstIndex = 0;
+  source.counter = 0;
+  return true;
+}
+
+void GeneratorThread::setBitrates(uint32_t bitrate, uint32_t dataBitrate) {
+  m_busLoad.setBitrates(bitrate, dataBitrate);
+}
+
+void GeneratorThread::run() {
+  fd_set readfds;
+  double framesPerSecond = 0;
+
+  for (GeneratorSource &source : m_sources)
+    framesPerSecond += source.burstCount * 1e6 / source.interval;
+  linfo << "GeneratorThread up and running, " << m_sources.size() << " sources, "
+        << (uint64_t) framesPerSecond << " frames/s" << std::endl;
+
+  uint64_t now = monotonicTime();
+  for (GeneratorSource &source : m_sources)
+    source.next = now + m_random() % source.interval;
+
+  m_timer.adjust(1, 1);
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
+  while (m_started) {
+    FD_ZERO(&readfds);
+    FD_SET(m_timer.getFd(), &readfds);
+    FD_SET(m_statsTimer.getFd(), &readfds);
+    FD_SET(getStopFd(), &readfds);
+    int ret = select(std::max({m_timer.getFd(), m_statsTimer.getFd(), getStopFd()})+1,
+                     &readfds, NULL, NULL, NULL);
+    if (ret < 0) {
+      lerror << "select error" << std::endl;
+      break;
+    }
+    if (FD_ISSET(getStopFd(), &readfds))
+      break;
+    if (FD_ISSET(m_timer.getFd(), &readfds))
+      m_timer.read();
+    if (FD_ISSET(m_statsTimer.getFd(), &readfds) && m_statsTimer.read() > 0)
+      publishStats();
+
+    now = monotonicTime();
+    uint64_t next = UINT64_MAX;
+    for (GeneratorSource &source : m_sources) {
+      while (source.next <= now) {
+        m_maxLag = std::max(m_maxLag, now - source.next);
+        generateFrame(source);
+        if (++source.burstIndex < source.burstCount) {
+          source.next += source.burstGap;
+        } else {
+          source.next += source.interval - (source.burstCount - 1) * source.burstGap;
+          source.burstIndex = 0;
+        }
+      }
+      next = std::min(next, source.next);
+    }
+    /* Sleep until the next frame is due */
+    m_timer.adjust(next - now, next - now);
+  }
+  publishStats();
+  linfo << "Shutting down. Generator Summary: TX: " << m_txCount << " RX: " << m_rxCount
+        << ", max. lag " << m_maxLag << " us" << std::endl;
+}
+
+void GeneratorThread::generateFrame(GeneratorSource &source) {
+  canfd_frame *frame = m_peerThread->getFrameBuffer()->requestFrame(true, m_debugOptions.buffer);
+  if (frame == NULL)
+    return;
+
+  uint32_t pick = m_random() % source.totalWeight;
+  uint8_t len = source.lengths.back().len;
+  for (const GeneratorLength &length : source.lengths) {
+    if (pick < length.weight) {
+      len = length.len;
+      break;
+    }
+    pick -= length.weight;
+  }
+  frame->can_id = source.id;
+  frame->len = len | (source.fd ? CANFD_FRAME : 0);
+  frame->flags = source.brs ? CANFD_BRS : 0;
+  if (len) {
+    frame->data[0] = source.counter++;
+    for (uint8_t i = 1; i < len; i++)
+      frame->data[i] = m_random();
+  }
+  m_busLoad.addFrame(frame, monotonicTime());
+  m_rxCount++;
+  m_peerThread->transmitFrame(frame);
+}
+
+void GeneratorThread::transmitFrame(canfd_frame *frame) {
+  m_frameBuffer->insertFramePool(frame);
+  m_txCount++;
+}
+
+void GeneratorThread::publishStats() {
+  uint64_t now = monotonicTime();
+  CANStats &stats = m_stats->can.beginWrite();
+  stats.rxFrames = m_rxCount;
+  stats.txFrames = m_txCount;
+  m_frameBuffer->getPoolStats(stats.pool);
+  stats.bitrate = m_busLoad.getBitrate();
+  stats.dataBitrate = m_busLoad.getDataBitrate();
+  stats.busLoad[BUSLOAD_100MS] = m_busLoad.getLoad(BUSLOAD_100MS, now);
+  stats.busLoad[BUSLOAD_1S] = m_busLoad.getLoad(BUSLOAD_1S, now);
+  stats.busLoad[BUSLOAD_10S] = m_busLoad.getLoad(BUSLOAD_10S, now);
+  m_stats->can.endWrite();
+}
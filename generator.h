@@ -0,0 +1,117 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "connection.h"
+#include "timer.h"
+#include "busload.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * GeneratorThread takes the place of a CANThread. Instead of reading a
+ * bus, it creates frames from a traffic profile and hands them to its
+ * peer. Frames it receives from the peer are counted and dropped, so
+ * the capacity of a tunnel can be measured without the limits of
+ * real bus hardware.
+ *
+ * A profile is a text file with one source per line, # starts a
+ * comment. Times are in us.
+ *
+ *   cyclic,ID,PERIOD,LENGTHS[,fd|brs]
+ *   burst,ID,INTERVAL,COUNT,GAP,LENGTHS[,fd|brs]
+ *
+ * A cyclic source sends one frame every PERIOD. A burst source sends
+ * COUNT frames GAP apart every INTERVAL, e.g. diagnostic sessions.
+ * IDs above 0x7FF are extended IDs. LENGTHS is a list of payload
+ * lengths with optional weights, e.g. "8" or "8@3|64@1". All sources
+ * start with a random phase so that they do not line up.
+ */
+
+struct GeneratorLength {
+  uint8_t len;
+  uint32_t weight;
+};
+
+struct GeneratorSource {
+  canid_t id;
+  bool fd;
+  bool brs;
+  /* Time between two cycles or bursts */
+  uint64_t interval;
+  /* Frames per burst, 1 for cyclic sources */
+  uint32_t burstCount;
+  uint64_t burstGap;
+  std::vector<GeneratorLength> lengths;
+  uint32_t totalWeight;
+
+  /* Due time of the next frame and position within the burst */
+  uint64_t next;
+  uint32_t burstIndex;
+  /* Rolling counter in the first byte of the payload */
+  uint8_t counter;
+};
+
+class GeneratorThread : public ConnectionThread {
+  public:
+    GeneratorThread(const struct debugOptions_t &debugOptions);
+    virtual ~GeneratorThread();
+
+    /* Loads a profile, all rates are multiplied with scale */
+    bool loadProfile(const std::string &path, double scale);
+
+    virtual void run();
+    virtual void transmitFrame(canfd_frame *frame);
+
+    /* Bitrates used to estimate the bus load the profile corresponds to */
+    void setBitrates(uint32_t bitrate, uint32_t dataBitrate);
+
+  private:
+    bool parseSource(const std::string &line, double scale, GeneratorSource &source);
+    void generateFrame(GeneratorSource &source);
+    void publishStats();
+
+  private:
+    struct debugOptions_t m_debugOptions;
+    std::vector<GeneratorSource> m_sources;
+    std::minstd_rand m_random;
+    Timer m_timer;
+    /* Publishes the counters every CANNELLONI_STATS_INTERVAL us */
+    Timer m_statsTimer;
+    BusLoad m_busLoad;
+
+    /* Performance Counters */
+    uint64_t m_rxCount;
+    /* Incremented by the peer thread */
+    std::atomic<uint64_t> m_txCount;
+    /* Largest delay of a frame behind its due time in us */
+    uint64_t m_maxLag;
+};
+
+}
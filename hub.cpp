@@ -0,0 +1,221 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "hub.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+RouteTable::RouteTable()
+  : m_extendedDestinations(0)
+{
+  memset(m_standard, 0, sizeof(m_standard));
+}
+
+void RouteTable::addRoute(canid_t id, canid_t mask, bool extended, uint32_t destinations) {
+  Route route;
+  route.mask = mask & (extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+  route.id = id & route.mask;
+  route.extended = extended;
+  route.destinations = destinations;
+  m_routes.push_back(route);
+}
+
+void RouteTable::compile() {
+  for (canid_t id = 0; id <= CAN_SFF_MASK; id++)
+    m_standard[id] = resolve(id, false);
+
+  m_extended.clear();
+  m_extendedDestinations = 0;
+  for (const Route &route : m_routes) {
+    if (!route.extended)
+      continue;
+    auto bucket = std::find_if(m_extended.begin(), m_extended.end(),
+                               [&route](const MaskBucket &b) { return b.mask == route.mask; });
+    if (bucket == m_extended.end()) {
+      m_extended.push_back(MaskBucket());
+      bucket = m_extended.end() - 1;
+      bucket->mask = route.mask;
+    }
+    bucket->destinations[route.id] |= route.destinations;
+    m_extendedDestinations |= route.destinations;
+  }
+  std::sort(m_extended.begin(), m_extended.end(), [](const MaskBucket &a, const MaskBucket &b) {
+    return __builtin_popcount(a.mask) > __builtin_popcount(b.mask);
+  });
+}
+
+size_t RouteTable::getRouteCount() const {
+  return m_routes.size();
+}
+
+uint32_t RouteTable::lookupExtended(canid_t id) const {
+  uint32_t destinations = 0;
+  for (const MaskBucket &bucket : m_extended) {
+    auto it = bucket.destinations.find(id & bucket.mask);
+    if (it == bucket.destinations.end())
+      continue;
+    destinations |= it->second;
+    /* The remaining buckets can not add anything */
+    if (destinations == m_extendedDestinations)
+      break;
+  }
+  return destinations;
+}
+
+uint32_t RouteTable::resolve(canid_t id, bool extended) const {
+  uint32_t destinations = 0;
+  for (const Route &route : m_routes) {
+    if (route.extended == extended && (id & route.mask) == route.id)
+      destinations |= route.destinations;
+  }
+  return destinations;
+}
+
+static std::string trim(const std::string &s) {
+  size_t first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos)
+    return "";
+  return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+static bool parseUnsigned(const std::string &s, uint64_t &value) {
+  char *end;
+  if (s.empty())
+    return false;
+  value = strtoull(s.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+static bool parseSite(const std::vector<std::string> &fields, uint16_t port,
+                      const std::vector<HubSite> &sites, HubSite &site) {
+  if (fields.size() != 3 || fields[1].empty() || fields[1] == "local" || fields[1] == "*")
+    return false;
+  for (const HubSite &other : sites) {
+    if (other.name == fields[1])
+      return false;
+  }
+  std::string ip = fields[2];
+  size_t colon = ip.find(':');
+  if (colon != std::string::npos) {
+    uint64_t value;
+    if (!parseUnsigned(ip.substr(colon + 1), value) || value == 0 || value > 0xFFFF)
+      return false;
+    port = value;
+    ip.erase(colon);
+  }
+  site.name = fields[1];
+  memset(&site.addr, 0, sizeof(site.addr));
+  site.addr.sin_family = AF_INET;
+  site.addr.sin_port = htons(port);
+  return inet_pton(AF_INET, ip.c_str(), &site.addr.sin_addr) == 1;
+}
+
+static bool parseRoute(const std::vector<std::string> &fields,
+                       const std::vector<HubSite> &sites, RouteTable &routes) {
+  uint64_t id, mask;
+  if (fields.size() < 4 || fields.size() > 5 ||
+      !parseUnsigned(fields[1], id) || id > CAN_EFF_MASK ||
+      !parseUnsigned(fields[2], mask) || mask > CAN_EFF_MASK)
+    return false;
+  bool extended = id > CAN_SFF_MASK;
+  if (fields.size() == 5) {
+    if (fields[4] != "ext")
+      return false;
+    extended = true;
+  }
+
+  uint32_t destinations = 0;
+  std::istringstream list(fields[3]);
+  std::string name;
+  while (getline(list, name, '|')) {
+    name = trim(name);
+    if (name == "*") {
+      destinations |= HUB_LOCAL | ((1u << sites.size()) - 1);
+    } else if (name == "local") {
+      destinations |= HUB_LOCAL;
+    } else {
+      size_t i = 0;
+      while (i < sites.size() && sites[i].name != name)
+        i++;
+      if (i == sites.size())
+        return false;
+      destinations |= 1u << i;
+    }
+  }
+  routes.addRoute(id, mask, extended, destinations);
+  return true;
+}
+
+bool cannelloni::loadHubTable(const std::string &path, uint16_t port,
+                              std::vector<HubSite> &sites, RouteTable &routes) {
+  std::ifstream file(path.c_str());
+  std::string line;
+  uint32_t lineNumber = 0;
+
+  if (!file.is_open()) {
+    lerror << "Unable to open " << path << "." << std::endl;
+    return false;
+  }
+  sites.clear();
+  while (getline(file, line)) {
+    lineNumber++;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    std::vector<std::string> fields;
+    std::istringstream ss(line);
+    std::string field;
+    while (getline(ss, field, ','))
+      fields.push_back(trim(field));
+
+    bool valid;
+    if (fields[0] == "site") {
+      HubSite site;
+      valid = sites.size() < HUB_MAX_SITES && parseSite(fields, port, sites, site);
+      if (valid)
+        sites.push_back(site);
+    } else if (fields[0] == "route") {
+      /* A route can only name the sites above it */
+      valid = parseRoute(fields, sites, routes);
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      lerror << "Error in " << path << ":" << lineNumber << ": " << line << std::endl;
+      return false;
+    }
+  }
+  if (sites.empty()) {
+    lerror << path << " contains no sites." << std::endl;
+    return false;
+  }
+  routes.compile();
+  return true;
+}
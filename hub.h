@@ -0,0 +1,119 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * In hub mode (-H TABLE), one cannelloni terminates the tunnels of many
+ * sites and forwards frames between them and its local CAN side. The
+ * table lists the sites and the routes, see README.md.
+ *
+ * A route sends the frames with (id & mask) == (ID & mask) to a set of
+ * destinations, a frame goes to the union of the destinations of all
+ * routes it matches. Destinations are kept as a bitmask, bit i is site
+ * i and HUB_LOCAL the local CAN side. RouteTable::compile() resolves all
+ * standard IDs into a table of 2048 masks. The extended routes are
+ * compiled into one hash per distinct mask, from (id & mask) to the
+ * destinations of the routes with that mask, the most specific mask
+ * first. A lookup costs one probe per mask and never allocates, it ends
+ * early once it has all destinations of the extended routes. Tables
+ * have a handful of distinct masks, mostly the exact one.
+ *
+ * Loops are prevented by the origin of a frame, which HubThread knows
+ * from the address a packet came from: a frame never goes back to where
+ * it came from. This needs nothing on the wire, so the sites run an
+ * unmodified cannelloni. Loops across several hubs or through a bus
+ * that is attached at two sites can not be detected, the topology has
+ * to be a tree.
+ */
+
+/* Sites of a hub at most, one bit of a destination mask each */
+#define HUB_MAX_SITES 31
+/* Bit of the local CAN side in a destination mask */
+#define HUB_LOCAL (1u << HUB_MAX_SITES)
+
+struct HubSite {
+  std::string name;
+  struct sockaddr_in addr;
+};
+
+class RouteTable {
+  public:
+    RouteTable();
+
+    /* Frames with (can_id & mask) == (id & mask) go to destinations */
+    void addRoute(canid_t id, canid_t mask, bool extended, uint32_t destinations);
+    /* Compiles the routes, has to be called after the last addRoute() */
+    void compile();
+    size_t getRouteCount() const;
+
+    /* Destinations of a frame with can_id id */
+    inline uint32_t lookup(canid_t id) const {
+      if (!(id & CAN_EFF_FLAG))
+        return m_standard[id & CAN_SFF_MASK];
+      return lookupExtended(id & CAN_EFF_MASK);
+    }
+
+  private:
+    struct Route {
+      canid_t id;
+      canid_t mask;
+      bool extended;
+      uint32_t destinations;
+    };
+
+    struct MaskBucket {
+      canid_t mask;
+      /* Destinations by id & mask */
+      std::unordered_map<canid_t, uint32_t> destinations;
+    };
+
+    uint32_t lookupExtended(canid_t id) const;
+    uint32_t resolve(canid_t id, bool extended) const;
+
+  private:
+    std::vector<Route> m_routes;
+    uint32_t m_standard[CAN_SFF_MASK + 1];
+    std::vector<MaskBucket> m_extended;
+    /* Destinations of all extended routes */
+    uint32_t m_extendedDestinations;
+};
+
+/*
+ * Reads the sites and routes of a hub from path. Sites without a port
+ * use port. Returns false and logs the line on errors.
+ */
+bool loadHubTable(const std::string &path, uint16_t port,
+                  std::vector<HubSite> &sites, RouteTable &routes);
+
+}
@@ -0,0 +1,435 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <sys/select.h>
+#include <arpa/inet.h>
+
+#include "hubthread.h"
+#include "codec.h"
+#include "logging.h"
+#include "iobackend.h"
+#include "sockets.h"
+#include "eventloop.h"
+
+using namespace cannelloni;
+
+typedef PacketCodec<FDFrames> HubCodec;
+
+static uint64_t siteKey(const struct sockaddr_in &addr) {
+  return ((uint64_t) addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+HubThread::HubThread(const struct debugOptions_t &debugOptions,
+                     const struct sockaddr_in &localAddr,
+                     const std::vector<HubSite> &sites,
+                     const RouteTable &routes)
+  : ConnectionThread()
+  , m_socket(0)
+  , m_routes(routes)
+  , m_nextDeadline(0)
+  , m_rxCount(0)
+  , m_txCount(0)
+  , m_rxErrorCount(0)
+  , m_txErrorCount(0)
+  , m_unroutedCount(0)
+{
+  memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
+  memcpy(&m_localAddr, &localAddr, sizeof(struct sockaddr_in));
+  for (const HubSite &config : sites) {
+    Site site;
+    site.config = config;
+    site.stats = NULL;
+    site.rxCount = site.rxFrameCount = site.rxByteCount = site.rxErrorCount = 0;
+    site.txCount = site.txFrameCount = site.txByteCount = site.txErrorCount = 0;
+    m_siteIndex[siteKey(config.addr)] = m_sites.size();
+    m_sites.push_back(site);
+  }
+}
+
+HubThread::~HubThread() {}
+
+int HubThread::start() {
+  if (setup() < 0)
+    return -1;
+  return Thread::start();
+}
+
+int HubThread::attach(EventLoop *loop) {
+  if (setup() < 0)
+    return -1;
+  m_loop = loop;
+  if (loop->add(m_socket, [this]() { handleSocket(); }) < 0 ||
+      loop->add(m_batchTimer.getFd(), [this]() { handleBatchTimer(); }) < 0 ||
+      loop->add(m_inboxTimer.getFd(), [this]() { handleInbox(); }) < 0 ||
+      loop->add(m_statsTimer.getFd(), [this]() { handleStatsTimer(); }) < 0)
+    return -1;
+  loop->addExitHandler([this]() { teardown(); });
+  linfo << "HubThread attached to the event loop" << std::endl;
+  return 0;
+}
+
+int HubThread::setup() {
+  m_socket = openUDPSocket(m_localAddr);
+  if (m_socket < 0)
+    return -1;
+  setIncomingCPU(m_socket);
+  /* The inbox is also drained every timeout, fire() only makes it earlier */
+  m_inboxTimer.adjust(m_flushPolicy.getTimeout(), m_flushPolicy.getTimeout());
+  m_batchTimer.adjust(m_flushPolicy.getTimeout(), m_flushPolicy.getTimeout());
+  m_batchTimer.disable();
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
+  for (const Site &site : m_sites) {
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &site.config.addr.sin_addr, addr, INET_ADDRSTRLEN);
+    linfo << "Site " << site.config.name << " at " << addr << ":"
+          << ntohs(site.config.addr.sin_port) << std::endl;
+  }
+  return 0;
+}
+
+void HubThread::run() {
+  fd_set readfds;
+
+  linfo << "HubThread up and running, " << m_sites.size() << " sites, "
+        << m_routes.getRouteCount() << " routes" << std::endl;
+  while (m_started) {
+    FD_ZERO(&readfds);
+    FD_SET(m_socket, &readfds);
+    FD_SET(m_batchTimer.getFd(), &readfds);
+    FD_SET(m_inboxTimer.getFd(), &readfds);
+    FD_SET(m_statsTimer.getFd(), &readfds);
+    FD_SET(getStopFd(), &readfds);
+
+    int ret = select(std::max({m_socket, m_batchTimer.getFd(), m_inboxTimer.getFd(),
+                               m_statsTimer.getFd(), getStopFd()})+1,
+                     &readfds, NULL, NULL, NULL);
+    if (ret < 0) {
+      lerror << "select error" << std::endl;
+      break;
+    }
+    if (FD_ISSET(getStopFd(), &readfds))
+      break;
+    if (FD_ISSET(m_inboxTimer.getFd(), &readfds))
+      handleInbox();
+    if (FD_ISSET(m_batchTimer.getFd(), &readfds))
+      handleBatchTimer();
+    if (FD_ISSET(m_statsTimer.getFd(), &readfds))
+      handleStatsTimer();
+    if (FD_ISSET(m_socket, &readfds))
+      handleSocket();
+  }
+  teardown();
+}
+
+void HubThread::teardown() {
+  if (m_debugOptions.buffer)
+    m_frameBuffer->debug();
+  linfo << "Shutting down. Hub Summary: TX: " << m_txCount << " RX: " << m_rxCount
+        << " unrouted frames: " << m_unroutedCount << std::endl;
+  publishStats();
+  io()->shutdown(m_socket, SHUT_RDWR);
+  io()->close(m_socket);
+}
+
+void HubThread::transmitFrame(canfd_frame *frame) {
+  m_frameBuffer->insertFrame(frame);
+  /* In the event loop, we are already on the right thread */
+  if (m_loop)
+    drainInbox();
+  else
+    m_inboxTimer.fire();
+}
+
+void HubThread::handleInbox() {
+  if (m_inboxTimer.read() > 0)
+    drainInbox();
+}
+
+void HubThread::drainInbox() {
+  while (canfd_frame *frame = m_frameBuffer->requestBufferFront()) {
+    route(frame, HUB_LOCAL);
+    m_frameBuffer->insertFramePool(frame);
+  }
+}
+
+void HubThread::handleSocket() {
+  uint8_t packet[RECEIVE_BUFFER_SIZE];
+  for (uint32_t n = 0; n < HUB_READ_BATCH; n++) {
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(struct sockaddr_in);
+    ssize_t receivedBytes = io()->recvfrom(m_socket, packet, RECEIVE_BUFFER_SIZE, MSG_DONTWAIT,
+                                           (struct sockaddr *) &clientAddr, &clientAddrLen);
+    if (receivedBytes < 0) {
+      if (errno == EWOULDBLOCK || errno == EAGAIN)
+        return;
+      lerror << "recvfrom error." << std::endl;
+      m_rxErrorCount++;
+      return;
+    }
+    int index = findSite(clientAddr);
+    if (index < 0) {
+      char addr[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &clientAddr.sin_addr, addr, INET_ADDRSTRLEN);
+      lwarn << "Received a packet from " << addr << ":" << ntohs(clientAddr.sin_port)
+            << ", which is not a site." << std::endl;
+      m_rxErrorCount++;
+      continue;
+    }
+    Site &site = m_sites[index];
+    if (m_debugOptions.udp)
+      linfo << "Received " << receivedBytes << " Bytes from " << site.config.name << std::endl;
+
+    uint16_t count = 0;
+    if (HubCodec::readHeader(packet, receivedBytes, count) != PACKET_OK) {
+      lerror << "Received an invalid packet from " << site.config.name << std::endl;
+      site.rxErrorCount++;
+      continue;
+    }
+    site.rxCount++;
+    site.rxByteCount += receivedBytes;
+    m_rxCount++;
+    const uint8_t *data = packet + CANNELLONI_DATA_PACKET_BASE_SIZE;
+    const uint8_t *end = packet + receivedBytes;
+    for (uint16_t i = 0; i < count; i++) {
+      struct canfd_frame frame;
+      if (HubCodec::decode(data, end, &frame) != DECODE_OK) {
+        lerror << "Received incomplete packet / can header corrupt!" << std::endl;
+        site.rxErrorCount++;
+        break;
+      }
+      site.rxFrameCount++;
+      if (m_debugOptions.can)
+        printCANInfo(&frame);
+      route(&frame, 1u << index);
+    }
+  }
+}
+
+int HubThread::findSite(const struct sockaddr_in &addr) {
+  auto it = m_siteIndex.find(siteKey(addr));
+  return it == m_siteIndex.end() ? -1 : (int) it->second;
+}
+
+void HubThread::route(const canfd_frame *frame, uint32_t origin) {
+  /* Error frames and the records of -E and -Y only make sense between two ends */
+  uint32_t destinations = 0;
+  if (!(frame->can_id & CAN_ERR_FLAG))
+    destinations = m_routes.lookup(frame->can_id);
+  if (destinations == 0) {
+    m_unroutedCount++;
+    return;
+  }
+  destinations &= ~origin;
+  if (destinations & HUB_LOCAL)
+    sendLocal(frame);
+  uint32_t sites = destinations & ~HUB_LOCAL;
+  if (sites)
+    queueFrame(*getGroup(sites), frame);
+}
+
+void HubThread::sendLocal(const canfd_frame *frame) {
+  bool fd = frame->len & CANFD_FRAME;
+  /* A CAN 2.0 interface could not write it */
+  if (fd && m_peerThread->getFrameMode() == FRAME_MODE_CLASSIC)
+    return;
+  canfd_frame *copy = m_peerThread->getFrameBuffer()->requestFrame(fd ? FRAME_CLASS_FD : FRAME_CLASS_CLASSIC,
+                                                                   true, m_debugOptions.buffer);
+  if (copy == NULL) {
+    m_rxErrorCount++;
+    return;
+  }
+  memcpy(copy, frame, fd ? CANFD_MTU : CAN_MTU);
+  m_peerThread->transmitFrame(copy);
+}
+
+HubThread::Group* HubThread::getGroup(uint32_t sites) {
+  auto it = m_groupIndex.find(sites);
+  if (it != m_groupIndex.end())
+    return it->second;
+  std::unique_ptr<Group> group(new Group);
+  group->sites = sites;
+  group->data = group->packet + CANNELLONI_DATA_PACKET_BASE_SIZE;
+  group->frameCount = 0;
+  group->sequenceNumber = 0;
+  group->bufferTime = 0;
+  group->deadline = 0;
+  group->trigger = FLUSH_TIMER;
+  if (m_debugOptions.udp)
+    linfo << "New group " << std::hex << sites << std::dec << std::endl;
+  Group *result = group.get();
+  m_groups.push_back(std::move(group));
+  m_groupIndex[sites] = result;
+  return result;
+}
+
+void HubThread::queueFrame(Group &group, const canfd_frame *frame) {
+  if (group.data - group.packet + HubCodec::size(frame) > m_flushPolicy.getPayloadSize())
+    flush(group, FLUSH_FULL);
+  group.data = HubCodec::encode(group.data, frame);
+  group.frameCount++;
+
+  uint64_t expiry;
+  size_t bufferSize = group.data - group.packet - CANNELLONI_DATA_PACKET_BASE_SIZE;
+  FlushTrigger trigger = m_flushPolicy.frameQueued(frame, bufferSize, expiry);
+  if (trigger == FLUSH_FULL) {
+    flush(group, FLUSH_FULL);
+    return;
+  }
+  uint64_t now = monotonicTime();
+  if (group.frameCount == 1) {
+    /* The first frame of the packet starts the buffer timeout */
+    group.bufferTime = now;
+    group.deadline = now + m_flushPolicy.getTimeout();
+    group.trigger = FLUSH_TIMER;
+  }
+  if (trigger == FLUSH_ID_TIMEOUT && now + expiry < group.deadline) {
+    if (m_debugOptions.timer) {
+      linfo << "Found timeout entry for ID " << (frame->can_id & CAN_EFF_MASK)
+            << ". Adjusting timer." << std::endl;
+    }
+    group.deadline = now + expiry;
+    group.trigger = FLUSH_ID_TIMEOUT;
+  }
+  armTimer(group.deadline);
+}
+
+void HubThread::flush(Group &group, FlushTrigger trigger) {
+  HubCodec::writeHeader(group.packet, group.sequenceNumber++, group.frameCount);
+  uint16_t len = group.data - group.packet;
+  /* A frame that is sent right away never started the buffer timeout */
+  uint64_t latency = (trigger == FLUSH_FULL && group.frameCount == 1) ?
+                     0 : monotonicTime() - group.bufferTime;
+  for (uint32_t sites = group.sites; sites; sites &= sites - 1) {
+    Site &site = m_sites[__builtin_ctz(sites)];
+    ssize_t transmittedBytes = io()->sendto(m_socket, group.packet, len, 0,
+                                            (struct sockaddr *) &site.config.addr,
+                                            sizeof(site.config.addr));
+    if (transmittedBytes != len) {
+      lerror << "UDP Socket error. Error while transmitting to " << site.config.name << std::endl;
+      site.txErrorCount++;
+      continue;
+    }
+    site.txCount++;
+    site.txFrameCount += group.frameCount;
+    site.txByteCount += len;
+    if (site.stats) {
+      NetStats &stats = site.stats->net.beginWrite();
+      stats.bufferLatency.add(latency);
+      stats.framesPerPacket.width = FRAMES_PER_PACKET_WIDTH;
+      stats.framesPerPacket.add(group.frameCount);
+      stats.bytesPerPacket.width = BYTES_PER_PACKET_WIDTH;
+      stats.bytesPerPacket.add(len);
+      stats.flushes[trigger]++;
+      site.stats->net.endWrite();
+    }
+  }
+  m_txCount++;
+  group.data = group.packet + CANNELLONI_DATA_PACKET_BASE_SIZE;
+  group.frameCount = 0;
+  group.deadline = 0;
+}
+
+void HubThread::armTimer(uint64_t deadline) {
+  if (m_nextDeadline && m_nextDeadline <= deadline)
+    return;
+  uint64_t now = monotonicTime();
+  m_batchTimer.adjust(m_flushPolicy.getTimeout(), deadline > now ? deadline - now : 1);
+  m_nextDeadline = deadline;
+}
+
+void HubThread::handleBatchTimer() {
+  if (m_batchTimer.read() == 0)
+    return;
+  m_batchTimer.disable();
+  m_nextDeadline = 0;
+  uint64_t now = monotonicTime();
+  for (std::unique_ptr<Group> &group : m_groups) {
+    if (group->frameCount == 0)
+      continue;
+    if (group->deadline <= now)
+      flush(*group, group->trigger);
+    else
+      armTimer(group->deadline);
+  }
+}
+
+void HubThread::handleStatsTimer() {
+  if (m_statsTimer.read() > 0)
+    publishStats();
+}
+
+void HubThread::setTimeout(uint32_t timeout) {
+  m_flushPolicy.setTimeout(timeout);
+}
+
+void HubThread::setTimeoutTable(const std::map<uint32_t,uint32_t> &timeoutTable) {
+  m_flushPolicy.setTimeoutTable(timeoutTable);
+}
+
+void HubThread::setSiteStatistics(size_t index, TunnelStats *stats) {
+  if (index < m_sites.size())
+    m_sites[index].stats = stats;
+}
+
+void HubThread::publishStats() {
+  NetStats total;
+  memset(&total, 0, sizeof(total));
+  for (Site &site : m_sites) {
+    total.rxPackets += site.rxCount;
+    total.rxFrames += site.rxFrameCount;
+    total.rxBytes += site.rxByteCount;
+    total.rxErrors += site.rxErrorCount;
+    total.txPackets += site.txCount;
+    total.txFrames += site.txFrameCount;
+    total.txBytes += site.txByteCount;
+    total.txErrors += site.txErrorCount;
+    if (!site.stats)
+      continue;
+    NetStats &stats = site.stats->net.beginWrite();
+    stats.rxPackets = site.rxCount;
+    stats.rxFrames = site.rxFrameCount;
+    stats.rxBytes = site.rxByteCount;
+    stats.rxErrors = site.rxErrorCount;
+    stats.txPackets = site.txCount;
+    stats.txFrames = site.txFrameCount;
+    stats.txBytes = site.txByteCount;
+    stats.txErrors = site.txErrorCount;
+    stats.payloadSize = m_flushPolicy.getPayloadSize();
+    site.stats->net.endWrite();
+  }
+  NetStats &stats = m_stats->net.beginWrite();
+  stats.rxPackets = total.rxPackets;
+  stats.rxFrames = total.rxFrames;
+  stats.rxBytes = total.rxBytes;
+  stats.rxErrors = total.rxErrors + m_rxErrorCount;
+  stats.txPackets = total.txPackets;
+  stats.txFrames = total.txFrames;
+  stats.txBytes = total.txBytes;
+  stats.txErrors = total.txErrors + m_txErrorCount;
+  stats.payloadSize = m_flushPolicy.getPayloadSize();
+  m_frameBuffer->getPoolStats(stats.pool);
+  m_stats->net.endWrite();
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "connection.h"
+#include "flushpolicy.h"
+#include "hub.h"
+#include "timer.h"
+#include "udpthread.h"
+
+namespace cannelloni {
+
+/* Packets read from the socket at most before the other events are served */
+#define HUB_READ_BATCH 64
+
+/* Design Notes:
+ *
+ * HubThread takes the place of the UDPThread in hub mode. All sites
+ * send to and receive from its single socket, a packet is assigned to
+ * the site with its source address and port. The peer thread is the
+ * local CAN side.
+ *
+ * Frames are routed by their destination mask (see RouteTable) without
+ * their origin. Every distinct mask is a group and has a packet of its
+ * own that the frames are encoded into, like in StaticTunnel. When the
+ * packet is sent, it goes to every site of the group, so a frame is
+ * encoded once no matter how many sites receive it. The groups share
+ * one timer that expires at the earliest buffer timeout of them.
+ *
+ * Frames of the local CAN side arrive on the thread of the peer. They
+ * are queued in the FrameBuffer of the hub and routed on the hub
+ * thread, so the groups are only ever touched by one thread.
+ *
+ * Frames are always encoded with the CAN FD codec. It encodes CAN 2.0
+ * frames exactly like the classic codec, so CAN 2.0 sites drop the CAN
+ * FD frames and keep the rest.
+ */
+
+class HubThread : public ConnectionThread {
+  public:
+    HubThread(const struct debugOptions_t &debugOptions,
+              const struct sockaddr_in &localAddr,
+              const std::vector<HubSite> &sites,
+              const RouteTable &routes);
+    virtual ~HubThread();
+
+    virtual int start();
+    virtual void run();
+    virtual int attach(EventLoop *loop);
+    virtual void transmitFrame(canfd_frame *frame);
+
+    void setTimeout(uint32_t timeout);
+    void setTimeoutTable(const std::map<uint32_t,uint32_t> &timeoutTable);
+    /* Sets the slot the network statistics of site index are published to */
+    void setSiteStatistics(size_t index, TunnelStats *stats);
+
+  private:
+    struct Site {
+      HubSite config;
+      TunnelStats *stats;
+      uint64_t rxCount;
+      uint64_t rxFrameCount;
+      uint64_t rxByteCount;
+      uint64_t rxErrorCount;
+      uint64_t txCount;
+      uint64_t txFrameCount;
+      uint64_t txByteCount;
+      uint64_t txErrorCount;
+    };
+
+    struct Group {
+      /* Sites of the group, never HUB_LOCAL */
+      uint32_t sites;
+      uint8_t packet[UDP_PAYLOAD_SIZE];
+      uint8_t *data;
+      uint16_t frameCount;
+      uint8_t sequenceNumber;
+      /* Arrival of the first frame and expiry of the packet in us */
+      uint64_t bufferTime;
+      uint64_t deadline;
+      FlushTrigger trigger;
+    };
+
+    /* Opens and binds the socket */
+    int setup();
+    void teardown();
+    void handleSocket();
+    void handleInbox();
+    /* Routes the frames of the local CAN side */
+    void drainInbox();
+    void handleBatchTimer();
+    void handleStatsTimer();
+    /* Returns the index of the site addr belongs to or -1 */
+    int findSite(const struct sockaddr_in &addr);
+    /* Passes frame to all destinations except origin, the bit of a site or HUB_LOCAL */
+    void route(const canfd_frame *frame, uint32_t origin);
+    void sendLocal(const canfd_frame *frame);
+    Group* getGroup(uint32_t sites);
+    void queueFrame(Group &group, const canfd_frame *frame);
+    void flush(Group &group, FlushTrigger trigger);
+    /* Makes the timer expire at deadline unless it expires earlier anyway */
+    void armTimer(uint64_t deadline);
+    void publishStats();
+
+  private:
+    struct debugOptions_t m_debugOptions;
+    int m_socket;
+    struct sockaddr_in m_localAddr;
+
+    std::vector<Site> m_sites;
+    /* Site index by address and port */
+    std::unordered_map<uint64_t, uint32_t> m_siteIndex;
+    RouteTable m_routes;
+    FlushPolicy m_flushPolicy;
+
+    std::vector<std::unique_ptr<Group>> m_groups;
+    /* Group by destination mask */
+    std::unordered_map<uint32_t, Group*> m_groupIndex;
+    Timer m_batchTimer;
+    /* Deadline m_batchTimer is armed for, 0 if it is disabled */
+    uint64_t m_nextDeadline;
+    /* Fired by transmitFrame() */
+    Timer m_inboxTimer;
+    /* Publishes the counters every CANNELLONI_STATS_INTERVAL us */
+    Timer m_statsTimer;
+
+    /* Performance Counters */
+    uint64_t m_rxCount;
+    uint64_t m_txCount;
+    uint64_t m_rxErrorCount;
+    uint64_t m_txErrorCount;
+    uint64_t m_unroutedCount;
+};
+
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/ioctl.h>
+
+#include <atomic>
+
+#include "iobackend.h"
+#include "busload.h"
+
+using namespace cannelloni;
+
+static PosixIO posixIO;
+static std::atomic<IOBackend*> activeIO(&posixIO);
+
+IOBackend* cannelloni::io() {
+  return activeIO.load(std::memory_order_relaxed);
+}
+
+void cannelloni::setIO(IOBackend *backend) {
+  activeIO.store(backend ? backend : &posixIO);
+}
+
+int PosixIO::socket(int domain, int type, int protocol) {
+  return ::socket(domain, type, protocol);
+}
+
+int PosixIO::bind(int fd, const struct sockaddr *addr, socklen_t addrLen) {
+  return ::bind(fd, addr, addrLen);
+}
+
+int PosixIO::connect(int fd, const struct sockaddr *addr, socklen_t addrLen) {
+  return ::connect(fd, addr, addrLen);
+}
+
+int PosixIO::setsockopt(int fd, int level, int name, const void *value, socklen_t len) {
+  return ::setsockopt(fd, level, name, value, len);
+}
+
+int PosixIO::ioctl(int fd, unsigned long request, void *arg) {
+  return ::ioctl(fd, request, arg);
+}
+
+ssize_t PosixIO::recvfrom(int fd, void *buffer, size_t len, int flags,
+                          struct sockaddr *addr, socklen_t *addrLen) {
+  return ::recvfrom(fd, buffer, len, flags, addr, addrLen);
+}
+
+ssize_t PosixIO::recvmsg(int fd, struct msghdr *msg, int flags) {
+  return ::recvmsg(fd, msg, flags);
+}
+
+ssize_t PosixIO::sendto(int fd, const void *buffer, size_t len, int flags,
+                        const struct sockaddr *addr, socklen_t addrLen) {
+  return ::sendto(fd, buffer, len, flags, addr, addrLen);
+}
+
+int PosixIO::shutdown(int fd, int how) {
+  return ::shutdown(fd, how);
+}
+
+int PosixIO::close(int fd) {
+  return ::close(fd);
+}
+
+bool PosixIO::readBitrates(const std::string &interfaceName,
+                           uint32_t &bitrate, uint32_t &dataBitrate) {
+  return BusLoad::readBitrates(interfaceName, bitrate, dataBitrate);
+}
+
+uint64_t PosixIO::monotonicTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+uint64_t PosixIO::realtimeTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <string>
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * The UDP and CAN threads do not call the socket API directly but go
+ * through the IOBackend returned by io(). By default this is PosixIO,
+ * which forwards every call to the kernel.
+ *
+ * A different backend (e.g. SimIO) can be installed with setIO()
+ * before any thread is started. Every descriptor a backend returns
+ * must be a real file descriptor that becomes readable once data is
+ * available, so that the threads can keep waiting in select()
+ * together with their timerfds.
+ *
+ * The backend also provides the clocks that are used for statistics,
+ * bus load and latency measurements.
+ */
+
+class IOBackend {
+  public:
+    virtual ~IOBackend() {}
+
+    virtual int socket(int domain, int type, int protocol) = 0;
+    virtual int bind(int fd, const struct sockaddr *addr, socklen_t addrLen) = 0;
+    /* Only used for CAN_BCM sockets */
+    virtual int connect(int fd, const struct sockaddr *addr, socklen_t addrLen) = 0;
+    virtual int setsockopt(int fd, int level, int name, const void *value, socklen_t len) = 0;
+    /* Only SIOCGIFINDEX and SIOCGIFMTU are used */
+    virtual int ioctl(int fd, unsigned long request, void *arg) = 0;
+    virtual ssize_t recvfrom(int fd, void *buffer, size_t len, int flags,
+                             struct sockaddr *addr, socklen_t *addrLen) = 0;
+    /* Used for the flags of a message (MSG_CONFIRM), only msg_iov is filled */
+    virtual ssize_t recvmsg(int fd, struct msghdr *msg, int flags) = 0;
+    /* addr may be NULL for sockets with a fixed destination (CAN) */
+    virtual ssize_t sendto(int fd, const void *buffer, size_t len, int flags,
+                           const struct sockaddr *addr, socklen_t addrLen) = 0;
+    virtual int shutdown(int fd, int how) = 0;
+    virtual int close(int fd) = 0;
+
+    /* Nominal and data bitrate of a CAN interface, false if unknown */
+    virtual bool readBitrates(const std::string &interfaceName,
+                              uint32_t &bitrate, uint32_t &dataBitrate) = 0;
+
+    /* CLOCK_MONOTONIC and CLOCK_REALTIME in us */
+    virtual uint64_t monotonicTime() = 0;
+    virtual uint64_t realtimeTime() = 0;
+};
+
+/*
+ * Forwards everything to the kernel
+ */
+class PosixIO : public IOBackend {
+  public:
+    virtual int socket(int domain, int type, int protocol);
+    virtual int bind(int fd, const struct sockaddr *addr, socklen_t addrLen);
+    virtual int connect(int fd, const struct sockaddr *addr, socklen_t addrLen);
+    virtual int setsockopt(int fd, int level, int name, const void *value, socklen_t len);
+    virtual int ioctl(int fd, unsigned long request, void *arg);
+    virtual ssize_t recvfrom(int fd, void *buffer, size_t len, int flags,
+                             struct sockaddr *addr, socklen_t *addrLen);
+    virtual ssize_t recvmsg(int fd, struct msghdr *msg, int flags);
+    virtual ssize_t sendto(int fd, const void *buffer, size_t len, int flags,
+                           const struct sockaddr *addr, socklen_t addrLen);
+    virtual int shutdown(int fd, int how);
+    virtual int close(int fd);
+
+    virtual bool readBitrates(const std::string &interfaceName,
+                              uint32_t &bitrate, uint32_t &dataBitrate);
+
+    virtual uint64_t monotonicTime();
+    virtual uint64_t realtimeTime();
+};
+
+/* Returns the active backend */
+IOBackend* io();
+/* Installs backend, NULL restores PosixIO. Must not be called while threads run */
+void setIO(IOBackend *backend);
+
+}
@@ -21,6 +21,7 @@
 #pragma once
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <string>
 
 #include "cannelloni.h"
@@ -35,7 +36,8 @@ inline std::string splitFilename(const std::string &path) {
     return path.substr(pos+1);
 }
 
-#define FUNCTION_STRING splitFilename(__FILE__) << "[" << std::dec <<  __LINE__ << "]:" << __FUNCTION__ << ":"
+/* Does not touch the stream flags, they are shared by all threads */
+#define FUNCTION_STRING splitFilename(__FILE__) << "[" << std::to_string(__LINE__) << "]:" << __FUNCTION__ << ":"
 #define INFO_STRING "INFO:"
 #define ERROR_STRING "ERROR:"
 #define WARNING_STRING "WARNING:"
@@ -45,27 +47,30 @@ inline std::string splitFilename(const std::string &path) {
 #define lerror std::cerr << ERROR_STRING << FUNCTION_STRING
 
 inline void printCANInfo(const canfd_frame *frame) {
+  /* Format locally, std::cout and its flags are shared by all threads */
+  std::ostringstream out;
   if (frame->len & CANFD_FRAME) {
-    std::cout << "FD|";
+    out << "FD|";
   } else {
-    std::cout << "LC|";
+    out << "LC|";
   }
   if (frame->can_id & CAN_EFF_FLAG) {
-    std::cout << "EFF Frame ID[" << std::setw(5) << std::dec << (frame->can_id & CAN_EFF_MASK) << "]";
+    out << "EFF Frame ID[" << std::setw(5) << std::dec << (frame->can_id & CAN_EFF_MASK) << "]";
   } else {
-    std::cout << "SFF Frame ID[" << std::setw(5) << std::dec << (frame->can_id & CAN_SFF_MASK) << "]";
+    out << "SFF Frame ID[" << std::setw(5) << std::dec << (frame->can_id & CAN_SFF_MASK) << "]";
   }
   if (frame->can_id & CAN_ERR_FLAG)
-    std::cout << "\t ERROR\t";
+    out << "\t ERROR\t";
   else
-    std::cout << "\t Length:" << std::dec << (int) canfd_len(frame) << "\t";
+    out << "\t Length:" << std::dec << (int) canfd_len(frame) << "\t";
 
   if (frame->can_id & CAN_RTR_FLAG)  {
-      std::cout << "\tREMOTE";
+      out << "\tREMOTE";
   } else {
     /* This will also contain the error information */
     for (uint8_t i=0; i < canfd_len(frame); i++)
-      std::cout << std::setbase(16) << " " << int(frame->data[i]);
+      out << std::setbase(16) << " " << int(frame->data[i]);
   }
-  std::cout << std::endl;
+  out << std::endl;
+  std::cout << out.str();
 };
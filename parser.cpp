@@ -1,77 +1,64 @@
 #include "parser.h"
+#include "codec.h"
 
-#include <arpa/inet.h>
-#include <string.h>
+#include <stdexcept>
 
-void parseFrames(uint16_t len, const uint8_t* buffer, std::function<canfd_frame*()> frameAllocator,
+template <class Mode>
+void parseFrames(uint16_t len, const uint8_t* buffer, std::function<canfd_frame*(bool)> frameAllocator,
         std::function<void(canfd_frame*, bool)> frameReceiver)
 {
     using namespace cannelloni;
+    typedef PacketCodec<Mode> Codec;
 
-    const struct CannelloniDataPacket* data;
-    /* Check for OP Code */
-    data = reinterpret_cast<const struct CannelloniDataPacket*> (buffer);
-    if (data->version != CANNELLONI_FRAME_VERSION)
-        throw std::runtime_error("Received wrong version");
-
-    if (data->op_code != DATA)
-        throw std::runtime_error("Received wrong OP code");
-
-    if (ntohs(data->count) == 0)
-        return; // Empty packets silently ignored
+    uint16_t count = 0;
+    switch (Codec::readHeader(buffer, len, count))
+    {
+        case PACKET_INCOMPLETE:
+            throw std::runtime_error("Received incomplete packet");
+        case PACKET_WRONG_VERSION:
+            throw std::runtime_error("Received wrong version");
+        case PACKET_WRONG_OP_CODE:
+            throw std::runtime_error("Received wrong OP code");
+        default:
+            break;
+    }
 
     const uint8_t* rawData = buffer + CANNELLONI_DATA_PACKET_BASE_SIZE;
+    const uint8_t* end = buffer + len;
 
-    for (uint16_t i = 0; i < ntohs(data->count); i++)
+    for (uint16_t i = 0; i < count; i++)
     {
         if (rawData - buffer + CANNELLONI_FRAME_BASE_SIZE > len)
             throw std::runtime_error("Received incomplete packet");
 
         /* We got at least a complete canfd_frame header */
-        canfd_frame* frame = frameAllocator();
+        canfd_frame* frame = frameAllocator(Codec::needsFDSlot(rawData));
         if (!frame)
             throw std::runtime_error("Allocation error.");
 
-        canid_t tmp;
-        memcpy(&tmp, rawData, sizeof (canid_t));
-        frame->can_id = ntohl(tmp);
-        /* += 4 */
-        rawData += sizeof (canid_t);
-        frame->len = *rawData;
-        /* += 1 */
-        rawData += sizeof (frame->len);
-        /* If this is a CAN FD frame, also retrieve the flags */
-        if (frame->len & CANFD_FRAME)
+        switch (Codec::decode(rawData, end, frame))
         {
-            frame->flags = *rawData;
-            /* += 1 */
-            rawData += sizeof (frame->flags);
-        }
-        /* RTR Frames have no data section although they have a dlc */
-        if ((frame->can_id & CAN_RTR_FLAG) == 0)
-        {
-            /* Check again now that we know the dlc */
-            if (rawData - buffer + canfd_len(frame) > len)
-            {
+            case DECODE_OK:
+                frameReceiver(frame, true);
+                break;
+            case DECODE_SKIP:
+                frameReceiver(frame, false);
+                break;
+            default:
                 frame->len = 0;
                 frameReceiver(frame, false);
-
                 throw std::runtime_error("Received incomplete packet / can header corrupt!");
-            }
-
-            memcpy(frame->data, rawData, canfd_len(frame));
-            rawData += canfd_len(frame);
         }
-
-        frameReceiver(frame, true);
     }
 }
 
+template <class Mode>
 uint8_t* buildPacket(uint16_t len, uint8_t* packetBuffer,
         std::list<canfd_frame*>& frames, uint8_t seqNo,
         std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)> handleOverflow)
 {
     using namespace cannelloni;
+    typedef PacketCodec<Mode> Codec;
 
     uint16_t frameCount = 0;
     uint8_t* data = packetBuffer + CANNELLONI_DATA_PACKET_BASE_SIZE;
@@ -79,40 +66,40 @@ uint8_t* buildPacket(uint16_t len, uint8_t* packetBuffer,
     {
         canfd_frame* frame = *it;
         /* Check for packet overflow */
-        if ((data - packetBuffer + CANNELLONI_FRAME_BASE_SIZE + canfd_len(frame)
-                + ((frame->len & CANFD_FRAME) ? sizeof(frame->flags) : 0))
-                > len)
+        if (data - packetBuffer + Codec::size(frame) > len)
         {
             handleOverflow(frames, it);
             break;
         }
-        canid_t tmp = htonl(frame->can_id);
-        memcpy(data, &tmp, sizeof(canid_t));
-        /* += 4 */
-        data += sizeof(canid_t);
-        *data = frame->len;
-        /* += 1 */
-        data += sizeof(frame->len);
-        /* If this is a CAN FD frame, also send the flags */
-        if (frame->len & CANFD_FRAME)
-        {
-            *data = frame->flags;
-            /* += 1 */
-            data += sizeof(frame->flags);
-        }
-        if ((frame->can_id & CAN_RTR_FLAG) == 0)
-        {
-            memcpy(data, frame->data, canfd_len(frame));
-            data += canfd_len(frame);
-        }
+        data = Codec::encode(data, frame);
         frameCount++;
     }
-    struct CannelloniDataPacket* dataPacket;
-    dataPacket = (struct CannelloniDataPacket*) (packetBuffer);
-    dataPacket->version = CANNELLONI_FRAME_VERSION;
-    dataPacket->op_code = DATA;
-    dataPacket->seq_no = seqNo;
-    dataPacket->count = htons(frameCount);
+    Codec::writeHeader(packetBuffer, seqNo, frameCount);
 
     return data;
 }
+
+template void parseFrames<cannelloni::FDFrames>(uint16_t, const uint8_t*,
+        std::function<canfd_frame*(bool)>, std::function<void(canfd_frame*, bool)>);
+template void parseFrames<cannelloni::ClassicFrames>(uint16_t, const uint8_t*,
+        std::function<canfd_frame*(bool)>, std::function<void(canfd_frame*, bool)>);
+template uint8_t* buildPacket<cannelloni::FDFrames>(uint16_t, uint8_t*,
+        std::list<canfd_frame*>&, uint8_t,
+        std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)>);
+template uint8_t* buildPacket<cannelloni::ClassicFrames>(uint16_t, uint8_t*,
+        std::list<canfd_frame*>&, uint8_t,
+        std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)>);
+
+void parseFrames(uint16_t len, const uint8_t* buffer, std::function<canfd_frame*()> frameAllocator,
+        std::function<void(canfd_frame*, bool)> frameReceiver)
+{
+    auto allocator = [&frameAllocator](bool) { return frameAllocator(); };
+    parseFrames<cannelloni::FDFrames>(len, buffer, allocator, frameReceiver);
+}
+
+uint8_t* buildPacket(uint16_t len, uint8_t* packetBuffer,
+        std::list<canfd_frame*>& frames, uint8_t seqNo,
+        std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)> handleOverflow)
+{
+    return buildPacket<cannelloni::FDFrames>(len, packetBuffer, frames, seqNo, handleOverflow);
+}
@@ -30,6 +30,21 @@ void parseFrames(uint16_t len, const uint8_t* buffer,
         std::function<canfd_frame*()> frameAllocator,
         std::function<void(canfd_frame*, bool)> frameReceiver);
 
+/**
+ * parseFrames() specialized for a frame mode (cannelloni::FDFrames or
+ * cannelloni::ClassicFrames). The classic variant hands frames that do not
+ * fit into a CAN 2.0 frame to frameReceiver as failed and goes on with the
+ * next frame of the packet.
+ *
+ * frameAllocator is told whether the frame is a CAN FD frame. Otherwise,
+ * nothing behind data[CAN_MAX_DLEN] is written, so a classic pool slot
+ * is sufficient.
+ */
+template <class Mode>
+void parseFrames(uint16_t len, const uint8_t* buffer,
+        std::function<canfd_frame*(bool)> frameAllocator,
+        std::function<void(canfd_frame*, bool)> frameReceiver);
+
 /**
  * Builds Cannelloni packet from provided list of CAN frames
  * @param len Buffer length
@@ -45,4 +60,14 @@ uint8_t* buildPacket(uint16_t len, uint8_t* packetBuffer,
         std::list<canfd_frame*>& frames, uint8_t seqNo,
         std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)> handleOverflow);
 
+/**
+ * buildPacket() specialized for a frame mode. The classic variant must only
+ * be given CAN 2.0 frames, it never encodes flags. Both variants are
+ * instantiated in parser.cpp.
+ */
+template <class Mode>
+uint8_t* buildPacket(uint16_t len, uint8_t* packetBuffer,
+        std::list<canfd_frame*>& frames, uint8_t seqNo,
+        std::function<void(std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator)> handleOverflow);
+
 #endif /* PARSER_H_ */
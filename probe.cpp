@@ -0,0 +1,111 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+
+#include "probe.h"
+#include "stats.h"
+
+using namespace cannelloni;
+
+LatencyProbe::LatencyProbe()
+  : m_id(0)
+  , m_rate(0)
+  , m_enabled(false)
+  , m_sequenceNumber(0)
+{
+  memset(m_sentSequence, 0xff, sizeof(m_sentSequence));
+  memset(m_sentTime, 0, sizeof(m_sentTime));
+  memset(m_sentRealTime, 0, sizeof(m_sentRealTime));
+}
+
+void LatencyProbe::setId(canid_t id) {
+  m_id = id;
+  m_enabled = true;
+}
+
+canid_t LatencyProbe::getId() {
+  return m_id;
+}
+
+void LatencyProbe::setRate(uint32_t rate) {
+  m_rate = rate;
+}
+
+uint32_t LatencyProbe::getRate() {
+  return m_rate;
+}
+
+bool LatencyProbe::isEnabled() {
+  return m_enabled;
+}
+
+bool LatencyProbe::isProbe(const struct canfd_frame *frame) {
+  return m_enabled && frame->can_id == m_id && frame->len == 8;
+}
+
+bool LatencyProbe::isRequest(const struct canfd_frame *frame) {
+  return frame->data[0] == PROBE_REQUEST;
+}
+
+void LatencyProbe::fill(struct canfd_frame *frame, uint8_t type, uint32_t seq, uint32_t timestamp) {
+  memset(frame, 0, sizeof(struct canfd_frame));
+  frame->can_id = m_id;
+  frame->len = 8;
+  frame->data[0] = type;
+  frame->data[1] = seq >> 16;
+  frame->data[2] = seq >> 8;
+  frame->data[3] = seq;
+  frame->data[4] = timestamp >> 24;
+  frame->data[5] = timestamp >> 16;
+  frame->data[6] = timestamp >> 8;
+  frame->data[7] = timestamp;
+}
+
+void LatencyProbe::buildRequest(struct canfd_frame *frame) {
+  uint32_t seq = m_sequenceNumber++ & 0xffffff;
+  m_sentSequence[seq % PROBE_HISTORY] = seq;
+  m_sentTime[seq % PROBE_HISTORY] = monotonicTime();
+  m_sentRealTime[seq % PROBE_HISTORY] = realtimeTime();
+  fill(frame, PROBE_REQUEST, seq, m_sentRealTime[seq % PROBE_HISTORY]);
+}
+
+void LatencyProbe::buildReply(const struct canfd_frame *request, struct canfd_frame *reply) {
+  uint32_t seq = (request->data[1] << 16) | (request->data[2] << 8) | request->data[3];
+  fill(reply, PROBE_REPLY, seq, realtimeTime());
+}
+
+bool LatencyProbe::handleReply(const struct canfd_frame *reply, uint64_t &roundTrip,
+                               int64_t &forward, int64_t &backward) {
+  uint32_t seq = (reply->data[1] << 16) | (reply->data[2] << 8) | reply->data[3];
+  if (m_sentSequence[seq % PROBE_HISTORY] != seq)
+    return false;
+  /* Only match each request once */
+  m_sentSequence[seq % PROBE_HISTORY] = UINT32_MAX;
+
+  uint32_t remoteTime = (reply->data[4] << 24) | (reply->data[5] << 16)
+                      | (reply->data[6] << 8) | reply->data[7];
+  uint32_t nowReal = realtimeTime();
+
+  roundTrip = monotonicTime() - m_sentTime[seq % PROBE_HISTORY];
+  forward = (int32_t) (remoteTime - m_sentRealTime[seq % PROBE_HISTORY]);
+  backward = (int32_t) (nowReal - remoteTime);
+  return true;
+}
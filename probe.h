@@ -0,0 +1,102 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * Probe frames measure the latency between the two CAN buses of a
+ * tunnel. Both instances must reserve the same CAN ID for them.
+ *
+ * The active side creates a request and hands it to the network thread
+ * as if it had been received from its bus. Once the remote side has
+ * written the request onto its bus, it answers with a reply that
+ * travels the tunnel backwards and is written onto the bus of the
+ * active side. At that point the round trip is complete.
+ *
+ * Each probe is a CAN 2.0 frame with 8 bytes of data (big endian):
+ *
+ * | Bytes | Description                                        |
+ * |-------|----------------------------------------------------|
+ * |   1   | Type, PROBE_REQUEST or PROBE_REPLY                 |
+ * |   3   | Sequence number                                    |
+ * |   4   | CLOCK_REALTIME in us (lower 32 bit) of the sender, |
+ * |       | for replies when the request hit the remote bus    |
+ *
+ * The one-way latencies are only meaningful if the clocks of both
+ * hosts are synchronized (e.g. NTP or PTP).
+ */
+
+#define PROBE_REQUEST 0
+#define PROBE_REPLY   1
+
+/* Number of outstanding requests that are remembered */
+#define PROBE_HISTORY 256
+
+class LatencyProbe {
+  public:
+    LatencyProbe();
+
+    /* Sets the reserved ID, include CAN_EFF_FLAG for extended IDs */
+    void setId(canid_t id);
+    canid_t getId();
+    /* Requests per second, 0 only answers requests of the remote */
+    void setRate(uint32_t rate);
+    uint32_t getRate();
+
+    bool isEnabled();
+    bool isProbe(const struct canfd_frame *frame);
+    bool isRequest(const struct canfd_frame *frame);
+
+    /* Fills frame with the next request */
+    void buildRequest(struct canfd_frame *frame);
+    /* Fills reply with the answer to request */
+    void buildReply(const struct canfd_frame *request, struct canfd_frame *reply);
+
+    /*
+     * Matches a reply that has been written onto the bus against the
+     * outstanding requests. Returns false if the request is unknown.
+     * forward and backward are negative if the clocks are not synchronized.
+     */
+    bool handleReply(const struct canfd_frame *reply, uint64_t &roundTrip,
+                     int64_t &forward, int64_t &backward);
+
+  private:
+    void fill(struct canfd_frame *frame, uint8_t type, uint32_t seq, uint32_t timestamp);
+
+  private:
+    canid_t m_id;
+    uint32_t m_rate;
+    bool m_enabled;
+    uint32_t m_sequenceNumber;
+    /* Sequence number, CLOCK_MONOTONIC and CLOCK_REALTIME (lower 32 bit)
+     * of outstanding requests */
+    uint32_t m_sentSequence[PROBE_HISTORY];
+    uint64_t m_sentTime[PROBE_HISTORY];
+    uint32_t m_sentRealTime[PROBE_HISTORY];
+};
+
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <sstream>
+
+#include "realtime.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+static std::atomic<bool> s_memoryLocked(false);
+
+SchedulingOptions::SchedulingOptions()
+  : policy(SCHED_OTHER)
+  , priority(0)
+{
+}
+
+bool SchedulingOptions::isDefault() const {
+  return cpus.empty() && policy == SCHED_OTHER;
+}
+
+static bool parseNumber(const std::string &s, int &value) {
+  char *end;
+  if (s.empty())
+    return false;
+  long v = strtol(s.c_str(), &end, 10);
+  if (*end != '\0' || v < 0)
+    return false;
+  value = v;
+  return true;
+}
+
+bool cannelloni::parseSchedulingOptions(const std::string &spec, SchedulingOptions &options) {
+  std::vector<std::string> fields;
+  std::istringstream ss(spec);
+  std::string field;
+  while (std::getline(ss, field, ':'))
+    fields.push_back(field);
+  if (fields.empty() || fields.size() > 3)
+    return false;
+
+  options = SchedulingOptions();
+  std::istringstream cpus(fields[0]);
+  std::string cpu;
+  while (std::getline(cpus, cpu, ',')) {
+    int first, last;
+    size_t dash = cpu.find('-');
+    if (dash == std::string::npos) {
+      if (!parseNumber(cpu, first))
+        return false;
+      last = first;
+    } else if (!parseNumber(cpu.substr(0, dash), first) ||
+               !parseNumber(cpu.substr(dash + 1), last) || last < first) {
+      return false;
+    }
+    for (int i = first; i <= last; i++) {
+      if (i >= CPU_SETSIZE)
+        return false;
+      options.cpus.push_back(i);
+    }
+  }
+
+  if (fields.size() >= 2) {
+    if (fields[1] == "other") {
+      options.policy = SCHED_OTHER;
+    } else if (fields[1] == "fifo") {
+      options.policy = SCHED_FIFO;
+    } else if (fields[1] == "rr") {
+      options.policy = SCHED_RR;
+    } else {
+      return false;
+    }
+  }
+  if (options.policy != SCHED_OTHER) {
+    options.priority = sched_get_priority_min(options.policy);
+    if (fields.size() == 3 && !parseNumber(fields[2], options.priority))
+      return false;
+    if (options.priority < sched_get_priority_min(options.policy) ||
+        options.priority > sched_get_priority_max(options.policy))
+      return false;
+  } else if (fields.size() == 3) {
+    return false;
+  }
+  return true;
+}
+
+bool cannelloni::applySchedulingOptions(const SchedulingOptions &options, const std::string &name) {
+  bool success = true;
+  if (!options.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : options.cpus)
+      CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+      lwarn << "Could not set the CPU affinity of " << name << ": " << strerror(ret) << std::endl;
+      success = false;
+    }
+  }
+  if (options.policy != SCHED_OTHER) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = options.priority;
+    int ret = pthread_setschedparam(pthread_self(), options.policy, &param);
+    if (ret != 0) {
+      lwarn << "Could not set the scheduling policy of " << name << ": " << strerror(ret)
+            << " (needs CAP_SYS_NICE)" << std::endl;
+      success = false;
+    }
+  }
+  return success;
+}
+
+bool cannelloni::lockMemory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    lerror << "mlockall failed: " << strerror(errno) << " (needs CAP_IPC_LOCK)" << std::endl;
+    return false;
+  }
+  s_memoryLocked = true;
+  prefaultStack();
+  return true;
+}
+
+void cannelloni::prefaultStack() {
+  if (!s_memoryLocked)
+    return;
+  volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+  long pageSize = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < sizeof(stack); i += pageSize)
+    stack[i] = 0;
+}
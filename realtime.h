@@ -0,0 +1,77 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * Every Thread can be pinned to a set of CPUs and run with a real-time
+ * policy. The settings are applied by the thread itself before run()
+ * is called. A thread that is pinned also sets SO_INCOMING_CPU on its
+ * sockets to the first CPU of its set. This does not move the softirq
+ * processing of the packets, the kernel only uses it to pick a socket
+ * of a SO_REUSEPORT group. Which CPU receives the packets is decided by
+ * the IRQ affinity of the NIC and by RPS/RFS, see README.md.
+ *
+ * lockMemory() locks all current and future pages of the process.
+ * Since the stack of a thread is only mapped once it is touched, every
+ * thread prefaults a part of its stack when it starts. Together, no
+ * page fault should hit the data path after startup.
+ */
+
+/* Bytes of stack every thread touches when memory is locked */
+#define REALTIME_STACK_PREFAULT (128 * 1024)
+
+struct SchedulingOptions {
+  /* Empty for all CPUs */
+  std::vector<int> cpus;
+  /* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+  int policy;
+  /* Only used for SCHED_FIFO and SCHED_RR */
+  int priority;
+
+  SchedulingOptions();
+  bool isDefault() const;
+};
+
+/*
+ * Parses CPUS[:POLICY[:PRIORITY]], e.g. "2", "2,3:fifo:50" or ":rr:10".
+ * CPUS is a comma separated list that can contain ranges (0-3),
+ * POLICY is one of other, fifo and rr.
+ */
+bool parseSchedulingOptions(const std::string &spec, SchedulingOptions &options);
+
+/* Applies options to the calling thread, name is used for messages */
+bool applySchedulingOptions(const SchedulingOptions &options, const std::string &name);
+
+/* Calls mlockall and enables stack prefaulting for all threads */
+bool lockMemory();
+
+/* Touches REALTIME_STACK_PREFAULT bytes of stack if memory is locked */
+void prefaultStack();
+
+}
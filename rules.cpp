@@ -0,0 +1,248 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "rules.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+static std::string trim(const std::string &s) {
+  size_t first = s.find_first_not_of(" \t\r");
+  if (first == std::string::npos)
+    return "";
+  return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+static bool parseUnsigned(const std::string &s, uint64_t &value) {
+  char *end;
+  if (s.empty())
+    return false;
+  value = strtoull(s.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+/* IDs above 0x7FF or with CAN_EFF_FLAG are extended IDs */
+static bool parseId(const std::string &s, canid_t &id) {
+  uint64_t value;
+  if (!parseUnsigned(s, value) || (value & ~(uint64_t) (CAN_EFF_FLAG | CAN_EFF_MASK)))
+    return false;
+  id = value;
+  if (id > CAN_SFF_MASK)
+    id |= CAN_EFF_FLAG;
+  return true;
+}
+
+static bool parseByte(const std::string &s, uint64_t max, uint8_t &byte) {
+  uint64_t value;
+  if (!parseUnsigned(s, value) || value > max)
+    return false;
+  byte = value;
+  return true;
+}
+
+FrameRules::FrameRules()
+  : m_rewrittenCount(0)
+  , m_droppedCount(0)
+{
+  memset(m_standard, 0, sizeof(m_standard));
+  for (int i = 0; i < 256; i++) {
+    uint8_t crc = i;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
+    m_crc8[i] = crc;
+  }
+}
+
+bool FrameRules::load(const std::string &path) {
+  std::ifstream file(path.c_str());
+  std::string line;
+  uint32_t lineNumber = 0;
+
+  if (!file.is_open()) {
+    lerror << "Unable to open " << path << "." << std::endl;
+    return false;
+  }
+  m_programs.clear();
+  memset(m_standard, 0, sizeof(m_standard));
+  while (getline(file, line)) {
+    lineNumber++;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    std::vector<std::string> fields;
+    std::istringstream ss(line);
+    std::string field;
+    while (getline(ss, field, ','))
+      fields.push_back(trim(field));
+
+    canid_t id;
+    Rule rule;
+    if (!parseRule(fields, id, rule)) {
+      lerror << "Error in " << path << ":" << lineNumber << ": " << line << std::endl;
+      return false;
+    }
+    Program &program = m_programs[id];
+    if (program.rules.empty())
+      program.counter = 0;
+    program.rules.push_back(rule);
+  }
+  if (m_programs.empty()) {
+    lerror << path << " contains no rules." << std::endl;
+    return false;
+  }
+  for (auto &entry : m_programs) {
+    if (!(entry.first & CAN_EFF_FLAG))
+      m_standard[entry.first] = &entry.second;
+  }
+  return true;
+}
+
+bool FrameRules::parseRule(const std::vector<std::string> &fields, canid_t &id, Rule &rule) {
+  if (fields.size() < 2 || !parseId(fields[0], id))
+    return false;
+  const std::string &op = fields[1];
+  memset(&rule, 0, sizeof(rule));
+  if (op == "drop") {
+    rule.op = RULE_DROP;
+    return fields.size() == 2;
+  }
+  if (op == "id") {
+    canid_t newId;
+    rule.op = RULE_ID;
+    if (fields.size() != 3 || !parseId(fields[2], newId))
+      return false;
+    rule.value = newId;
+    return true;
+  }
+  if (op == "set" || op == "and" || op == "or" || op == "xor" || op == "counter") {
+    uint8_t value;
+    if (fields.size() != 4 || !parseByte(fields[2], CANFD_MAX_DLEN - 1, rule.byte) ||
+        !parseByte(fields[3], 0xFF, value))
+      return false;
+    rule.value = value;
+    if (op == "set")
+      rule.op = RULE_SET;
+    else if (op == "and")
+      rule.op = RULE_AND;
+    else if (op == "or")
+      rule.op = RULE_OR;
+    else if (op == "xor")
+      rule.op = RULE_XOR;
+    else
+      rule.op = RULE_COUNTER;
+    /* The counter needs at least one bit */
+    return rule.op != RULE_COUNTER || value != 0;
+  }
+  if (op == "checksum") {
+    if (fields.size() != 6 || !parseByte(fields[2], CANFD_MAX_DLEN - 1, rule.byte) ||
+        !parseByte(fields[3], CANFD_MAX_DLEN - 1, rule.first) ||
+        !parseByte(fields[4], CANFD_MAX_DLEN - 1, rule.last) || rule.first > rule.last)
+      return false;
+    if (fields[5] == "xor")
+      rule.op = RULE_CHECKSUM_XOR;
+    else if (fields[5] == "sum")
+      rule.op = RULE_CHECKSUM_SUM;
+    else if (fields[5] == "crc8")
+      rule.op = RULE_CHECKSUM_CRC8;
+    else
+      return false;
+    return true;
+  }
+  return false;
+}
+
+bool FrameRules::empty() const {
+  return m_programs.empty();
+}
+
+bool FrameRules::run(Program &program, canfd_frame *frame) {
+  uint8_t len = canfd_len(frame);
+  for (const Rule &rule : program.rules) {
+    switch (rule.op) {
+      case RULE_DROP:
+        m_droppedCount++;
+        return false;
+      case RULE_ID:
+        frame->can_id = rule.value | (frame->can_id & CAN_RTR_FLAG);
+        break;
+      case RULE_SET:
+        if (rule.byte < len)
+          frame->data[rule.byte] = rule.value;
+        break;
+      case RULE_AND:
+        if (rule.byte < len)
+          frame->data[rule.byte] &= rule.value;
+        break;
+      case RULE_OR:
+        if (rule.byte < len)
+          frame->data[rule.byte] |= rule.value;
+        break;
+      case RULE_XOR:
+        if (rule.byte < len)
+          frame->data[rule.byte] ^= rule.value;
+        break;
+      case RULE_COUNTER:
+        if (rule.byte < len) {
+          uint8_t counter = (program.counter << __builtin_ctz(rule.value)) & rule.value;
+          frame->data[rule.byte] = (frame->data[rule.byte] & ~rule.value) | counter;
+        }
+        break;
+      case RULE_CHECKSUM_XOR:
+      case RULE_CHECKSUM_SUM:
+      case RULE_CHECKSUM_CRC8:
+        if (rule.byte < len && rule.last < len)
+          frame->data[rule.byte] = checksum(rule, frame);
+        break;
+    }
+  }
+  program.counter++;
+  m_rewrittenCount++;
+  return true;
+}
+
+uint8_t FrameRules::checksum(const Rule &rule, const canfd_frame *frame) const {
+  uint8_t result = (rule.op == RULE_CHECKSUM_CRC8) ? 0xFF : 0;
+  for (uint8_t i = rule.first; i <= rule.last; i++) {
+    /* The checksum byte itself is not part of the checksum */
+    if (i == rule.byte)
+      continue;
+    if (rule.op == RULE_CHECKSUM_XOR)
+      result ^= frame->data[i];
+    else if (rule.op == RULE_CHECKSUM_SUM)
+      result += frame->data[i];
+    else
+      result = m_crc8[result ^ frame->data[i]];
+  }
+  return (rule.op == RULE_CHECKSUM_CRC8) ? result ^ 0xFF : result;
+}
+
+uint64_t FrameRules::getRewrittenCount() const {
+  return m_rewrittenCount;
+}
+
+uint64_t FrameRules::getDroppedCount() const {
+  return m_droppedCount;
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * FrameRules rewrites and drops frames that CANThread reads from the bus
+ * before they are tunneled (-g RULES), like cangw but without another
+ * trip through the kernel. Each line of the rules file adds one
+ * operation to the program of one ID, see README.md. The operations of
+ * an ID run in the order of the file.
+ *
+ * load() compiles the file into one program per ID. Standard IDs are
+ * dispatched through a table of 2048 pointers, extended IDs through a
+ * hash map, so finding the program of a frame costs the same no matter
+ * how many rules there are. Frames of IDs without rules only pay for
+ * that lookup.
+ *
+ * A program counts the frames of its ID for the counter operation, the
+ * counter advances once per frame. Byte operations beyond the length of
+ * a frame are skipped.
+ */
+
+enum RuleOp {
+  RULE_DROP,
+  /* Replace the ID, keeps RTR */
+  RULE_ID,
+  RULE_SET,
+  RULE_AND,
+  RULE_OR,
+  RULE_XOR,
+  /* Write the frame counter into the bits of mask of a byte */
+  RULE_COUNTER,
+  /* Write a checksum over the bytes first..last into a byte */
+  RULE_CHECKSUM_XOR,
+  RULE_CHECKSUM_SUM,
+  /* CRC-8 SAE J1850, polynomial 0x1D, initial value and final XOR 0xFF */
+  RULE_CHECKSUM_CRC8
+};
+
+class FrameRules {
+  public:
+    FrameRules();
+    /* m_standard points into m_programs */
+    FrameRules(const FrameRules&) = delete;
+    FrameRules& operator=(const FrameRules&) = delete;
+
+    /* Reads and compiles the rules in path, logs the line on errors */
+    bool load(const std::string &path);
+    bool empty() const;
+
+    /* Applies the rules of the ID of frame, returns false if it has to be dropped */
+    inline bool apply(canfd_frame *frame) {
+      Program *program;
+      if (frame->can_id & CAN_EFF_FLAG) {
+        auto it = m_programs.find(frame->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+        program = (it == m_programs.end()) ? NULL : &it->second;
+      } else {
+        program = m_standard[frame->can_id & CAN_SFF_MASK];
+      }
+      return program == NULL || run(*program, frame);
+    }
+
+    uint64_t getRewrittenCount() const;
+    uint64_t getDroppedCount() const;
+
+  private:
+    struct Rule {
+      RuleOp op;
+      uint8_t byte;
+      uint8_t first;
+      uint8_t last;
+      /* Operand of the byte operations, mask of the counter or the new ID */
+      uint32_t value;
+    };
+
+    struct Program {
+      std::vector<Rule> rules;
+      uint32_t counter;
+    };
+
+    bool parseRule(const std::vector<std::string> &fields, canid_t &id, Rule &rule);
+    bool run(Program &program, canfd_frame *frame);
+    uint8_t checksum(const Rule &rule, const canfd_frame *frame) const;
+
+  private:
+    /* Keyed by the ID with CAN_EFF_FLAG for extended IDs, nodes never move */
+    std::unordered_map<canid_t, Program> m_programs;
+    Program *m_standard[CAN_SFF_MASK + 1];
+    uint8_t m_crc8[256];
+    uint64_t m_rewrittenCount;
+    uint64_t m_droppedCount;
+};
+
+}
@@ -18,7 +18,6 @@
  *
  */
 
-#include <chrono>
 #include <cstdio>
 #include <algorithm>
 
@@ -55,7 +54,7 @@ SCTPThread::SCTPThread(const struct debugOptions_t &debugOptions,
   , m_checkPeerConnect(checkPeer)
   , m_connected(false)
 {
-  m_payloadSize = SCTP_PAYLOAD_SIZE;
+  m_flushPolicy.setPayloadSize(SCTP_PAYLOAD_SIZE);
 }
 
 int SCTPThread::start() {
@@ -84,6 +83,11 @@ int SCTPThread::start() {
   return Thread::start();
 }
 
+int SCTPThread::attach(EventLoop *loop) {
+  lerror << "SCTP is not supported in the event loop" << std::endl;
+  return -1;
+}
+
 void SCTPThread::run() {
   fd_set readfds;
   ssize_t receivedBytes;
@@ -91,9 +95,9 @@ void SCTPThread::run() {
   struct sockaddr_in clientAddr;
   socklen_t clientAddrLen = sizeof(struct sockaddr_in);
 
-  /* Set interval to m_timeout */
-  m_transmitTimer.adjust(m_timeout, m_timeout);
-  m_blockTimer.adjust(SELECT_TIMEOUT, SELECT_TIMEOUT);
+  /* Set interval to the buffer timeout */
+  m_transmitTimer.adjust(m_flushPolicy.getTimeout(), m_flushPolicy.getTimeout());
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
 
   while (m_started) {
     if (!m_connected) {
@@ -102,25 +106,21 @@ void SCTPThread::run() {
         char connAddrStr[INET_ADDRSTRLEN];
         socklen_t connAddrLen = sizeof(connAddr);
         fd_set readfds;
-        struct timeval timeout;
         const int nagle = 0;
 
         listen(m_serverSocket, 1);
         FD_ZERO(&readfds);
         FD_SET(m_serverSocket, &readfds);
+        FD_SET(getStopFd(), &readfds);
 
         linfo << "Waiting for a client to connect." << std::endl;
-        /* Set Timeout to 1 second */
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        int ret = select(m_serverSocket+1, &readfds, NULL, NULL, &timeout);
+        int ret = select(std::max(m_serverSocket, getStopFd())+1, &readfds, NULL, NULL, NULL);
         if (ret < 0) {
           lerror << "select error" << std::endl;
           continue;
-        } else if (ret == 0) {
-          /* Timeout occured, checking whether m_started changed */
-          continue;
-        } /* else */
+        }
+        if (FD_ISSET(getStopFd(), &readfds))
+          break;
         m_socket = accept(m_serverSocket,(struct sockaddr*) &connAddr, &connAddrLen);
         /* Reject all further connection attemps */
         listen(m_serverSocket, 0);
@@ -143,7 +143,7 @@ void SCTPThread::run() {
                   << ", which is not set as a remote." << std::endl;
             close(m_socket);
             /* Wait here for some time */
-            std::this_thread::sleep_for(std::chrono::seconds(2));
+            waitForStop(2000);
             continue;
           }
         } else {
@@ -172,7 +172,7 @@ void SCTPThread::run() {
           close(m_socket);
           linfo << "Connect failed." << std::endl;
           /* Wait here for some time */
-          std::this_thread::sleep_for(std::chrono::seconds(2));
+          waitForStop(2000);
           continue;
         } else {
           linfo << "Connected!" << std::endl;
@@ -184,8 +184,10 @@ void SCTPThread::run() {
       FD_ZERO(&readfds);
       FD_SET(m_socket, &readfds);
       FD_SET(m_transmitTimer.getFd(), &readfds);
-      FD_SET(m_blockTimer.getFd(), &readfds);
-      int ret = select(std::max({m_socket, m_transmitTimer.getFd(), m_blockTimer.getFd()})+1,
+      FD_SET(m_statsTimer.getFd(), &readfds);
+      FD_SET(getStopFd(), &readfds);
+      int ret = select(std::max({m_socket, m_transmitTimer.getFd(), m_statsTimer.getFd(),
+                                 getStopFd()})+1,
         &readfds, NULL, NULL, NULL);
       if (ret < 0) {
         if (errno == EOF) {
@@ -200,13 +202,16 @@ void SCTPThread::run() {
         if (m_transmitTimer.read() > 0) {
           if (m_frameBuffer->getFrameBufferSize())
             prepareBuffer();
-          else
+          else {
             m_transmitTimer.disable();
+            m_flushTriggers = 0;
+          }
         }
       }
-      if (FD_ISSET(m_blockTimer.getFd(), &readfds)) {
-        m_blockTimer.read();
-      }
+      if (FD_ISSET(m_statsTimer.getFd(), &readfds))
+        handleStatsTimer();
+      if (FD_ISSET(getStopFd(), &readfds))
+        break;
       if (FD_ISSET(m_socket, &readfds)) {
         struct sctp_sndrcvinfo sinfo;
         int flags = 0;
@@ -217,6 +222,7 @@ void SCTPThread::run() {
                         (struct sockaddr *) &clientAddr, &clientAddrLen, &sinfo, &flags);
         if (receivedBytes < 0) {
           lerror << "recvfrom error." << std::endl;
+          m_rxErrorCount++;
           /* close connection */
           m_connected = false;
           close(m_socket);
@@ -231,10 +237,14 @@ void SCTPThread::run() {
       }
     }
   }
+  publishStats();
   if (m_debugOptions.buffer) {
     m_frameBuffer->debug();
   }
   linfo << "Shutting down. SCTP Transmission Summary: TX: " << m_txCount << " RX: " << m_rxCount << std::endl;
+  if (m_debugOptions.buffer) {
+    debugFlushes();
+  }
   m_connected = false;
   close(m_socket);
   if (m_role == SERVER) {
@@ -254,6 +264,16 @@ void SCTPThread::transmitFrame(canfd_frame *frame) {
   }
 }
 
+bool SCTPThread::waitForStop(uint32_t ms) {
+  fd_set readfds;
+  struct timeval timeout;
+  FD_ZERO(&readfds);
+  FD_SET(getStopFd(), &readfds);
+  timeout.tv_sec = ms / 1000;
+  timeout.tv_usec = (ms % 1000) * 1000;
+  return select(getStopFd()+1, &readfds, NULL, NULL, &timeout) > 0;
+}
+
 ssize_t SCTPThread::sendBuffer(uint8_t *buffer, uint16_t len) {
   struct sctp_sndrcvinfo sinfo;
   bzero(&sinfo, sizeof(sinfo));
@@ -23,6 +23,8 @@
 #include "udpthread.h"
 #include <netinet/sctp.h>
 
+#include <atomic>
+
 namespace cannelloni {
 
 /* The common header + one Chunk Header */
@@ -42,6 +44,8 @@ class SCTPThread : public UDPThread {
 
     virtual int start();
     virtual void run();
+    /* The connection handling of SCTP needs its own thread */
+    virtual int attach(EventLoop *loop);
 
     virtual void transmitFrame(canfd_frame *frame);
 
@@ -49,12 +53,15 @@ class SCTPThread : public UDPThread {
     virtual ssize_t sendBuffer(uint8_t *buffer, uint16_t len);
   private:
     bool isConnected();
+    /* Sleeps for ms, returns true early if the thread has been stopped */
+    bool waitForStop(uint32_t ms);
 
   private:
     bool m_checkPeerConnect;
     int m_serverSocket;
     sctp_assoc_t m_assoc_id;
-    bool m_connected;
+    /* Read by transmitFrame() in the CAN thread */
+    std::atomic<bool> m_connected;
     SCTPThreadRole m_role;
 };
 
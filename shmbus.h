@@ -0,0 +1,153 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+#include "cannelloni.h"
+#include "spscring.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * The shared memory bus connects local processes to a tunnel without a
+ * vcan interface. cannelloni creates the region, clients map it with
+ * libcannelloni-client. Every client owns a slot with two SPSC rings:
+ * rx is filled by cannelloni and drained by the client, tx the other
+ * way round. Frames are written into and read from the ring slots in
+ * place, see shmCopyFrame(), no syscall is involved while both sides are
+ * busy.
+ *
+ * Each frame is copied once into a ring and once out of it. The two
+ * processes share nothing but the region, so a frame can not be handed
+ * over by reference: a slot that several clients point at would need a
+ * reference count the server has to trust every client to release. The
+ * copies only cover the header and the used data bytes, 16 bytes for a
+ * CAN 2.0 frame instead of the 72 of a canfd_frame.
+ *
+ * A side that runs out of work announces it in a futex word (waiting,
+ * serverWaiting) and sleeps on it. The producer checks the word after
+ * every push and only then issues a FUTEX_WAKE. Both sides put a full
+ * fence between their store and the following load, so either the
+ * sleeper sees the new frame or the producer sees the sleeper.
+ *
+ * Slots go FREE -> CLAIMED -> ACTIVE -> CLOSING -> FREE. Clients claim
+ * and close slots, only cannelloni frees them, so it never works on a
+ * slot that is handed out again. A client that finds no free slot
+ * closes the slots of dead processes on their behalf.
+ *
+ * Subscriptions work like CAN_RAW_FILTER: a frame is delivered if
+ * (can_id & mask) == (id & mask) for any filter. A client without
+ * filters receives everything. The filters are protected by a sequence
+ * lock, see SeqLocked in stats.h.
+ *
+ * The layout is part of the external interface. Whenever it changes,
+ * CANNELLONI_SHM_VERSION must be increased.
+ */
+
+#define CANNELLONI_SHM_MAGIC 0x4d484e43 /* "CNHM" */
+#define CANNELLONI_SHM_VERSION 1
+
+#define CANNELLONI_SHM_MAX_CLIENTS 8
+#define CANNELLONI_SHM_MAX_FILTERS 16
+/* Frames per ring */
+#define CANNELLONI_SHM_RING_SIZE 4096
+
+enum ShmClientState {
+  SHM_CLIENT_FREE,
+  SHM_CLIENT_CLAIMED,
+  SHM_CLIENT_ACTIVE,
+  SHM_CLIENT_CLOSING
+};
+
+struct ShmFilter {
+  std::atomic<uint32_t> id;
+  std::atomic<uint32_t> mask;
+};
+
+typedef SPSCRing<canfd_frame, CANNELLONI_SHM_RING_SIZE> ShmRing;
+
+struct ShmClient {
+  std::atomic<uint32_t> state;
+  std::atomic<int32_t> pid;
+  /* Futex word, 1 while the client sleeps until rx is filled */
+  std::atomic<uint32_t> waiting;
+  /* Odd while the client updates the filters */
+  std::atomic<uint32_t> filterSeq;
+  std::atomic<uint32_t> filterCount;
+  ShmFilter filters[CANNELLONI_SHM_MAX_FILTERS];
+  /* Frames cannelloni could not put into a full rx ring */
+  std::atomic<uint64_t> rxDropped;
+  /* cannelloni to client */
+  ShmRing rx;
+  /* client to cannelloni */
+  ShmRing tx;
+};
+
+struct ShmBusRegion {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  /* 0 once cannelloni has shut down */
+  std::atomic<int32_t> serverPid;
+  /* Futex word, 1 while cannelloni sleeps until a tx ring is filled */
+  std::atomic<uint32_t> serverWaiting;
+  uint32_t reserved;
+  ShmClient clients[CANNELLONI_SHM_MAX_CLIENTS];
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain integers");
+
+/*
+ * Copies the header and the data bytes of from, len is the length field
+ * the caller has checked. from may be a slot another process writes to,
+ * so its len is never read again.
+ */
+inline void shmCopyFrame(canfd_frame *to, const canfd_frame *from, uint8_t len) {
+  memcpy(to, from, offsetof(struct canfd_frame, data));
+  to->len = len;
+  memcpy(to->data, from->data, len & ~CANFD_FRAME);
+}
+
+/* Sleeps while *word is value, timeout may be NULL */
+inline void shmFutexWait(std::atomic<uint32_t> &word, uint32_t value, const struct timespec *timeout) {
+  syscall(SYS_futex, &word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+/* To be called by a producer after a push, wakes the consumer if it sleeps */
+inline void shmNotify(std::atomic<uint32_t> &waiting) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting.load(std::memory_order_relaxed) && waiting.exchange(0))
+    syscall(SYS_futex, &waiting, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+}
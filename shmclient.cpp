@@ -0,0 +1,238 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "cannelloni_client.h"
+#include "cannelloni.h"
+#include "shmbus.h"
+
+using namespace cannelloni;
+
+static_assert(CANNELLONI_CANFD_FRAME == CANFD_FRAME, "FD marker of the API and the wire differ");
+
+/* How long open() waits for cannelloni to free the slot of a dead client */
+#define SHM_CLIENT_RECLAIM_MS 100
+
+struct cannelloni_client {
+  ShmBusRegion *region;
+  ShmClient *slot;
+};
+
+static ShmBusRegion* mapRegion(const char *name) {
+  std::string shmName = (name[0] == '/') ? name : std::string("/") + name;
+  int fd = shm_open(shmName.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(ShmBusRegion)) {
+    close(fd);
+    errno = EPROTO;
+    return NULL;
+  }
+  void *mem = mmap(NULL, sizeof(ShmBusRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED)
+    return NULL;
+  ShmBusRegion *region = static_cast<ShmBusRegion*>(mem);
+  if (region->magic != CANNELLONI_SHM_MAGIC || region->version != CANNELLONI_SHM_VERSION ||
+      region->size != sizeof(ShmBusRegion) || region->serverPid == 0) {
+    munmap(mem, sizeof(ShmBusRegion));
+    errno = EPROTO;
+    return NULL;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return region;
+}
+
+static ShmClient* claimSlot(ShmBusRegion *region) {
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++) {
+    uint32_t expected = SHM_CLIENT_FREE;
+    if (region->clients[i].state.compare_exchange_strong(expected, SHM_CLIENT_CLAIMED))
+      return &region->clients[i];
+  }
+  return NULL;
+}
+
+/* Closes the slots of clients that have died, returns true if there were any */
+static bool closeDeadSlots(ShmBusRegion *region) {
+  bool found = false;
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++) {
+    ShmClient &client = region->clients[i];
+    if (client.state != SHM_CLIENT_ACTIVE)
+      continue;
+    if (kill(client.pid, 0) < 0 && errno == ESRCH) {
+      uint32_t expected = SHM_CLIENT_ACTIVE;
+      if (client.state.compare_exchange_strong(expected, SHM_CLIENT_CLOSING))
+        found = true;
+    }
+  }
+  if (found)
+    shmNotify(region->serverWaiting);
+  return found;
+}
+
+extern "C" {
+
+cannelloni_client* cannelloni_client_open(const char *name) {
+  ShmBusRegion *region = mapRegion(name);
+  if (region == NULL)
+    return NULL;
+
+  ShmClient *slot = claimSlot(region);
+  if (slot == NULL && closeDeadSlots(region)) {
+    /* cannelloni frees the slots on its next poll */
+    for (int i = 0; i < SHM_CLIENT_RECLAIM_MS && slot == NULL; i++) {
+      usleep(1000);
+      slot = claimSlot(region);
+    }
+  }
+  if (slot == NULL) {
+    munmap(region, sizeof(ShmBusRegion));
+    errno = EBUSY;
+    return NULL;
+  }
+
+  /* cannelloni does not look at a claimed slot, we have it to ourselves */
+  slot->pid = getpid();
+  slot->waiting = 0;
+  slot->filterCount = 0;
+  slot->filterSeq = 0;
+  slot->rxDropped = 0;
+  slot->rx.reset();
+  slot->tx.reset();
+  slot->state.store(SHM_CLIENT_ACTIVE, std::memory_order_release);
+  shmNotify(region->serverWaiting);
+
+  cannelloni_client *client = new cannelloni_client;
+  client->region = region;
+  client->slot = slot;
+  return client;
+}
+
+void cannelloni_client_close(cannelloni_client *client) {
+  if (client == NULL)
+    return;
+  client->slot->state.store(SHM_CLIENT_CLOSING, std::memory_order_release);
+  shmNotify(client->region->serverWaiting);
+  munmap(client->region, sizeof(ShmBusRegion));
+  delete client;
+}
+
+int cannelloni_client_subscribe(cannelloni_client *client, canid_t id, canid_t mask) {
+  ShmClient *slot = client->slot;
+  uint32_t count = slot->filterCount.load(std::memory_order_relaxed);
+  if (count >= CANNELLONI_SHM_MAX_FILTERS)
+    return -1;
+  uint32_t seq = slot->filterSeq.load(std::memory_order_relaxed);
+  slot->filterSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->filters[count].id.store(id, std::memory_order_relaxed);
+  slot->filters[count].mask.store(mask, std::memory_order_relaxed);
+  slot->filterCount.store(count + 1, std::memory_order_relaxed);
+  slot->filterSeq.store(seq + 2, std::memory_order_release);
+  return 0;
+}
+
+void cannelloni_client_unsubscribe_all(cannelloni_client *client) {
+  ShmClient *slot = client->slot;
+  uint32_t seq = slot->filterSeq.load(std::memory_order_relaxed);
+  slot->filterSeq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->filterCount.store(0, std::memory_order_relaxed);
+  slot->filterSeq.store(seq + 2, std::memory_order_release);
+}
+
+int cannelloni_client_send(cannelloni_client *client, const struct canfd_frame *frame) {
+  uint8_t max = (frame->len & CANFD_FRAME) ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  if (canfd_len(frame) > max || client->region->serverPid == 0)
+    return -1;
+  canfd_frame *slot = client->slot->tx.reserve();
+  if (slot == NULL)
+    return -1;
+  shmCopyFrame(slot, frame, frame->len);
+  client->slot->tx.commit();
+  shmNotify(client->region->serverWaiting);
+  return 0;
+}
+
+int cannelloni_client_receive(cannelloni_client *client, struct canfd_frame *frame) {
+  ShmRing &rx = client->slot->rx;
+  const canfd_frame *slot = rx.front();
+  if (slot == NULL)
+    return 0;
+  /* cannelloni checked the length before it wrote the slot */
+  shmCopyFrame(frame, slot, slot->len);
+  rx.consume();
+  return 1;
+}
+
+int cannelloni_client_wait(cannelloni_client *client, int timeout_ms) {
+  ShmClient *slot = client->slot;
+  struct timespec now, deadline;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  while (slot->rx.empty()) {
+    if (client->region->serverPid == 0)
+      return -1;
+    struct timespec timeout;
+    if (timeout_ms >= 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+      timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if (timeout.tv_nsec < 0) {
+        timeout.tv_sec--;
+        timeout.tv_nsec += 1000000000L;
+      }
+      if (timeout.tv_sec < 0)
+        return 0;
+    }
+    /* Announce that we sleep and look again, see shmNotify */
+    slot->waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    /* A wakeup may be left over from frames we have already taken, loop then */
+    if (slot->rx.empty() && client->region->serverPid != 0)
+      shmFutexWait(slot->waiting, 1, timeout_ms < 0 ? NULL : &timeout);
+    slot->waiting.store(0);
+  }
+  return 1;
+}
+
+uint64_t cannelloni_client_dropped(cannelloni_client *client) {
+  return client->slot->rxDropped.load(std::memory_order_relaxed);
+}
+
+}
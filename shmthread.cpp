@@ -0,0 +1,297 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "shmthread.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+ShmThread::ShmThread(const struct debugOptions_t &debugOptions, const std::string &name)
+  : ConnectionThread()
+  , m_name((name[0] == '/') ? name : "/" + name)
+  , m_region(NULL)
+  , m_pendingNotify(0)
+  , m_rxCount(0)
+  , m_txCount(0)
+  , m_rxErrorCount(0)
+  , m_txErrorCount(0)
+  , m_remoteSummaryCount(0)
+  , m_remoteCyclicCount(0)
+{
+  memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
+  memset(m_filters, 0, sizeof(m_filters));
+}
+
+ShmThread::~ShmThread() {
+  closeRegion();
+}
+
+int ShmThread::start() {
+  if (!openRegion())
+    return -1;
+  return Thread::start();
+}
+
+void ShmThread::stop() {
+  Thread::stop();
+  /* The thread may sleep on the futex instead of the stop fd */
+  if (m_region)
+    shmNotify(m_region->serverWaiting);
+}
+
+bool ShmThread::openRegion() {
+  int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+  if (fd < 0) {
+    lerror << "Could not create shared memory bus " << m_name << std::endl;
+    return false;
+  }
+  if (ftruncate(fd, sizeof(ShmBusRegion)) < 0) {
+    lerror << "Could not resize shared memory bus " << m_name << std::endl;
+    close(fd);
+    shm_unlink(m_name.c_str());
+    return false;
+  }
+  void *mem = mmap(NULL, sizeof(ShmBusRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    lerror << "Could not map shared memory bus " << m_name << std::endl;
+    shm_unlink(m_name.c_str());
+    return false;
+  }
+  /* The mapping is zero-filled, all slots are free and all rings empty */
+  m_region = static_cast<ShmBusRegion*>(mem);
+  m_region->size = sizeof(ShmBusRegion);
+  m_region->version = CANNELLONI_SHM_VERSION;
+  m_region->serverPid = getpid();
+  /* Clients check the magic last */
+  std::atomic_thread_fence(std::memory_order_release);
+  m_region->magic = CANNELLONI_SHM_MAGIC;
+  return true;
+}
+
+void ShmThread::closeRegion() {
+  if (!m_region)
+    return;
+  /* Tell the clients that we are gone and wake those that wait */
+  m_region->serverPid = 0;
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++)
+    shmNotify(m_region->clients[i].waiting);
+  munmap(m_region, sizeof(ShmBusRegion));
+  m_region = NULL;
+  shm_unlink(m_name.c_str());
+}
+
+void ShmThread::run() {
+  uint32_t busyPolls = 0;
+
+  linfo << "ShmThread up and running, bus " << m_name << std::endl;
+  while (m_started) {
+    if (poll()) {
+      if (++busyPolls % SHM_STATS_POLLS == 0)
+        publishStats();
+      continue;
+    }
+    /* Out of work, announce that we sleep and look again */
+    publishStats();
+    m_region->serverWaiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_started)
+      break;
+    if (!poll())
+      shmFutexWait(m_region->serverWaiting, 1, NULL);
+    m_region->serverWaiting.store(0);
+  }
+  /* stop() woke us through the futex, see Design Notes */
+  clearStop();
+  publishStats();
+  linfo << "Shutting down. Shared memory bus Summary: TX: " << m_txCount << " RX: " << m_rxCount << std::endl;
+}
+
+bool ShmThread::poll() {
+  bool busy = false;
+
+  updateClients();
+
+  /* Frames from the network */
+  while (canfd_frame *frame = m_frameBuffer->requestBufferFront()) {
+    if (m_debugOptions.can)
+      printCANInfo(frame);
+    /* Not a frame of the remote bus, see doc/udp_format.md */
+    if (__builtin_expect(canfd_is_record(frame), 0)) {
+      if (frame->can_id & CANNELLONI_CYCLIC_RECORD)
+        m_remoteCyclicCount++;
+      else
+        m_remoteSummaryCount++;
+      m_frameBuffer->insertFramePool(frame);
+      busy = true;
+      continue;
+    }
+    deliver(frame, frame->len, -1);
+    m_frameBuffer->insertFramePool(frame);
+    m_txCount++;
+    busy = true;
+  }
+
+  /* Frames from the clients */
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++) {
+    if (!m_filters[i].active)
+      continue;
+    ShmClient &client = m_region->clients[i];
+    canfd_frame *frame;
+    for (uint32_t n = 0; n < SHM_TX_BATCH && (frame = client.tx.front()); n++) {
+      busy = true;
+      m_rxCount++;
+      /* The slot is shared with the client, read the length only once */
+      uint8_t len = frame->len;
+      bool fd = len & CANFD_FRAME;
+      if ((len & ~CANFD_FRAME) > (fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN)) {
+        m_rxErrorCount++;
+        client.tx.consume();
+        continue;
+      }
+      if (m_debugOptions.can)
+        printCANInfo(frame);
+      deliver(frame, len, i);
+      canfd_frame *out = m_peerThread->getFrameBuffer()->requestFrame(
+          fd ? FRAME_CLASS_FD : FRAME_CLASS_CLASSIC, false, m_debugOptions.buffer);
+      if (out == NULL) {
+        m_rxErrorCount++;
+        client.tx.consume();
+        continue;
+      }
+      shmCopyFrame(out, frame, len);
+      client.tx.consume();
+      m_peerThread->transmitFrame(out);
+    }
+  }
+
+  /* Wake up the clients that got frames, once per poll */
+  for (uint32_t i = 0; m_pendingNotify; i++) {
+    if (m_pendingNotify & (1u << i)) {
+      shmNotify(m_region->clients[i].waiting);
+      m_pendingNotify &= ~(1u << i);
+    }
+  }
+  return busy;
+}
+
+void ShmThread::updateClients() {
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++) {
+    ShmClient &client = m_region->clients[i];
+    FilterCache &cache = m_filters[i];
+    uint32_t state = client.state.load(std::memory_order_acquire);
+    if (state == SHM_CLIENT_ACTIVE) {
+      if (!cache.active) {
+        cache.active = true;
+        cache.count = 0;
+        /* Odd, never matches a consistent filterSeq */
+        cache.seq = 1;
+        linfo << "Client " << client.pid << " connected to slot " << i << std::endl;
+      }
+      if (client.filterSeq.load(std::memory_order_acquire) != cache.seq)
+        loadFilters(i);
+    } else {
+      if (cache.active) {
+        cache.active = false;
+        linfo << "Client " << client.pid << " disconnected from slot " << i << std::endl;
+      }
+      /* After this, the slot may be claimed again, we must not touch it */
+      if (state == SHM_CLIENT_CLOSING)
+        client.state.store(SHM_CLIENT_FREE, std::memory_order_release);
+    }
+  }
+}
+
+void ShmThread::loadFilters(uint32_t index) {
+  ShmClient &client = m_region->clients[index];
+  FilterCache &cache = m_filters[index];
+  FilterCache copy;
+
+  /* A single attempt, an inconsistent copy is retried on the next poll */
+  uint32_t before = client.filterSeq.load(std::memory_order_acquire);
+  if (before & 1)
+    return;
+  copy.count = std::min<uint32_t>(client.filterCount.load(std::memory_order_relaxed),
+                                  CANNELLONI_SHM_MAX_FILTERS);
+  for (uint32_t i = 0; i < copy.count; i++) {
+    copy.id[i] = client.filters[i].id.load(std::memory_order_relaxed);
+    copy.mask[i] = client.filters[i].mask.load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (client.filterSeq.load(std::memory_order_relaxed) != before)
+    return;
+  cache.seq = before;
+  cache.count = copy.count;
+  memcpy(cache.id, copy.id, sizeof(copy.id[0]) * copy.count);
+  memcpy(cache.mask, copy.mask, sizeof(copy.mask[0]) * copy.count);
+}
+
+bool ShmThread::matches(uint32_t index, const canfd_frame &frame) {
+  const FilterCache &cache = m_filters[index];
+  if (cache.count == 0)
+    return true;
+  for (uint32_t i = 0; i < cache.count; i++) {
+    if ((frame.can_id & cache.mask[i]) == (cache.id[i] & cache.mask[i]))
+      return true;
+  }
+  return false;
+}
+
+void ShmThread::deliver(const canfd_frame *frame, uint8_t len, int source) {
+  for (uint32_t i = 0; i < CANNELLONI_SHM_MAX_CLIENTS; i++) {
+    if ((int) i == source || !m_filters[i].active || !matches(i, *frame))
+      continue;
+    ShmClient &client = m_region->clients[i];
+    if (canfd_frame *slot = client.rx.reserve()) {
+      shmCopyFrame(slot, frame, len);
+      client.rx.commit();
+      m_pendingNotify |= 1u << i;
+    } else {
+      client.rxDropped.fetch_add(1, std::memory_order_relaxed);
+      m_txErrorCount++;
+    }
+  }
+}
+
+void ShmThread::transmitFrame(canfd_frame *frame) {
+  m_frameBuffer->insertFrame(frame);
+  shmNotify(m_region->serverWaiting);
+}
+
+void ShmThread::publishStats() {
+  CANStats &stats = m_stats->can.beginWrite();
+  stats.rxFrames = m_rxCount;
+  stats.txFrames = m_txCount;
+  stats.rxErrors = m_rxErrorCount;
+  stats.txErrors = m_txErrorCount;
+  stats.remoteErrorSummaries = m_remoteSummaryCount;
+  stats.remoteCyclicRecords = m_remoteCyclicCount;
+  m_frameBuffer->getPoolStats(stats.pool);
+  m_stats->can.endWrite();
+}
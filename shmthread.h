@@ -0,0 +1,105 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "connection.h"
+#include "shmbus.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * ShmThread takes the place of a CANThread and serves the clients of
+ * a shared memory bus (see shmbus.h). Frames from the network are
+ * queued in its FrameBuffer like for a CAN interface and then copied
+ * into the rx ring of every subscribed client. Frames from the tx ring
+ * of a client are passed to the network and to the other clients, just
+ * like frames on a real bus are seen by every other node.
+ *
+ * While there is traffic, the thread polls the rings without any
+ * syscall. As soon as a poll finds no work, it sleeps on the futex in
+ * the region. Clients can only wake it through that futex, which can not
+ * be waited on together with getStopFd(), so stop() wakes it there too
+ * and run() consumes the stop notification on its way out.
+ */
+/* Busy polls between two updates of the statistics */
+#define SHM_STATS_POLLS 1024
+/* Frames taken from one tx ring per poll, keeps clients fair */
+#define SHM_TX_BATCH 256
+
+class ShmThread : public ConnectionThread {
+  public:
+    ShmThread(const struct debugOptions_t &debugOptions, const std::string &name);
+    virtual ~ShmThread();
+
+    /* Creates the region and starts the thread */
+    virtual int start();
+    virtual void stop();
+    virtual void run();
+    virtual void transmitFrame(canfd_frame *frame);
+
+  private:
+    bool openRegion();
+    void closeRegion();
+    /* One round over the network buffer and all clients, true if there was work */
+    bool poll();
+    void updateClients();
+    void loadFilters(uint32_t index);
+    bool matches(uint32_t index, const canfd_frame &frame);
+    /* Copies frame into the rx rings of all clients but source, see shmCopyFrame() */
+    void deliver(const canfd_frame *frame, uint8_t len, int source);
+    void publishStats();
+
+  private:
+    /* Private copy of the filters of a client */
+    struct FilterCache {
+      bool active;
+      uint32_t seq;
+      uint32_t count;
+      uint32_t id[CANNELLONI_SHM_MAX_FILTERS];
+      uint32_t mask[CANNELLONI_SHM_MAX_FILTERS];
+    };
+
+    struct debugOptions_t m_debugOptions;
+    std::string m_name;
+    ShmBusRegion *m_region;
+    FilterCache m_filters[CANNELLONI_SHM_MAX_CLIENTS];
+    /* Clients whose rx ring got frames during the current poll */
+    uint32_t m_pendingNotify;
+
+    /* Performance Counters */
+    uint64_t m_rxCount;
+    uint64_t m_txCount;
+    /* Frames of clients the network buffer could not take */
+    uint64_t m_rxErrorCount;
+    /* Frames dropped because a client ring was full */
+    uint64_t m_txErrorCount;
+    /* Records of the remote, never delivered to the clients */
+    uint64_t m_remoteSummaryCount;
+    uint64_t m_remoteCyclicCount;
+};
+
+}
@@ -0,0 +1,555 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/can/bcm.h>
+#include <linux/can/raw.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "simio.h"
+#include "stats.h"
+
+using namespace cannelloni;
+
+SimIO::SimIO(uint32_t seed)
+  : m_stop(false)
+  , m_random(seed)
+  , m_sequence(0)
+  , m_nextPort(SIM_EPHEMERAL_PORT)
+{
+  memset(&m_counters, 0, sizeof(m_counters));
+  memset(&m_defaultLink, 0, sizeof(m_defaultLink));
+  m_scheduler = std::thread(&SimIO::runScheduler, this);
+}
+
+SimIO::~SimIO() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+  m_scheduler.join();
+  for (auto &socket : m_sockets)
+    ::close(socket.first);
+}
+
+void SimIO::addBus(const std::string &name, uint32_t bitrate, uint32_t dataBitrate, bool fd) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_buses.emplace_back();
+  Bus &bus = m_buses.back();
+  bus.name = name;
+  bus.fd = fd;
+  bus.timing.setBitrates(bitrate, dataBitrate);
+  bus.busyUntil = 0;
+}
+
+void SimIO::setLink(const SimLink &link) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_defaultLink = link;
+}
+
+void SimIO::setLink(const struct sockaddr_in &from, const struct sockaddr_in &to,
+                    const SimLink &link) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_links[std::make_pair(key(from), key(to))] = link;
+}
+
+SimCounters SimIO::getCounters() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_counters;
+}
+
+int SimIO::socket(int domain, int type, int protocol) {
+  if (!((domain == AF_INET && type == SOCK_DGRAM) ||
+        (domain == PF_CAN && type == SOCK_RAW && protocol == CAN_RAW) ||
+        (domain == PF_CAN && type == SOCK_DGRAM && protocol == CAN_BCM))) {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
+  int fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+  if (fd < 0)
+    return -1;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Socket &socket = m_sockets[fd];
+  socket.domain = domain;
+  socket.bound = false;
+  memset(&socket.addr, 0, sizeof(socket.addr));
+  socket.bus = -1;
+  socket.fdFrames = false;
+  socket.recvOwn = false;
+  socket.bcm = domain == PF_CAN && protocol == CAN_BCM;
+  return fd;
+}
+
+int SimIO::bind(int fd, const struct sockaddr *addr, socklen_t addrLen) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_sockets.find(fd);
+  if (it == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &socket = it->second;
+  if (socket.bound) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (socket.domain == AF_INET) {
+    if (addrLen < sizeof(struct sockaddr_in) || addr->sa_family != AF_INET) {
+      errno = EINVAL;
+      return -1;
+    }
+    struct sockaddr_in local;
+    memcpy(&local, addr, sizeof(local));
+    if (local.sin_port == 0)
+      local.sin_port = htons(m_nextPort++);
+    if (findSocket(local) >= 0) {
+      errno = EADDRINUSE;
+      return -1;
+    }
+    socket.addr = local;
+  } else {
+    const struct sockaddr_can *local = reinterpret_cast<const struct sockaddr_can*>(addr);
+    if (addrLen < sizeof(struct sockaddr_can) || local->can_ifindex < 1 ||
+        local->can_ifindex > (int) m_buses.size()) {
+      errno = ENODEV;
+      return -1;
+    }
+    socket.bus = local->can_ifindex - 1;
+  }
+  socket.bound = true;
+  return 0;
+}
+
+int SimIO::connect(int fd, const struct sockaddr *addr, socklen_t addrLen) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_sockets.find(fd);
+  if (it == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &socket = it->second;
+  const struct sockaddr_can *remote = reinterpret_cast<const struct sockaddr_can*>(addr);
+  if (!socket.bcm || socket.bound) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (addrLen < sizeof(struct sockaddr_can) || remote->can_ifindex < 1 ||
+      remote->can_ifindex > (int) m_buses.size()) {
+    errno = ENODEV;
+    return -1;
+  }
+  socket.bus = remote->can_ifindex - 1;
+  socket.bound = true;
+  return 0;
+}
+
+int SimIO::setsockopt(int fd, int level, int name, const void *value, socklen_t len) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_sockets.find(fd);
+  if (it == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  if (level == SOL_CAN_RAW && name == CAN_RAW_FD_FRAMES && len >= sizeof(int)) {
+    it->second.fdFrames = *static_cast<const int*>(value) != 0;
+  }
+  if (level == SOL_CAN_RAW && name == CAN_RAW_RECV_OWN_MSGS && len >= sizeof(int)) {
+    it->second.recvOwn = *static_cast<const int*>(value) != 0;
+  }
+  /* Everything else is accepted and ignored */
+  return 0;
+}
+
+int SimIO::ioctl(int fd, unsigned long request, void *arg) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  struct ifreq *ifr = static_cast<struct ifreq*>(arg);
+  int bus = findBus(ifr->ifr_name);
+  if (m_sockets.find(fd) == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  if (bus < 0) {
+    errno = ENODEV;
+    return -1;
+  }
+  switch (request) {
+    case SIOCGIFINDEX:
+      ifr->ifr_ifindex = bus + 1;
+      return 0;
+    case SIOCGIFMTU:
+      ifr->ifr_mtu = m_buses[bus].fd ? CANFD_MTU : CAN_MTU;
+      return 0;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+ssize_t SimIO::recvfrom(int fd, void *buffer, size_t len, int,
+                        struct sockaddr *addr, socklen_t *addrLen) {
+  return receive(fd, buffer, len, addr, addrLen, NULL);
+}
+
+ssize_t SimIO::recvmsg(int fd, struct msghdr *msg, int) {
+  /* Only a single buffer is supported */
+  if (msg->msg_iovlen < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  socklen_t addrLen = msg->msg_namelen;
+  ssize_t ret = receive(fd, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len,
+                        static_cast<struct sockaddr*>(msg->msg_name),
+                        msg->msg_name ? &addrLen : NULL, &msg->msg_flags);
+  msg->msg_namelen = addrLen;
+  msg->msg_controllen = 0;
+  return ret;
+}
+
+ssize_t SimIO::receive(int fd, void *buffer, size_t len, struct sockaddr *addr,
+                       socklen_t *addrLen, int *msgFlags) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_sockets.find(fd);
+  if (it == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &socket = it->second;
+  if (socket.queue.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  Message &message = socket.queue.front();
+  size_t size = std::min(len, message.data.size());
+  memcpy(buffer, message.data.data(), size);
+  if (addr && addrLen) {
+    if (socket.domain == AF_INET) {
+      *addrLen = std::min<socklen_t>(*addrLen, sizeof(message.from));
+      memcpy(addr, &message.from, *addrLen);
+    } else {
+      struct sockaddr_can from;
+      memset(&from, 0, sizeof(from));
+      from.can_family = AF_CAN;
+      from.can_ifindex = socket.bus + 1;
+      *addrLen = std::min<socklen_t>(*addrLen, sizeof(from));
+      memcpy(addr, &from, *addrLen);
+    }
+  }
+  if (msgFlags)
+    *msgFlags = message.flags;
+  socket.queue.pop_front();
+  uint64_t value;
+  /* Decrements the semaphore by one */
+  if (::read(fd, &value, sizeof(value)) < 0) {
+    errno = EIO;
+    return -1;
+  }
+  return size;
+}
+
+ssize_t SimIO::sendto(int fd, const void *buffer, size_t len, int,
+                      const struct sockaddr *addr, socklen_t addrLen) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_sockets.find(fd);
+  if (it == m_sockets.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &socket = it->second;
+  uint64_t now = monotonicTime();
+
+  if (socket.domain == AF_INET) {
+    Message message;
+    message.flags = 0;
+    message.data.assign(static_cast<const uint8_t*>(buffer),
+                        static_cast<const uint8_t*>(buffer) + len);
+    if (addr == NULL || addrLen < sizeof(struct sockaddr_in)) {
+      errno = EDESTADDRREQ;
+      return -1;
+    }
+    if (!socket.bound) {
+      socket.addr.sin_family = AF_INET;
+      socket.addr.sin_port = htons(m_nextPort++);
+      socket.bound = true;
+    }
+    struct sockaddr_in to;
+    memcpy(&to, addr, sizeof(to));
+    message.from = socket.addr;
+    if (message.from.sin_addr.s_addr == htonl(INADDR_ANY))
+      message.from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    const SimLink &link = findLink(message.from, to);
+    std::uniform_real_distribution<double> probability(0.0, 1.0);
+    if (link.loss > 0 && probability(m_random) < link.loss) {
+      m_counters.lost++;
+      return len;
+    }
+    message.due = now + link.delay;
+    if (link.jitter)
+      message.due += std::uniform_int_distribution<uint64_t>(0, link.jitter)(m_random);
+    if (link.reorder > 0 && probability(m_random) < link.reorder) {
+      message.due += link.reorderDelay;
+      m_counters.reordered++;
+    }
+    message.fd = findSocket(to);
+    if (message.fd >= 0)
+      schedule(message);
+    return len;
+  }
+
+  /* CAN */
+  if (!socket.bound) {
+    errno = ENXIO;
+    return -1;
+  }
+  if (socket.bcm)
+    return handleBCM(fd, socket, buffer, len, now);
+  return transmit(fd, socket, buffer, len, now);
+}
+
+ssize_t SimIO::transmit(int fd, Socket &socket, const void *buffer, size_t len, uint64_t now) {
+  Message message;
+  message.flags = 0;
+  message.data.assign(static_cast<const uint8_t*>(buffer),
+                      static_cast<const uint8_t*>(buffer) + len);
+  Bus &bus = m_buses[socket.bus];
+  if (!(len == CAN_MTU || (len == CANFD_MTU && socket.fdFrames && bus.fd))) {
+    errno = EINVAL;
+    return -1;
+  }
+  message.due = now;
+  if (bus.timing.isEnabled()) {
+    struct canfd_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    memcpy(&frame, buffer, len);
+    if (len == CANFD_MTU)
+      frame.len |= CANFD_FRAME;
+    uint64_t duration = (bus.timing.frameTime(&frame) + 999) / 1000;
+    uint64_t start = std::max(now, bus.busyUntil);
+    if (start - now > SIM_CAN_TXQUEUE * duration) {
+      m_counters.busFull++;
+      errno = ENOBUFS;
+      return -1;
+    }
+    bus.busyUntil = start + duration;
+    message.due = bus.busyUntil;
+  }
+  memset(&message.from, 0, sizeof(message.from));
+  for (auto &other : m_sockets) {
+    if (other.first == fd || other.second.bus != socket.bus || other.second.bcm ||
+        (len == CANFD_MTU && !other.second.fdFrames))
+      continue;
+    Message copy = message;
+    copy.fd = other.first;
+    schedule(copy);
+  }
+  if (socket.recvOwn) {
+    message.fd = fd;
+    message.flags = MSG_CONFIRM;
+    schedule(message);
+  }
+  return len;
+}
+
+ssize_t SimIO::handleBCM(int fd, Socket &, const void *buffer, size_t len, uint64_t now) {
+  struct bcm_msg_head head;
+  if (len < sizeof(head)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(&head, buffer, sizeof(head));
+  auto key = std::make_pair(fd, head.can_id);
+  if (head.opcode == TX_DELETE) {
+    if (m_jobs.erase(key) == 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    return len;
+  }
+  if (head.opcode != TX_SETUP || head.nframes != 1 || (head.flags & CAN_FD_FRAME) ||
+      len < sizeof(head) + sizeof(struct can_frame)) {
+    errno = EINVAL;
+    return -1;
+  }
+  Job &job = m_jobs[key];
+  memcpy(&job.frame, static_cast<const uint8_t*>(buffer) + sizeof(head), sizeof(job.frame));
+  if (head.flags & SETTIMER) {
+    job.interval = head.ival2.tv_sec * 1000000ULL + head.ival2.tv_usec;
+    job.first = head.ival1.tv_sec * 1000000ULL + head.ival1.tv_usec;
+    job.count = job.first ? head.count : 0;
+  }
+  if ((head.flags & STARTTIMER) && job.interval) {
+    /* Like the kernel, ival1 is used while count has not run out */
+    job.next = (head.flags & TX_ANNOUNCE) ? now : now + (job.count ? job.first : job.interval);
+    m_condition.notify_one();
+  }
+  return len;
+}
+
+int SimIO::shutdown(int, int) {
+  return 0;
+}
+
+int SimIO::close(int fd) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_sockets.erase(fd) == 0) {
+    errno = EBADF;
+    return -1;
+  }
+  for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+    if (it->first.first == fd)
+      it = m_jobs.erase(it);
+    else
+      ++it;
+  }
+  return ::close(fd);
+}
+
+bool SimIO::readBitrates(const std::string &interfaceName,
+                         uint32_t &bitrate, uint32_t &dataBitrate) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  int bus = findBus(interfaceName.c_str());
+  if (bus < 0 || !m_buses[bus].timing.isEnabled())
+    return false;
+  bitrate = m_buses[bus].timing.getBitrate();
+  dataBitrate = m_buses[bus].timing.getDataBitrate();
+  return true;
+}
+
+uint64_t SimIO::monotonicTime() {
+  /* The timers of the threads are real timerfds, so is the clock */
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+uint64_t SimIO::realtimeTime() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+void SimIO::schedule(Message &message) {
+  message.sequence = m_sequence++;
+  if (m_pending.empty() && message.due <= monotonicTime()) {
+    deliver(message);
+  } else {
+    m_pending.push(message);
+    m_condition.notify_one();
+  }
+}
+
+void SimIO::deliver(Message &message) {
+  auto it = m_sockets.find(message.fd);
+  /* The socket has been closed in the meantime */
+  if (it == m_sockets.end())
+    return;
+  if (it->second.queue.size() >= SIM_SOCKET_QUEUE) {
+    m_counters.overflows++;
+    return;
+  }
+  it->second.queue.push_back(std::move(message));
+  uint64_t one = 1;
+  if (::write(it->first, &one, sizeof(one)) == sizeof(one))
+    m_counters.delivered++;
+}
+
+void SimIO::runScheduler() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stop) {
+    auto job = nextJob();
+    if (m_pending.empty() && job == m_jobs.end()) {
+      m_condition.wait(lock);
+      continue;
+    }
+    uint64_t due = m_pending.empty() ? UINT64_MAX : m_pending.top().due;
+    if (job != m_jobs.end())
+      due = std::min(due, job->second.next);
+    uint64_t now = monotonicTime();
+    if (due > now) {
+      m_condition.wait_until(lock, std::chrono::steady_clock::time_point(
+                                     std::chrono::microseconds(due)));
+      continue;
+    }
+    if (job != m_jobs.end() && job->second.next == due) {
+      auto socket = m_sockets.find(job->first.first);
+      if (socket != m_sockets.end())
+        transmit(socket->first, socket->second, &job->second.frame, CAN_MTU, now);
+      if (job->second.count > 0)
+        job->second.count--;
+      job->second.next += job->second.count ? job->second.first : job->second.interval;
+      continue;
+    }
+    Message message = m_pending.top();
+    m_pending.pop();
+    deliver(message);
+  }
+}
+
+std::map<std::pair<int, canid_t>, SimIO::Job>::iterator SimIO::nextJob() {
+  auto next = m_jobs.end();
+  for (auto it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+    if (it->second.next && (next == m_jobs.end() || it->second.next < next->second.next))
+      next = it;
+  }
+  return next;
+}
+
+const SimLink& SimIO::findLink(const struct sockaddr_in &from, const struct sockaddr_in &to) {
+  auto it = m_links.find(std::make_pair(key(from), key(to)));
+  if (it != m_links.end())
+    return it->second;
+  return m_defaultLink;
+}
+
+int SimIO::findBus(const char *name) {
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    if (strncmp(m_buses[i].name.c_str(), name, IFNAMSIZ) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int SimIO::findSocket(const struct sockaddr_in &addr) {
+  int wildcard = -1;
+  for (auto &socket : m_sockets) {
+    if (socket.second.domain != AF_INET || !socket.second.bound ||
+        socket.second.addr.sin_port != addr.sin_port)
+      continue;
+    if (socket.second.addr.sin_addr.s_addr == addr.sin_addr.s_addr)
+      return socket.first;
+    if (socket.second.addr.sin_addr.s_addr == htonl(INADDR_ANY))
+      wildcard = socket.first;
+  }
+  return wildcard;
+}
+
+uint64_t SimIO::key(const struct sockaddr_in &addr) {
+  return ((uint64_t) ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
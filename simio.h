@@ -0,0 +1,223 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iobackend.h"
+#include "busload.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * SimIO is an IOBackend that keeps all traffic inside the process, so
+ * tunnels can be run without root, vcan or a network.
+ *
+ * Simulated CAN buses are created with addBus(). A raw CAN socket that
+ * is bound to a bus receives every frame written by the other sockets
+ * on the bus. If the bus has a bitrate, frames occupy the bus for their
+ * worst-case length (see BusLoad) and are delivered once they have
+ * been transmitted. Writes fail with ENOBUFS once more than
+ * SIM_CAN_TXQUEUE frames are waiting for the bus. A socket with
+ * CAN_RAW_RECV_OWN_MSGS gets its own frames back at the same time,
+ * marked with MSG_CONFIRM.
+ *
+ * CAN_BCM sockets only support cyclic transmissions (TX_SETUP and
+ * TX_DELETE) of a single CAN 2.0 frame with an interval of ival2. The
+ * scheduler thread writes the frames to the bus like a raw socket
+ * would, frames that find the bus queue full are skipped.
+ *
+ * UDP sockets exchange datagrams through simulated links. Every link
+ * adds a fixed delay and a uniformly distributed jitter, drops packets
+ * with a loss probability and holds back packets with a reorder
+ * probability for an additional reorder delay.
+ *
+ * Each socket is backed by an eventfd in semaphore mode that counts the
+ * queued messages, so select() works as usual. Delayed messages are
+ * delivered by a scheduler thread. The simulation runs in real time,
+ * all random decisions come from a seeded PRNG in the order in which
+ * packets are sent.
+ */
+
+/* Messages that may be queued on a socket before it drops */
+#define SIM_SOCKET_QUEUE 4096
+/* Frames that may wait for a bus before writes fail */
+#define SIM_CAN_TXQUEUE 10
+/* First port that is handed out for UDP sockets bound to port 0 */
+#define SIM_EPHEMERAL_PORT 49152
+
+struct SimLink {
+  /* Delay and maximum jitter in us */
+  uint64_t delay;
+  uint64_t jitter;
+  /* Probabilities from 0 to 1 */
+  double loss;
+  double reorder;
+  /* Additional delay of reordered packets in us */
+  uint64_t reorderDelay;
+};
+
+struct SimCounters {
+  uint64_t delivered;
+  uint64_t lost;
+  uint64_t reordered;
+  /* Messages dropped because a socket queue was full */
+  uint64_t overflows;
+  /* CAN writes rejected with ENOBUFS */
+  uint64_t busFull;
+};
+
+class SimIO : public IOBackend {
+  public:
+    SimIO(uint32_t seed = 1);
+    virtual ~SimIO();
+
+    /* Creates a CAN bus, a bitrate of 0 transmits without delay */
+    void addBus(const std::string &name, uint32_t bitrate, uint32_t dataBitrate, bool fd);
+    /* Sets the parameters of all links without an explicit setting */
+    void setLink(const SimLink &link);
+    /* Sets the parameters of the link from one address to another */
+    void setLink(const struct sockaddr_in &from, const struct sockaddr_in &to,
+                 const SimLink &link);
+    SimCounters getCounters();
+
+    virtual int socket(int domain, int type, int protocol);
+    virtual int bind(int fd, const struct sockaddr *addr, socklen_t addrLen);
+    virtual int connect(int fd, const struct sockaddr *addr, socklen_t addrLen);
+    virtual int setsockopt(int fd, int level, int name, const void *value, socklen_t len);
+    virtual int ioctl(int fd, unsigned long request, void *arg);
+    virtual ssize_t recvfrom(int fd, void *buffer, size_t len, int flags,
+                             struct sockaddr *addr, socklen_t *addrLen);
+    virtual ssize_t recvmsg(int fd, struct msghdr *msg, int flags);
+    virtual ssize_t sendto(int fd, const void *buffer, size_t len, int flags,
+                           const struct sockaddr *addr, socklen_t addrLen);
+    virtual int shutdown(int fd, int how);
+    virtual int close(int fd);
+
+    virtual bool readBitrates(const std::string &interfaceName,
+                              uint32_t &bitrate, uint32_t &dataBitrate);
+
+    virtual uint64_t monotonicTime();
+    virtual uint64_t realtimeTime();
+
+  private:
+    struct Message {
+      /* Delivery time in us */
+      uint64_t due;
+      /* Keeps messages with the same due time in order */
+      uint64_t sequence;
+      int fd;
+      struct sockaddr_in from;
+      /* msg_flags of recvmsg() */
+      int flags;
+      std::vector<uint8_t> data;
+    };
+
+    struct LaterFirst {
+      bool operator()(const Message &a, const Message &b) const {
+        return a.due > b.due || (a.due == b.due && a.sequence > b.sequence);
+      }
+    };
+
+    struct Socket {
+      int domain;
+      bool bound;
+      /* UDP */
+      struct sockaddr_in addr;
+      /* CAN, index into m_buses */
+      int bus;
+      bool fdFrames;
+      bool recvOwn;
+      /* CAN_BCM instead of CAN_RAW */
+      bool bcm;
+      std::deque<Message> queue;
+    };
+
+    /* A TX_SETUP of a CAN_BCM socket */
+    struct Job {
+      struct can_frame frame;
+      /* Interval and time of the next frame in us, 0 if not started */
+      uint64_t interval;
+      uint64_t next;
+      /* Frames still sent at the first interval (ival1, count) before it */
+      uint64_t first;
+      uint32_t count;
+    };
+
+    struct Bus {
+      std::string name;
+      bool fd;
+      BusLoad timing;
+      /* Time in us at which the bus becomes idle */
+      uint64_t busyUntil;
+    };
+
+  private:
+    /* recvfrom() that also returns the flags of the message */
+    ssize_t receive(int fd, void *buffer, size_t len, struct sockaddr *addr,
+                    socklen_t *addrLen, int *msgFlags);
+    /* Writes a CAN frame of fd to its bus */
+    ssize_t transmit(int fd, Socket &socket, const void *buffer, size_t len, uint64_t now);
+    ssize_t handleBCM(int fd, Socket &socket, const void *buffer, size_t len, uint64_t now);
+    /* The job with the earliest next frame, m_jobs.end() if none is started */
+    std::map<std::pair<int, canid_t>, Job>::iterator nextJob();
+    void schedule(Message &message);
+    void deliver(Message &message);
+    void runScheduler();
+    const SimLink& findLink(const struct sockaddr_in &from, const struct sockaddr_in &to);
+    int findBus(const char *name);
+    int findSocket(const struct sockaddr_in &addr);
+    static uint64_t key(const struct sockaddr_in &addr);
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_scheduler;
+    bool m_stop;
+
+    std::mt19937 m_random;
+    uint64_t m_sequence;
+    uint16_t m_nextPort;
+    SimCounters m_counters;
+
+    std::map<int, Socket> m_sockets;
+    std::vector<Bus> m_buses;
+    SimLink m_defaultLink;
+    std::map<std::pair<uint64_t, uint64_t>, SimLink> m_links;
+    std::priority_queue<Message, std::vector<Message>, LaterFirst> m_pending;
+    /* Key is the CAN_BCM socket and the CAN ID */
+    std::map<std::pair<int, canid_t>, Job> m_jobs;
+};
+
+}
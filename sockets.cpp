@@ -0,0 +1,145 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+#include "sockets.h"
+#include "iobackend.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+CANSocketOptions::CANSocketOptions()
+  : fd(CANFD_AUTO)
+  , errorFrames(false)
+  , recvOwnMsgs(false)
+  , sendBuffer(0)
+{
+}
+
+static int failCANSocket(int fd) {
+  io()->close(fd);
+  return -1;
+}
+
+int cannelloni::openCANSocket(const std::string &interfaceName, CANSocketOptions &options,
+                              FrameMode &mode, int &ifindex) {
+  struct ifreq canInterface;
+  struct sockaddr_can localAddr;
+  uint32_t canfd_on = 1;
+
+  int fd = io()->socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (fd < 0) {
+    lerror << "socket Error" << std::endl;
+    return -1;
+  }
+  /* Determine the index of interfaceName */
+  memset(&canInterface, 0, sizeof(canInterface));
+  strncpy(canInterface.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
+  if (io()->ioctl(fd, SIOCGIFINDEX, &canInterface) < 0) {
+    lerror << "Could get index of interface >" << interfaceName << "<" << std::endl;
+    return failCANSocket(fd);
+  }
+  ifindex = canInterface.ifr_ifindex;
+
+  mode = FRAME_MODE_CLASSIC;
+  if (options.fd != CANFD_OFF) {
+    /* Check MTU of interface */
+    if (io()->ioctl(fd, SIOCGIFMTU, &canInterface) < 0) {
+      lerror << "Could get MTU of interface >" << interfaceName << "<" <<  std::endl;
+    } else if (canInterface.ifr_mtu != CANFD_MTU) {
+      lerror << "CAN_FD is not supported on >" << interfaceName << "<" << std::endl;
+    } else if (io()->setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on))) {
+      lerror << "Could not enable CAN_FD." << std::endl;
+    } else {
+      mode = FRAME_MODE_FD;
+    }
+    if (options.fd == CANFD_REQUIRED && mode != FRAME_MODE_FD)
+      return failCANSocket(fd);
+  }
+
+  if (options.errorFrames) {
+    can_err_mask_t errorMask = CAN_ERR_MASK;
+    if (io()->setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errorMask, sizeof(errorMask)))
+      lerror << "Could not enable error frames on >" << interfaceName << "<" << std::endl;
+  }
+  if (options.recvOwnMsgs) {
+    int recvOwn = 1;
+    if (io()->setsockopt(fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &recvOwn, sizeof(recvOwn))) {
+      lerror << "Could not receive own frames on >" << interfaceName << "<" << std::endl;
+      options.recvOwnMsgs = false;
+    }
+  }
+  if (options.sendBuffer &&
+      io()->setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sendBuffer, sizeof(options.sendBuffer)))
+    lerror << "Could not limit the send buffer of >" << interfaceName << "<" << std::endl;
+
+  memset(&localAddr, 0, sizeof(localAddr));
+  localAddr.can_ifindex = ifindex;
+  localAddr.can_family = AF_CAN;
+  if (io()->bind(fd, (struct sockaddr *)&localAddr, sizeof(localAddr)) < 0) {
+    lerror << "Could not bind to interface" << std::endl;
+    return failCANSocket(fd);
+  }
+  return fd;
+}
+
+FrameMode cannelloni::canInterfaceMode(const std::string &interfaceName) {
+  struct ifreq canInterface;
+  FrameMode mode = FRAME_MODE_CLASSIC;
+  int fd = io()->socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (fd < 0)
+    return mode;
+  memset(&canInterface, 0, sizeof(canInterface));
+  strncpy(canInterface.ifr_name, interfaceName.c_str(), IFNAMSIZ - 1);
+  if (io()->ioctl(fd, SIOCGIFINDEX, &canInterface) == 0 &&
+      io()->ioctl(fd, SIOCGIFMTU, &canInterface) == 0 &&
+      canInterface.ifr_mtu == CANFD_MTU)
+    mode = FRAME_MODE_FD;
+  io()->close(fd);
+  return mode;
+}
+
+int cannelloni::openUDPSocket(const struct sockaddr_in &localAddr) {
+  int fd = io()->socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    lerror << "socket Error" << std::endl;
+    return -1;
+  }
+  if (io()->bind(fd, (struct sockaddr *)&localAddr, sizeof(localAddr)) < 0) {
+    lerror << "Could not bind to address" << std::endl;
+    io()->close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void cannelloni::setIncomingCPU(int fd, const SchedulingOptions &options) {
+  if (options.cpus.empty())
+    return;
+  int cpu = options.cpus.front();
+  if (io()->setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+    lwarn << "Could not set SO_INCOMING_CPU" << std::endl;
+}
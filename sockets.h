@@ -0,0 +1,78 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+
+#include <string>
+
+#include "cannelloni.h"
+#include "realtime.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * The socket setup shared by the connection threads, StaticTunnel and
+ * cannelloni-bench. Everything goes through io(), so the sockets can be
+ * simulated with SimIO. On error, the socket is closed again, the
+ * reason is logged and -1 is returned.
+ */
+
+/* Whether openCANSocket() enables CAN FD frames */
+enum CANFDSetting {
+  /* If the interface has the MTU of CAN FD */
+  CANFD_AUTO,
+  /* Never, the socket only carries CAN 2.0 frames */
+  CANFD_OFF,
+  /* Always, the socket can not be opened otherwise */
+  CANFD_REQUIRED
+};
+
+struct CANSocketOptions {
+  CANSocketOptions();
+
+  CANFDSetting fd;
+  /* Receive all error frames, see CAN_RAW_ERR_FILTER */
+  bool errorFrames;
+  /* See CAN_RAW_RECV_OWN_MSGS, cleared if it could not be enabled */
+  bool recvOwnMsgs;
+  /* SO_SNDBUF in bytes, 0 keeps the default */
+  int sendBuffer;
+};
+
+/*
+ * Opens a CAN_RAW socket bound to interfaceName. mode is set to the
+ * frame mode of the socket, ifindex to the index of the interface.
+ */
+int openCANSocket(const std::string &interfaceName, CANSocketOptions &options,
+                  FrameMode &mode, int &ifindex);
+
+/* FRAME_MODE_FD if interfaceName has the MTU of CAN FD */
+FrameMode canInterfaceMode(const std::string &interfaceName);
+
+/* Opens a UDP socket bound to localAddr */
+int openUDPSocket(const struct sockaddr_in &localAddr);
+
+/* Sets SO_INCOMING_CPU of fd to the first CPU of options, see realtime.h */
+void setIncomingCPU(int fd, const SchedulingOptions &options);
+
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * A bounded queue for exactly one producer and one consumer thread
+ * that never blocks and never allocates. Both indices run freely and
+ * are masked on access, so a full ring can be told apart from an empty
+ * one without wasting a slot. m_head is only written by the producer
+ * and m_tail only by the consumer; each sits on its own cache line.
+ *
+ * The ring contains no pointers. As long as T is trivially copyable,
+ * it can be placed in memory that is shared between processes.
+ */
+
+#define SPSC_RING_CACHE_LINE 64
+
+template <typename T, uint32_t N>
+class SPSCRing {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+  public:
+    SPSCRing()
+      : m_head(0)
+      , m_tail(0)
+    { }
+
+    /* Producer side, returns false if the ring is full */
+    bool push(const T &item) {
+      uint32_t head = m_head.load(std::memory_order_relaxed);
+      if (head - m_tail.load(std::memory_order_acquire) == N)
+        return false;
+      m_items[head & (N - 1)] = item;
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    /* Consumer side, returns false if the ring is empty */
+    bool pop(T &item) {
+      uint32_t tail = m_tail.load(std::memory_order_relaxed);
+      if (m_head.load(std::memory_order_acquire) == tail)
+        return false;
+      item = m_items[tail & (N - 1)];
+      m_tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    /*
+     * In-place access for items that are only partially used. reserve()
+     * returns the free slot push() would write to, or NULL if the ring is
+     * full; the item becomes visible with commit(). front() returns the
+     * item pop() would take, or NULL if the ring is empty; the slot stays
+     * owned by the consumer until consume().
+     */
+    T* reserve() {
+      uint32_t head = m_head.load(std::memory_order_relaxed);
+      if (head - m_tail.load(std::memory_order_acquire) == N)
+        return NULL;
+      return &m_items[head & (N - 1)];
+    }
+
+    void commit() {
+      m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    T* front() {
+      uint32_t tail = m_tail.load(std::memory_order_relaxed);
+      if (m_head.load(std::memory_order_acquire) == tail)
+        return NULL;
+      return &m_items[tail & (N - 1)];
+    }
+
+    void consume() {
+      m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /* Only a snapshot when called while the other side is active */
+    uint32_t size() const {
+      return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+      return size() == 0;
+    }
+
+    static uint32_t capacity() {
+      return N;
+    }
+
+    /* Empties the ring, neither side may use it meanwhile */
+    void reset() {
+      m_head.store(0, std::memory_order_relaxed);
+      m_tail.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint32_t> m_head;
+    char m_headPad[SPSC_RING_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> m_tail;
+    char m_tailPad[SPSC_RING_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    T m_items[N];
+};
+
+}
@@ -0,0 +1,739 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "cannelloni.h"
+#include "codec.h"
+#include "connection.h"
+#include "cyclic.h"
+#include "flushpolicy.h"
+#include "iobackend.h"
+#include "logging.h"
+#include "rules.h"
+#include "sockets.h"
+#include "stats.h"
+#include "thread.h"
+#include "timer.h"
+#include "udpthread.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * The runtime-configurable tunnel consists of a CANThread and a
+ * UDPThread (or SCTPThread) that hand frames to each other through
+ * FrameBuffers and the virtual ConnectionThread::transmitFrame(). Every
+ * frame is allocated from a pool, queued in a list and encoded only
+ * when the packet is built.
+ *
+ * StaticTunnel serves both sides of a tunnel from a single thread and
+ * is composed at compile time from four policies:
+ *
+ *   Transport  opens the network socket, sends and receives packets,
+ *              see UDPTransport
+ *   Batching   decides when the packet has to be sent, see
+ *              TimeoutBatching and ImmediateBatching
+ *   Codec      encodes and decodes frames, PacketCodec<FDFrames> or
+ *              PacketCodec<ClassicFrames>
+ *   Drop       decides which frame is dropped when the CAN socket does
+ *              not keep up, see DropNewest and DropOldest
+ *
+ * None of them has a virtual method, so the compiler sees the whole
+ * path from the CAN socket into the packet and from the packet onto
+ * the CAN socket. A frame read from the bus is encoded straight into
+ * the packet that is being built, there is no pool, no list and no
+ * lock. Frames from the network are written to the CAN socket right
+ * away. Only if the socket is full, they wait in a fixed ring of
+ * STATIC_TX_RING_SIZE frames and are retried every
+ * STATIC_RETRY_TIMEOUT us, like in CANThread.
+ *
+ * Only the data path is composed here. The sockets are opened with the
+ * helpers in sockets.h and the batching decisions are the FlushPolicy
+ * of UDPThread, so both tunnels set up their sockets and flush their
+ * packets the same way. Frame rules (-g) are the FrameRules of
+ * CANThread. Everything goes through io(), so a StaticTunnel runs on
+ * SimIO as well. The codec has to match the CAN interface: a
+ * PacketCodec<FDFrames> tunnel fails to start if the interface does
+ * not support CAN FD. staticFrameMode() tells which instantiation to
+ * pick at runtime.
+ *
+ * Features that need the frames to wait in a list (sorting, -Q), a
+ * timer per frame (-E, -W, -Y, probes) or a second thread (SCTP,
+ * generators, the shared memory bus) are only offered by the
+ * runtime-configurable tunnel. cannelloni refuses to combine them
+ * with -F.
+ */
+
+/* Frames from the network that may wait for the CAN socket */
+#define STATIC_TX_RING_SIZE 1024
+/* Retry interval of the CAN socket in us */
+#define STATIC_RETRY_TIMEOUT 25
+/* Frames read from the CAN socket and packets read from the network per wakeup */
+#define STATIC_READ_BATCH 64
+
+/*
+ * Transport policy for UDP, the counterpart of UDPThread
+ */
+class UDPTransport {
+  public:
+    UDPTransport(const struct sockaddr_in &remoteAddr,
+                 const struct sockaddr_in &localAddr,
+                 bool checkPeer)
+      : m_socket(-1)
+      , m_checkPeer(checkPeer)
+    {
+      memcpy(&m_remoteAddr, &remoteAddr, sizeof(struct sockaddr_in));
+      memcpy(&m_localAddr, &localAddr, sizeof(struct sockaddr_in));
+    }
+
+    /* Opens and binds the socket */
+    int open() {
+      m_socket = openUDPSocket(m_localAddr);
+      return m_socket < 0 ? -1 : 0;
+    }
+
+    void close() {
+      if (m_socket < 0)
+        return;
+      io()->shutdown(m_socket, SHUT_RDWR);
+      io()->close(m_socket);
+      m_socket = -1;
+    }
+
+    int getFd() const {
+      return m_socket;
+    }
+
+    static const uint32_t payloadSize = UDP_PAYLOAD_SIZE;
+
+    inline ssize_t send(const uint8_t *packet, uint16_t len) {
+      return io()->sendto(m_socket, packet, len, 0,
+                          (struct sockaddr *) &m_remoteAddr, sizeof(m_remoteAddr));
+    }
+
+    /*
+     * Reads a packet without blocking. Returns 0 for a packet that has
+     * to be ignored and -1 with errno EAGAIN if there is none.
+     */
+    inline ssize_t receive(uint8_t *packet, size_t len) {
+      struct sockaddr_in clientAddr;
+      socklen_t clientAddrLen = sizeof(struct sockaddr_in);
+      ssize_t receivedBytes = io()->recvfrom(m_socket, packet, len, MSG_DONTWAIT,
+                                             (struct sockaddr *) &clientAddr, &clientAddrLen);
+      if (receivedBytes > 0 && m_checkPeer &&
+          clientAddr.sin_addr.s_addr != m_remoteAddr.sin_addr.s_addr) {
+        char clientAddrStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, clientAddrStr, INET_ADDRSTRLEN);
+        lwarn << "Received a packet from " << clientAddrStr
+              << ", which is not set as a remote." << std::endl;
+        return 0;
+      }
+      return receivedBytes;
+    }
+
+  private:
+    int m_socket;
+    bool m_checkPeer;
+    struct sockaddr_in m_remoteAddr;
+    struct sockaddr_in m_localAddr;
+};
+
+/*
+ * Batching policy with the buffer timeout and timeout table of
+ * UDPThread, which is its FlushPolicy
+ */
+class TimeoutBatching : public FlushPolicy {
+  public:
+    TimeoutBatching() {
+      setTimeout(100000);
+    }
+};
+
+/*
+ * Batching policy that sends every frame in its own packet
+ */
+class ImmediateBatching {
+  public:
+    uint32_t getTimeout() const {
+      return 0;
+    }
+
+    void setPayloadSize(uint32_t) { }
+
+    inline FlushTrigger frameQueued(const canfd_frame *, size_t, uint64_t &) const {
+      return FLUSH_FULL;
+    }
+};
+
+/*
+ * Drop policies, makeRoom() is called when a frame from the network
+ * finds the tx ring full. It returns false if the new frame has to be
+ * dropped.
+ */
+struct DropNewest {
+  template <class Ring>
+  static inline bool makeRoom(Ring &) {
+    return false;
+  }
+};
+
+struct DropOldest {
+  template <class Ring>
+  static inline bool makeRoom(Ring &ring) {
+    ring.pop();
+    return true;
+  }
+};
+
+/*
+ * Frames waiting for the CAN socket, only used by the tunnel thread
+ */
+template <uint32_t N>
+class TxRing {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+  public:
+    TxRing()
+      : m_head(0)
+      , m_tail(0)
+    { }
+
+    bool empty() const {
+      return m_head == m_tail;
+    }
+
+    bool full() const {
+      return m_head - m_tail == N;
+    }
+
+    uint32_t size() const {
+      return m_head - m_tail;
+    }
+
+    static uint32_t capacity() {
+      return N;
+    }
+
+    void push(const canfd_frame &frame) {
+      m_frames[m_head++ & (N - 1)] = frame;
+    }
+
+    canfd_frame& front() {
+      return m_frames[m_tail & (N - 1)];
+    }
+
+    void pop() {
+      m_tail++;
+    }
+
+  private:
+    uint32_t m_head;
+    uint32_t m_tail;
+    canfd_frame m_frames[N];
+};
+
+/* Codec mode for canInterfaceName, FRAME_MODE_FD if it has the MTU of CAN FD */
+inline FrameMode staticFrameMode(const std::string &canInterfaceName) {
+  return canInterfaceMode(canInterfaceName);
+}
+
+template <class Transport, class Batching, class Codec, class Drop>
+class StaticTunnel : public Thread {
+  public:
+    StaticTunnel(const struct debugOptions_t &debugOptions,
+                 const std::string &canInterfaceName,
+                 const Transport &transport)
+      : Thread()
+      , m_transport(transport)
+      , m_canInterfaceName(canInterfaceName)
+      , m_canSocket(-1)
+      , m_epollFd(-1)
+      , m_useRules(false)
+      , m_data(m_packet + CANNELLONI_DATA_PACKET_BASE_SIZE)
+      , m_frameCount(0)
+      , m_sequenceNumber(0)
+      , m_pendingTrigger(FLUSH_TIMER)
+      , m_bufferTime(0)
+      , m_canRxCount(0)
+      , m_canTxCount(0)
+      , m_canRxErrorCount(0)
+      , m_canTxErrorCount(0)
+      , m_canDropCount(0)
+      , m_canRemoteErrorCount(0)
+      , m_canRemoteSummaryCount(0)
+      , m_canRemoteCyclicCount(0)
+      , m_netRxCount(0)
+      , m_netTxCount(0)
+      , m_netRxFrameCount(0)
+      , m_netTxFrameCount(0)
+      , m_netRxByteCount(0)
+      , m_netTxByteCount(0)
+      , m_netRxErrorCount(0)
+      , m_netTxErrorCount(0)
+      , m_privateStats(new TunnelStats())
+    {
+      memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
+      m_stats = m_privateStats.get();
+      m_batching.setPayloadSize(Transport::payloadSize);
+    }
+
+    virtual ~StaticTunnel() {}
+
+    /* Opens the sockets and starts the thread */
+    virtual int start() {
+      if (setup() < 0) {
+        closeSockets();
+        return -1;
+      }
+      return Thread::start();
+    }
+
+    virtual void run() {
+      struct epoll_event events[STATIC_EVENTS];
+
+      linfo << "StaticTunnel up and running" << std::endl;
+      bool running = true;
+      while (m_started && running) {
+        int ret = epoll_wait(m_epollFd, events, STATIC_EVENTS, -1);
+        if (ret < 0) {
+          if (errno == EINTR)
+            continue;
+          lerror << "epoll_wait error" << std::endl;
+          break;
+        }
+        /* Timers first, a socket handler may rearm them and a stale read would block */
+        uint32_t ready = 0;
+        for (int i = 0; i < ret; i++)
+          ready |= 1 << events[i].data.u32;
+        if (ready & (1 << EVENT_STOP))
+          break;
+        if (ready & (1 << EVENT_BATCH))
+          handleBatchTimer();
+        if (ready & (1 << EVENT_RETRY))
+          handleRetryTimer();
+        if (ready & (1 << EVENT_STATS))
+          handleStatsTimer();
+        if (ready & (1 << EVENT_NET))
+          handleNet();
+        if (ready & (1 << EVENT_CAN))
+          running = handleCAN();
+      }
+      teardown();
+    }
+
+    Transport& transport() {
+      return m_transport;
+    }
+
+    Batching& batching() {
+      return m_batching;
+    }
+
+    /* Sets the slot in the statistics region this tunnel publishes to */
+    void setStatistics(TunnelStats *stats) {
+      m_stats = stats ? stats : m_privateStats.get();
+    }
+
+    TunnelStats* getStatistics() {
+      return m_stats;
+    }
+
+    /* Rewrites or drops frames read from the CAN bus, see rules.h */
+    bool loadRules(const std::string &path) {
+      m_useRules = m_rules.load(path);
+      return m_useRules;
+    }
+
+  private:
+    enum Event {EVENT_STOP, EVENT_CAN, EVENT_NET, EVENT_BATCH, EVENT_RETRY, EVENT_STATS,
+                STATIC_EVENTS};
+
+    typedef typename Codec::Frames Frames;
+
+    int setup() {
+      CANSocketOptions options;
+      options.fd = Frames::fd ? CANFD_REQUIRED : CANFD_OFF;
+      FrameMode mode;
+      int ifindex;
+      m_canSocket = openCANSocket(m_canInterfaceName, options, mode, ifindex);
+      if (m_canSocket < 0)
+        return -1;
+      if (m_transport.open() < 0)
+        return -1;
+      setIncomingCPU(m_canSocket, getScheduling());
+      setIncomingCPU(m_transport.getFd(), getScheduling());
+
+      m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+      if (m_epollFd < 0) {
+        lerror << "epoll_create1 error" << std::endl;
+        return -1;
+      }
+      if (watch(getStopFd(), EVENT_STOP) < 0 || watch(m_canSocket, EVENT_CAN) < 0 ||
+          watch(m_transport.getFd(), EVENT_NET) < 0 ||
+          watch(m_batchTimer.getFd(), EVENT_BATCH) < 0 ||
+          watch(m_retryTimer.getFd(), EVENT_RETRY) < 0 ||
+          watch(m_statsTimer.getFd(), EVENT_STATS) < 0)
+        return -1;
+      m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
+      return 0;
+    }
+
+    int watch(int fd, Event event) {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u32 = event;
+      if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        lerror << "Could not add fd " << fd << " to epoll" << std::endl;
+        return -1;
+      }
+      return 0;
+    }
+
+    void teardown() {
+      linfo << "Shutting down. CAN Transmission Summary: TX: " << m_canTxCount
+            << " RX: " << m_canRxCount << " Dropped: " << m_canDropCount << std::endl;
+      linfo << "Shutting down. UDP Transmission Summary: TX: " << m_netTxCount
+            << " RX: " << m_netRxCount << std::endl;
+      publishStats();
+      closeSockets();
+    }
+
+    void closeSockets() {
+      m_transport.close();
+      if (m_canSocket >= 0) {
+        io()->shutdown(m_canSocket, SHUT_RDWR);
+        io()->close(m_canSocket);
+        m_canSocket = -1;
+      }
+      if (m_epollFd >= 0) {
+        ::close(m_epollFd);
+        m_epollFd = -1;
+      }
+    }
+
+    /* CAN -> network, returns false on a fatal read error */
+    bool handleCAN() {
+      for (uint32_t n = 0; n < STATIC_READ_BATCH; n++) {
+        struct canfd_frame frame;
+        ssize_t receivedBytes = io()->recvfrom(m_canSocket, &frame, Frames::fd ? CANFD_MTU : CAN_MTU,
+                                               MSG_DONTWAIT, NULL, NULL);
+        if (receivedBytes == CAN_MTU) {
+          frame.len &= ~(CANFD_FRAME);
+        } else if (Frames::fd && receivedBytes == CANFD_MTU) {
+          frame.len |= CANFD_FRAME;
+        } else if (receivedBytes < 0) {
+          if (errno == EWOULDBLOCK || errno == EAGAIN)
+            return true;
+          lerror << "CAN read error" << std::endl;
+          m_canRxErrorCount++;
+          return false;
+        } else {
+          lwarn << "Incomplete/Invalid CAN frame" << std::endl;
+          m_canRxErrorCount++;
+          continue;
+        }
+        m_canRxCount++;
+        if (m_useRules && !m_rules.apply(&frame))
+          continue;
+        if (m_debugOptions.can)
+          printCANInfo(&frame);
+        queueFrame(&frame);
+      }
+      return true;
+    }
+
+    /* Encodes frame into the packet and sends it if the batching policy says so */
+    inline void queueFrame(const canfd_frame *frame) {
+      if (m_data - m_packet + Codec::size(frame) > Transport::payloadSize)
+        flush(FLUSH_FULL);
+      m_data = Codec::encode(m_data, frame);
+      m_frameCount++;
+
+      uint64_t expiry;
+      size_t bufferSize = m_data - m_packet - CANNELLONI_DATA_PACKET_BASE_SIZE;
+      FlushTrigger trigger = m_batching.frameQueued(frame, bufferSize, expiry);
+      if (trigger == FLUSH_FULL) {
+        flush(FLUSH_FULL);
+        return;
+      }
+      uint32_t timeout = m_batching.getTimeout();
+      if (m_frameCount == 1) {
+        /* The first frame of the packet starts the buffer timeout */
+        m_bufferTime = monotonicTime();
+        m_pendingTrigger = FLUSH_TIMER;
+        m_batchTimer.adjust(timeout, timeout);
+      }
+      if (trigger == FLUSH_ID_TIMEOUT && expiry < m_batchTimer.getValue()) {
+        if (m_debugOptions.timer) {
+          linfo << "Found timeout entry for ID " << (frame->can_id & CAN_EFF_MASK)
+                << ". Adjusting timer." << std::endl;
+        }
+        m_pendingTrigger = FLUSH_ID_TIMEOUT;
+        m_batchTimer.adjust(timeout, expiry);
+      }
+    }
+
+    void handleBatchTimer() {
+      if (m_batchTimer.read() == 0)
+        return;
+      if (m_frameCount)
+        flush(m_pendingTrigger);
+      /* Armed again by the next frame */
+      m_batchTimer.disable();
+    }
+
+    void flush(FlushTrigger trigger) {
+      Codec::writeHeader(m_packet, m_sequenceNumber++, m_frameCount);
+      uint16_t len = m_data - m_packet;
+      ssize_t transmittedBytes = m_transport.send(m_packet, len);
+      if (transmittedBytes != len) {
+        lerror << "UDP Socket error. Error while transmitting" << std::endl;
+        m_netTxErrorCount++;
+      } else {
+        m_netTxCount++;
+        m_netTxFrameCount += m_frameCount;
+        m_netTxByteCount += len;
+        NetStats &stats = m_stats->net.beginWrite();
+        /* A frame that is sent right away never started the buffer timeout */
+        stats.bufferLatency.add(trigger == FLUSH_FULL && m_frameCount == 1 ?
+                                0 : monotonicTime() - m_bufferTime);
+        stats.framesPerPacket.width = FRAMES_PER_PACKET_WIDTH;
+        stats.framesPerPacket.add(m_frameCount);
+        stats.bytesPerPacket.width = BYTES_PER_PACKET_WIDTH;
+        stats.bytesPerPacket.add(len);
+        stats.flushes[trigger]++;
+        m_stats->net.endWrite();
+      }
+      m_data = m_packet + CANNELLONI_DATA_PACKET_BASE_SIZE;
+      m_frameCount = 0;
+    }
+
+    /* Network -> CAN */
+    void handleNet() {
+      uint8_t packet[RECEIVE_BUFFER_SIZE];
+      for (uint32_t n = 0; n < STATIC_READ_BATCH; n++) {
+        ssize_t receivedBytes = m_transport.receive(packet, RECEIVE_BUFFER_SIZE);
+        if (receivedBytes < 0) {
+          if (errno == EWOULDBLOCK || errno == EAGAIN)
+            return;
+          lerror << "recvfrom error." << std::endl;
+          m_netRxErrorCount++;
+          return;
+        }
+        if (receivedBytes == 0)
+          continue;
+        if (m_debugOptions.udp)
+          linfo << "Received " << receivedBytes << " Bytes" << std::endl;
+        decodePacket(packet, receivedBytes);
+      }
+    }
+
+    inline void decodePacket(const uint8_t *packet, uint16_t len) {
+      uint16_t count = 0;
+      if (Codec::readHeader(packet, len, count) != PACKET_OK) {
+        lerror << "Received an invalid packet" << std::endl;
+        m_netRxErrorCount++;
+        return;
+      }
+      const uint8_t *data = packet + CANNELLONI_DATA_PACKET_BASE_SIZE;
+      const uint8_t *end = packet + len;
+      for (uint16_t i = 0; i < count; i++) {
+        struct canfd_frame frame;
+        DecodeResult result = Codec::decode(data, end, &frame);
+        if (result == DECODE_SKIP)
+          continue;
+        if (result == DECODE_ERROR) {
+          lerror << "Received incomplete packet / can header corrupt!" << std::endl;
+          m_netRxErrorCount++;
+          return;
+        }
+        m_netRxFrameCount++;
+        if (m_debugOptions.can)
+          printCANInfo(&frame);
+        /* Error frames and records of the remote, never put them on the bus */
+        if (__builtin_expect(frame.can_id & CAN_ERR_FLAG, 0)) {
+          if (isCyclicRecord(&frame))
+            m_canRemoteCyclicCount++;
+          else if (frame.can_id & CANNELLONI_ERR_SUMMARY)
+            m_canRemoteSummaryCount++;
+          else
+            m_canRemoteErrorCount++;
+          continue;
+        }
+        writeFrame(frame);
+      }
+      m_netRxCount++;
+      m_netRxByteCount += len;
+    }
+
+    inline void writeFrame(const canfd_frame &frame) {
+      /* Keep the order, nothing overtakes the frames in the ring */
+      if (m_txRing.empty() && sendFrame(frame))
+        return;
+      if (m_txRing.full()) {
+        m_canDropCount++;
+        if (!Drop::makeRoom(m_txRing))
+          return;
+      }
+      m_txRing.push(frame);
+      if (m_txRing.size() == 1)
+        m_retryTimer.adjust(STATIC_RETRY_TIMEOUT, STATIC_RETRY_TIMEOUT);
+    }
+
+    inline bool sendFrame(const canfd_frame &frame) {
+      ssize_t transmittedBytes;
+      if (Frames::fd && (frame.len & CANFD_FRAME)) {
+        /* The kernel expects len without the CANFD_FRAME bit */
+        struct canfd_frame tmp = frame;
+        tmp.len &= ~(CANFD_FRAME);
+        transmittedBytes = io()->sendto(m_canSocket, &tmp, CANFD_MTU, MSG_DONTWAIT, NULL, 0);
+      } else {
+        transmittedBytes = io()->sendto(m_canSocket, &frame, CAN_MTU, MSG_DONTWAIT, NULL, 0);
+      }
+      if (transmittedBytes == CAN_MTU || (Frames::fd && transmittedBytes == CANFD_MTU)) {
+        m_canTxCount++;
+        return true;
+      }
+      m_canTxErrorCount++;
+      if (m_debugOptions.can)
+        linfo << "CAN write failed." << std::endl;
+      return false;
+    }
+
+    void handleRetryTimer() {
+      if (m_retryTimer.read() == 0)
+        return;
+      while (!m_txRing.empty()) {
+        if (!sendFrame(m_txRing.front()))
+          return;
+        m_txRing.pop();
+      }
+      m_retryTimer.disable();
+    }
+
+    void handleStatsTimer() {
+      if (m_statsTimer.read() > 0)
+        publishStats();
+    }
+
+    void publishStats() {
+      CANStats &can = m_stats->can.beginWrite();
+      can.rxFrames = m_canRxCount;
+      can.txFrames = m_canTxCount;
+      can.rxErrors = m_canRxErrorCount;
+      can.txErrors = m_canTxErrorCount;
+      can.pool.allocated = m_txRing.capacity();
+      can.pool.free = m_txRing.capacity() - m_txRing.size();
+      can.pool.buffered = m_txRing.size();
+      can.pool.maxAlloc = m_txRing.capacity();
+      can.pool.memoryBytes = sizeof(m_txRing);
+      can.remoteErrorFrames = m_canRemoteErrorCount;
+      can.remoteErrorSummaries = m_canRemoteSummaryCount;
+      can.remoteCyclicRecords = m_canRemoteCyclicCount;
+      can.ruleRewrites = m_rules.getRewrittenCount();
+      can.ruleDrops = m_rules.getDroppedCount();
+      m_stats->can.endWrite();
+
+      NetStats &net = m_stats->net.beginWrite();
+      net.rxPackets = m_netRxCount;
+      net.rxFrames = m_netRxFrameCount;
+      net.rxBytes = m_netRxByteCount;
+      net.rxErrors = m_netRxErrorCount;
+      net.txPackets = m_netTxCount;
+      net.txFrames = m_netTxFrameCount;
+      net.txBytes = m_netTxByteCount;
+      net.txErrors = m_netTxErrorCount;
+      net.payloadSize = Transport::payloadSize;
+      net.pool.buffered = m_frameCount;
+      net.pool.bufferedBytes = m_data - m_packet - CANNELLONI_DATA_PACKET_BASE_SIZE;
+      net.pool.memoryBytes = sizeof(m_packet);
+      m_stats->net.endWrite();
+    }
+
+  private:
+    struct debugOptions_t m_debugOptions;
+    Transport m_transport;
+    Batching m_batching;
+    std::string m_canInterfaceName;
+    int m_canSocket;
+    int m_epollFd;
+    bool m_useRules;
+    FrameRules m_rules;
+    Timer m_batchTimer;
+    Timer m_retryTimer;
+    /* Publishes the counters every CANNELLONI_STATS_INTERVAL us */
+    Timer m_statsTimer;
+
+    /* The packet that is being built, m_data points behind the last frame */
+    uint8_t m_packet[Transport::payloadSize];
+    uint8_t *m_data;
+    uint16_t m_frameCount;
+    uint8_t m_sequenceNumber;
+    /* Reported for the next flush by the timer */
+    FlushTrigger m_pendingTrigger;
+    /* When the first frame entered the packet */
+    uint64_t m_bufferTime;
+
+    TxRing<STATIC_TX_RING_SIZE> m_txRing;
+
+    /* Performance Counters */
+    uint64_t m_canRxCount;
+    uint64_t m_canTxCount;
+    uint64_t m_canRxErrorCount;
+    uint64_t m_canTxErrorCount;
+    /* Frames from the network that found the tx ring full */
+    uint64_t m_canDropCount;
+    /* Error frames and summaries from the network, see decodePacket() */
+    uint64_t m_canRemoteErrorCount;
+    uint64_t m_canRemoteSummaryCount;
+    uint64_t m_canRemoteCyclicCount;
+    uint64_t m_netRxCount;
+    uint64_t m_netTxCount;
+    uint64_t m_netRxFrameCount;
+    uint64_t m_netTxFrameCount;
+    uint64_t m_netRxByteCount;
+    uint64_t m_netTxByteCount;
+    uint64_t m_netRxErrorCount;
+    uint64_t m_netTxErrorCount;
+
+    TunnelStats *m_stats;
+    /* Used as long as no slot has been assigned */
+    std::unique_ptr<TunnelStats> m_privateStats;
+};
+
+/* The composition offered by cannelloni -F and cannelloni-bench -F */
+template <class Mode>
+using UDPStaticTunnel = StaticTunnel<UDPTransport, TimeoutBatching, PacketCodec<Mode>, DropOldest>;
+
+}
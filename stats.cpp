@@ -0,0 +1,141 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "iobackend.h"
+#include "logging.h"
+
+using namespace cannelloni;
+
+Statistics::Statistics()
+  : m_region(NULL)
+{ }
+
+Statistics::~Statistics() {
+  close();
+}
+
+bool Statistics::open(const std::string &name) {
+  void *mem;
+
+  if (m_region)
+    return false;
+
+  if (name.empty()) {
+    mem = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    std::string shmName = (name[0] == '/') ? name : "/" + name;
+    int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      lerror << "Could not create shared memory region " << shmName << std::endl;
+      return false;
+    }
+    if (ftruncate(fd, sizeof(StatsRegion)) < 0) {
+      lerror << "Could not resize shared memory region " << shmName << std::endl;
+      ::close(fd);
+      shm_unlink(shmName.c_str());
+      return false;
+    }
+    mem = mmap(NULL, sizeof(StatsRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    m_name = shmName;
+  }
+  if (mem == MAP_FAILED) {
+    lerror << "Could not map statistics region" << std::endl;
+    if (!m_name.empty())
+      shm_unlink(m_name.c_str());
+    m_name.clear();
+    return false;
+  }
+  /* The mapping is zero-filled, which is a valid initial state */
+  m_region = static_cast<StatsRegion*>(mem);
+  m_region->pid = getpid();
+  m_region->startTime = realtimeTime();
+  m_region->size = sizeof(StatsRegion);
+  m_region->version = CANNELLONI_STATS_VERSION;
+  /* Readers check the magic last */
+  std::atomic_thread_fence(std::memory_order_release);
+  m_region->magic = CANNELLONI_STATS_MAGIC;
+  return true;
+}
+
+void Statistics::close() {
+  if (!m_region)
+    return;
+  munmap(m_region, sizeof(StatsRegion));
+  m_region = NULL;
+  if (!m_name.empty())
+    shm_unlink(m_name.c_str());
+  m_name.clear();
+}
+
+TunnelStats* Statistics::addTunnel(const std::string &name) {
+  if (!m_region)
+    return NULL;
+  uint32_t index = m_region->tunnelCount.load(std::memory_order_relaxed);
+  if (index >= CANNELLONI_STATS_MAX_TUNNELS)
+    return NULL;
+  TunnelStats *tunnel = &m_region->tunnels[index];
+  strncpy(tunnel->name, name.c_str(), CANNELLONI_STATS_NAME_LEN - 1);
+  tunnel->active.store(1, std::memory_order_release);
+  m_region->tunnelCount.store(index + 1, std::memory_order_release);
+  return tunnel;
+}
+
+StatsRegion* Statistics::getRegion() {
+  return m_region;
+}
+
+const StatsRegion* Statistics::attach(const std::string &name) {
+  std::string shmName = (name[0] == '/') ? name : "/" + name;
+  int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(StatsRegion)) {
+    ::close(fd);
+    return NULL;
+  }
+  void *mem = mmap(NULL, sizeof(StatsRegion), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED)
+    return NULL;
+  return static_cast<const StatsRegion*>(mem);
+}
+
+void Statistics::detach(const StatsRegion *region) {
+  if (region)
+    munmap(const_cast<StatsRegion*>(region), sizeof(StatsRegion));
+}
+
+uint64_t cannelloni::monotonicTime() {
+  return io()->monotonicTime();
+}
+
+uint64_t cannelloni::realtimeTime() {
+  return io()->realtimeTime();
+}
@@ -0,0 +1,312 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * All counters and gauges of a cannelloni instance are published in a
+ * single memory region. When a name is supplied, the region is created
+ * with shm_open() so that external readers (e.g. cannelloni-top) can
+ * map it read-only and sample it without any syscall into cannelloni.
+ *
+ * Every section of the region has exactly one writer thread and is
+ * protected by a sequence lock. The writer increments the sequence
+ * number before and after modifying the section, a reader retries its
+ * copy whenever it observed an odd or changed sequence number.
+ *
+ * Counting stays in plain members of the threads. They copy them into
+ * the region every CANNELLONI_STATS_INTERVAL us from a timer and once
+ * at teardown, so the data path never pays for a section write.
+ *
+ * The layout is part of the external interface. Whenever it changes,
+ * CANNELLONI_STATS_VERSION must be increased.
+ */
+
+#define CANNELLONI_STATS_MAGIC 0x534e4e43 /* "CNNS" */
+#define CANNELLONI_STATS_VERSION 11
+
+#define CANNELLONI_STATS_MAX_TUNNELS 16
+#define CANNELLONI_STATS_NAME_LEN 32
+/* Bucket i counts all values v with 2^(i-1) <= v < 2^i, bucket 0 counts 0 */
+#define CANNELLONI_STATS_HIST_BUCKETS 32
+/* Bus load over 100 ms, 1 s and 10 s */
+#define CANNELLONI_STATS_BUSLOAD_WINDOWS 3
+/* Quarters of the arbitration order, 0 is the highest priority */
+#define CANNELLONI_STATS_PRIORITY_CLASSES 4
+/* Interval in us in which the threads publish their counters */
+#define CANNELLONI_STATS_INTERVAL 100000
+
+struct StatsHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t bucket[CANNELLONI_STATS_HIST_BUCKETS];
+
+  void add(uint64_t value) {
+    uint32_t i = 0;
+    if (value)
+      i = 64 - __builtin_clzll(value);
+    if (i >= CANNELLONI_STATS_HIST_BUCKETS)
+      i = CANNELLONI_STATS_HIST_BUCKETS - 1;
+    bucket[i]++;
+    count++;
+    sum += value;
+  }
+
+  /* Returns the upper bound of the bucket containing the p-quantile */
+  uint64_t percentile(double p) const {
+    if (count == 0)
+      return 0;
+    uint64_t target = (uint64_t) (p * count);
+    if (target >= count)
+      target = count - 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < CANNELLONI_STATS_HIST_BUCKETS; i++) {
+      seen += bucket[i];
+      if (seen > target)
+        return i ? (1ULL << i) - 1 : 0;
+    }
+    return (1ULL << (CANNELLONI_STATS_HIST_BUCKETS - 1)) - 1;
+  }
+};
+
+/* Bucket i counts all values v with i*width <= v < (i+1)*width,
+ * the last bucket also counts all larger values */
+struct StatsLinearHistogram {
+  uint64_t width;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t bucket[CANNELLONI_STATS_HIST_BUCKETS];
+
+  void add(uint64_t value) {
+    uint64_t i = width ? value / width : 0;
+    if (i >= CANNELLONI_STATS_HIST_BUCKETS)
+      i = CANNELLONI_STATS_HIST_BUCKETS - 1;
+    bucket[i]++;
+    count++;
+    sum += value;
+  }
+
+  /* Returns the upper bound of the bucket containing the p-quantile */
+  uint64_t percentile(double p) const {
+    if (count == 0)
+      return 0;
+    uint64_t target = (uint64_t) (p * count);
+    if (target >= count)
+      target = count - 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < CANNELLONI_STATS_HIST_BUCKETS; i++) {
+      seen += bucket[i];
+      if (seen > target)
+        return (i + 1) * width - 1;
+    }
+    return CANNELLONI_STATS_HIST_BUCKETS * width - 1;
+  }
+};
+
+/* Events that lead to a packet being sent */
+enum FlushTrigger {
+  /* The buffer timeout (-t) expired */
+  FLUSH_TIMER,
+  /* The buffer could not take another frame */
+  FLUSH_FULL,
+  /* A frame with an individual timeout (-T) expired */
+  FLUSH_ID_TIMEOUT,
+  /* The previous packet could not take all buffered frames */
+  FLUSH_OVERFLOW,
+  FLUSH_TRIGGERS
+};
+
+/* Frame pool and buffer gauges of a FrameBuffer */
+struct PoolStats {
+  /* Slots of both size classes */
+  uint64_t allocated;
+  uint64_t classicAllocated;
+  uint64_t free;
+  uint64_t buffered;
+  uint64_t bufferedBytes;
+  uint64_t maxAlloc;
+  /* Memory of all slots */
+  uint64_t memoryBytes;
+};
+
+/* Published by CANThread */
+struct CANStats {
+  uint64_t rxFrames;
+  uint64_t txFrames;
+  /* recv() failures and incomplete frames */
+  uint64_t rxErrors;
+  /* write() failures, the frame is retried later */
+  uint64_t txErrors;
+  /* Frames from the network that waited for the CAN socket */
+  PoolStats pool;
+  /* Nominal and data bitrate, 0 if unknown */
+  uint32_t bitrate;
+  uint32_t dataBitrate;
+  /* Bus load in 1/100 percent, see CANNELLONI_STATS_BUSLOAD_WINDOWS */
+  uint32_t busLoad[CANNELLONI_STATS_BUSLOAD_WINDOWS];
+  /* Alarm threshold in 1/100 percent, 0 if disabled */
+  uint32_t busLoadThreshold;
+  /* Non-zero while the 1 s bus load is above the threshold */
+  uint32_t busLoadAlarm;
+  uint32_t reserved;
+  /* Number of times the alarm has been raised */
+  uint64_t busLoadAlarms;
+  /* Latency probes, all times in us */
+  uint64_t probesSent;
+  uint64_t probesAnswered;
+  uint64_t probesReplied;
+  StatsHistogram probeRoundTrip;
+  /* Local bus to remote bus and back, needs synchronized clocks */
+  StatsHistogram probeForward;
+  StatsHistogram probeBackward;
+  /* Error frames received and those collapsed into summaries */
+  uint64_t errorFrames;
+  uint64_t errorFramesSuppressed;
+  /* Error frames, summaries and cyclic records without -Y from the
+   * network, which are never written to the bus */
+  uint64_t remoteErrorFrames;
+  uint64_t remoteErrorSummaries;
+  uint64_t remoteCyclicRecords;
+  /* Time in us from write() until the own-message echo of a frame, by
+   * priority class. Echoes without a write and writes without an echo */
+  StatsHistogram txCompletion[CANNELLONI_STATS_PRIORITY_CLASSES];
+  uint64_t txEchoesUnmatched;
+  uint64_t txEchoesLost;
+  /* Cyclic offload: IDs announced to the remote, frames not tunneled
+   * because the remote acknowledged its job and jobs installed for the remote */
+  uint32_t cyclicOffloaded;
+  uint32_t cyclicJobs;
+  uint64_t cyclicSuppressed;
+  /* Frame rules: frames rewritten and dropped */
+  uint64_t ruleRewrites;
+  uint64_t ruleDrops;
+};
+
+/* Published by UDPThread and SCTPThread */
+struct NetStats {
+  uint64_t rxPackets;
+  uint64_t rxFrames;
+  uint64_t rxBytes;
+  uint64_t rxErrors;
+  uint64_t txPackets;
+  uint64_t txFrames;
+  uint64_t txBytes;
+  uint64_t txErrors;
+  uint64_t payloadSize;
+  /* Frames from the CAN bus that wait for the next packet */
+  PoolStats pool;
+  /* Time in us between the first frame entering the buffer and the flush */
+  StatsHistogram bufferLatency;
+  /* Number of frames and payload bytes of each sent packet */
+  StatsLinearHistogram framesPerPacket;
+  StatsLinearHistogram bytesPerPacket;
+  /* Sent packets by the event that triggered them, see FlushTrigger */
+  uint64_t flushes[FLUSH_TRIGGERS];
+};
+
+/*
+ * A section that is written by a single thread and read by anyone
+ */
+template <class T>
+struct SeqLocked {
+  std::atomic<uint32_t> seq;
+  T data;
+
+  T& beginWrite() {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return data;
+  }
+
+  void endWrite() {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  void read(T &copy) const {
+    uint32_t before, after;
+    do {
+      before = seq.load(std::memory_order_acquire);
+      memcpy(&copy, &data, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+};
+
+struct TunnelStats {
+  std::atomic<uint32_t> active;
+  char name[CANNELLONI_STATS_NAME_LEN];
+  SeqLocked<CANStats> can;
+  SeqLocked<NetStats> net;
+};
+
+struct StatsRegion {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  std::atomic<uint32_t> tunnelCount;
+  uint64_t pid;
+  /* CLOCK_REALTIME in us when the region was created */
+  uint64_t startTime;
+  TunnelStats tunnels[CANNELLONI_STATS_MAX_TUNNELS];
+};
+
+/*
+ * Owns the statistics region of this process
+ */
+class Statistics {
+  public:
+    Statistics();
+    ~Statistics();
+
+    /* Creates the region. If name is empty, the region is private to this
+     * process, otherwise it is created as /dev/shm/<name> */
+    bool open(const std::string &name = std::string());
+    void close();
+
+    /* Reserves the next tunnel slot, returns NULL if all slots are taken */
+    TunnelStats* addTunnel(const std::string &name);
+
+    StatsRegion* getRegion();
+
+    /* Maps an existing region read-only. Returns NULL on error */
+    static const StatsRegion* attach(const std::string &name);
+    static void detach(const StatsRegion *region);
+
+  private:
+    StatsRegion *m_region;
+    std::string m_name;
+};
+
+/* Returns CLOCK_MONOTONIC in us */
+uint64_t monotonicTime();
+/* Returns CLOCK_REALTIME in us */
+uint64_t realtimeTime();
+
+}
@@ -18,7 +18,14 @@
  *
  */
 
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
 #include "thread.h"
+#include "logging.h"
 #include "make_unique.h"
 
 using namespace cannelloni;
@@ -26,22 +33,34 @@ using namespace cannelloni;
 Thread::Thread()
   : m_started(false)
   , m_running(false)
-{ }
+{
+  m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_stopFd < 0)
+    lerror << "eventfd error" << std::endl;
+}
 
 Thread::~Thread() {
   if (m_started)
     stop();
+  if (m_stopFd >= 0)
+    close(m_stopFd);
 }
 
 int Thread::start() {
+  /* Drop a notification left over from a previous stop() */
+  clearStop();
   m_started = true;
-  m_privThread = std::make_unique<std::thread>(&Thread::privRun, this);
   m_running = true;
+  m_privThread = std::make_unique<std::thread>(&Thread::privRun, this);
   return 0;
 }
 
 void Thread::stop() {
   m_started = false;
+  /* Wake up the thread, it is blocked on getStopFd() */
+  uint64_t value = 1;
+  if (::write(m_stopFd, &value, sizeof(value)) < 0)
+    lerror << "eventfd write error" << std::endl;
 }
 
 void Thread::join() {
@@ -54,7 +73,33 @@ bool Thread::isRunning() {
   return m_running;
 }
 
+void Thread::setScheduling(const std::string &name, const SchedulingOptions &options) {
+  m_name = name;
+  m_scheduling = options;
+}
+
+const SchedulingOptions& Thread::getScheduling() {
+  return m_scheduling;
+}
+
+int Thread::getStopFd() {
+  return m_stopFd;
+}
+
+bool Thread::clearStop() {
+  uint64_t value;
+  if (::read(m_stopFd, &value, sizeof(value)) < 0) {
+    if (errno != EAGAIN)
+      lerror << "eventfd read error" << std::endl;
+    return false;
+  }
+  return true;
+}
+
 void Thread::privRun() {
+  if (!m_scheduling.isDefault())
+    applySchedulingOptions(m_scheduling, m_name);
+  prefaultStack();
   run();
   m_running = false;
   m_started = false;
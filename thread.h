@@ -20,11 +20,25 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <string>
 #include <thread>
 
+#include "realtime.h"
+
 namespace cannelloni {
 
+/* Design Notes:
+ *
+ * stop() is called from another thread than the one it stops, usually
+ * the main thread, so the run state is kept in atomics. Besides
+ * clearing m_started, stop() writes an eventfd that every run() loop
+ * waits on together with its sockets and timers. A thread therefore
+ * blocks without any timeout while idle and still returns from its
+ * select/epoll_wait as soon as it is asked to stop.
+ */
+
 class Thread {
   public:
     Thread();
@@ -38,16 +52,28 @@ class Thread {
     bool isRunning();
     /* */
     virtual void run() = 0;
+
+    /* CPU affinity and scheduling policy, applied when the thread starts */
+    void setScheduling(const std::string &name, const SchedulingOptions &options);
+    const SchedulingOptions& getScheduling();
   private:
     /* thread control loop */
     void privRun();
 
   protected:
+    /* readable once stop() has been called, add to select/epoll sets */
+    int getStopFd();
+    /* reads the stop notification, returns false if there was none */
+    bool clearStop();
+
     /* determines when to break from run() */
-    bool m_started;
+    std::atomic<bool> m_started;
   private:
-    bool m_running;
+    std::atomic<bool> m_running;
+    int m_stopFd;
     std::unique_ptr<std::thread> m_privThread;
+    std::string m_name;
+    SchedulingOptions m_scheduling;
 };
 
 }
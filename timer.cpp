@@ -93,7 +93,7 @@ void Timer::enable() {
 void Timer::fire() {
   struct itimerspec ts;
   timerfd_gettime(m_timerfd, &ts);
-  adjust(ts.it_interval.tv_sec*1000+ts.it_interval.tv_nsec/1000, 1);
+  adjust(ts.it_interval.tv_sec*1000000+ts.it_interval.tv_nsec/1000, 1);
 }
 
 bool Timer::isEnabled() {
@@ -0,0 +1,320 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+
+#include "tunnel.h"
+#include "udpthread.h"
+#include "spscring.h"
+#include "logging.h"
+#include "make_unique.h"
+
+using namespace cannelloni;
+
+static_assert(CANNELLONI_CANFD_FRAME == CANFD_FRAME, "FD marker of the API and the wire differ");
+
+/* Frames held by the receive queue of a Tunnel */
+#define TUNNEL_RECEIVE_QUEUE_SIZE 4096
+
+namespace cannelloni {
+
+/*
+ * Takes the place of CANThread, transmitFrame() is called by the
+ * UDPThread for every received frame. There is no thread of its own.
+ */
+class ApplicationConnection : public ConnectionThread {
+  public:
+    ApplicationConnection()
+      : m_waiting(false)
+      , m_dropped(0)
+    {
+      m_notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (m_notifyFd < 0)
+        lerror << "eventfd error" << std::endl;
+    }
+
+    virtual ~ApplicationConnection() {
+      if (m_notifyFd >= 0)
+        close(m_notifyFd);
+    }
+
+    virtual void run() { }
+
+    virtual void transmitFrame(canfd_frame *frame) {
+      /* Not a frame of the remote bus, see doc/udp_format.md */
+      if (canfd_is_record(frame)) {
+        m_frameBuffer->insertFramePool(frame);
+        return;
+      }
+      if (m_handler) {
+        m_handler(*frame);
+      } else if (m_queue.push(*frame)) {
+        /* Pairs with the fence in receive(), see there */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting.exchange(false)) {
+          uint64_t value = 1;
+          if (::write(m_notifyFd, &value, sizeof(value)) < 0)
+            lerror << "eventfd write error" << std::endl;
+        }
+      } else {
+        m_dropped++;
+      }
+      m_frameBuffer->insertFramePool(frame);
+    }
+
+    bool receive(canfd_frame &frame) {
+      if (m_queue.pop(frame))
+        return true;
+      /*
+       * The queue is empty, announce that we wait and look again.
+       * Either transmitFrame() sees m_waiting and writes the eventfd
+       * or we see its frame here, a wakeup cannot get lost.
+       */
+      uint64_t value;
+      if (::read(m_notifyFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        lerror << "eventfd read error" << std::endl;
+      m_waiting = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return m_queue.pop(frame);
+    }
+
+    void setHandler(const Tunnel::ReceiveHandler &handler) {
+      m_handler = handler;
+    }
+
+    int getNotifyFd() {
+      return m_notifyFd;
+    }
+
+    uint64_t getDropped() {
+      return m_dropped;
+    }
+
+  private:
+    Tunnel::ReceiveHandler m_handler;
+    SPSCRing<canfd_frame, TUNNEL_RECEIVE_QUEUE_SIZE> m_queue;
+    std::atomic<bool> m_waiting;
+    std::atomic<uint64_t> m_dropped;
+    int m_notifyFd;
+};
+
+class TunnelImpl {
+  public:
+    TunnelImpl(const TunnelConfig &config)
+      : config(config)
+      , netBuffer(1000, 16000)
+      , appBuffer(1000, 16000)
+      , running(false)
+    { }
+
+    TunnelConfig config;
+    FrameBuffer netBuffer;
+    FrameBuffer appBuffer;
+    ApplicationConnection app;
+    std::unique_ptr<UDPThread> net;
+    std::atomic<bool> running;
+};
+
+}
+
+TunnelConfig::TunnelConfig()
+  : localAddress("0.0.0.0")
+  , localPort(20000)
+  , remoteAddress("127.0.0.1")
+  , remotePort(20000)
+  , timeout(100000)
+  , sort(false)
+  , checkPeer(true)
+{
+}
+
+static bool makeAddr(const std::string &address, uint16_t port, struct sockaddr_in &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  return inet_pton(AF_INET, address.c_str(), &addr.sin_addr) == 1;
+}
+
+Tunnel::Tunnel(const TunnelConfig &config)
+  : m_impl(std::make_unique<TunnelImpl>(config))
+{
+}
+
+Tunnel::~Tunnel() {
+  stop();
+}
+
+void Tunnel::setReceiveHandler(const ReceiveHandler &handler) {
+  m_impl->app.setHandler(handler);
+}
+
+int Tunnel::start() {
+  struct debugOptions_t debugOptions = { 0, 0, 0, 0 };
+  struct sockaddr_in localAddr, remoteAddr;
+  const TunnelConfig &config = m_impl->config;
+
+  if (m_impl->running) {
+    lerror << "Tunnel is already running" << std::endl;
+    return -1;
+  }
+  if (!makeAddr(config.localAddress, config.localPort, localAddr)) {
+    lerror << "Invalid local address " << config.localAddress << std::endl;
+    return -1;
+  }
+  if (!makeAddr(config.remoteAddress, config.remotePort, remoteAddr)) {
+    lerror << "Invalid remote address " << config.remoteAddress << std::endl;
+    return -1;
+  }
+
+  m_impl->net = std::make_unique<UDPThread>(debugOptions, remoteAddr, localAddr,
+                                            config.sort, config.checkPeer);
+  m_impl->net->setTimeout(config.timeout);
+  m_impl->net->setPeerThread(&m_impl->app);
+  m_impl->net->setFrameBuffer(&m_impl->netBuffer);
+  m_impl->app.setPeerThread(m_impl->net.get());
+  m_impl->app.setFrameBuffer(&m_impl->appBuffer);
+  if (m_impl->net->start() < 0) {
+    m_impl->net.reset();
+    return -1;
+  }
+  m_impl->running = true;
+  return 0;
+}
+
+void Tunnel::stop() {
+  if (!m_impl->running)
+    return;
+  m_impl->running = false;
+  m_impl->net->stop();
+  m_impl->net->join();
+  m_impl->net.reset();
+  m_impl->netBuffer.reset();
+}
+
+bool Tunnel::send(const struct canfd_frame &frame) {
+  uint8_t max = (frame.len & CANFD_FRAME) ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  if (canfd_len(&frame) > max || !m_impl->running)
+    return false;
+  canfd_frame *f = m_impl->netBuffer.requestFrame(false);
+  if (f == NULL)
+    return false;
+  memcpy(f, &frame, sizeof(*f));
+  m_impl->net->transmitFrame(f);
+  return true;
+}
+
+bool Tunnel::receive(struct canfd_frame &frame) {
+  return m_impl->app.receive(frame);
+}
+
+int Tunnel::getReceiveFd() {
+  return m_impl->app.getNotifyFd();
+}
+
+uint64_t Tunnel::getReceiveDropped() {
+  return m_impl->app.getDropped();
+}
+
+/* C interface */
+
+struct cannelloni_tunnel {
+  Tunnel tunnel;
+
+  cannelloni_tunnel(const TunnelConfig &config)
+    : tunnel(config)
+  { }
+};
+
+extern "C" {
+
+void cannelloni_tunnel_config_init(struct cannelloni_tunnel_config *config) {
+  static const TunnelConfig defaults;
+  config->local_address = "0.0.0.0";
+  config->local_port = defaults.localPort;
+  config->remote_address = "127.0.0.1";
+  config->remote_port = defaults.remotePort;
+  config->timeout = defaults.timeout;
+  config->sort = defaults.sort;
+  config->check_peer = defaults.checkPeer;
+}
+
+cannelloni_tunnel* cannelloni_tunnel_create(const struct cannelloni_tunnel_config *config) {
+  TunnelConfig tunnelConfig;
+  if (config->local_address)
+    tunnelConfig.localAddress = config->local_address;
+  if (config->remote_address)
+    tunnelConfig.remoteAddress = config->remote_address;
+  tunnelConfig.localPort = config->local_port;
+  tunnelConfig.remotePort = config->remote_port;
+  tunnelConfig.timeout = config->timeout;
+  tunnelConfig.sort = config->sort;
+  tunnelConfig.checkPeer = config->check_peer;
+  try {
+    return new cannelloni_tunnel(tunnelConfig);
+  } catch (std::exception &e) {
+    lerror << e.what() << std::endl;
+    return NULL;
+  }
+}
+
+void cannelloni_tunnel_destroy(cannelloni_tunnel *tunnel) {
+  delete tunnel;
+}
+
+void cannelloni_tunnel_set_receive_handler(cannelloni_tunnel *tunnel,
+                                           cannelloni_receive_fn fn, void *user) {
+  if (fn)
+    tunnel->tunnel.setReceiveHandler([fn, user](const struct canfd_frame &frame) { fn(&frame, user); });
+  else
+    tunnel->tunnel.setReceiveHandler(Tunnel::ReceiveHandler());
+}
+
+int cannelloni_tunnel_start(cannelloni_tunnel *tunnel) {
+  return tunnel->tunnel.start();
+}
+
+void cannelloni_tunnel_stop(cannelloni_tunnel *tunnel) {
+  tunnel->tunnel.stop();
+}
+
+int cannelloni_tunnel_send(cannelloni_tunnel *tunnel, const struct canfd_frame *frame) {
+  return tunnel->tunnel.send(*frame) ? 0 : -1;
+}
+
+int cannelloni_tunnel_receive(cannelloni_tunnel *tunnel, struct canfd_frame *frame) {
+  return tunnel->tunnel.receive(*frame) ? 1 : 0;
+}
+
+int cannelloni_tunnel_receive_fd(cannelloni_tunnel *tunnel) {
+  return tunnel->tunnel.getReceiveFd();
+}
+
+uint64_t cannelloni_tunnel_receive_dropped(cannelloni_tunnel *tunnel) {
+  return tunnel->tunnel.getReceiveDropped();
+}
+
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "cannelloni_tunnel.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * Tunnel is the embeddable form of one cannelloni endpoint. It runs a
+ * UDPThread like cannelloni does, but the CAN side is the application
+ * itself instead of a CANThread, so a simulator can exchange frames
+ * with a remote bus without a vcan interface and a second process.
+ *
+ * send() hands a frame directly to the UDPThread, exactly like
+ * CANThread does after reading a frame from the bus. Received frames
+ * are either passed to a handler in the network thread or, if no
+ * handler is set, copied into a lock-free single producer single
+ * consumer ring (see spscring.h) that the application drains with
+ * receive(). The network thread never waits for the application; when
+ * the ring is full, frames are dropped and counted. The error summaries
+ * and cyclic records of a remote cannelloni (-E, -Y) are dropped, error
+ * frames are passed on like CAN_RAW does with an error filter.
+ *
+ * The eventfd from getReceiveFd() allows to wait for frames with
+ * poll(). It is only written when the consumer has seen an empty ring,
+ * so a busy consumer does not cost the network thread any syscall.
+ *
+ * This header and cannelloni_tunnel.h are the stable interface of
+ * libcannelloni. Everything else is internal, hence the pimpl.
+ */
+
+struct CANNELLONI_TUNNEL_EXPORT TunnelConfig {
+  std::string localAddress;
+  uint16_t localPort;
+  std::string remoteAddress;
+  uint16_t remotePort;
+  /* Buffer timeout in us */
+  uint32_t timeout;
+  bool sort;
+  bool checkPeer;
+
+  TunnelConfig();
+};
+
+class TunnelImpl;
+
+class CANNELLONI_TUNNEL_EXPORT Tunnel {
+  public:
+    /* Called in the network thread for every received frame */
+    typedef std::function<void(const struct canfd_frame &frame)> ReceiveHandler;
+
+    explicit Tunnel(const TunnelConfig &config);
+    ~Tunnel();
+
+    /* Must be called before start() */
+    void setReceiveHandler(const ReceiveHandler &handler);
+
+    /* Opens the socket and starts the network thread, returns -1 on error */
+    int start();
+    void stop();
+
+    /*
+     * Queues frame for the remote. Only one thread may call send() at
+     * a time. Returns false if the frame is invalid, the tunnel is not
+     * running or the buffer is full.
+     */
+    bool send(const struct canfd_frame &frame);
+
+    /* Returns false if the receive queue is empty */
+    bool receive(struct canfd_frame &frame);
+
+    /* Readable when frames have arrived after receive() returned false */
+    int getReceiveFd();
+
+    /* Frames dropped because the receive queue was full */
+    uint64_t getReceiveDropped();
+
+  private:
+    Tunnel(const Tunnel&) = delete;
+    Tunnel& operator=(const Tunnel&) = delete;
+
+    std::unique_ptr<TunnelImpl> m_impl;
+};
+
+}
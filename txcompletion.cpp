@@ -0,0 +1,74 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "txcompletion.h"
+#include "txqueue.h"
+
+using namespace cannelloni;
+
+TxCompletion::TxCompletion()
+  : m_unmatched(0)
+  , m_lost(0)
+{
+}
+
+void TxCompletion::sent(const struct canfd_frame *frame, uint64_t now) {
+  expire(now);
+  if (m_pending.size() >= TX_COMPLETION_PENDING) {
+    m_pending.pop_front();
+    m_lost++;
+  }
+  Write write;
+  write.id = frame->can_id;
+  write.time = now;
+  m_pending.push_back(write);
+}
+
+bool TxCompletion::confirm(const struct canfd_frame *frame, uint64_t now, uint64_t &latency) {
+  /* Usually the first one */
+  for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+    if (it->id != frame->can_id)
+      continue;
+    latency = now - it->time;
+    m_pending.erase(it);
+    return true;
+  }
+  m_unmatched++;
+  return false;
+}
+
+uint32_t TxCompletion::priorityClass(const struct canfd_frame *frame) {
+  return arbitrationKey(frame) >> 30;
+}
+
+uint64_t TxCompletion::getUnmatchedCount() {
+  return m_unmatched;
+}
+
+uint64_t TxCompletion::getLostCount() {
+  return m_lost;
+}
+
+void TxCompletion::expire(uint64_t now) {
+  while (!m_pending.empty() && now - m_pending.front().time > TX_COMPLETION_TIMEOUT) {
+    m_pending.pop_front();
+    m_lost++;
+  }
+}
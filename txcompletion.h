@@ -0,0 +1,96 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * A successful write() to a CAN socket only means that the kernel has
+ * taken the frame. On a loaded bus it may wait in the queue of the
+ * interface and lose the arbitration a number of times before it is
+ * actually on the wire.
+ *
+ * With CAN_RAW_RECV_OWN_MSGS, the socket receives its own frames again,
+ * marked with MSG_CONFIRM. Drivers that implement IFF_ECHO (all real
+ * controllers, vcan with echo=1) hand back the frame once it has been
+ * transmitted, otherwise the kernel loops it back right when it is
+ * queued. TxCompletion remembers the time of every write and matches
+ * the echoes in order. A controller with several tx mailboxes may send
+ * frames of different IDs out of order, so an echo is matched with the
+ * oldest pending write of the same ID.
+ *
+ * The time of an echo is taken when CANThread reads it, so it includes
+ * the wakeup of the thread.
+ *
+ * Writes whose echo does not come back within TX_COMPLETION_TIMEOUT
+ * (e.g. bus off) are given up.
+ */
+
+/* Pending writes that are remembered at most */
+#define TX_COMPLETION_PENDING 1024
+/* Time in us after which a write is given up */
+#define TX_COMPLETION_TIMEOUT 1000000
+
+class TxCompletion {
+  public:
+    TxCompletion();
+
+    /* Records a write of frame at now (us) */
+    void sent(const struct canfd_frame *frame, uint64_t now);
+
+    /*
+     * Matches the echo of a frame that has been sent. Returns false if
+     * there is no pending write for it. Otherwise latency holds the time
+     * from the write to now.
+     */
+    bool confirm(const struct canfd_frame *frame, uint64_t now, uint64_t &latency);
+
+    /* Quarters of the arbitration order (see TxQueue), 0 is the highest
+     * priority, see CANNELLONI_STATS_PRIORITY_CLASSES */
+    static uint32_t priorityClass(const struct canfd_frame *frame);
+
+    /* Echoes without a pending write and writes without an echo */
+    uint64_t getUnmatchedCount();
+    uint64_t getLostCount();
+
+  private:
+    /* Gives up writes that are older than TX_COMPLETION_TIMEOUT */
+    void expire(uint64_t now);
+
+  private:
+    struct Write {
+      canid_t id;
+      uint64_t time;
+    };
+
+    std::deque<Write> m_pending;
+    uint64_t m_unmatched;
+    uint64_t m_lost;
+};
+
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <algorithm>
+
+#include "txqueue.h"
+
+using namespace cannelloni;
+
+TxQueue::TxQueue()
+  : m_seqNo(0)
+  , m_bytes(0)
+{
+}
+
+void TxQueue::push(canfd_frame *frame) {
+  /* The push order only has to be unique among the queued frames */
+  if (m_heap.empty())
+    m_seqNo = 0;
+  Entry entry;
+  entry.key = ((uint64_t) arbitrationKey(frame) << 32) | m_seqNo++;
+  entry.frame = frame;
+  m_heap.push_back(entry);
+  std::push_heap(m_heap.begin(), m_heap.end());
+  m_bytes += canfd_wire_size(frame);
+}
+
+canfd_frame* TxQueue::top() {
+  return m_heap.empty() ? NULL : m_heap.front().frame;
+}
+
+void TxQueue::pop() {
+  if (m_heap.empty())
+    return;
+  m_bytes -= canfd_wire_size(m_heap.front().frame);
+  std::pop_heap(m_heap.begin(), m_heap.end());
+  m_heap.pop_back();
+}
+
+bool TxQueue::empty() {
+  return m_heap.empty();
+}
+
+size_t TxQueue::size() {
+  return m_heap.size();
+}
+
+size_t TxQueue::getBytes() {
+  return m_bytes;
+}
+
+void TxQueue::clear(std::vector<canfd_frame*> &frames) {
+  for (const Entry &entry : m_heap)
+    frames.push_back(entry.frame);
+  m_heap.clear();
+  m_bytes = 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of cannelloni, a SocketCAN over Ethernet tunnel.
+ *
+ * Copyright (C) 2014-2017 Maximilian Güntner <code@sourcediver.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "cannelloni.h"
+
+namespace cannelloni {
+
+/* Design Notes:
+ *
+ * Frames from the network are written to the CAN socket in the order
+ * they arrived. Once the controller falls behind, the kernel queue of the
+ * interface fills up and a high priority frame waits behind everything
+ * that arrived before it, although it would win the arbitration against
+ * all of them on a real bus.
+ *
+ * TxQueue keeps the frames that wait for the socket in a binary heap
+ * ordered like the arbitration does it: the lowest ID first, a standard
+ * frame before an extended frame with the same base ID and a data frame
+ * before a remote frame. Frames that are equal on the bus leave in the
+ * order they were pushed, so the order of frames with the same ID is
+ * never changed.
+ */
+
+/*
+ * Orders frames like the arbitration field on the bus, smaller wins.
+ * Bits 31-21 are the (base) ID, bit 20 is RTR or SRR, bit 19 IDE, bits
+ * 18-1 the ID extension and bit 0 the RTR bit of an extended frame.
+ */
+static inline uint32_t arbitrationKey(const struct canfd_frame *frame) {
+  canid_t id = frame->can_id;
+  uint32_t rtr = (id & CAN_RTR_FLAG) ? 1 : 0;
+  if (id & CAN_EFF_FLAG) {
+    id &= CAN_EFF_MASK;
+    return ((id >> 18) << 21) | (1U << 20) | (1U << 19) | ((id & 0x3ffff) << 1) | rtr;
+  }
+  return ((id & CAN_SFF_MASK) << 21) | (rtr << 20);
+}
+
+class TxQueue {
+  public:
+    TxQueue();
+
+    void push(canfd_frame *frame);
+    /* Returns the frame that wins the arbitration, NULL if empty */
+    canfd_frame* top();
+    void pop();
+
+    bool empty();
+    size_t size();
+    /* Wire size of all frames, see canfd_wire_size() */
+    size_t getBytes();
+
+    /* Removes all frames, the caller owns them */
+    void clear(std::vector<canfd_frame*> &frames);
+
+  private:
+    struct Entry {
+      /* arbitrationKey() in the upper, the push order in the lower half */
+      uint64_t key;
+      canfd_frame *frame;
+
+      bool operator<(const Entry &other) const {
+        /* std::push_heap builds a max heap */
+        return key > other.key;
+      }
+    };
+
+    std::vector<Entry> m_heap;
+    uint32_t m_seqNo;
+    size_t m_bytes;
+};
+
+}
@@ -39,6 +39,9 @@
 #include "logging.h"
 #include "make_unique.h"
 #include "parser.h"
+#include "iobackend.h"
+#include "sockets.h"
+#include "eventloop.h"
 
 UDPThread::UDPThread(const struct debugOptions_t &debugOptions,
                      const struct sockaddr_in &remoteAddr,
@@ -48,12 +51,17 @@ UDPThread::UDPThread(const struct debugOptions_t &debugOptions,
   : ConnectionThread()
   , m_socket(0)
   , m_sequenceNumber(0)
-  , m_timeout(100)
   , m_rxCount(0)
   , m_txCount(0)
+  , m_rxFrameCount(0)
+  , m_txFrameCount(0)
+  , m_rxByteCount(0)
+  , m_txByteCount(0)
+  , m_rxErrorCount(0)
+  , m_txErrorCount(0)
   , m_sort(sort)
   , m_checkPeer(checkPeer)
-  , m_payloadSize(UDP_PAYLOAD_SIZE)
+  , m_flushTriggers(0)
 {
   memcpy(&m_debugOptions, &debugOptions, sizeof(struct debugOptions_t));
   memcpy(&m_remoteAddr, &remoteAddr, sizeof(struct sockaddr_in));
@@ -61,23 +69,32 @@ UDPThread::UDPThread(const struct debugOptions_t &debugOptions,
 }
 
 int UDPThread::start() {
-  /* Setup our connection */
-  m_socket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (m_socket < 0) {
-    lerror << "socket Error" << std::endl;
+  if (setup() < 0)
     return -1;
-  }
-  if (bind(m_socket, (struct sockaddr *)&m_localAddr, sizeof(m_localAddr)) < 0) {
-    lerror << "Could not bind to address" << std::endl;
-    return -1;
-  }
   return Thread::start();
 }
 
-void UDPThread::stop() {
-  Thread::stop();
-  /* m_started is now false, we need to wake up the thread */
-  m_blockTimer.fire();
+int UDPThread::attach(EventLoop *loop) {
+  if (setup() < 0)
+    return -1;
+  m_loop = loop;
+  m_transmitTimer.adjust(m_flushPolicy.getTimeout(), m_flushPolicy.getTimeout());
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
+  if (loop->add(m_socket, [this]() { handleSocket(); }) < 0 ||
+      loop->add(m_transmitTimer.getFd(), [this]() { handleTransmitTimer(); }) < 0 ||
+      loop->add(m_statsTimer.getFd(), [this]() { handleStatsTimer(); }) < 0)
+    return -1;
+  loop->addExitHandler([this]() { teardown(); });
+  linfo << "UDPThread attached to the event loop" << std::endl;
+  return 0;
+}
+
+int UDPThread::setup() {
+  m_socket = openUDPSocket(m_localAddr);
+  if (m_socket < 0)
+    return -1;
+  setIncomingCPU(m_socket);
+  return 0;
 }
 
 
@@ -95,13 +112,14 @@ bool UDPThread::parsePacket(uint8_t *buffer, uint16_t len, struct sockaddr_in &c
     } else {
 
         if (m_debugOptions.udp) {
-            linfo << "Received " << std::dec << len << " Bytes from Host " << clientAddrStr
+            linfo << "Received " << len << " Bytes from Host " << clientAddrStr
                     << ":" << ntohs(clientAddr.sin_port) << std::endl;
         }
 
-        auto allocator = [this]()
+        auto allocator = [this](bool fd)
         {
-            return m_peerThread->getFrameBuffer()->requestFrame(true, m_debugOptions.buffer);
+            return m_peerThread->getFrameBuffer()->requestFrame(fd ? FRAME_CLASS_FD : FRAME_CLASS_CLASSIC,
+                                                                true, m_debugOptions.buffer);
         };
         auto receiver = [this](canfd_frame* f, bool success)
         {
@@ -112,6 +130,7 @@ bool UDPThread::parsePacket(uint8_t *buffer, uint16_t len, struct sockaddr_in &c
             }
 
             m_peerThread->transmitFrame(f);
+            m_rxFrameCount++;
             if (m_debugOptions.can)
             {
                 printCANInfo(f);
@@ -119,12 +138,17 @@ bool UDPThread::parsePacket(uint8_t *buffer, uint16_t len, struct sockaddr_in &c
         };
         try
         {
-            parseFrames(len, buffer, allocator, receiver);
+            if (m_peerThread->getFrameMode() == FRAME_MODE_CLASSIC)
+                parseFrames<ClassicFrames>(len, buffer, allocator, receiver);
+            else
+                parseFrames<FDFrames>(len, buffer, allocator, receiver);
             m_rxCount++;
+            m_rxByteCount += len;
         }
         catch(std::exception& e)
         {
             lerror << e.what();
+            m_rxErrorCount++;
             return true;
         }
     }
@@ -134,14 +158,10 @@ bool UDPThread::parsePacket(uint8_t *buffer, uint16_t len, struct sockaddr_in &c
 
 void UDPThread::run() {
   fd_set readfds;
-  ssize_t receivedBytes;
-  uint8_t buffer[RECEIVE_BUFFER_SIZE];
-  struct sockaddr_in clientAddr;
-  socklen_t clientAddrLen = sizeof(struct sockaddr_in);
 
-  /* Set interval to m_timeout */
-  m_transmitTimer.adjust(m_timeout, m_timeout);
-  m_blockTimer.adjust(SELECT_TIMEOUT, SELECT_TIMEOUT);
+  /* Set interval to the buffer timeout */
+  m_transmitTimer.adjust(m_flushPolicy.getTimeout(), m_flushPolicy.getTimeout());
+  m_statsTimer.adjust(CANNELLONI_STATS_INTERVAL, CANNELLONI_STATS_INTERVAL);
 
   linfo << "UDPThread up and running" << std::endl;
   while (m_started) {
@@ -149,45 +169,72 @@ void UDPThread::run() {
     FD_ZERO(&readfds);
     FD_SET(m_socket, &readfds);
     FD_SET(m_transmitTimer.getFd(), &readfds);
-    FD_SET(m_blockTimer.getFd(), &readfds);
+    FD_SET(m_statsTimer.getFd(), &readfds);
+    FD_SET(getStopFd(), &readfds);
 
-    int ret = select(std::max({m_socket, m_transmitTimer.getFd(), m_blockTimer.getFd()})+1,
+    int ret = select(std::max({m_socket, m_transmitTimer.getFd(), m_statsTimer.getFd(),
+                               getStopFd()})+1,
                      &readfds, NULL, NULL, NULL);
     if (ret < 0) {
       lerror << "select error" << std::endl;
       break;
     }
-    if (FD_ISSET(m_transmitTimer.getFd(), &readfds)) {
-      if (m_transmitTimer.read() > 0) {
-        if (m_frameBuffer->getFrameBufferSize())
-          prepareBuffer();
-        else {
-          m_transmitTimer.disable();
-        }
-      }
-    }
-    if (FD_ISSET(m_blockTimer.getFd(), &readfds)) {
-      m_blockTimer.read();
-    }
-    if (FD_ISSET(m_socket, &readfds)) {
-      /* Clear buffer */
-      memset(buffer, 0, RECEIVE_BUFFER_SIZE);
-      receivedBytes = recvfrom(m_socket, buffer, RECEIVE_BUFFER_SIZE,
-          0, (struct sockaddr *) &clientAddr, &clientAddrLen);
-      if (receivedBytes < 0) {
-        lerror << "recvfrom error." << std::endl;
-        continue;
-      } else if (receivedBytes > 0) {
-        parsePacket(buffer, receivedBytes, clientAddr);
-      }
+    if (FD_ISSET(getStopFd(), &readfds))
+      break;
+    if (FD_ISSET(m_transmitTimer.getFd(), &readfds))
+      handleTransmitTimer();
+    if (FD_ISSET(m_statsTimer.getFd(), &readfds))
+      handleStatsTimer();
+    if (FD_ISSET(m_socket, &readfds))
+      handleSocket();
+  }
+  teardown();
+}
+
+void UDPThread::handleTransmitTimer() {
+  if (m_transmitTimer.read() > 0) {
+    if (m_frameBuffer->getFrameBufferSize())
+      prepareBuffer();
+    else {
+      m_transmitTimer.disable();
+      m_flushTriggers = 0;
     }
   }
+}
+
+void UDPThread::handleStatsTimer() {
+  if (m_statsTimer.read() > 0)
+    publishStats();
+}
+
+void UDPThread::handleSocket() {
+  uint8_t buffer[RECEIVE_BUFFER_SIZE];
+  struct sockaddr_in clientAddr;
+  socklen_t clientAddrLen = sizeof(struct sockaddr_in);
+
+  /* Clear buffer */
+  memset(buffer, 0, RECEIVE_BUFFER_SIZE);
+  ssize_t receivedBytes = io()->recvfrom(m_socket, buffer, RECEIVE_BUFFER_SIZE,
+                                         0, (struct sockaddr *) &clientAddr, &clientAddrLen);
+  if (receivedBytes < 0) {
+    lerror << "recvfrom error." << std::endl;
+    m_rxErrorCount++;
+  } else if (receivedBytes > 0) {
+    parsePacket(buffer, receivedBytes, clientAddr);
+  }
+}
+
+void UDPThread::teardown() {
   if (m_debugOptions.buffer) {
     m_frameBuffer->debug();
   }
   linfo << "Shutting down. UDP Transmission Summary: TX: " << m_txCount << " RX: " << m_rxCount << std::endl;
-  shutdown(m_socket, SHUT_RDWR);
-  close(m_socket);
+  if (m_debugOptions.buffer) {
+    debugFlushes();
+  }
+  publishStats();
+  io()->shutdown(m_socket, SHUT_RDWR);
+  io()->close(m_socket);
 }
 
 void UDPThread::transmitFrame(canfd_frame *frame) {
@@ -196,61 +243,53 @@ void UDPThread::transmitFrame(canfd_frame *frame) {
   if (!m_transmitTimer.isEnabled()) {
     m_transmitTimer.enable();
   }
-  /*
-   * We want that at least this frame and next frame fits into
-   * the packet. The minimum size is CANNELLONI_FRAME_BASE_SIZE,
-   * which is just the ID * plus the DLC
-   */
-  if (m_frameBuffer->getFrameBufferSize() +
-      CANNELLONI_DATA_PACKET_BASE_SIZE +
-      CANNELLONI_FRAME_BASE_SIZE >= m_payloadSize) {
-    m_transmitTimer.fire();
-  } else {
-    /* Check whether we have custom timeout for this frame */
-    std::map<uint32_t,uint32_t>::iterator it;
-    uint32_t can_id;
-    if (frame->can_id & CAN_EFF_FLAG)
-      can_id = frame->can_id & CAN_EFF_MASK;
-    else
-      can_id = frame->can_id & CAN_SFF_MASK;
-    it = m_timeoutTable.find(can_id);
-    if (it != m_timeoutTable.end()) {
-      uint32_t timeout = it->second;
-      if (timeout < m_timeout) {
-        if (timeout < m_transmitTimer.getValue()) {
-          if (m_debugOptions.timer) {
-            linfo << "Found timeout entry for ID " << can_id << ". Adjusting timer." << std::endl;
-          }
-          /* Let buffer expire in timeout ms */
-          m_transmitTimer.adjust(m_timeout, timeout);
+  uint64_t expiry;
+  switch (m_flushPolicy.frameQueued(frame, m_frameBuffer->getFrameBufferSize(), expiry)) {
+    case FLUSH_FULL:
+      setFlushTrigger(FLUSH_FULL);
+      /* In the event loop, we are already on the right thread */
+      if (m_loop)
+        prepareBuffer();
+      else
+        m_transmitTimer.fire();
+      break;
+    case FLUSH_ID_TIMEOUT:
+      if (expiry < m_transmitTimer.getValue()) {
+        if (m_debugOptions.timer) {
+          linfo << "Found timeout entry for ID " << (frame->can_id & CAN_EFF_MASK)
+                << ". Adjusting timer." << std::endl;
         }
+        /* Let buffer expire in expiry us */
+        setFlushTrigger(FLUSH_ID_TIMEOUT);
+        m_transmitTimer.adjust(m_flushPolicy.getTimeout(), expiry);
       }
-
-    }
-
+      break;
+    default:
+      break;
   }
 }
 
 void UDPThread::setTimeout(uint32_t timeout) {
-  m_timeout = timeout;
+  m_flushPolicy.setTimeout(timeout);
 }
 
 uint32_t UDPThread::getTimeout() {
-  return m_timeout;
+  return m_flushPolicy.getTimeout();
 }
 
 void UDPThread::setTimeoutTable(std::map<uint32_t,uint32_t> &timeoutTable) {
-  m_timeoutTable = timeoutTable;
+  m_flushPolicy.setTimeoutTable(timeoutTable);
 }
 
 std::map<uint32_t,uint32_t>& UDPThread::getTimeoutTable() {
-  return m_timeoutTable;
+  return m_flushPolicy.getTimeoutTable();
 }
 
 void UDPThread::prepareBuffer() {
   // TODO : this should be a std::array, since payloadSize is really known at
   // compile time.
-  auto bufWrap = std::make_unique<uint8_t[]>(m_payloadSize);
+  uint32_t payloadSize = m_flushPolicy.getPayloadSize();
+  auto bufWrap = std::make_unique<uint8_t[]>(payloadSize);
   auto packetBuffer = bufWrap.get();
 
   ssize_t transmittedBytes = 0;
@@ -264,26 +303,79 @@ void UDPThread::prepareBuffer() {
 
   std::list<canfd_frame*> *buffer = m_frameBuffer->getIntermediateBuffer();
 
-  auto overflowHandler = [this](std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator it)
+  bool overflow = false;
+  auto overflowHandler = [this, &overflow](std::list<canfd_frame*>&, std::list<canfd_frame*>::iterator it)
   {
       /* Move all remaining frames back to m_buffer */
       m_frameBuffer->returnIntermediateBuffer(it);
+      overflow = true;
   };
 
-  uint8_t* data = buildPacket(m_payloadSize, packetBuffer, *buffer,
-          m_sequenceNumber++, overflowHandler);
+  uint64_t bufferTime = m_frameBuffer->getIntermediateBufferTime();
+  uint8_t* data;
+  if (m_peerThread->getFrameMode() == FRAME_MODE_CLASSIC)
+    data = buildPacket<ClassicFrames>(payloadSize, packetBuffer, *buffer,
+                                      m_sequenceNumber++, overflowHandler);
+  else
+    data = buildPacket<FDFrames>(payloadSize, packetBuffer, *buffer,
+                                 m_sequenceNumber++, overflowHandler);
 
   transmittedBytes = sendBuffer(packetBuffer, data-packetBuffer);
   if (transmittedBytes != data-packetBuffer) {
     lerror << "UDP Socket error. Error while transmitting" << std::endl;
+    m_txErrorCount++;
   } else {
+    struct CannelloniDataPacket *dataPacket = (struct CannelloniDataPacket*) packetBuffer;
+    uint16_t frameCount = ntohs(dataPacket->count);
+    FlushTrigger trigger = FlushPolicy::mostUrgent(m_flushTriggers.exchange(0));
     m_txCount++;
+    m_txFrameCount += frameCount;
+    m_txByteCount += transmittedBytes;
+    NetStats &stats = m_stats->net.beginWrite();
+    stats.bufferLatency.add(monotonicTime() - bufferTime);
+    stats.framesPerPacket.width = FRAMES_PER_PACKET_WIDTH;
+    stats.framesPerPacket.add(frameCount);
+    stats.bytesPerPacket.width = BYTES_PER_PACKET_WIDTH;
+    stats.bytesPerPacket.add(transmittedBytes);
+    stats.flushes[trigger]++;
+    m_stats->net.endWrite();
   }
+  /* The next packet carries the frames that did not fit into this one */
+  if (uint32_t triggers = m_flushPolicy.packetBuilt(overflow))
+    m_flushTriggers.fetch_or(triggers);
   m_frameBuffer->unlockIntermediateBuffer();
   m_frameBuffer->mergeIntermediateBuffer();
 }
 
 ssize_t UDPThread::sendBuffer(uint8_t *buffer, uint16_t len) {
-  return sendto(m_socket, buffer, len, 0,
-               (struct sockaddr *) &m_remoteAddr, sizeof(m_remoteAddr));
+  return io()->sendto(m_socket, buffer, len, 0,
+                      (struct sockaddr *) &m_remoteAddr, sizeof(m_remoteAddr));
+}
+
+void UDPThread::setFlushTrigger(FlushTrigger trigger) {
+  m_flushTriggers.fetch_or(1 << trigger);
+}
+
+void UDPThread::debugFlushes() {
+  NetStats stats;
+  m_stats->net.read(stats);
+  linfo << "Flushes: timer " << stats.flushes[FLUSH_TIMER]
+        << " full " << stats.flushes[FLUSH_FULL]
+        << " id timeout " << stats.flushes[FLUSH_ID_TIMEOUT]
+        << " overflow " << stats.flushes[FLUSH_OVERFLOW] << std::endl;
+}
+
+void UDPThread::publishStats() {
+  NetStats &stats = m_stats->net.beginWrite();
+  stats.rxPackets = m_rxCount;
+  stats.rxFrames = m_rxFrameCount;
+  stats.rxBytes = m_rxByteCount;
+  stats.rxErrors = m_rxErrorCount;
+  stats.txPackets = m_txCount;
+  stats.txFrames = m_txFrameCount;
+  stats.txBytes = m_txByteCount;
+  stats.txErrors = m_txErrorCount;
+  stats.payloadSize = m_flushPolicy.getPayloadSize();
+  m_frameBuffer->getPoolStats(stats.pool);
+  m_stats->net.endWrite();
 }
@@ -21,12 +21,14 @@
 #pragma once
 
 #include <map>
+#include <atomic>
 
 #include <sys/types.h>
 #include <netinet/in.h>
 
 #include "connection.h"
 #include "timer.h"
+#include "flushpolicy.h"
 
 
 namespace cannelloni {
@@ -35,8 +37,9 @@ namespace cannelloni {
 #define IP_HEADER_SIZE 20
 #define UDP_HEADER_SIZE 8
 
-/* Block select max. for 500ms */
-#define SELECT_TIMEOUT 500000
+/* Bucket widths of the packet histograms */
+#define FRAMES_PER_PACKET_WIDTH 8
+#define BYTES_PER_PACKET_WIDTH 48
 
 #define RECEIVE_BUFFER_SIZE ETHERNET_MTU
 #define UDP_PAYLOAD_SIZE ETHERNET_MTU-IP_HEADER_SIZE-UDP_HEADER_SIZE
@@ -50,8 +53,8 @@ class UDPThread : public ConnectionThread {
               bool checkPeer);
 
     virtual int start();
-    virtual void stop();
     virtual void run();
+    virtual int attach(EventLoop *loop);
     bool parsePacket(uint8_t *buf, uint16_t len, struct sockaddr_in &clientAddr);
     virtual void transmitFrame(canfd_frame *frame);
 
@@ -62,29 +65,46 @@ class UDPThread : public ConnectionThread {
     std::map<uint32_t,uint32_t>& getTimeoutTable();
 
   protected:
+    /* Opens and binds the socket */
+    int setup();
+    void handleTransmitTimer();
+    void handleStatsTimer();
+    void handleSocket();
+    void teardown();
     void prepareBuffer();
     virtual ssize_t sendBuffer(uint8_t *buffer, uint16_t len);
+    void publishStats();
+    /* Marks trigger as pending for the next flush */
+    void setFlushTrigger(FlushTrigger trigger);
+    void debugFlushes();
 
   protected:
     struct debugOptions_t m_debugOptions;
     bool m_sort;
     bool m_checkPeer;
     int m_socket;
-    Timer m_blockTimer;
     Timer m_transmitTimer;
+    /* Publishes the counters every CANNELLONI_STATS_INTERVAL us */
+    Timer m_statsTimer;
 
     struct sockaddr_in m_localAddr;
     struct sockaddr_in m_remoteAddr;
 
     uint8_t m_sequenceNumber;
-    /* Timeout variables */
-    uint32_t m_timeout;
-    std::map<uint32_t,uint32_t> m_timeoutTable;
+    /* Buffer timeout, timeout table and payload size */
+    FlushPolicy m_flushPolicy;
     /* Performance Counters */
     uint64_t m_rxCount;
     uint64_t m_txCount;
-
-    uint32_t m_payloadSize;
+    uint64_t m_rxFrameCount;
+    uint64_t m_txFrameCount;
+    uint64_t m_rxByteCount;
+    uint64_t m_txByteCount;
+    uint64_t m_rxErrorCount;
+    uint64_t m_txErrorCount;
+
+    /* Bitmask of pending FlushTriggers, set by the producer */
+    std::atomic<uint32_t> m_flushTriggers;
 };
 
 }